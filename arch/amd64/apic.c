@@ -0,0 +1,315 @@
+#include "apic.h"
+#include "cpu.h"
+#include "idt.h"
+#include "percpu.h"
+#include "tsc.h"
+
+/* IA32_APIC_BASE bits */
+#define APIC_BASE_X2APIC_ENABLE (1UL << 10)
+#define APIC_BASE_GLOBAL_ENABLE (1UL << 11)
+#define APIC_BASE_ADDRESS_MASK 0x000FFFFFFFFFF000UL
+
+/* Register offsets (xAPIC MMIO; x2APIC MSR = 0x800 + offset / 16) */
+#define APIC_REG_ID 0x020
+#define APIC_REG_TPR 0x080
+#define APIC_REG_EOI 0x0B0
+#define APIC_REG_SVR 0x0F0
+#define APIC_REG_ESR 0x280
+#define APIC_REG_ICR_LOW 0x300
+#define APIC_REG_ICR_HIGH 0x310
+#define APIC_REG_LVT_TIMER 0x320
+#define APIC_REG_LVT_PMC 0x340
+#define APIC_REG_LVT_LINT0 0x350
+#define APIC_REG_LVT_ERROR 0x370
+#define APIC_REG_TIMER_INITIAL 0x380
+#define APIC_REG_TIMER_CURRENT 0x390
+#define APIC_REG_TIMER_DIVIDE 0x3E0
+
+#define APIC_SVR_ENABLE (1U << 8)
+
+#define APIC_ICR_DELIVERY_INIT (5U << 8)
+#define APIC_ICR_DELIVERY_STARTUP (6U << 8)
+#define APIC_ICR_DELIVERY_NMI (4U << 8)
+#define APIC_ICR_DELIVERY_PENDING (1U << 12)
+#define APIC_ICR_LEVEL_ASSERT (1U << 14)
+#define APIC_ICR_ALL_BUT_SELF (3U << 18)
+
+#define APIC_LVT_DELIVERY_NMI (4U << 8)
+#define APIC_LVT_DELIVERY_EXTINT (7U << 8)
+#define APIC_LVT_MASKED (1U << 16)
+#define APIC_LVT_TIMER_ONESHOT (0U << 17)
+#define APIC_LVT_TIMER_TSC_DEADLINE (2U << 17)
+
+#define APIC_TIMER_DIVIDE_BY_16 0x3
+
+#define APIC_CALIBRATION_MS 10
+
+#define REPROGRAM_BENCH_ITERATIONS 1000
+
+struct apic_timer_state {
+  u64 deadline; /* Armed TSC deadline, 0 when idle */
+  u64 armed;    /* Number of times the timer was programmed */
+  u64 fired;    /* Number of timer interrupts taken */
+};
+
+static bool x2apic_mode = false;
+static volatile u8 *apic_mmio = NULL;
+
+static bool tsc_deadline_mode = false;
+static u64 apic_ticks_per_tsc_mult = 0; /* One-shot fallback: TSC -> APIC */
+
+static apic_timer_handler_t timer_handler = NULL;
+static struct apic_timer_state timer_state[MAX_CPUS];
+
+static inline u32 apic_read(u32 reg) {
+  if (x2apic_mode) {
+    return (u32)rdmsr(MSR_X2APIC_BASE + (reg >> 4));
+  }
+  return *(volatile u32 *)(apic_mmio + reg);
+}
+
+static inline void apic_write(u32 reg, u32 value) {
+  if (x2apic_mode) {
+    wrmsr(MSR_X2APIC_BASE + (reg >> 4), value);
+    return;
+  }
+  *(volatile u32 *)(apic_mmio + reg) = value;
+}
+
+bool apic_init(void) {
+  if (!cpu_has(CPU_FEATURE_APIC)) {
+    return false;
+  }
+
+  u64 base = rdmsr(MSR_IA32_APIC_BASE);
+
+  /* x2APIC avoids MMIO entirely. Once firmware has enabled it there is no
+   * way back to xAPIC mode without a full disable, so honour that too. */
+  x2apic_mode =
+      cpu_has(CPU_FEATURE_X2APIC) || (base & APIC_BASE_X2APIC_ENABLE) != 0;
+
+  if (!x2apic_mode) {
+    /* Identity mapped by the bootloader (see docs/boot/protocol.md) */
+    apic_mmio = (volatile u8 *)(base & APIC_BASE_ADDRESS_MASK);
+  }
+
+  apic_init_cpu();
+  return true;
+}
+
+void apic_init_cpu(void) {
+  u64 base = rdmsr(MSR_IA32_APIC_BASE) | APIC_BASE_GLOBAL_ENABLE;
+  wrmsr(MSR_IA32_APIC_BASE, base);
+  if (x2apic_mode) {
+    /* xAPIC -> x2APIC must go through the enabled state */
+    wrmsr(MSR_IA32_APIC_BASE, base | APIC_BASE_X2APIC_ENABLE);
+  }
+
+  apic_write(APIC_REG_TPR, 0);
+  apic_write(APIC_REG_LVT_LINT0, APIC_LVT_MASKED); /* ExtINT from the PIC */
+  apic_write(APIC_REG_LVT_ERROR, APIC_ERROR_VECTOR);
+  apic_write(APIC_REG_LVT_TIMER, APIC_LVT_MASKED | APIC_TIMER_VECTOR);
+  apic_write(APIC_REG_LVT_PMC, APIC_LVT_MASKED);
+
+  /* ESR must be written before it is read */
+  apic_write(APIC_REG_ESR, 0);
+  apic_write(APIC_REG_ESR, 0);
+
+  apic_write(APIC_REG_SVR, APIC_SVR_ENABLE | VECTOR_SPURIOUS);
+}
+
+bool apic_is_x2apic(void) { return x2apic_mode; }
+
+u32 apic_get_id(void) {
+  u32 id = apic_read(APIC_REG_ID);
+  return x2apic_mode ? id : (id >> 24);
+}
+
+void apic_eoi(void) { apic_write(APIC_REG_EOI, 0); }
+
+/* Take the 8259's output on this CPU's LINT0 (virtual wire mode) */
+void apic_enable_extint(void) {
+  apic_write(APIC_REG_LVT_LINT0, APIC_LVT_DELIVERY_EXTINT);
+}
+
+/*
+ * Counter overflow interrupts arrive as NMIs on this CPU. The APIC masks
+ * the entry on each delivery, so the handler enables it again.
+ */
+void apic_pmi_enable(void) {
+  apic_write(APIC_REG_LVT_PMC, APIC_LVT_DELIVERY_NMI);
+}
+
+void apic_pmi_disable(void) { apic_write(APIC_REG_LVT_PMC, APIC_LVT_MASKED); }
+
+static void apic_send_icr(u32 apic_id, u32 icr_low) {
+  if (x2apic_mode) {
+    /*
+     * One 64-bit write, no delivery status to poll. The ICR MSR write is
+     * not serializing: order earlier stores (a wake word) before the IPI.
+     */
+    __asm__ volatile("mfence" ::: "memory");
+    wrmsr(MSR_X2APIC_BASE + (APIC_REG_ICR_LOW >> 4),
+          ((u64)apic_id << 32) | icr_low);
+    return;
+  }
+
+  /* An IPI sent from an interrupt between the writes would retarget ours */
+  u64 flags = irq_save();
+  apic_write(APIC_REG_ICR_HIGH, apic_id << 24);
+  apic_write(APIC_REG_ICR_LOW, icr_low);
+  while (apic_read(APIC_REG_ICR_LOW) & APIC_ICR_DELIVERY_PENDING) {
+    cpu_relax();
+  }
+  irq_restore(flags);
+}
+
+void apic_send_ipi(u32 apic_id, u8 vector) {
+  apic_send_icr(apic_id, APIC_ICR_LEVEL_ASSERT | vector);
+}
+
+/* Every CPU but this one takes an NMI (vector 2, none is sent) */
+void apic_send_nmi_others(void) {
+  apic_send_icr(0, APIC_ICR_LEVEL_ASSERT | APIC_ICR_DELIVERY_NMI |
+                       APIC_ICR_ALL_BUT_SELF);
+}
+
+void apic_send_init(u32 apic_id) {
+  apic_send_icr(apic_id, APIC_ICR_LEVEL_ASSERT | APIC_ICR_DELIVERY_INIT);
+}
+
+/* The target starts in real mode at page_address:0, which must be < 1 MiB */
+void apic_send_startup(u32 apic_id, u64 page_address) {
+  apic_send_icr(apic_id, APIC_ICR_LEVEL_ASSERT | APIC_ICR_DELIVERY_STARTUP |
+                             (u32)(page_address >> PAGE_SHIFT));
+}
+
+static u64 read_apic_elapsed(void) {
+  return 0xFFFFFFFFULL - apic_read(APIC_REG_TIMER_CURRENT);
+}
+
+static bool apic_timer_calibrate_oneshot(void) {
+  const struct tsc_calibration *cal = tsc_get_calibration();
+
+  apic_write(APIC_REG_TIMER_DIVIDE, APIC_TIMER_DIVIDE_BY_16);
+  apic_write(APIC_REG_LVT_TIMER, APIC_LVT_MASKED | APIC_TIMER_VECTOR);
+  apic_write(APIC_REG_TIMER_INITIAL, 0xFFFFFFFF);
+
+  u64 ticks = pit_measure_ticks(APIC_CALIBRATION_MS, read_apic_elapsed);
+  apic_write(APIC_REG_TIMER_INITIAL, 0);
+
+  if (ticks == 0 || cal->hz == 0) {
+    return false;
+  }
+
+  u64 apic_hz = ticks * 1000 / APIC_CALIBRATION_MS;
+  apic_ticks_per_tsc_mult = (apic_hz << TSC_SHIFT) / cal->hz;
+  return apic_ticks_per_tsc_mult != 0;
+}
+
+static void apic_timer_interrupt(u8 vector) {
+  UNUSED(vector);
+
+  struct apic_timer_state *state = &timer_state[this_cpu_id()];
+  state->deadline = 0;
+  state->fired++;
+
+  if (timer_handler != NULL) {
+    timer_handler();
+  }
+}
+
+bool apic_timer_init(void) {
+  tsc_deadline_mode = cpu_has(CPU_FEATURE_TSC_DEADLINE);
+
+  if (!tsc_deadline_mode && !apic_timer_calibrate_oneshot()) {
+    return false;
+  }
+
+  if (!irq_register(APIC_TIMER_VECTOR, apic_timer_interrupt)) {
+    return false;
+  }
+
+  apic_timer_init_cpu();
+  return true;
+}
+
+void apic_timer_init_cpu(void) {
+  if (tsc_deadline_mode) {
+    apic_write(APIC_REG_LVT_TIMER,
+               APIC_LVT_TIMER_TSC_DEADLINE | APIC_TIMER_VECTOR);
+    /* SDM: the LVT write must be globally visible before the first
+     * IA32_TSC_DEADLINE write, or the deadline may be dropped. */
+    __asm__ volatile("mfence" ::: "memory");
+  } else {
+    apic_write(APIC_REG_TIMER_DIVIDE, APIC_TIMER_DIVIDE_BY_16);
+    apic_write(APIC_REG_LVT_TIMER, APIC_LVT_TIMER_ONESHOT | APIC_TIMER_VECTOR);
+  }
+
+  timer_state[this_cpu_id()].deadline = 0;
+}
+
+bool apic_timer_uses_tsc_deadline(void) { return tsc_deadline_mode; }
+
+void apic_timer_set_handler(apic_timer_handler_t handler) {
+  timer_handler = handler;
+}
+
+void apic_timer_arm(u64 deadline_tsc) {
+  struct apic_timer_state *state = &timer_state[this_cpu_id()];
+
+  if (deadline_tsc == 0) {
+    deadline_tsc = 1; /* 0 disarms; "as soon as possible" instead */
+  }
+
+  state->deadline = deadline_tsc;
+  state->armed++;
+
+  if (LIKELY(tsc_deadline_mode)) {
+    wrmsr(MSR_IA32_TSC_DEADLINE, deadline_tsc);
+    return;
+  }
+
+  u64 now = rdtsc();
+  u64 delta = deadline_tsc > now ? deadline_tsc - now : 0;
+  u64 count = (u64)(((unsigned __int128)delta * apic_ticks_per_tsc_mult) >>
+                    TSC_SHIFT);
+  if (count == 0) {
+    count = 1;
+  } else if (count > 0xFFFFFFFF) {
+    count = 0xFFFFFFFF; /* Fires early; the handler re-arms if needed */
+  }
+  apic_write(APIC_REG_TIMER_INITIAL, (u32)count);
+}
+
+void apic_timer_cancel(void) {
+  timer_state[this_cpu_id()].deadline = 0;
+
+  if (tsc_deadline_mode) {
+    wrmsr(MSR_IA32_TSC_DEADLINE, 0);
+  } else {
+    apic_write(APIC_REG_TIMER_INITIAL, 0);
+  }
+}
+
+u64 apic_timer_get_deadline(void) {
+  return timer_state[this_cpu_id()].deadline;
+}
+
+/*
+ * Average cost, in TSC cycles, of reprogramming the one-shot timer. Run
+ * with interrupts disabled; the deadlines are far enough out never to fire.
+ */
+u64 apic_timer_measure_reprogram(void) {
+  const struct tsc_calibration *cal = tsc_get_calibration();
+  u64 far_deadline = rdtsc() + cal->hz; /* One second from now */
+
+  u64 start = rdtsc_ordered();
+  for (u32 i = 0; i < REPROGRAM_BENCH_ITERATIONS; i++) {
+    apic_timer_arm(far_deadline + i);
+  }
+  u64 end = rdtsc_ordered();
+
+  apic_timer_cancel();
+  return (end - start) / REPROGRAM_BENCH_ITERATIONS;
+}
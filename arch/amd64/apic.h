@@ -0,0 +1,53 @@
+#ifndef DELTA_ARCH_AMD64_APIC_H
+#define DELTA_ARCH_AMD64_APIC_H
+
+#include "arch_types.h"
+
+/* Interrupt vectors owned by the local APIC */
+#define APIC_TIMER_VECTOR 0xF0
+#define APIC_WAKEUP_VECTOR 0xF1
+#define APIC_ERROR_VECTOR 0xFE
+
+typedef void (*apic_timer_handler_t)(void);
+
+bool apic_init(void);
+
+void apic_init_cpu(void);
+
+bool apic_is_x2apic(void);
+
+u32 apic_get_id(void);
+
+void apic_eoi(void);
+
+void apic_enable_extint(void);
+
+void apic_pmi_enable(void);
+
+void apic_pmi_disable(void);
+
+void apic_send_ipi(u32 apic_id, u8 vector);
+
+void apic_send_nmi_others(void);
+
+void apic_send_init(u32 apic_id);
+
+void apic_send_startup(u32 apic_id, u64 page_address);
+
+bool apic_timer_init(void);
+
+void apic_timer_init_cpu(void);
+
+bool apic_timer_uses_tsc_deadline(void);
+
+void apic_timer_set_handler(apic_timer_handler_t handler);
+
+void apic_timer_arm(u64 deadline_tsc);
+
+void apic_timer_cancel(void);
+
+u64 apic_timer_get_deadline(void);
+
+u64 apic_timer_measure_reprogram(void);
+
+#endif /* DELTA_ARCH_AMD64_APIC_H */
@@ -21,6 +21,8 @@
 
 #define STACK_ALIGNMENT 16
 
+#define MAX_CPUS 64
+
 #define CR0_PE (1UL << 0)
 
 #define CR0_MP (1UL << 1) /* Monitor Co-Processor */
@@ -46,6 +48,7 @@
 #define CR4_OSFXSR (1UL << 9)      /* OS support for FXSAVE/FXRSTOR */
 #define CR4_OSXMMEXCPT (1UL << 10) /* OS support for SSE exceptions */
 #define CR4_UMIP (1UL << 11) /* User-Mode Instruction Prevention - SECURITY */
+#define CR4_OSXSAVE (1UL << 18) /* XSAVE and processor extended states */
 #define CR4_SMEP                                                               \
   (1UL << 20) /* Supervisor Mode Execution Prevention - SECURITY */
 #define CR4_SMAP                                                               \
@@ -65,6 +68,26 @@
 #define PTE_NX                                                                 \
   (1UL << 63) /* No Execute bit - SECURITY: Prevents code execution */
 
+#define MSR_IA32_APIC_BASE 0x0000001B
+#define MSR_IA32_PMC0 0x000000C1        /* General-purpose counter 0 */
+#define MSR_IA32_PERFEVTSEL0 0x00000186 /* Its event select */
+#define MSR_IA32_PERF_GLOBAL_STATUS 0x0000038E   /* PMU version 2+ */
+#define MSR_IA32_PERF_GLOBAL_CTRL 0x0000038F     /* PMU version 2+ */
+#define MSR_IA32_PERF_GLOBAL_OVF_CTRL 0x00000390 /* PMU version 2+ */
+#define MSR_IA32_TSC_DEADLINE 0x000006E0
+#define MSR_X2APIC_BASE 0x00000800 /* x2APIC registers: 0x800 + (offset >> 4) */
+#define MSR_IA32_XSS 0x00000DA0 /* Supervisor state components (XSAVES) */
+#define MSR_EFER 0xC0000080
+#define MSR_STAR 0xC0000081  /* SYSCALL/SYSRET segment selectors */
+#define MSR_LSTAR 0xC0000082 /* SYSCALL entry point (64-bit) */
+#define MSR_FMASK 0xC0000084 /* RFLAGS bits cleared by SYSCALL */
+#define MSR_FS_BASE 0xC0000100
+#define MSR_GS_BASE 0xC0000101
+#define MSR_KERNEL_GS_BASE 0xC0000102
+
+#define EFER_SCE (1UL << 0)  /* SYSCALL/SYSRET enable */
+#define EFER_NXE (1UL << 11) /* No-execute page protection enable */
+
 static inline void outb(u16 port, u8 value) {
   __asm__ volatile("outb %0, %1" : : "a"(value), "Nd"(port));
 }
@@ -78,12 +101,113 @@ static inline u8 inb(u16 port) {
 
 static inline void io_wait(void) { outb(0x80, 0); }
 
+static inline void cpuid(u32 leaf, u32 subleaf, u32 *eax, u32 *ebx, u32 *ecx,
+                         u32 *edx) {
+  __asm__ volatile("cpuid"
+                   : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                   : "a"(leaf), "c"(subleaf));
+}
+
+static inline u64 rdmsr(u32 msr) {
+  u32 low, high;
+  __asm__ volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+  return ((u64)high << 32) | low;
+}
+
+static inline void wrmsr(u32 msr, u64 value) {
+  __asm__ volatile("wrmsr"
+                   :
+                   : "c"(msr), "a"((u32)value), "d"((u32)(value >> 32))
+                   : "memory");
+}
+
+static inline u64 rdtsc(void) {
+  u32 low, high;
+  __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+  return ((u64)high << 32) | low;
+}
+
+/* rdtsc that cannot be reordered before earlier instructions */
+static inline u64 rdtsc_ordered(void) {
+  u32 low, high;
+  __asm__ volatile("lfence; rdtsc" : "=a"(low), "=d"(high) : : "memory");
+  return ((u64)high << 32) | low;
+}
+
+static inline void cpu_relax(void) { __asm__ volatile("pause" ::: "memory"); }
+
+static inline u64 read_rflags(void) {
+  u64 flags;
+  __asm__ volatile("pushfq; popq %0" : "=r"(flags));
+  return flags;
+}
+
+#define RFLAGS_TF (1UL << 8)  /* Trap flag (single step) */
+#define RFLAGS_IF (1UL << 9)  /* Interrupt enable flag */
+#define RFLAGS_DF (1UL << 10) /* Direction flag */
+#define RFLAGS_NT (1UL << 14) /* Nested task */
+#define RFLAGS_AC (1UL << 18) /* Alignment check (SMAP override) */
+
 static inline void hlt(void) { __asm__ volatile("hlt"); }
 
 static inline void cli(void) { __asm__ volatile("cli"); }
 
 static inline void sti(void) { __asm__ volatile("sti"); }
 
+static inline u64 read_cr0(void) {
+  u64 value;
+  __asm__ volatile("mov %%cr0, %0" : "=r"(value));
+  return value;
+}
+
+static inline void write_cr0(u64 value) {
+  __asm__ volatile("mov %0, %%cr0" : : "r"(value) : "memory");
+}
+
+static inline u64 read_cr2(void) {
+  u64 value;
+  __asm__ volatile("mov %%cr2, %0" : "=r"(value));
+  return value;
+}
+
+static inline u64 read_cr3(void) {
+  u64 value;
+  __asm__ volatile("mov %%cr3, %0" : "=r"(value));
+  return value;
+}
+
+static inline u64 read_cr4(void) {
+  u64 value;
+  __asm__ volatile("mov %%cr4, %0" : "=r"(value));
+  return value;
+}
+
+static inline void write_cr4(u64 value) {
+  __asm__ volatile("mov %0, %%cr4" : : "r"(value) : "memory");
+}
+
+/* Disable interrupts, returning the previous RFLAGS for irq_restore() */
+static inline u64 irq_save(void) {
+  u64 flags;
+  __asm__ volatile("pushfq; popq %0; cli" : "=r"(flags) : : "memory");
+  return flags;
+}
+
+static inline void irq_restore(u64 flags) {
+  if (flags & RFLAGS_IF) {
+    __asm__ volatile("sti" ::: "memory");
+  }
+}
+
+/* The bootloader identity maps physical memory (docs/boot/protocol.md) */
+static inline void *phys_to_virt(u64 phys) { return (void *)phys; }
+
+static inline u64 virt_to_phys(const void *virt) { return (u64)virt; }
+
+static inline void invlpg(u64 address) {
+  __asm__ volatile("invlpg (%0)" : : "r"(address) : "memory");
+}
+
 static inline NORETURN void halt_forever(void) {
   cli();
   for (;;) {
@@ -0,0 +1,113 @@
+#include "cpu.h"
+
+#define CPUID_LEAF_FEATURES 0x00000001
+#define CPUID_LEAF_EXT_FEATURES 0x00000007
+#define CPUID_LEAF_TOPOLOGY 0x0000000B
+#define CPUID_EXT_LEAF_MAX 0x80000000
+#define CPUID_EXT_LEAF_POWER 0x80000007
+
+/* CPUID.01H:ECX */
+#define CPUID_1_ECX_PCLMUL (1U << 1)
+#define CPUID_1_ECX_MONITOR (1U << 3)
+#define CPUID_1_ECX_X2APIC (1U << 21)
+#define CPUID_1_ECX_TSC_DEADLINE (1U << 24)
+#define CPUID_1_ECX_XSAVE (1U << 26)
+#define CPUID_1_ECX_AVX (1U << 28)
+
+/* CPUID.01H:EDX */
+#define CPUID_1_EDX_TSC (1U << 4)
+#define CPUID_1_EDX_APIC (1U << 9)
+#define CPUID_1_EDX_FXSR (1U << 24)
+
+/* CPUID.(EAX=07H,ECX=0):EBX */
+#define CPUID_7_EBX_AVX2 (1U << 5)
+
+/* CPUID.80000007H:EDX */
+#define CPUID_80000007_EDX_INVARIANT_TSC (1U << 8)
+
+/* CPUID.0BH: ECX[15:8] level type */
+#define TOPOLOGY_LEVEL_SMT 1
+#define TOPOLOGY_LEVEL_CORE 2
+
+static bool cpu_features[CPU_FEATURE_COUNT];
+static u32 max_leaf = 0;
+
+/* APIC ID bits: [smt_shift-1:0] thread, [package_shift-1:smt_shift] core */
+static u32 smt_shift = 0;
+static u32 package_shift = 8;
+
+static void cpu_detect_topology(void) {
+  if (max_leaf < CPUID_LEAF_TOPOLOGY) {
+    return; /* Keep the defaults: every CPU is a core of one package */
+  }
+
+  for (u32 subleaf = 0; subleaf < 8; subleaf++) {
+    u32 eax, ebx, ecx, edx;
+    cpuid(CPUID_LEAF_TOPOLOGY, subleaf, &eax, &ebx, &ecx, &edx);
+
+    u32 level_type = (ecx >> 8) & 0xFF;
+    if (level_type == 0) {
+      break;
+    }
+
+    if (level_type == TOPOLOGY_LEVEL_SMT) {
+      smt_shift = eax & 0x1F;
+    } else if (level_type == TOPOLOGY_LEVEL_CORE) {
+      package_shift = eax & 0x1F;
+    }
+  }
+}
+
+void cpu_detect_features(void) {
+  u32 eax, ebx, ecx, edx;
+
+  cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+  max_leaf = eax;
+
+  if (max_leaf >= CPUID_LEAF_FEATURES) {
+    cpuid(CPUID_LEAF_FEATURES, 0, &eax, &ebx, &ecx, &edx);
+    cpu_features[CPU_FEATURE_TSC] = (edx & CPUID_1_EDX_TSC) != 0;
+    cpu_features[CPU_FEATURE_APIC] = (edx & CPUID_1_EDX_APIC) != 0;
+    cpu_features[CPU_FEATURE_X2APIC] = (ecx & CPUID_1_ECX_X2APIC) != 0;
+    cpu_features[CPU_FEATURE_MONITOR] = (ecx & CPUID_1_ECX_MONITOR) != 0;
+    cpu_features[CPU_FEATURE_TSC_DEADLINE] =
+        (ecx & CPUID_1_ECX_TSC_DEADLINE) != 0;
+    cpu_features[CPU_FEATURE_FXSR] = (edx & CPUID_1_EDX_FXSR) != 0;
+    cpu_features[CPU_FEATURE_XSAVE] = (ecx & CPUID_1_ECX_XSAVE) != 0;
+    cpu_features[CPU_FEATURE_AVX] = (ecx & CPUID_1_ECX_AVX) != 0;
+    cpu_features[CPU_FEATURE_PCLMUL] = (ecx & CPUID_1_ECX_PCLMUL) != 0;
+  }
+
+  if (max_leaf >= CPUID_LEAF_EXT_FEATURES) {
+    cpuid(CPUID_LEAF_EXT_FEATURES, 0, &eax, &ebx, &ecx, &edx);
+    cpu_features[CPU_FEATURE_AVX2] = (ebx & CPUID_7_EBX_AVX2) != 0;
+  }
+
+  cpuid(CPUID_EXT_LEAF_MAX, 0, &eax, &ebx, &ecx, &edx);
+  if (eax >= CPUID_EXT_LEAF_POWER) {
+    cpuid(CPUID_EXT_LEAF_POWER, 0, &eax, &ebx, &ecx, &edx);
+    cpu_features[CPU_FEATURE_INVARIANT_TSC] =
+        (edx & CPUID_80000007_EDX_INVARIANT_TSC) != 0;
+  }
+
+  cpu_detect_topology();
+}
+
+bool cpu_has(enum cpu_feature feature) {
+  if (feature >= CPU_FEATURE_COUNT) {
+    return false;
+  }
+  return cpu_features[feature];
+}
+
+u32 cpu_max_leaf(void) { return max_leaf; }
+
+enum cpu_topology_distance cpu_topology_distance(u32 apic_a, u32 apic_b) {
+  if ((apic_a >> smt_shift) == (apic_b >> smt_shift)) {
+    return CPU_DISTANCE_SMT;
+  }
+  if ((apic_a >> package_shift) == (apic_b >> package_shift)) {
+    return CPU_DISTANCE_PACKAGE;
+  }
+  return CPU_DISTANCE_REMOTE;
+}
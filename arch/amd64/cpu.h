@@ -0,0 +1,37 @@
+#ifndef DELTA_ARCH_AMD64_CPU_H
+#define DELTA_ARCH_AMD64_CPU_H
+
+#include "arch_types.h"
+
+enum cpu_feature {
+  CPU_FEATURE_APIC,          /* On-chip local APIC */
+  CPU_FEATURE_X2APIC,        /* x2APIC (MSR-based APIC access) */
+  CPU_FEATURE_TSC,           /* Time Stamp Counter */
+  CPU_FEATURE_TSC_DEADLINE,  /* APIC timer TSC-deadline mode */
+  CPU_FEATURE_INVARIANT_TSC, /* TSC runs at a constant rate in all states */
+  CPU_FEATURE_MONITOR,       /* MONITOR/MWAIT */
+  CPU_FEATURE_FXSR,          /* FXSAVE/FXRSTOR */
+  CPU_FEATURE_XSAVE,         /* XSAVE/XRSTOR and XCR0 */
+  CPU_FEATURE_AVX,           /* 256-bit YMM state */
+  CPU_FEATURE_AVX2,          /* 256-bit integer SIMD */
+  CPU_FEATURE_PCLMUL,        /* PCLMULQDQ carry-less multiply */
+  CPU_FEATURE_COUNT,
+};
+
+/* Distance between two CPUs, by APIC ID */
+enum cpu_topology_distance {
+  CPU_DISTANCE_SMT = 0,     /* Hyper-thread siblings on one core */
+  CPU_DISTANCE_PACKAGE = 1, /* Different cores, same package (shared LLC) */
+  CPU_DISTANCE_REMOTE = 2,  /* Different packages */
+  CPU_DISTANCE_COUNT,
+};
+
+void cpu_detect_features(void);
+
+bool cpu_has(enum cpu_feature feature);
+
+u32 cpu_max_leaf(void);
+
+enum cpu_topology_distance cpu_topology_distance(u32 apic_a, u32 apic_b);
+
+#endif /* DELTA_ARCH_AMD64_CPU_H */
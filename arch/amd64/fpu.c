@@ -0,0 +1,200 @@
+#include "fpu.h"
+#include "cpu.h"
+
+#define CPUID_LEAF_XSTATE 0x0D
+
+/* CPUID 0x0D, subleaf 1, EAX */
+#define XSTATE_FEATURE_XSAVEOPT (1U << 0)
+#define XSTATE_FEATURE_XSAVES (1U << 3)
+
+/* XCR0 state components */
+#define XSTATE_X87 (1UL << 0)
+#define XSTATE_SSE (1UL << 1)
+#define XSTATE_AVX (1UL << 2)
+
+#define XCOMP_BV_COMPACTED (1UL << 63)
+
+#define FXSAVE_SIZE 512
+#define XSAVE_HEADER_SIZE 64
+#define XSAVE_XCOMP_BV_OFFSET (FXSAVE_SIZE + 8)
+
+/* Power-on values, from the SDM's FNINIT and MXCSR reset descriptions */
+#define FCW_DEFAULT 0x037F
+#define MXCSR_DEFAULT 0x1F80
+
+#define FXSAVE_FCW_OFFSET 0
+#define FXSAVE_MXCSR_OFFSET 24
+
+static enum fpu_format format = FPU_FXSAVE;
+static u64 xstate_mask = 0;
+static u32 state_size = FXSAVE_SIZE;
+static bool ready = false;
+
+static const char *const format_names[] = {
+    [FPU_FXSAVE] = "FXSAVE",
+    [FPU_XSAVE] = "XSAVE",
+    [FPU_XSAVEOPT] = "XSAVEOPT",
+    [FPU_XSAVES] = "XSAVES",
+};
+
+/*
+ * Clean state for a thread's first FPU use. With XSAVE, an all-zero
+ * XSTATE_BV in the header makes XRSTOR initialise every component; MXCSR is
+ * still loaded from the legacy area, so it is filled in either way.
+ */
+static u8 init_state[FPU_STATE_MAX] ALIGNED(FPU_STATE_ALIGN);
+
+static inline void xsetbv(u32 index, u64 value) {
+  __asm__ volatile("xsetbv"
+                   :
+                   : "c"(index), "a"((u32)value), "d"((u32)(value >> 32)));
+}
+
+/* Pick the state components and the save format; BSP only */
+void fpu_init(void) {
+  bool use_xsave =
+      cpu_has(CPU_FEATURE_XSAVE) && cpu_max_leaf() >= CPUID_LEAF_XSTATE;
+  u32 eax, ebx, ecx, edx;
+
+  if (use_xsave) {
+    cpuid(CPUID_LEAF_XSTATE, 0, &eax, &ebx, &ecx, &edx);
+
+    u64 supported = ((u64)edx << 32) | eax;
+    xstate_mask = XSTATE_X87 | XSTATE_SSE;
+    if (cpu_has(CPU_FEATURE_AVX) && (supported & XSTATE_AVX)) {
+      xstate_mask |= XSTATE_AVX;
+    }
+
+    cpuid(CPUID_LEAF_XSTATE, 1, &eax, &ebx, &ecx, &edx);
+    if (eax & XSTATE_FEATURE_XSAVES) {
+      format = FPU_XSAVES;
+    } else if (eax & XSTATE_FEATURE_XSAVEOPT) {
+      format = FPU_XSAVEOPT;
+    } else {
+      format = FPU_XSAVE;
+    }
+  }
+
+  fpu_init_cpu();
+
+  if (use_xsave) {
+    /*
+     * Size for the components enabled right now: subleaf 0 EBX is the
+     * standard layout, subleaf 1 EBX the compacted one (XCR0 | IA32_XSS).
+     */
+    cpuid(CPUID_LEAF_XSTATE, format == FPU_XSAVES ? 1 : 0, &eax, &ebx, &ecx,
+          &edx);
+    state_size = ebx;
+
+    if (state_size > FPU_STATE_MAX) {
+      /* Not with x87/SSE/AVX only, but never overrun the save areas */
+      format = FPU_FXSAVE;
+      xstate_mask = 0;
+      state_size = FXSAVE_SIZE;
+      write_cr4(read_cr4() & ~CR4_OSXSAVE);
+    }
+  }
+
+  *(u16 *)&init_state[FXSAVE_FCW_OFFSET] = FCW_DEFAULT;
+  *(u32 *)&init_state[FXSAVE_MXCSR_OFFSET] = MXCSR_DEFAULT;
+  if (format == FPU_XSAVES) {
+    /* XRSTORS takes the compacted format only */
+    *(u64 *)&init_state[XSAVE_XCOMP_BV_OFFSET] =
+        XCOMP_BV_COMPACTED | xstate_mask;
+  }
+
+  ready = true;
+}
+
+/* Enable the FPU and SSE on the calling CPU, with TS clear */
+void fpu_init_cpu(void) {
+  u64 cr0 = read_cr0();
+  cr0 &= ~(CR0_EM | CR0_TS);
+  cr0 |= CR0_MP | CR0_NE;
+  write_cr0(cr0);
+
+  u64 cr4 = read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT;
+  if (format != FPU_FXSAVE) {
+    cr4 |= CR4_OSXSAVE;
+  }
+  write_cr4(cr4);
+
+  if (format != FPU_FXSAVE) {
+    xsetbv(0, xstate_mask);
+  }
+  if (format == FPU_XSAVES) {
+    wrmsr(MSR_IA32_XSS, 0); /* No supervisor components */
+  }
+
+  __asm__ volatile("fninit");
+}
+
+/* The BSP's FPU is set up (APs enable theirs before running threads) */
+bool fpu_ready(void) { return ready; }
+
+enum fpu_format fpu_get_format(void) { return format; }
+
+const char *fpu_format_name(void) { return format_names[format]; }
+
+/* 256-bit AVX registers are enabled in XCR0 */
+bool fpu_has_avx(void) { return (xstate_mask & XSTATE_AVX) != 0; }
+
+u32 fpu_state_size(void) { return state_size; }
+
+/* state must be FPU_STATE_ALIGN aligned and fpu_state_size() bytes long */
+void fpu_save(void *state) {
+  switch (format) {
+  case FPU_XSAVES:
+    __asm__ volatile("xsaves64 (%0)"
+                     :
+                     : "r"(state), "a"(U32_MAX), "d"(U32_MAX)
+                     : "memory");
+    break;
+  case FPU_XSAVEOPT:
+    __asm__ volatile("xsaveopt64 (%0)"
+                     :
+                     : "r"(state), "a"(U32_MAX), "d"(U32_MAX)
+                     : "memory");
+    break;
+  case FPU_XSAVE:
+    __asm__ volatile("xsave64 (%0)"
+                     :
+                     : "r"(state), "a"(U32_MAX), "d"(U32_MAX)
+                     : "memory");
+    break;
+  case FPU_FXSAVE:
+    __asm__ volatile("fxsave64 (%0)" : : "r"(state) : "memory");
+    break;
+  }
+}
+
+void fpu_restore(const void *state) {
+  switch (format) {
+  case FPU_XSAVES:
+    __asm__ volatile("xrstors64 (%0)"
+                     :
+                     : "r"(state), "a"(U32_MAX), "d"(U32_MAX)
+                     : "memory");
+    break;
+  case FPU_XSAVEOPT:
+  case FPU_XSAVE:
+    __asm__ volatile("xrstor64 (%0)"
+                     :
+                     : "r"(state), "a"(U32_MAX), "d"(U32_MAX)
+                     : "memory");
+    break;
+  case FPU_FXSAVE:
+    __asm__ volatile("fxrstor64 (%0)" : : "r"(state) : "memory");
+    break;
+  }
+}
+
+void fpu_restore_init(void) { fpu_restore(init_state); }
+
+/* Give a save area the clean state, as if saved right after FNINIT */
+void fpu_copy_init(void *state) {
+  u8 *dst = state;
+  for (u32 i = 0; i < state_size; i++) {
+    dst[i] = init_state[i];
+  }
+}
@@ -0,0 +1,47 @@
+#ifndef DELTA_ARCH_AMD64_FPU_H
+#define DELTA_ARCH_AMD64_FPU_H
+
+#include "arch_types.h"
+
+/*
+ * x87/SSE/AVX register state, switched eagerly with each thread. The save
+ * instruction is the best the CPU has: XSAVES or XSAVEOPT skip components
+ * still in their init state and, when the area was the last one restored
+ * on this CPU, components not modified since; plain XSAVE and FXSAVE
+ * always store everything. The XSAVE size depends on the components
+ * enabled in XCR0.
+ */
+
+#define FPU_STATE_MAX 4096
+#define FPU_STATE_ALIGN 64 /* XSAVE needs 64, FXSAVE 16 */
+
+enum fpu_format {
+  FPU_FXSAVE = 0,
+  FPU_XSAVE = 1,
+  FPU_XSAVEOPT = 2,
+  FPU_XSAVES = 3, /* Compacted format */
+};
+
+void fpu_init(void);
+
+void fpu_init_cpu(void);
+
+bool fpu_ready(void);
+
+enum fpu_format fpu_get_format(void);
+
+const char *fpu_format_name(void);
+
+bool fpu_has_avx(void);
+
+u32 fpu_state_size(void);
+
+void fpu_save(void *state);
+
+void fpu_restore(const void *state);
+
+void fpu_restore_init(void);
+
+void fpu_copy_init(void *state);
+
+#endif /* DELTA_ARCH_AMD64_FPU_H */
@@ -0,0 +1,90 @@
+#include "gdt.h"
+
+#define GDT_ENTRY_COUNT 7 /* null, 4 segments, 16-byte TSS descriptor */
+
+#define GDT_DESC_KERNEL_CODE 0x00AF9A000000FFFFULL
+#define GDT_DESC_KERNEL_DATA 0x00CF92000000FFFFULL
+#define GDT_DESC_USER_DATA 0x00CFF2000000FFFFULL
+#define GDT_DESC_USER_CODE 0x00AFFA000000FFFFULL
+
+#define TSS_TYPE_AVAILABLE 0x89ULL /* Present, 64-bit TSS (available) */
+
+struct gdt_pointer {
+  u16 limit;
+  u64 base;
+} PACKED;
+
+static u64 gdt_tables[MAX_CPUS][GDT_ENTRY_COUNT] ALIGNED(16);
+static struct tss cpu_tss[MAX_CPUS] ALIGNED(16);
+
+static u8 ist_stacks[MAX_CPUS][IST_COUNT][IST_STACK_SIZE] ALIGNED(16);
+
+static void gdt_set_tss(u64 *gdt, const struct tss *tss) {
+  u64 base = (u64)tss;
+  u64 limit = sizeof(struct tss) - 1;
+
+  gdt[GDT_TSS / 8] = (limit & 0xFFFF) | ((base & 0xFFFFFF) << 16) |
+                     (TSS_TYPE_AVAILABLE << 40) | (((limit >> 16) & 0xF) << 48) |
+                     (((base >> 24) & 0xFF) << 56);
+  gdt[GDT_TSS / 8 + 1] = base >> 32;
+}
+
+static void gdt_load(const struct gdt_pointer *ptr) {
+  /* Reload CS with a far return; the data segments are reloaded directly. */
+  __asm__ volatile("lgdt (%0)\n"
+                   "pushq %1\n"
+                   "leaq 1f(%%rip), %%rax\n"
+                   "pushq %%rax\n"
+                   "lretq\n"
+                   "1:\n"
+                   "movw %w2, %%ds\n"
+                   "movw %w2, %%es\n"
+                   "movw %w2, %%ss\n"
+                   "xorl %%eax, %%eax\n"
+                   "movw %%ax, %%fs\n"
+                   "movw %%ax, %%gs\n"
+                   :
+                   : "r"(ptr), "i"((u64)GDT_KERNEL_CODE), "r"((u64)GDT_KERNEL_DATA)
+                   : "rax", "memory");
+
+  __asm__ volatile("ltr %w0" : : "r"((u16)GDT_TSS));
+}
+
+void gdt_init_cpu(u32 cpu) {
+  if (cpu >= MAX_CPUS) {
+    return;
+  }
+
+  u64 *gdt = gdt_tables[cpu];
+  struct tss *tss = &cpu_tss[cpu];
+
+  gdt[0] = 0;
+  gdt[GDT_KERNEL_CODE / 8] = GDT_DESC_KERNEL_CODE;
+  gdt[GDT_KERNEL_DATA / 8] = GDT_DESC_KERNEL_DATA;
+  gdt[GDT_USER_DATA / 8] = GDT_DESC_USER_DATA;
+  gdt[GDT_USER_CODE / 8] = GDT_DESC_USER_CODE;
+
+  for (u32 i = 0; i < IST_COUNT; i++) {
+    /* IST slots are 1-based; stacks grow down from the end of each buffer */
+    tss->ist[i] = (u64)&ist_stacks[cpu][i][IST_STACK_SIZE];
+  }
+
+  /* SECURITY: I/O bitmap offset past the TSS limit denies all port access
+   * from user mode. */
+  tss->iomap_base = sizeof(struct tss);
+
+  gdt_set_tss(gdt, tss);
+
+  struct gdt_pointer ptr = {
+      .limit = sizeof(gdt_tables[cpu]) - 1,
+      .base = (u64)gdt,
+  };
+  gdt_load(&ptr);
+}
+
+struct tss *gdt_get_tss(u32 cpu) {
+  if (cpu >= MAX_CPUS) {
+    return NULL;
+  }
+  return &cpu_tss[cpu];
+}
@@ -0,0 +1,40 @@
+#ifndef DELTA_ARCH_AMD64_GDT_H
+#define DELTA_ARCH_AMD64_GDT_H
+
+#include "arch_types.h"
+
+/*
+ * Segment selectors. The user data/code order is fixed by SYSRET, which
+ * loads SS from STAR[63:48] + 8 and CS from STAR[63:48] + 16.
+ */
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_USER_DATA 0x18
+#define GDT_USER_CODE 0x20
+#define GDT_TSS 0x28
+
+#define GDT_RPL_USER 3
+
+/* Interrupt Stack Table slots (1-based, 0 means "no IST") */
+#define IST_NMI 1
+#define IST_DOUBLE_FAULT 2
+#define IST_MACHINE_CHECK 3
+#define IST_COUNT 3
+
+#define IST_STACK_SIZE (8 * 1024) /* 8 KiB per IST stack */
+
+struct tss {
+  u32 reserved0;
+  u64 rsp[3]; /* Stack loaded on privilege change to ring 0-2 */
+  u64 reserved1;
+  u64 ist[7]; /* Known-good stacks for critical exceptions */
+  u64 reserved2;
+  u16 reserved3;
+  u16 iomap_base;
+} PACKED;
+
+void gdt_init_cpu(u32 cpu);
+
+struct tss *gdt_get_tss(u32 cpu);
+
+#endif /* DELTA_ARCH_AMD64_GDT_H */
@@ -0,0 +1,341 @@
+#include "idt.h"
+#include "apic.h"
+#include "gdt.h"
+
+#include "../../kernel/panic.h"
+
+#define IDT_GATE_INTERRUPT 0x8E /* Present, DPL 0, 64-bit interrupt gate */
+
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA 0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA 0xA1
+#define PIC_EOI 0x20
+#define PIC_CASCADE_LINE 2
+
+struct idt_entry {
+  u16 offset_low;
+  u16 selector;
+  u8 ist;
+  u8 type_attr;
+  u16 offset_mid;
+  u32 offset_high;
+  u32 reserved;
+} PACKED;
+
+struct idt_pointer {
+  u16 limit;
+  u64 base;
+} PACKED;
+
+/* Generated by the stub table in interrupts.asm */
+extern const u64 isr_stub_table[IDT_ENTRIES];
+
+static struct idt_entry idt[IDT_ENTRIES] ALIGNED(16);
+
+static irq_handler_t irq_handlers[IDT_ENTRIES];
+
+static exception_handler_t exception_handlers[EXCEPTION_COUNT];
+
+static irq_exit_handler_t irq_exit_handler = NULL;
+
+/* NMIs are shared: the panic freeze, the profiler */
+#define NMI_HANDLERS_MAX 4
+static exception_handler_t nmi_handlers[NMI_HANDLERS_MAX];
+
+static u64 spurious_irq_count = 0;
+
+/* ISA lines unmasked at the PIC, bit per line; they take a PIC EOI */
+static u16 pic_enabled_lines = 0;
+
+static const char *const exception_names[EXCEPTION_COUNT] = {
+    "#DE Divide Error",
+    "#DB Debug",
+    "NMI",
+    "#BP Breakpoint",
+    "#OF Overflow",
+    "#BR Bound Range Exceeded",
+    "#UD Invalid Opcode",
+    "#NM Device Not Available",
+    "#DF Double Fault",
+    "Coprocessor Segment Overrun",
+    "#TS Invalid TSS",
+    "#NP Segment Not Present",
+    "#SS Stack-Segment Fault",
+    "#GP General Protection Fault",
+    "#PF Page Fault",
+    "Reserved",
+    "#MF x87 Floating-Point Exception",
+    "#AC Alignment Check",
+    "#MC Machine Check",
+    "#XM SIMD Floating-Point Exception",
+    "#VE Virtualization Exception",
+    "#CP Control Protection Exception",
+    "Reserved",
+    "Reserved",
+    "Reserved",
+    "Reserved",
+    "Reserved",
+    "Reserved",
+    "#HV Hypervisor Injection",
+    "#VC VMM Communication",
+    "#SX Security Exception",
+    "Reserved",
+};
+
+/* Page fault error code bits, in bit order, for the decoded message */
+static const char *const page_fault_bits[] = {
+    " present", " write", " user",        " reserved-bit",
+    " fetch",   " pkey",  " shadow-stack",
+};
+
+/*
+ * Fatal exceptions are reported by building the panic message on the
+ * faulting CPU's stack, so CPUs faulting together each keep their own.
+ * SECURITY: fixed-size buffer, every append is bounds-checked.
+ */
+struct exception_message {
+  char text[192];
+  u32 length;
+};
+
+static void msg_append(struct exception_message *msg, const char *str) {
+  while (*str && msg->length < sizeof(msg->text) - 1) {
+    msg->text[msg->length++] = *str++;
+  }
+  msg->text[msg->length] = '\0';
+}
+
+static void msg_append_hex(struct exception_message *msg, u64 value) {
+  static const char hex_chars[] = "0123456789ABCDEF";
+  char buffer[19];
+
+  buffer[0] = '0';
+  buffer[1] = 'x';
+  for (int i = 0; i < 16; i++) {
+    buffer[2 + i] = hex_chars[(value >> (60 - i * 4)) & 0xF];
+  }
+  buffer[18] = '\0';
+  msg_append(msg, buffer);
+}
+
+static void idt_set_gate(u8 vector, u64 handler, u8 ist) {
+  struct idt_entry *entry = &idt[vector];
+
+  entry->offset_low = handler & 0xFFFF;
+  entry->selector = GDT_KERNEL_CODE;
+  entry->ist = ist;
+  entry->type_attr = IDT_GATE_INTERRUPT;
+  entry->offset_mid = (handler >> 16) & 0xFFFF;
+  entry->offset_high = (handler >> 32) & 0xFFFFFFFF;
+  entry->reserved = 0;
+}
+
+/*
+ * The 8259 PIC comes out of firmware with IRQs mapped over the CPU exception
+ * vectors (IRQ0 -> #DF). Move it out of the way and mask every line; all
+ * interrupt routing goes through the local APIC.
+ */
+static void pic_disable(void) {
+  outb(PIC1_COMMAND, 0x11); /* ICW1: init, expect ICW4 */
+  io_wait();
+  outb(PIC2_COMMAND, 0x11);
+  io_wait();
+  outb(PIC1_DATA, IRQ_VECTOR_BASE); /* ICW2: vector offsets */
+  io_wait();
+  outb(PIC2_DATA, IRQ_VECTOR_BASE + 8);
+  io_wait();
+  outb(PIC1_DATA, 0x04); /* ICW3: slave on IRQ2 */
+  io_wait();
+  outb(PIC2_DATA, 0x02);
+  io_wait();
+  outb(PIC1_DATA, 0x01); /* ICW4: 8086 mode */
+  io_wait();
+  outb(PIC2_DATA, 0x01);
+  io_wait();
+
+  outb(PIC1_DATA, 0xFF);
+  outb(PIC2_DATA, 0xFF);
+}
+
+void idt_load(void) {
+  struct idt_pointer ptr = {
+      .limit = sizeof(idt) - 1,
+      .base = (u64)idt,
+  };
+  __asm__ volatile("lidt %0" : : "m"(ptr));
+}
+
+void idt_init(void) {
+  for (u32 vector = 0; vector < IDT_ENTRIES; vector++) {
+    idt_set_gate((u8)vector, isr_stub_table[vector], 0);
+    irq_handlers[vector] = NULL;
+  }
+
+  /* These can arrive on a corrupt or exhausted stack; give them their own. */
+  idt_set_gate(EXC_NMI, isr_stub_table[EXC_NMI], IST_NMI);
+  idt_set_gate(EXC_DOUBLE_FAULT, isr_stub_table[EXC_DOUBLE_FAULT],
+               IST_DOUBLE_FAULT);
+  idt_set_gate(EXC_MACHINE_CHECK, isr_stub_table[EXC_MACHINE_CHECK],
+               IST_MACHINE_CHECK);
+
+  pic_disable();
+  idt_load();
+}
+
+bool irq_register(u8 vector, irq_handler_t handler) {
+  if (vector < IRQ_VECTOR_BASE || handler == NULL) {
+    return false; /* Exception vectors are not IRQs */
+  }
+
+  if (irq_handlers[vector] != NULL) {
+    return false; /* Already claimed */
+  }
+
+  irq_handlers[vector] = handler;
+  return true;
+}
+
+void irq_unregister(u8 vector) { irq_handlers[vector] = NULL; }
+
+/*
+ * Unmask ISA line at the PIC and take the PIC's output on this CPU's LINT0.
+ * There is no I/O APIC driver; virtual wire mode is enough for the few
+ * legacy devices (the serial port) that need an interrupt. Register the
+ * handler for IRQ_LEGACY_VECTOR(line) first.
+ */
+void irq_legacy_enable(u8 line) {
+  if (line >= 16 || line == PIC_CASCADE_LINE) {
+    return;
+  }
+
+  u64 flags = irq_save();
+  pic_enabled_lines |= (u16)(1U << line);
+  if (line >= 8) {
+    pic_enabled_lines |= 1U << PIC_CASCADE_LINE;
+  }
+  outb(PIC1_DATA, (u8)~pic_enabled_lines);
+  outb(PIC2_DATA, (u8)~(pic_enabled_lines >> 8));
+  apic_enable_extint();
+  irq_restore(flags);
+}
+
+/* Spurious IRQ7/15 arrive on masked lines and get no EOI */
+static void pic_eoi(u64 vector) {
+  u32 line = (u32)(vector - IRQ_VECTOR_BASE);
+  if (!(pic_enabled_lines & (1U << line))) {
+    return;
+  }
+  if (line >= 8) {
+    outb(PIC2_COMMAND, PIC_EOI);
+  }
+  outb(PIC1_COMMAND, PIC_EOI);
+}
+
+/* Recoverable exceptions (#NM for lazy FPU switching, later #PF) */
+bool exception_register(u8 vector, exception_handler_t handler) {
+  if (vector >= EXCEPTION_COUNT || handler == NULL) {
+    return false;
+  }
+
+  if (exception_handlers[vector] != NULL) {
+    return false; /* Already claimed */
+  }
+
+  exception_handlers[vector] = handler;
+  return true;
+}
+
+/*
+ * NMIs carry no cause, so every handler is asked in turn and claims the
+ * NMI by returning true. One nobody claims is fatal.
+ */
+bool nmi_register(exception_handler_t handler) {
+  for (u32 i = 0; i < NMI_HANDLERS_MAX; i++) {
+    exception_handler_t expected = NULL;
+    if (__atomic_compare_exchange_n(&nmi_handlers[i], &expected, handler,
+                                    false, __ATOMIC_RELEASE,
+                                    __ATOMIC_RELAXED)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * Run after every IRQ handler, still on the interrupted stack with
+ * interrupts disabled: the scheduler's preemption point.
+ */
+void irq_set_exit_handler(irq_exit_handler_t handler) {
+  irq_exit_handler = handler;
+}
+
+/* Called from irq_common with only the caller-saved registers preserved. */
+void irq_dispatch(u64 vector) {
+  irq_handler_t handler = irq_handlers[vector & 0xFF];
+
+  /* Acknowledge up front: handlers may switch away and not come back soon.
+   * Legacy vectors are the PIC's to acknowledge (ExtINT needs no APIC EOI);
+   * spurious vectors have nothing in service. */
+  if (vector >= IRQ_LEGACY_PIC_END && vector != VECTOR_SPURIOUS) {
+    apic_eoi();
+  } else if (vector >= IRQ_VECTOR_BASE && vector < IRQ_LEGACY_PIC_END) {
+    pic_eoi(vector);
+  }
+
+  if (LIKELY(handler != NULL)) {
+    handler((u8)vector);
+  } else {
+    spurious_irq_count++;
+  }
+
+  if (irq_exit_handler != NULL) {
+    irq_exit_handler();
+  }
+}
+
+/* Called from exception_common with a full struct interrupt_frame. */
+void exception_dispatch(struct interrupt_frame *frame) {
+  exception_handler_t handler =
+      exception_handlers[frame->vector & (EXCEPTION_COUNT - 1)];
+  if (handler != NULL && handler(frame)) {
+    return;
+  }
+  if (frame->vector == EXC_NMI) {
+    for (u32 i = 0; i < NMI_HANDLERS_MAX; i++) {
+      exception_handler_t nmi =
+          __atomic_load_n(&nmi_handlers[i], __ATOMIC_ACQUIRE);
+      if (nmi != NULL && nmi(frame)) {
+        return;
+      }
+    }
+  }
+
+  /* Read CR2 first: a nested fault would overwrite it. */
+  u64 fault_address = (frame->vector == EXC_PAGE_FAULT) ? read_cr2() : 0;
+
+  struct exception_message msg;
+  msg.length = 0;
+  msg_append(&msg, exception_names[frame->vector & (EXCEPTION_COUNT - 1)]);
+  msg_append(&msg, " at RIP ");
+  msg_append_hex(&msg, frame->rip);
+
+  if (frame->vector == EXC_PAGE_FAULT) {
+    msg_append(&msg, "\n  Address: ");
+    msg_append_hex(&msg, fault_address);
+    msg_append(&msg, "\n  Cause:  ");
+    if (!(frame->error_code & PF_PRESENT)) {
+      msg_append(&msg, " not-present");
+    }
+    for (u32 bit = 0; bit < ARRAY_SIZE(page_fault_bits); bit++) {
+      if (frame->error_code & (1UL << bit)) {
+        msg_append(&msg, page_fault_bits[bit]);
+      }
+    }
+  } else if (frame->error_code != 0) {
+    msg_append(&msg, "\n  Error code: ");
+    msg_append_hex(&msg, frame->error_code);
+  }
+
+  panic_with_frame(msg.text, frame);
+}
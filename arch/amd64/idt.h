@@ -0,0 +1,103 @@
+#ifndef DELTA_ARCH_AMD64_IDT_H
+#define DELTA_ARCH_AMD64_IDT_H
+
+#include "arch_types.h"
+
+#define IDT_ENTRIES 256
+
+/* CPU exception vectors */
+#define EXC_DIVIDE_ERROR 0
+#define EXC_DEBUG 1
+#define EXC_NMI 2
+#define EXC_BREAKPOINT 3
+#define EXC_OVERFLOW 4
+#define EXC_BOUND_RANGE 5
+#define EXC_INVALID_OPCODE 6
+#define EXC_DEVICE_NOT_AVAILABLE 7
+#define EXC_DOUBLE_FAULT 8
+#define EXC_INVALID_TSS 10
+#define EXC_SEGMENT_NOT_PRESENT 11
+#define EXC_STACK_FAULT 12
+#define EXC_GENERAL_PROTECTION 13
+#define EXC_PAGE_FAULT 14
+#define EXC_X87_FPU 16
+#define EXC_ALIGNMENT_CHECK 17
+#define EXC_MACHINE_CHECK 18
+#define EXC_SIMD_FPU 19
+#define EXC_VIRTUALIZATION 20
+#define EXC_CONTROL_PROTECTION 21
+
+#define EXCEPTION_COUNT 32
+
+/* Vectors 0x20-0x2F are where the legacy PIC is parked (masked). */
+#define IRQ_VECTOR_BASE 0x20
+#define IRQ_LEGACY_PIC_END 0x30
+#define IRQ_LEGACY_VECTOR(line) (IRQ_VECTOR_BASE + (line)) /* ISA line 0-15 */
+
+#define VECTOR_SPURIOUS 0xFF
+
+/* Page fault error code bits */
+#define PF_PRESENT (1UL << 0)  /* Protection violation (vs. not-present) */
+#define PF_WRITE (1UL << 1)    /* Caused by a write */
+#define PF_USER (1UL << 2)     /* Fault occurred in user mode */
+#define PF_RESERVED (1UL << 3) /* Reserved bit set in a paging entry */
+#define PF_INSTR (1UL << 4)    /* Caused by an instruction fetch */
+#define PF_PKEY (1UL << 5)     /* Protection-key violation */
+#define PF_SHADOW (1UL << 6)   /* Shadow-stack access */
+
+/*
+ * Full register frame built by the exception stubs in interrupts.asm.
+ * Field order must match the push order there (last pushed = first field).
+ */
+struct interrupt_frame {
+  u64 r15;
+  u64 r14;
+  u64 r13;
+  u64 r12;
+  u64 r11;
+  u64 r10;
+  u64 r9;
+  u64 r8;
+  u64 rbp;
+  u64 rdi;
+  u64 rsi;
+  u64 rdx;
+  u64 rcx;
+  u64 rbx;
+  u64 rax;
+
+  u64 vector;
+  u64 error_code; /* Pushed by the CPU, or 0 by the stub */
+
+  /* Pushed by the CPU */
+  u64 rip;
+  u64 cs;
+  u64 rflags;
+  u64 rsp;
+  u64 ss;
+} PACKED;
+
+typedef void (*irq_handler_t)(u8 vector);
+
+/* Returns true if it dealt with the exception and execution may resume */
+typedef bool (*exception_handler_t)(struct interrupt_frame *frame);
+
+typedef void (*irq_exit_handler_t)(void);
+
+void idt_init(void);
+
+void idt_load(void);
+
+bool irq_register(u8 vector, irq_handler_t handler);
+
+void irq_unregister(u8 vector);
+
+void irq_legacy_enable(u8 line);
+
+bool exception_register(u8 vector, exception_handler_t handler);
+
+bool nmi_register(exception_handler_t handler);
+
+void irq_set_exit_handler(irq_exit_handler_t handler);
+
+#endif /* DELTA_ARCH_AMD64_IDT_H */
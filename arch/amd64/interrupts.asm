@@ -0,0 +1,151 @@
+bits 64
+
+
+section .text
+
+
+extern exception_dispatch
+extern irq_dispatch
+
+
+global isr_stub_table
+
+
+; Entered from user mode (RPL 3 in the saved CS): the GS base is the user's
+; and must be swapped for the kernel's on the way in and back on the way out.
+%macro SWAPGS_IF_USER 1
+    test byte [rsp + %1], 3
+    jz %%kernel
+    swapgs
+%%kernel:
+%endmacro
+
+
+; Vectors for which the CPU pushes an error code itself
+%define HAS_ERROR_CODE(v) ((v) == 8 || ((v) >= 10 && (v) <= 14) || (v) == 17 || (v) == 21 || (v) == 29 || (v) == 30)
+
+
+; Exceptions (0-31): normalize the stack to [vector, error_code] and build a
+; full struct interrupt_frame, so handlers can inspect every register.
+%macro EXCEPTION_STUB 1
+isr_stub_%+%1:
+%if HAS_ERROR_CODE(%1) == 0
+    push 0                  ; Dummy error code
+%endif
+    push %1
+    jmp exception_common
+%endmacro
+
+
+; IRQs (32-255): only the vector, the C dispatcher saves whatever it clobbers.
+%macro IRQ_STUB 1
+isr_stub_%+%1:
+    push %1
+    jmp irq_common
+%endmacro
+
+
+%assign vector 0
+%rep 256
+%if vector < 32
+    EXCEPTION_STUB vector
+%else
+    IRQ_STUB vector
+%endif
+%assign vector vector + 1
+%endrep
+
+
+exception_common:
+
+    SWAPGS_IF_USER 24       ; Vector, error code, rip, then cs
+    push rax
+    push rbx
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push rbp
+    push r8
+    push r9
+    push r10
+    push r11
+    push r12
+    push r13
+    push r14
+    push r15
+
+    cld
+    mov rdi, rsp            ; struct interrupt_frame * (22 qwords, 16-byte aligned)
+    call exception_dispatch
+
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rbp
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+
+    SWAPGS_IF_USER 24
+    add rsp, 16             ; Drop vector and error code
+    iretq
+
+
+; Minimal save path: the System V ABI makes the callee preserve rbx, rbp and
+; r12-r15, so only the caller-saved registers need to survive the C call.
+irq_common:
+
+    SWAPGS_IF_USER 16       ; Vector, rip, then cs
+    push rax
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+
+    cld
+    mov rdi, [rsp + 72]     ; Vector pushed by the stub
+    sub rsp, 8              ; 5 CPU + 1 vector + 9 saved qwords: realign to 16
+    call irq_dispatch
+    add rsp, 8
+
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rax
+
+    SWAPGS_IF_USER 16
+    add rsp, 8              ; Drop vector
+    iretq
+
+
+section .rodata
+
+
+align 8
+
+
+isr_stub_table:
+
+%assign vector 0
+%rep 256
+    dq isr_stub_%+vector
+%assign vector vector + 1
+%endrep
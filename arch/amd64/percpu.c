@@ -0,0 +1,55 @@
+#include "percpu.h"
+
+_Static_assert(__builtin_offsetof(struct percpu, cpu_id) ==
+                   PERCPU_OFFSET_CPU_ID,
+               "PERCPU_OFFSET_CPU_ID out of sync with struct percpu");
+_Static_assert(__builtin_offsetof(struct percpu, current) ==
+                   PERCPU_OFFSET_CURRENT,
+               "PERCPU_OFFSET_CURRENT out of sync with struct percpu");
+_Static_assert(__builtin_offsetof(struct percpu, preempt_count) ==
+                   PERCPU_OFFSET_PREEMPT_COUNT,
+               "PERCPU_OFFSET_PREEMPT_COUNT out of sync with struct percpu");
+_Static_assert(__builtin_offsetof(struct percpu, kernel_stack) ==
+                   PERCPU_OFFSET_KERNEL_STACK,
+               "PERCPU_OFFSET_KERNEL_STACK out of sync with struct percpu");
+_Static_assert(__builtin_offsetof(struct percpu, user_rsp) ==
+                   PERCPU_OFFSET_USER_RSP,
+               "PERCPU_OFFSET_USER_RSP out of sync with struct percpu");
+_Static_assert(__builtin_offsetof(struct percpu, tss_rsp0) ==
+                   PERCPU_OFFSET_TSS_RSP0,
+               "PERCPU_OFFSET_TSS_RSP0 out of sync with struct percpu");
+
+static struct percpu percpu_areas[MAX_CPUS] ALIGNED(64);
+
+static u32 online_count = 0;
+
+void percpu_init_cpu(u32 cpu, u32 apic_id) {
+  if (cpu >= MAX_CPUS) {
+    return;
+  }
+
+  struct percpu *area = &percpu_areas[cpu];
+  area->self = area;
+  area->cpu_id = cpu;
+  area->apic_id = apic_id;
+  area->current = NULL;
+  area->preempt_count = 0;
+  area->kernel_stack = 0;
+  area->user_rsp = 0;
+  area->tss_rsp0 = NULL;
+
+  wrmsr(MSR_GS_BASE, (u64)area);
+
+  __atomic_fetch_add(&online_count, 1, __ATOMIC_RELEASE);
+}
+
+struct percpu *percpu_get(u32 cpu) {
+  if (cpu >= MAX_CPUS) {
+    return NULL;
+  }
+  return &percpu_areas[cpu];
+}
+
+u32 percpu_online_count(void) {
+  return __atomic_load_n(&online_count, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,83 @@
+#ifndef DELTA_ARCH_AMD64_PERCPU_H
+#define DELTA_ARCH_AMD64_PERCPU_H
+
+#include "arch_types.h"
+
+struct kthread;
+
+/*
+ * Per-CPU control block, reached through the GS base. Subsystems keep their
+ * own per-CPU state in arrays indexed by this_cpu_id(); only what the
+ * low-level entry paths need lives here.
+ */
+struct percpu {
+  struct percpu *self; /* Must stay first: this_cpu() reads %gs:0 */
+  u32 cpu_id;          /* Dense index, 0 = BSP */
+  u32 apic_id;
+  struct kthread *current; /* Running thread, NULL until kthread_init_cpu() */
+  u32 preempt_count;       /* Preemption allowed only at 0 */
+  u64 kernel_stack; /* Loaded by syscall_entry: top of the user thread's stack */
+  u64 user_rsp;     /* User stack pointer, saved by syscall_entry */
+  u64 *tss_rsp0;    /* This CPU's TSS.RSP0, kept equal to kernel_stack */
+};
+
+#define PERCPU_OFFSET_CPU_ID 8
+#define PERCPU_OFFSET_CURRENT 16
+#define PERCPU_OFFSET_PREEMPT_COUNT 24
+#define PERCPU_OFFSET_KERNEL_STACK 32
+#define PERCPU_OFFSET_USER_RSP 40
+#define PERCPU_OFFSET_TSS_RSP0 48
+
+void percpu_init_cpu(u32 cpu, u32 apic_id);
+
+struct percpu *percpu_get(u32 cpu);
+
+u32 percpu_online_count(void);
+
+static inline struct percpu *this_cpu(void) {
+  struct percpu *self;
+  __asm__ volatile("movq %%gs:0, %0" : "=r"(self));
+  return self;
+}
+
+static inline u32 this_cpu_id(void) {
+  u32 id;
+  __asm__ volatile("movl %%gs:%c1, %0" : "=r"(id) : "i"(PERCPU_OFFSET_CPU_ID));
+  return id;
+}
+
+static inline struct kthread *this_cpu_current(void) {
+  struct kthread *current;
+  __asm__ volatile("movq %%gs:%c1, %0"
+                   : "=r"(current)
+                   : "i"(PERCPU_OFFSET_CURRENT));
+  return current;
+}
+
+static inline void this_cpu_set_current(struct kthread *current) {
+  __asm__ volatile("movq %0, %%gs:%c1"
+                   :
+                   : "r"(current), "i"(PERCPU_OFFSET_CURRENT)
+                   : "memory");
+}
+
+static inline u32 this_cpu_preempt_count(void) {
+  u32 count;
+  __asm__ volatile("movl %%gs:%c1, %0"
+                   : "=r"(count)
+                   : "i"(PERCPU_OFFSET_PREEMPT_COUNT));
+  return count;
+}
+
+/* A single instruction, so it cannot be split by an interrupt */
+static inline void preempt_disable(void) {
+  __asm__ volatile("incl %%gs:%c0" : : "i"(PERCPU_OFFSET_PREEMPT_COUNT)
+                   : "memory");
+}
+
+static inline void preempt_enable_no_resched(void) {
+  __asm__ volatile("decl %%gs:%c0" : : "i"(PERCPU_OFFSET_PREEMPT_COUNT)
+                   : "memory");
+}
+
+#endif /* DELTA_ARCH_AMD64_PERCPU_H */
@@ -0,0 +1,138 @@
+#include "pmu.h"
+#include "apic.h"
+#include "cpu.h"
+
+#define CPUID_LEAF_PMU 0x0000000A
+
+/* CPUID.0AH:EAX */
+#define PMU_VERSION(eax) ((eax) & 0xFF)
+#define PMU_COUNTERS(eax) (((eax) >> 8) & 0xFF)
+#define PMU_WIDTH(eax) (((eax) >> 16) & 0xFF)
+#define PMU_EVENTS_LENGTH(eax) ((eax) >> 24) /* Valid bits of EBX */
+
+/* IA32_PERFEVTSELx */
+#define EVTSEL_OS (1U << 17)  /* Count in ring 0 */
+#define EVTSEL_INT (1U << 20) /* Interrupt through the APIC on overflow */
+#define EVTSEL_EN (1U << 22)
+
+#define PMC0_BIT (1UL << 0) /* In the global control and status MSRs */
+
+/*
+ * Counters are written through IA32_PMCx, which takes 32 bits and
+ * sign-extends them, so the period must leave bit 31 set in -period.
+ */
+#define PMU_PERIOD_MIN 10000U
+#define PMU_PERIOD_MAX 0x7FFFFFFFU
+
+/* Event select and unit mask of each architectural event */
+static const struct {
+  u8 event;
+  u8 umask;
+  const char *name;
+} events[PMU_EVENT_COUNT] = {
+    [PMU_EVENT_CYCLES] = {0x3C, 0x00, "cycles"},
+    [PMU_EVENT_INSTRUCTIONS] = {0xC0, 0x00, "instructions"},
+    [PMU_EVENT_REF_CYCLES] = {0x3C, 0x01, "ref-cycles"},
+};
+
+static struct pmu_info info;
+static u32 reload; /* -period, as written to IA32_PMC0 */
+
+/*
+ * Probe leaf 0xA once, on the boot CPU; the others match it. Picks the
+ * first architectural event the CPU has, cycles if it can.
+ */
+bool pmu_init(void) {
+  if (cpu_max_leaf() < CPUID_LEAF_PMU) {
+    return false;
+  }
+
+  u32 eax, ebx, ecx, edx;
+  cpuid(CPUID_LEAF_PMU, 0, &eax, &ebx, &ecx, &edx);
+  if (PMU_VERSION(eax) == 0 || PMU_COUNTERS(eax) == 0 ||
+      PMU_WIDTH(eax) < 32) {
+    return false;
+  }
+
+  /* An EBX bit set, or past the valid length, means the event is absent */
+  for (u32 event = 0; event < PMU_EVENT_COUNT; event++) {
+    if (event < PMU_EVENTS_LENGTH(eax) && (ebx & (1U << event)) == 0) {
+      info.version = PMU_VERSION(eax);
+      info.counters = PMU_COUNTERS(eax);
+      info.width = PMU_WIDTH(eax);
+      info.event = (enum pmu_event)event;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool pmu_available(void) { return info.version != 0; }
+
+void pmu_get_info(struct pmu_info *out) { *out = info; }
+
+const char *pmu_event_name(enum pmu_event event) {
+  return event < PMU_EVENT_COUNT ? events[event].name : "unknown";
+}
+
+/*
+ * Count ring-0 events on this CPU, with an NMI every period of them.
+ * Returns the period used, after clamping, or 0 without a PMU.
+ */
+u32 pmu_start(u32 period) {
+  if (!pmu_available()) {
+    return 0;
+  }
+  period = MIN(MAX(period, PMU_PERIOD_MIN), PMU_PERIOD_MAX);
+  reload = (u32)-period;
+
+  wrmsr(MSR_IA32_PERFEVTSEL0, 0);
+  if (info.version >= 2) {
+    wrmsr(MSR_IA32_PERF_GLOBAL_CTRL, 0);
+    wrmsr(MSR_IA32_PERF_GLOBAL_OVF_CTRL, PMC0_BIT);
+  }
+  wrmsr(MSR_IA32_PMC0, reload);
+  apic_pmi_enable();
+
+  wrmsr(MSR_IA32_PERFEVTSEL0, events[info.event].event |
+                                  (u32)events[info.event].umask << 8 |
+                                  EVTSEL_OS | EVTSEL_INT | EVTSEL_EN);
+  if (info.version >= 2) {
+    wrmsr(MSR_IA32_PERF_GLOBAL_CTRL, PMC0_BIT);
+  }
+  return period;
+}
+
+void pmu_stop(void) {
+  if (!pmu_available()) {
+    return;
+  }
+  apic_pmi_disable();
+  wrmsr(MSR_IA32_PERFEVTSEL0, 0);
+  if (info.version >= 2) {
+    wrmsr(MSR_IA32_PERF_GLOBAL_CTRL, 0);
+    wrmsr(MSR_IA32_PERF_GLOBAL_OVF_CTRL, PMC0_BIT);
+  }
+}
+
+/*
+ * Version 2+ latches the overflow in the global status. Version 1 has no
+ * status: the counter starts with its top bit set and wraps to small.
+ */
+bool pmu_overflowed(void) {
+  if (!pmu_available()) {
+    return false;
+  }
+  if (info.version >= 2) {
+    return (rdmsr(MSR_IA32_PERF_GLOBAL_STATUS) & PMC0_BIT) != 0;
+  }
+  return (rdmsr(MSR_IA32_PMC0) & (1UL << (info.width - 1))) == 0;
+}
+
+void pmu_rearm(void) {
+  wrmsr(MSR_IA32_PMC0, reload);
+  if (info.version >= 2) {
+    wrmsr(MSR_IA32_PERF_GLOBAL_OVF_CTRL, PMC0_BIT);
+  }
+  apic_pmi_enable();
+}
@@ -0,0 +1,50 @@
+#ifndef DELTA_ARCH_AMD64_PMU_H
+#define DELTA_ARCH_AMD64_PMU_H
+
+#include "arch_types.h"
+
+/*
+ * Architectural performance monitoring (CPUID leaf 0xA), for sampling.
+ * One general-purpose counter counts an architectural event in ring 0 and
+ * overflows every `period` events; the overflow interrupt is delivered as
+ * an NMI through the local APIC, so samples land even with interrupts off.
+ *
+ * Each CPU programs its own counter: pmu_start() and pmu_stop() act on the
+ * calling CPU only. In the NMI, pmu_overflowed() says whether the counter
+ * raised it and pmu_rearm() reloads the period and unmasks the APIC entry.
+ *
+ * Needs PMU version 1 or later: KVM exposes it (QEMU -enable-kvm, -cpu
+ * host), QEMU's TCG and AMD's own counters report version 0.
+ */
+
+enum pmu_event {
+  PMU_EVENT_CYCLES = 0,       /* Core cycles, unhalted */
+  PMU_EVENT_INSTRUCTIONS = 1, /* Instructions retired */
+  PMU_EVENT_REF_CYCLES = 2,   /* Reference cycles, unhalted */
+  PMU_EVENT_COUNT = 3,
+};
+
+struct pmu_info {
+  u32 version;  /* CPUID.0AH:EAX[7:0], 0 when there is no PMU */
+  u32 counters; /* General-purpose counters per CPU */
+  u32 width;    /* Bits per counter */
+  enum pmu_event event;
+};
+
+bool pmu_init(void);
+
+bool pmu_available(void);
+
+void pmu_get_info(struct pmu_info *info);
+
+const char *pmu_event_name(enum pmu_event event);
+
+u32 pmu_start(u32 period);
+
+void pmu_stop(void);
+
+bool pmu_overflowed(void);
+
+void pmu_rearm(void);
+
+#endif /* DELTA_ARCH_AMD64_PMU_H */
@@ -0,0 +1,106 @@
+#include "rtc.h"
+
+#define CMOS_ADDRESS 0x70
+#define CMOS_DATA 0x71
+
+#define RTC_SECONDS 0x00
+#define RTC_MINUTES 0x02
+#define RTC_HOURS 0x04
+#define RTC_DAY 0x07
+#define RTC_MONTH 0x08
+#define RTC_YEAR 0x09
+#define RTC_STATUS_A 0x0A
+#define RTC_STATUS_B 0x0B
+
+#define RTC_A_UPDATE_IN_PROGRESS (1 << 7)
+#define RTC_B_24_HOUR (1 << 1)
+#define RTC_B_BINARY (1 << 2)
+#define RTC_HOUR_PM (1 << 7)
+
+#define RTC_CENTURY 2000 /* The century register is not reliably present */
+
+struct rtc_time {
+  u8 second;
+  u8 minute;
+  u8 hour;
+  u8 day;
+  u8 month;
+  u8 year;
+};
+
+static u8 cmos_read(u8 reg) {
+  outb(CMOS_ADDRESS, reg);
+  return inb(CMOS_DATA);
+}
+
+static void rtc_read_raw(struct rtc_time *t) {
+  while (cmos_read(RTC_STATUS_A) & RTC_A_UPDATE_IN_PROGRESS) {
+    cpu_relax();
+  }
+  t->second = cmos_read(RTC_SECONDS);
+  t->minute = cmos_read(RTC_MINUTES);
+  t->hour = cmos_read(RTC_HOURS);
+  t->day = cmos_read(RTC_DAY);
+  t->month = cmos_read(RTC_MONTH);
+  t->year = cmos_read(RTC_YEAR);
+}
+
+static inline u8 bcd_to_binary(u8 value) {
+  return (u8)((value & 0x0F) + (value >> 4) * 10);
+}
+
+/* Days from 1970-01-01 to the given civil date (proleptic Gregorian) */
+static i64 days_from_civil(i64 year, u32 month, u32 day) {
+  year -= month <= 2;
+  i64 era = (year >= 0 ? year : year - 399) / 400;
+  u32 year_of_era = (u32)(year - era * 400);
+  u32 day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 +
+                    day - 1;
+  u32 day_of_era =
+      year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + (i64)day_of_era - 719468;
+}
+
+u64 rtc_read_unix_seconds(void) {
+  struct rtc_time t;
+  struct rtc_time again;
+
+  /* An update can land between two register reads: read until stable */
+  rtc_read_raw(&t);
+  for (;;) {
+    rtc_read_raw(&again);
+    if (again.second == t.second && again.minute == t.minute &&
+        again.hour == t.hour && again.day == t.day &&
+        again.month == t.month && again.year == t.year) {
+      break;
+    }
+    t = again;
+  }
+
+  u8 status_b = cmos_read(RTC_STATUS_B);
+  bool pm = (t.hour & RTC_HOUR_PM) != 0;
+  t.hour &= (u8)~RTC_HOUR_PM;
+
+  if (!(status_b & RTC_B_BINARY)) {
+    t.second = bcd_to_binary(t.second);
+    t.minute = bcd_to_binary(t.minute);
+    t.hour = bcd_to_binary(t.hour);
+    t.day = bcd_to_binary(t.day);
+    t.month = bcd_to_binary(t.month);
+    t.year = bcd_to_binary(t.year);
+  }
+
+  if (!(status_b & RTC_B_24_HOUR)) {
+    t.hour %= 12; /* 12 AM is 0 */
+    if (pm) {
+      t.hour += 12;
+    }
+  }
+
+  if (t.month < 1 || t.month > 12 || t.day < 1 || t.day > 31) {
+    return 0;
+  }
+
+  i64 days = days_from_civil(RTC_CENTURY + t.year, t.month, t.day);
+  return (u64)(days * 86400 + t.hour * 3600 + t.minute * 60 + t.second);
+}
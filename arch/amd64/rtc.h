@@ -0,0 +1,13 @@
+#ifndef DELTA_ARCH_AMD64_RTC_H
+#define DELTA_ARCH_AMD64_RTC_H
+
+#include "arch_types.h"
+
+/*
+ * CMOS real-time clock, read once at boot to anchor wall time. It only
+ * has one-second resolution; everything finer comes from the TSC.
+ */
+
+u64 rtc_read_unix_seconds(void);
+
+#endif /* DELTA_ARCH_AMD64_RTC_H */
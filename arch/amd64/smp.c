@@ -0,0 +1,215 @@
+#include "smp.h"
+#include "apic.h"
+#include "gdt.h"
+#include "idt.h"
+#include "percpu.h"
+#include "syscall.h"
+#include "tsc.h"
+
+#include "../../kernel/idle.h"
+#include "../../kernel/kthread.h"
+#include "../../kernel/param.h"
+#include "../../kernel/sched.h"
+#include "../../kernel/timer.h"
+
+/* The STARTUP IPI vector is a page number below 1 MiB; page 0 holds the
+ * real-mode IVT and BIOS data area. */
+#define TRAMPOLINE_MIN 0x1000UL
+#define TRAMPOLINE_MAX 0x100000UL
+
+#define EFER_LMA (1UL << 10) /* Status bit: must not be written back */
+
+/* Delays from the MP specification's universal startup algorithm */
+#define INIT_DELAY_US 10000
+#define SIPI_DELAY_US 200
+#define AP_BOOT_TIMEOUT_US 100000
+
+/* Patched into the trampoline copy; layout shared with trampoline.asm */
+struct ap_boot_data {
+  u16 padding0;
+  u16 gdt_limit;
+  u32 gdt_base;
+  u32 far_jump_offset;
+  u16 far_jump_selector;
+  u16 padding1;
+  u32 cr0;
+  u32 cr3;
+  u32 cr4;
+  u32 efer;
+  u64 stack;
+  u64 entry;
+  u32 cpu;
+  u32 padding2;
+} PACKED;
+
+_Static_assert(OFFSET_OF(struct ap_boot_data, gdt_limit) == 2,
+               "AP_DATA_GDTR out of sync with struct ap_boot_data");
+_Static_assert(OFFSET_OF(struct ap_boot_data, far_jump_offset) == 8,
+               "AP_DATA_FAR_JUMP out of sync with struct ap_boot_data");
+_Static_assert(OFFSET_OF(struct ap_boot_data, cr0) == 16,
+               "AP_DATA_CR0 out of sync with struct ap_boot_data");
+_Static_assert(OFFSET_OF(struct ap_boot_data, stack) == 32,
+               "AP_DATA_STACK out of sync with struct ap_boot_data");
+_Static_assert(OFFSET_OF(struct ap_boot_data, entry) == 40,
+               "AP_DATA_ENTRY out of sync with struct ap_boot_data");
+_Static_assert(OFFSET_OF(struct ap_boot_data, cpu) == 48,
+               "AP_DATA_CPU out of sync with struct ap_boot_data");
+
+extern const u8 smp_trampoline_start[];
+extern const u8 smp_trampoline_data[];
+extern const u8 smp_trampoline_end[];
+
+static u8 ap_stacks[MAX_CPUS][KERNEL_STACK_SIZE] ALIGNED(16);
+
+static u32 ap_ready = 0;
+static u32 cpu_count = 1;
+
+/* maxcpus=N: bring up at most N CPUs, BSP included; 0 = all */
+static u32 max_cpus = 0;
+KERNEL_PARAM_U32("maxcpus", max_cpus);
+
+static void delay_us(u64 us) {
+  const struct tsc_calibration *cal = tsc_get_calibration();
+  u64 end = rdtsc() + tsc_ns_to_cycles(cal, us * 1000);
+  while (rdtsc() < end) {
+    cpu_relax();
+  }
+}
+
+static NORETURN void ap_entry(u32 cpu) {
+  gdt_init_cpu(cpu);
+  idt_load();
+  apic_init_cpu();
+  percpu_init_cpu(cpu, apic_get_id());
+  apic_timer_init_cpu();
+  timer_init_cpu();
+  idle_init_cpu();
+  sched_init_cpu();
+  kthread_init_cpu();
+  syscall_init_cpu();
+
+  __atomic_store_n(&ap_ready, 1, __ATOMIC_RELEASE);
+
+  idle_loop();
+}
+
+/* First usable page in [TRAMPOLINE_MIN, TRAMPOLINE_MAX), or 0 */
+static u64 find_trampoline_page(const struct parsed_boot_info *info) {
+  if (!info->has_memory_map) {
+    return 0;
+  }
+
+  const struct db_tag_memory_map *mmap = info->memory_map;
+  for (u32 i = 0; i < mmap->entry_count; i++) {
+    const u8 *entry_ptr = (const u8 *)mmap->entries + (i * mmap->entry_size);
+    const struct db_mmap_entry *entry = (const struct db_mmap_entry *)entry_ptr;
+
+    if (entry->type != DB_MEM_USABLE) {
+      continue;
+    }
+
+    u64 start = ALIGN_UP(MAX(entry->base, TRAMPOLINE_MIN), PAGE_SIZE);
+    u64 end = MIN(entry->base + entry->length, TRAMPOLINE_MAX);
+    if (start + PAGE_SIZE <= end) {
+      return start;
+    }
+  }
+
+  return 0;
+}
+
+static bool smp_boot_ap(struct ap_boot_data *data, u64 page, u32 cpu,
+                        u32 apic_id) {
+  data->stack = (u64)&ap_stacks[cpu][KERNEL_STACK_SIZE];
+  data->cpu = cpu;
+  __atomic_store_n(&ap_ready, 0, __ATOMIC_SEQ_CST);
+
+  apic_send_init(apic_id);
+  delay_us(INIT_DELAY_US);
+
+  /* The second SIPI is only for CPUs that missed the first */
+  for (u32 attempt = 0; attempt < 2; attempt++) {
+    apic_send_startup(apic_id, page);
+    delay_us(SIPI_DELAY_US);
+    if (__atomic_load_n(&ap_ready, __ATOMIC_ACQUIRE)) {
+      return true;
+    }
+  }
+
+  const struct tsc_calibration *cal = tsc_get_calibration();
+  u64 deadline = rdtsc() + tsc_ns_to_cycles(cal, AP_BOOT_TIMEOUT_US * 1000);
+  while (rdtsc() < deadline) {
+    if (__atomic_load_n(&ap_ready, __ATOMIC_ACQUIRE)) {
+      return true;
+    }
+    cpu_relax();
+  }
+
+  apic_send_init(apic_id); /* Park it again before its stack is reused */
+  return false;
+}
+
+/*
+ * Start every enabled AP listed in the SMP tag, one at a time (they share
+ * the trampoline). Needs the TSC calibrated for the startup delays. Returns
+ * the number of CPUs online, BSP included.
+ */
+u32 smp_init(const struct parsed_boot_info *info) {
+  if (!info->has_smp) {
+    return cpu_count;
+  }
+
+  /* Real mode can only load a 32-bit CR3 */
+  u64 cr3 = read_cr3();
+  if (cr3 > U32_MAX) {
+    return cpu_count;
+  }
+
+  u64 size = (u64)(smp_trampoline_end - smp_trampoline_start);
+  u64 page = find_trampoline_page(info);
+  if (page == 0 || size > PAGE_SIZE) {
+    return cpu_count;
+  }
+
+  /* Identity mapped by the bootloader (see docs/boot/protocol.md) */
+  u8 *trampoline = (u8 *)page;
+  for (u64 i = 0; i < size; i++) {
+    trampoline[i] = smp_trampoline_start[i];
+  }
+
+  struct ap_boot_data *data =
+      (struct ap_boot_data *)(trampoline +
+                              (smp_trampoline_data - smp_trampoline_start));
+  data->gdt_base += (u32)page;
+  data->far_jump_offset += (u32)page;
+  data->cr0 = (u32)read_cr0();
+  data->cr3 = (u32)cr3;
+  data->cr4 = (u32)read_cr4();
+  data->efer = (u32)(rdmsr(MSR_EFER) & ~EFER_LMA);
+  data->entry = (u64)ap_entry;
+
+  const struct db_tag_smp *smp = info->smp;
+  u32 listed = (smp->header.size - sizeof(struct db_tag_smp)) /
+               sizeof(struct db_cpu);
+  listed = MIN(listed, smp->cpu_count);
+
+  u32 bsp_apic_id = this_cpu()->apic_id;
+
+  u32 limit = max_cpus == 0 ? MAX_CPUS : MIN(max_cpus, (u32)MAX_CPUS);
+  for (u32 i = 0; i < listed && cpu_count < limit; i++) {
+    const struct db_cpu *entry = &smp->cpus[i];
+
+    if (!(entry->flags & DB_CPU_FLAG_ENABLED) ||
+        (entry->flags & DB_CPU_FLAG_BSP) || entry->id == bsp_apic_id) {
+      continue;
+    }
+
+    if (smp_boot_ap(data, page, cpu_count, entry->id)) {
+      cpu_count++;
+    }
+  }
+
+  return cpu_count;
+}
+
+u32 smp_cpu_count(void) { return cpu_count; }
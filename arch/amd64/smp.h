@@ -0,0 +1,18 @@
+#ifndef DELTA_ARCH_AMD64_SMP_H
+#define DELTA_ARCH_AMD64_SMP_H
+
+#include "arch_types.h"
+
+#include "../../kernel/boot_info.h"
+
+/*
+ * Application processor bring-up. The DB bootloader reports CPUs in
+ * DB_TAG_SMP but leaves them parked; the BSP wakes each one with
+ * INIT-SIPI-SIPI through a real-mode trampoline.
+ */
+
+u32 smp_init(const struct parsed_boot_info *info);
+
+u32 smp_cpu_count(void);
+
+#endif /* DELTA_ARCH_AMD64_SMP_H */
@@ -0,0 +1,33 @@
+#ifndef DELTA_ARCH_AMD64_STACKTRACE_H
+#define DELTA_ARCH_AMD64_STACKTRACE_H
+
+#include "arch_types.h"
+
+/*
+ * Walk the frame-pointer chain (the kernel keeps rbp in every function):
+ * [rbp] is the caller's rbp, [rbp + 8] the return address. Frames must
+ * climb the stack and stay within one kernel stack of rsp, so a clobbered
+ * rbp ends the walk instead of faulting. Reads memory only: safe in a
+ * panic or an NMI.
+ *
+ * Stores up to max return addresses, innermost first; returns how many.
+ */
+static inline u32 stack_walk(u64 rsp, u64 rbp, u64 *returns, u32 max) {
+  u64 limit = rsp + KERNEL_STACK_SIZE;
+  u32 count = 0;
+  while (count < max) {
+    if (rbp < rsp || rbp + 16 > limit || (rbp & 7) != 0) {
+      break;
+    }
+    const u64 *frame = (const u64 *)rbp;
+    if (frame[1] == 0) {
+      break;
+    }
+    returns[count++] = frame[1];
+    rsp = rbp + 16;
+    rbp = frame[0];
+  }
+  return count;
+}
+
+#endif /* DELTA_ARCH_AMD64_STACKTRACE_H */
@@ -0,0 +1,56 @@
+; Kernel thread context switch.
+;
+; A switch is an ordinary function call as far as the compiler is concerned,
+; so the System V ABI already guarantees the caller-saved registers are dead
+; across it: only rbx, rbp and r12-r15 need saving, on the outgoing stack.
+; FPU/SIMD state is switched by kthread.c, not here.
+
+
+bits 64
+
+
+section .text
+
+
+extern kthread_entry
+
+
+global context_switch
+global kthread_entry_stub
+
+
+; struct kthread *context_switch(u64 *prev_rsp, u64 next_rsp,
+;                                struct kthread *prev)
+;
+; Returns on the next thread's stack, handing it prev: the thread that ran
+; last, which only the new side can finish switching out.
+context_switch:
+
+    push rbp
+    push rbx
+    push r12
+    push r13
+    push r14
+    push r15
+
+    mov [rdi], rsp
+    mov rsp, rsi
+
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbx
+    pop rbp
+
+    mov rax, rdx
+    ret
+
+
+; First return target of a new thread (see kthread_create): rax holds the
+; previous thread, as it would after a context_switch call.
+kthread_entry_stub:
+
+    mov rdi, rax
+    call kthread_entry
+    ud2                     ; kthread_entry never returns
@@ -0,0 +1,32 @@
+#include "syscall.h"
+#include "gdt.h"
+
+/* syscall_entry.asm */
+void syscall_entry(void);
+
+/* Cleared on entry; IF stays off until the kernel stack is in place */
+#define SYSCALL_FMASK                                                          \
+  (RFLAGS_IF | RFLAGS_TF | RFLAGS_DF | RFLAGS_AC | RFLAGS_NT)
+
+/*
+ * SYSCALL loads CS from STAR[47:32] and SS from that + 8; SYSRET loads SS
+ * from STAR[63:48] + 8 and CS from that + 16, both with RPL 3.
+ */
+#define STAR_VALUE                                                             \
+  (((u64)((GDT_USER_DATA - 8) | GDT_RPL_USER) << 48) |                         \
+   ((u64)GDT_KERNEL_CODE << 32))
+
+void syscall_init_cpu(void) {
+  struct percpu *cpu = this_cpu();
+  struct tss *tss = gdt_get_tss(cpu->cpu_id);
+
+  /* struct tss is packed, so rsp[0] is reached by offset rather than & */
+  cpu->tss_rsp0 = (u64 *)((u8 *)tss + OFFSET_OF(struct tss, rsp));
+  cpu->kernel_stack = 0;
+
+  wrmsr(MSR_STAR, STAR_VALUE);
+  wrmsr(MSR_LSTAR, (u64)syscall_entry);
+  wrmsr(MSR_FMASK, SYSCALL_FMASK);
+  wrmsr(MSR_KERNEL_GS_BASE, 0); /* User GS base while in the kernel */
+  wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
+}
@@ -0,0 +1,25 @@
+#ifndef DELTA_ARCH_AMD64_SYSCALL_H
+#define DELTA_ARCH_AMD64_SYSCALL_H
+
+#include "arch_types.h"
+#include "percpu.h"
+
+/*
+ * SYSCALL/SYSRET setup and the transitions to and from user mode
+ * (syscall_entry.asm). The dispatch table itself is kernel/syscall.c's.
+ */
+
+void syscall_init_cpu(void);
+
+i64 user_enter(u64 rip, u64 rsp, u64 arg, u64 *kernel_rsp);
+
+NORETURN void user_return(i64 code);
+
+/* Kernel stack for entries from user mode on this CPU */
+static inline void syscall_set_kernel_stack(u64 top) {
+  struct percpu *cpu = this_cpu();
+  cpu->kernel_stack = top;
+  *cpu->tss_rsp0 = top;
+}
+
+#endif /* DELTA_ARCH_AMD64_SYSCALL_H */
@@ -0,0 +1,196 @@
+; System call entry and user-mode transitions.
+;
+; SYSCALL leaves the user rsp in place and the return rip/rflags in rcx/r11,
+; so the entry path swaps to the kernel GS, switches to the thread's kernel
+; stack and keeps only what SYSRET needs: the user rsp, rcx and r11.
+; Handlers are plain C functions, so the ABI preserves rbx, rbp and r12-r15
+; for us. The caller-saved registers that could carry kernel values back
+; out are zeroed before returning; rax holds the result.
+;
+; Calling convention: number in rax, arguments in rdi, rsi, rdx, r10, r8,
+; r9 (r10 replaces rcx, which SYSCALL overwrites).
+;
+; The GS swap is not NMI-safe yet: an NMI between SYSCALL and swapgs would
+; run with the user GS base.
+
+
+bits 64
+
+
+section .text
+
+
+extern syscall_table
+
+
+global syscall_entry
+global user_enter
+global user_return
+global user_null_loop_start
+global user_null_loop_end
+
+
+; Offsets into struct percpu; keep in sync with percpu.h
+%define PERCPU_KERNEL_STACK 32
+%define PERCPU_USER_RSP 40
+%define PERCPU_TSS_RSP0 48
+
+; Keep in sync with kernel/syscall.h
+%define SYSCALL_COUNT 2
+%define SYSCALL_ENOSYS -38
+%define SYSCALL_EFAULT -14
+
+%define USER_CS (0x20 | 3)
+%define USER_SS (0x18 | 3)
+%define USER_RFLAGS 0x202   ; IF, plus the always-set bit 1
+
+
+syscall_entry:
+
+    swapgs
+    mov [gs:PERCPU_USER_RSP], rsp
+    mov rsp, [gs:PERCPU_KERNEL_STACK]
+
+    push qword [gs:PERCPU_USER_RSP]
+    push rcx                ; User rip
+    push r11                ; User rflags
+    sub rsp, 8              ; Keep the call 16-byte aligned
+    sti
+
+    cmp rax, SYSCALL_COUNT
+    jae .bad_number
+    sbb r11, r11            ; All ones here, so a mispredicted jae still
+    and rax, r11            ; indexes entry 0, never past the table
+
+    mov rcx, r10
+    call [syscall_table + rax * 8]
+
+.exit:
+    cli
+    add rsp, 8
+    pop r11
+    pop rcx
+
+    ; SYSRET to a non-canonical rip faults in ring 0 on the user stack
+    mov rdx, rcx
+    shr rdx, 47
+    jnz .bad_return
+
+    xor edx, edx
+    xor esi, esi
+    xor edi, edi
+    xor r8d, r8d
+    xor r9d, r9d
+    xor r10d, r10d
+
+    pop rsp
+    swapgs
+    o64 sysret
+
+.bad_number:
+    mov rax, SYSCALL_ENOSYS
+    jmp .exit
+
+.bad_return:
+    mov rdi, SYSCALL_EFAULT
+    jmp user_return
+
+
+; i64 user_enter(u64 rip, u64 rsp, u64 arg, u64 *kernel_rsp)
+;
+; Runs user code at rip with arg in rdi until it leaves through
+; user_return(); returns that call's code. The frame saved here is the
+; kernel stack top for everything the user code enters the kernel with, so
+; it is published to *kernel_rsp (for the scheduler), the per-CPU area and
+; TSS.RSP0.
+user_enter:
+
+    pushfq
+    push rbp
+    push rbx
+    push r12
+    push r13
+    push r14
+    push r15                ; 16-byte aligned again
+
+    cli
+    mov [rcx], rsp
+    mov [gs:PERCPU_KERNEL_STACK], rsp
+    mov rax, [gs:PERCPU_TSS_RSP0]
+    mov [rax], rsp
+
+    push USER_SS
+    push rsi
+    push USER_RFLAGS
+    push USER_CS
+    push rdi
+
+    mov rdi, rdx
+    xor eax, eax
+    xor ebx, ebx
+    xor ecx, ecx
+    xor edx, edx
+    xor esi, esi
+    xor ebp, ebp
+    xor r8d, r8d
+    xor r9d, r9d
+    xor r10d, r10d
+    xor r11d, r11d
+    xor r12d, r12d
+    xor r13d, r13d
+    xor r14d, r14d
+    xor r15d, r15d
+
+    swapgs
+    iretq
+
+
+; NORETURN void user_return(i64 code)
+;
+; Called on the kernel stack of a thread inside user_enter(): unwinds to
+; the frame saved there, dropping everything above it.
+user_return:
+
+    mov rsp, [gs:PERCPU_KERNEL_STACK]
+    mov rax, rdi
+
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbx
+    pop rbp
+    popfq
+    ret
+
+
+section .rodata
+
+
+; Null system call benchmark, copied to a user page (position independent).
+; rdi = iterations; exits with the cycles the loop took.
+user_null_loop_start:
+
+    mov rbx, rdi
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    mov r12, rax
+
+.loop:
+    xor eax, eax            ; SYS_NULL
+    syscall
+    dec rbx
+    jnz .loop
+
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    sub rax, r12
+
+    mov rdi, rax
+    mov eax, 1              ; SYS_EXIT
+    syscall
+    ud2
+
+user_null_loop_end:
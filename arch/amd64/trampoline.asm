@@ -0,0 +1,122 @@
+; Application processor startup trampoline.
+;
+; Never executed in place: smp.c copies [smp_trampoline_start,
+; smp_trampoline_end) to a page below 1 MiB and points the STARTUP IPI at it,
+; so the AP begins here in real mode with CS = page >> 4, IP = 0. Everything
+; is addressed relative to the start of the copy.
+;
+; The BSP fills in the data block at the end (struct ap_boot_data in smp.c)
+; with its own CR0/CR3/CR4/EFER, so the AP switches straight from real mode
+; to long mode on the BSP's page tables, then calls ap_entry(cpu) on the
+; stack it was handed.
+
+
+section .rodata
+
+
+global smp_trampoline_start
+global smp_trampoline_data
+global smp_trampoline_end
+
+
+%define TRAMP(label) ((label) - smp_trampoline_start)
+
+; Offsets into the data block; keep in sync with struct ap_boot_data
+%define AP_DATA_GDTR 2
+%define AP_DATA_FAR_JUMP 8
+%define AP_DATA_CR0 16
+%define AP_DATA_CR3 20
+%define AP_DATA_CR4 24
+%define AP_DATA_EFER 28
+%define AP_DATA_STACK 32
+%define AP_DATA_ENTRY 40
+%define AP_DATA_CPU 48
+
+%define DATA(field) (TRAMP(smp_trampoline_data) + (field))
+
+%define TRAMP_CODE_SEL 0x08
+%define TRAMP_DATA_SEL 0x10
+
+%define MSR_EFER 0xC0000080
+
+
+bits 16
+
+smp_trampoline_start:
+    cli
+    cld
+
+    mov ax, cs
+    mov ds, ax
+
+    mov eax, [DATA(AP_DATA_CR4)]    ; PAE (and whatever else the BSP runs with)
+    mov cr4, eax
+
+    mov eax, [DATA(AP_DATA_CR3)]
+    mov cr3, eax
+
+    mov ecx, MSR_EFER               ; LME, plus NXE if the page tables use it
+    mov eax, [DATA(AP_DATA_EFER)]
+    xor edx, edx
+    wrmsr
+
+    o32 lgdt [DATA(AP_DATA_GDTR)]
+
+    mov eax, [DATA(AP_DATA_CR0)]    ; PE and PG at once: straight to long mode
+    mov cr0, eax
+
+    jmp dword far [DATA(AP_DATA_FAR_JUMP)]
+
+
+bits 64
+
+ap_long_mode:
+    mov ax, TRAMP_DATA_SEL
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    xor eax, eax
+    mov fs, ax
+    mov gs, ax
+
+    mov rsp, [rel smp_trampoline_data + AP_DATA_STACK]
+    mov edi, [rel smp_trampoline_data + AP_DATA_CPU]
+    mov rax, [rel smp_trampoline_data + AP_DATA_ENTRY]
+    xor ebp, ebp
+    call rax                        ; ap_entry(cpu), never returns
+
+.halt:
+    cli
+    hlt
+    jmp .halt
+
+
+; Temporary GDT, replaced by gdt_init_cpu() as soon as the AP reaches C
+align 16
+ap_gdt:
+    dq 0
+    dq 0x00AF9A000000FFFF           ; 0x08: 64-bit code
+    dq 0x00CF92000000FFFF           ; 0x10: data
+ap_gdt_end:
+
+
+; struct ap_boot_data. The GDT base and far jump target hold offsets into
+; the trampoline; the BSP relocates them to the copy's physical address.
+align 8
+smp_trampoline_data:
+    dw 0                            ; Padding: keeps the GDT base aligned
+    dw ap_gdt_end - ap_gdt - 1      ; GDTR limit
+    dd TRAMP(ap_gdt)                ; GDTR base
+    dd TRAMP(ap_long_mode)          ; Far jump offset
+    dw TRAMP_CODE_SEL               ; Far jump selector
+    dw 0
+    dd 0                            ; CR0
+    dd 0                            ; CR3
+    dd 0                            ; CR4
+    dd 0                            ; EFER
+    dq 0                            ; Stack top
+    dq 0                            ; Entry point
+    dd 0                            ; CPU index
+    dd 0
+
+smp_trampoline_end:
@@ -0,0 +1,118 @@
+#include "tsc.h"
+#include "cpu.h"
+
+#define PIT_HZ 1193182ULL
+#define PIT_CHANNEL2_DATA 0x42
+#define PIT_COMMAND 0x43
+#define PIT_GATE_PORT 0x61
+
+#define PIT_GATE_ENABLE 0x01
+#define PIT_SPEAKER_ENABLE 0x02
+#define PIT_OUT2_STATUS 0x20
+
+#define CPUID_LEAF_TSC_CRYSTAL 0x15
+
+#define NS_PER_SEC 1000000000ULL
+
+#define CALIBRATION_MS 10
+#define CALIBRATION_RUNS 3
+
+static struct tsc_calibration calibration;
+
+/*
+ * Count how far read_counter advances while PIT channel 2 counts down `ms`
+ * milliseconds. Channel 2 is used because its gate is software controlled
+ * and its output can be polled without interrupts.
+ */
+u64 pit_measure_ticks(u32 ms, u64 (*read_counter)(void)) {
+  u32 latch = (u32)(PIT_HZ * ms / 1000);
+  if (latch == 0 || latch > 0xFFFF) {
+    return 0;
+  }
+
+  /* Gate high, speaker off */
+  outb(PIT_GATE_PORT,
+       (inb(PIT_GATE_PORT) & ~PIT_SPEAKER_ENABLE) | PIT_GATE_ENABLE);
+
+  outb(PIT_COMMAND, 0xB0); /* Channel 2, lobyte/hibyte, mode 0 */
+  outb(PIT_CHANNEL2_DATA, latch & 0xFF);
+  outb(PIT_CHANNEL2_DATA, (latch >> 8) & 0xFF);
+
+  u64 start = read_counter();
+  while ((inb(PIT_GATE_PORT) & PIT_OUT2_STATUS) == 0) {
+    cpu_relax();
+  }
+  u64 end = read_counter();
+
+  return end - start;
+}
+
+static u64 read_tsc_counter(void) { return rdtsc_ordered(); }
+
+/* Exact frequency from CPUID when the CPU enumerates its crystal clock */
+static u64 tsc_hz_from_cpuid(void) {
+  if (cpu_max_leaf() < CPUID_LEAF_TSC_CRYSTAL) {
+    return 0;
+  }
+
+  u32 denominator, numerator, crystal_hz, edx;
+  cpuid(CPUID_LEAF_TSC_CRYSTAL, 0, &denominator, &numerator, &crystal_hz,
+        &edx);
+  if (denominator == 0 || numerator == 0 || crystal_hz == 0) {
+    return 0;
+  }
+
+  return (u64)crystal_hz * numerator / denominator;
+}
+
+static u64 tsc_hz_from_pit(void) {
+  u64 best = U64_MAX;
+
+  /* SMIs and virtualization exits only ever lengthen a run: keep the
+   * shortest. */
+  for (u32 run = 0; run < CALIBRATION_RUNS; run++) {
+    u64 ticks = pit_measure_ticks(CALIBRATION_MS, read_tsc_counter);
+    if (ticks != 0 && ticks < best) {
+      best = ticks;
+    }
+  }
+
+  if (best == U64_MAX) {
+    return 0;
+  }
+
+  u64 latch = PIT_HZ * CALIBRATION_MS / 1000;
+  return best * PIT_HZ / latch;
+}
+
+bool tsc_calibrate(void) {
+  if (!cpu_has(CPU_FEATURE_TSC)) {
+    return false;
+  }
+
+  u64 hz = tsc_hz_from_cpuid();
+  if (hz == 0) {
+    hz = tsc_hz_from_pit();
+  }
+  if (hz == 0) {
+    return false;
+  }
+
+  calibration.hz = hz;
+  calibration.ns_mult = (NS_PER_SEC << TSC_SHIFT) / hz;
+
+  /* (hz << 32) / 1e9 overflows 64 bits above ~4.29 GHz: split it. */
+  calibration.cycles_mult = ((hz / NS_PER_SEC) << TSC_SHIFT) +
+                            (((hz % NS_PER_SEC) << TSC_SHIFT) / NS_PER_SEC);
+
+  calibration.boot_tsc = rdtsc();
+  return true;
+}
+
+const struct tsc_calibration *tsc_get_calibration(void) {
+  return &calibration;
+}
+
+u64 clock_monotonic_ns(void) {
+  return tsc_cycles_to_ns(&calibration, rdtsc() - calibration.boot_tsc);
+}
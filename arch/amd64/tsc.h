@@ -0,0 +1,37 @@
+#ifndef DELTA_ARCH_AMD64_TSC_H
+#define DELTA_ARCH_AMD64_TSC_H
+
+#include "arch_types.h"
+
+/*
+ * TSC <-> nanosecond conversion is a multiply and a shift:
+ *   ns     = (cycles * ns_mult) >> TSC_SHIFT
+ *   cycles = (ns * cycles_mult) >> TSC_SHIFT
+ */
+#define TSC_SHIFT 32
+
+struct tsc_calibration {
+  u64 hz;          /* TSC frequency */
+  u64 ns_mult;     /* cycles -> ns multiplier */
+  u64 cycles_mult; /* ns -> cycles multiplier */
+  u64 boot_tsc;    /* TSC value at calibration (monotonic clock origin) */
+};
+
+bool tsc_calibrate(void);
+
+const struct tsc_calibration *tsc_get_calibration(void);
+
+u64 pit_measure_ticks(u32 ms, u64 (*read_counter)(void));
+
+static inline u64 tsc_cycles_to_ns(const struct tsc_calibration *cal,
+                                   u64 cycles) {
+  return (u64)(((unsigned __int128)cycles * cal->ns_mult) >> TSC_SHIFT);
+}
+
+static inline u64 tsc_ns_to_cycles(const struct tsc_calibration *cal, u64 ns) {
+  return (u64)(((unsigned __int128)ns * cal->cycles_mult) >> TSC_SHIFT);
+}
+
+u64 clock_monotonic_ns(void);
+
+#endif /* DELTA_ARCH_AMD64_TSC_H */
@@ -0,0 +1,248 @@
+#include "uart.h"
+#include "idt.h"
+
+#include "../../kernel/param.h"
+#include "../../kernel/spinlock.h"
+
+/* Register offsets from the base port */
+#define UART_DATA 0 /* THR (write), RBR (read); divisor low with DLAB */
+#define UART_IER 1  /* Interrupt enable; divisor high with DLAB */
+#define UART_IIR 2  /* Interrupt identification (read) */
+#define UART_FCR 2  /* FIFO control (write) */
+#define UART_LCR 3  /* Line control */
+#define UART_MCR 4  /* Modem control */
+#define UART_LSR 5  /* Line status */
+#define UART_SCRATCH 7
+
+#define IER_THRE 0x02 /* Interrupt when the transmitter empties */
+#define IIR_NONE 0x01 /* No interrupt pending */
+#define IIR_CAUSE_MASK 0x0E
+#define IIR_CAUSE_THRE 0x02
+#define IIR_FIFO_MASK 0xC0 /* Both set: a 16550A with working FIFOs */
+#define FCR_ENABLE 0x01
+#define FCR_CLEAR_RX 0x02
+#define FCR_CLEAR_TX 0x04
+#define LCR_8N1 0x03
+#define LCR_DLAB 0x80
+#define MCR_DTR 0x01
+#define MCR_RTS 0x02
+#define MCR_OUT2 0x08 /* Gates the interrupt line on PCs */
+#define MCR_LOOPBACK 0x10
+#define LSR_DATA_READY 0x01
+#define LSR_THRE 0x20 /* Transmit holding register (or FIFO) empty */
+
+#define FIFO_SIZE 16
+#define LOOPBACK_BYTE 0xAE
+#define BAUD_TOLERANCE 50 /* 1/50: within 2% of the requested rate */
+
+static u16 base = 0;
+static u32 baud_rate = 0;
+static u32 fifo_size = 1; /* Bytes per load of an empty transmitter */
+
+/* Input clock of the baud generator; boards with a faster crystal set it */
+static u32 uart_clock = UART_CLOCK_HZ;
+KERNEL_PARAM_U32("uart.clock", uart_clock);
+
+static struct spinlock tx_lock = SPINLOCK_INIT;
+static char tx_ring[UART_TX_RING_SIZE];
+static u64 tx_head = 0; /* Next byte written */
+static u64 tx_tail = 0; /* Next byte sent */
+static bool irq_mode = false;
+static bool tx_idle = true; /* IRQ mode: no THRE interrupt is outstanding */
+
+/* Nearest divisor, or 0 if none is within tolerance */
+static u16 divisor_for(u32 baud) {
+  u32 max_rate = uart_clock / 16;
+  if (baud == 0 || max_rate == 0) {
+    return 0;
+  }
+
+  u32 divisor = (max_rate + baud / 2) / baud;
+  if (divisor == 0 || divisor > 0xFFFF) {
+    return 0;
+  }
+  u32 actual = max_rate / divisor;
+  u32 error = actual > baud ? actual - baud : baud - actual;
+  return error * BAUD_TOLERANCE <= baud ? (u16)divisor : 0;
+}
+
+bool uart_baud_supported(u32 baud) {
+  return baud >= UART_BAUD_DEFAULT && baud <= UART_BAUD_MAX &&
+         divisor_for(baud) != 0;
+}
+
+/*
+ * Program port for baud, 8N1, and check a UART is really there: the
+ * scratch register must hold a value and a byte sent in loopback mode
+ * must come back. Turns the FIFOs on if the chip has working ones.
+ */
+bool uart_init(u16 port, u32 baud) {
+  u16 divisor = divisor_for(baud);
+  if (divisor == 0) {
+    return false;
+  }
+
+  outb(port + UART_SCRATCH, 0x5A);
+  if (inb(port + UART_SCRATCH) != 0x5A) {
+    return false; /* Floating bus: nothing decodes the port */
+  }
+
+  outb(port + UART_IER, 0);
+  outb(port + UART_LCR, LCR_DLAB);
+  outb(port + UART_DATA, (u8)divisor);
+  outb(port + UART_IER, (u8)(divisor >> 8));
+  outb(port + UART_LCR, LCR_8N1);
+
+  /* An 8250/16450 has no FIFO, and the original 16550's is broken */
+  outb(port + UART_FCR, FCR_ENABLE | FCR_CLEAR_RX | FCR_CLEAR_TX);
+  if ((inb(port + UART_IIR) & IIR_FIFO_MASK) == IIR_FIFO_MASK) {
+    fifo_size = FIFO_SIZE;
+  } else {
+    outb(port + UART_FCR, 0);
+    fifo_size = 1;
+  }
+
+  outb(port + UART_MCR, MCR_LOOPBACK | MCR_RTS | MCR_OUT2);
+  outb(port + UART_DATA, LOOPBACK_BYTE);
+  for (u32 spins = 0;
+       spins < 1000 && !(inb(port + UART_LSR) & LSR_DATA_READY); spins++) {
+    io_wait();
+  }
+  if (inb(port + UART_DATA) != LOOPBACK_BYTE) {
+    return false;
+  }
+
+  outb(port + UART_MCR, MCR_DTR | MCR_RTS | MCR_OUT2);
+  baud_rate = uart_clock / 16 / divisor;
+  base = port;
+  return true;
+}
+
+bool uart_present(void) { return base != 0; }
+
+u32 uart_baud(void) { return baud_rate; }
+
+u32 uart_fifo_size(void) { return fifo_size; }
+
+/*
+ * Load the empty transmitter from the ring. Each load is followed by a THRE
+ * interrupt once the FIFO drains, so in IRQ mode one is now outstanding.
+ * Called with tx_lock held.
+ */
+static void fill_fifo(void) {
+  u32 count = 0;
+  for (; count < fifo_size && tx_tail != tx_head; count++) {
+    outb(base + UART_DATA, (u8)tx_ring[tx_tail++ & (UART_TX_RING_SIZE - 1)]);
+  }
+  if (count > 0) {
+    tx_idle = false;
+  }
+}
+
+static void wait_transmitter_empty(void) {
+  while (!(inb(base + UART_LSR) & LSR_THRE)) {
+    cpu_relax();
+  }
+}
+
+/* The slow path: one LSR wait per FIFO load, not per byte */
+static void fill_fifo_polled(void) {
+  wait_transmitter_empty();
+  fill_fifo();
+}
+
+static void push(char c) {
+  if (tx_head - tx_tail == UART_TX_RING_SIZE) {
+    fill_fifo_polled();
+  }
+  tx_ring[tx_head++ & (UART_TX_RING_SIZE - 1)] = c;
+}
+
+void uart_write(const char *text, u64 length) {
+  if (base == 0) {
+    return;
+  }
+
+  u64 flags = spin_lock_irqsave(&tx_lock);
+  for (u64 i = 0; i < length; i++) {
+    if (text[i] == '\n') {
+      push('\r');
+    }
+    push(text[i]);
+  }
+
+  if (!irq_mode) {
+    while (tx_tail != tx_head) {
+      fill_fifo_polled();
+    }
+  } else if (tx_idle) {
+    /* The last THRE interrupt found nothing to send: start it again */
+    fill_fifo();
+  }
+  spin_unlock_irqrestore(&tx_lock, flags);
+}
+
+/* One LSR wait per FIFO load; room counts what the FIFO still takes */
+static void put_polled(u8 byte, u32 *room) {
+  if (*room == 0) {
+    wait_transmitter_empty();
+    *room = fifo_size;
+  }
+  outb(base + UART_DATA, byte);
+  (*room)--;
+}
+
+/*
+ * For a panic: straight to the transmitter, past the lock (its holder may
+ * be frozen) and the ring, whose unsent bytes are abandoned.
+ */
+void uart_write_polled(const char *text, u64 length) {
+  if (base == 0) {
+    return;
+  }
+
+  u32 room = 0;
+  for (u64 i = 0; i < length; i++) {
+    if (text[i] == '\n') {
+      put_polled('\r', &room);
+    }
+    put_polled((u8)text[i], &room);
+  }
+}
+
+static void uart_irq(u8 vector) {
+  (void)vector;
+
+  spin_lock(&tx_lock);
+  /* Reading IIR acknowledges THRE; loop so the line drops before return */
+  while ((inb(base + UART_IIR) & (IIR_NONE | IIR_CAUSE_MASK)) ==
+         IIR_CAUSE_THRE) {
+    tx_idle = true;
+    fill_fifo();
+  }
+  spin_unlock(&tx_lock);
+}
+
+/*
+ * Switch transmission to the THRE interrupt on ISA line (routed to this
+ * CPU). Call before interrupts are enabled; until then output is polled.
+ */
+bool uart_enable_irq(u8 line) {
+  if (base == 0 || irq_mode) {
+    return false;
+  }
+  if (!irq_register(IRQ_LEGACY_VECTOR(line), uart_irq)) {
+    return false;
+  }
+
+  u64 flags = spin_lock_irqsave(&tx_lock);
+  /* Polled mode leaves the ring drained but the last load in flight */
+  wait_transmitter_empty();
+  irq_mode = true;
+  tx_idle = true;
+  outb(base + UART_IER, IER_THRE);
+  spin_unlock_irqrestore(&tx_lock, flags);
+
+  irq_legacy_enable(line);
+  return true;
+}
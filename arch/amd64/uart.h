@@ -0,0 +1,44 @@
+#ifndef DELTA_ARCH_AMD64_UART_H
+#define DELTA_ARCH_AMD64_UART_H
+
+#include "arch_types.h"
+
+/*
+ * 16550-compatible UART on an I/O port, used as a console sink. 8N1, no
+ * flow control; output only. '\n' is sent as "\r\n".
+ *
+ * Output goes into a transmit ring. Until uart_enable_irq() the writer
+ * drains it itself, one FIFO load per wait for an empty transmitter; after
+ * it, the THRE interrupt refills the FIFO and writers only copy into the
+ * ring. A writer that finds the ring full drains by polling, so output is
+ * slowed down rather than dropped.
+ */
+
+#define UART_COM1 0x3F8
+#define UART_COM1_IRQ 4
+
+#define UART_CLOCK_HZ 1843200 /* Standard crystal; uart.clock overrides */
+
+/* Rates the console accepts; the top end needs a faster clock */
+#define UART_BAUD_DEFAULT 115200
+#define UART_BAUD_MAX 921600
+
+#define UART_TX_RING_SIZE 8192 /* Power of two */
+
+bool uart_baud_supported(u32 baud);
+
+bool uart_init(u16 port, u32 baud);
+
+bool uart_enable_irq(u8 line);
+
+bool uart_present(void);
+
+u32 uart_baud(void);
+
+u32 uart_fifo_size(void);
+
+void uart_write(const char *text, u64 length);
+
+void uart_write_polled(const char *text, u64 length);
+
+#endif /* DELTA_ARCH_AMD64_UART_H */
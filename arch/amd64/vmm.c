@@ -0,0 +1,135 @@
+#include "vmm.h"
+
+#include "../../kernel/pmm.h"
+#include "../../kernel/spinlock.h"
+
+#define PT_ENTRIES 512
+#define PTE_ADDR_MASK 0x000FFFFFFFFFF000UL
+
+#define PT_INDEX(v) (((v) >> PAGE_SHIFT) & (PT_ENTRIES - 1))
+
+static struct spinlock vmm_lock = SPINLOCK_INIT;
+
+static inline u64 *table_at(u64 entry) {
+  return phys_to_virt(entry & PTE_ADDR_MASK);
+}
+
+/*
+ * Entry for virt in the last-level table, creating the tables on the way if
+ * create is set. NULL if a level is missing (and not created) or is mapped
+ * by a huge page, which this code never splits.
+ */
+static u64 *walk(u64 virt, bool create, u64 table_flags) {
+  static const u32 shifts[3] = {39, 30, 21};
+  u64 *table = phys_to_virt(read_cr3() & PTE_ADDR_MASK);
+
+  for (u32 level = 0; level < 3; level++) {
+    u64 *entry = &table[(virt >> shifts[level]) & (PT_ENTRIES - 1)];
+
+    if (!(*entry & PTE_PRESENT)) {
+      if (!create) {
+        return NULL;
+      }
+      u64 page = pmm_alloc_zeroed_page();
+      if (page == 0) {
+        return NULL;
+      }
+      *entry = page | PTE_PRESENT | PTE_WRITABLE | table_flags;
+    } else if (*entry & PTE_HUGE) {
+      return NULL;
+    } else {
+      *entry |= table_flags;
+    }
+
+    table = table_at(*entry);
+  }
+
+  return &table[PT_INDEX(virt)];
+}
+
+bool vmm_map_page(u64 virt, u64 phys, u64 flags) {
+  if ((virt & PAGE_MASK) != 0 || (phys & PAGE_MASK) != 0) {
+    return false;
+  }
+
+  /* Without EFER.NXE bit 63 is reserved and would fault every access */
+  if (!(rdmsr(MSR_EFER) & EFER_NXE)) {
+    flags &= ~PTE_NX;
+  }
+
+  u64 irq_flags = spin_lock_irqsave(&vmm_lock);
+
+  bool mapped = false;
+  u64 *pte = walk(virt, true, flags & PTE_USER);
+  if (pte != NULL && !(*pte & PTE_PRESENT)) {
+    *pte = phys | flags | PTE_PRESENT;
+    mapped = true;
+  }
+
+  spin_unlock_irqrestore(&vmm_lock, irq_flags);
+  return mapped;
+}
+
+/* Returns the physical page that was mapped at virt, or 0 */
+u64 vmm_unmap_page(u64 virt) {
+  u64 irq_flags = spin_lock_irqsave(&vmm_lock);
+
+  u64 phys = 0;
+  u64 *pte = walk(virt, false, 0);
+  if (pte != NULL && (*pte & PTE_PRESENT)) {
+    phys = *pte & PTE_ADDR_MASK;
+    *pte = 0;
+    invlpg(virt);
+  }
+
+  spin_unlock_irqrestore(&vmm_lock, irq_flags);
+  return phys;
+}
+
+/* Physical address virt maps to, or 0 if it is not mapped by a 4 KiB page */
+u64 vmm_translate(u64 virt) {
+  u64 irq_flags = spin_lock_irqsave(&vmm_lock);
+
+  u64 phys = 0;
+  u64 *pte = walk(virt, false, 0);
+  if (pte != NULL && (*pte & PTE_PRESENT)) {
+    phys = (*pte & PTE_ADDR_MASK) | (virt & PAGE_MASK);
+  }
+
+  spin_unlock_irqrestore(&vmm_lock, irq_flags);
+  return phys;
+}
+
+/* Count the tables below one entry, recording each in tables[] */
+static void collect_tables(u64 entry, u32 level, u64 *tables, u64 max,
+                           u64 *count) {
+  if (*count < max) {
+    tables[*count] = entry & PTE_ADDR_MASK;
+  }
+  (*count)++;
+
+  if (level == 3) {
+    return; /* Last level: its entries map pages */
+  }
+  const u64 *table = table_at(entry);
+  for (u32 i = 0; i < PT_ENTRIES; i++) {
+    if ((table[i] & PTE_PRESENT) && !(table[i] & PTE_HUGE)) {
+      collect_tables(table[i], level + 1, tables, max, count);
+    }
+  }
+}
+
+/*
+ * Physical pages holding the active page tables, the top-level one
+ * included, up to max of them. Returns how many there are, which may be
+ * more than max: call with max 0 to size the array.
+ */
+u64 vmm_table_pages(u64 *tables, u64 max) {
+  u64 irq_flags = spin_lock_irqsave(&vmm_lock);
+
+  u64 count = 0;
+  collect_tables(read_cr3(), 0, tables, max, &count);
+
+  spin_unlock_irqrestore(&vmm_lock, irq_flags);
+  return count;
+}
@@ -0,0 +1,27 @@
+#ifndef DELTA_ARCH_AMD64_VMM_H
+#define DELTA_ARCH_AMD64_VMM_H
+
+#include "arch_types.h"
+
+/*
+ * 4 KiB mappings in the active page tables. Missing intermediate tables are
+ * allocated from the PMM; a request for a user mapping also marks the path
+ * down to it user-accessible, since the CPU checks every level.
+ *
+ * Mappings are shared by all CPUs but TLB invalidation is local: callers
+ * unmapping a page another CPU may have cached must shoot it down.
+ */
+
+/* Lower half, clear of the bootloader's identity map */
+#define USER_BASE 0x0000700000000000UL
+#define USER_TOP 0x0000800000000000UL /* Exclusive: end of the lower half */
+
+bool vmm_map_page(u64 virt, u64 phys, u64 flags);
+
+u64 vmm_unmap_page(u64 virt);
+
+u64 vmm_translate(u64 virt);
+
+u64 vmm_table_pages(u64 *tables, u64 max);
+
+#endif /* DELTA_ARCH_AMD64_VMM_H */
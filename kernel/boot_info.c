@@ -1,4 +1,7 @@
 #include "boot_info.h"
+#include "pmm.h"
+
+#include "../arch/amd64/arch_types.h"
 
 static bool safe_add_u64(u64 a, u64 b, u64 *result) {
   if (b > U64_MAX - a) {
@@ -92,6 +95,7 @@ bool boot_info_parse(const struct db_boot_info *info,
   parsed->has_acpi = false;
   parsed->has_smp = false;
   parsed->has_initrd = false;
+  parsed->has_modules = false;
 
   parsed->memory_map = NULL;
   parsed->framebuffer = NULL;
@@ -99,8 +103,10 @@ bool boot_info_parse(const struct db_boot_info *info,
   parsed->acpi_rsdp = NULL;
   parsed->smp = NULL;
   parsed->initrd = NULL;
+  parsed->modules = NULL;
   parsed->bootloader = NULL;
 
+  parsed->relocated = false;
   parsed->total_usable_memory_mb = 0;
   parsed->cpu_count = 1; /* Default to 1 CPU if no SMP tag */
 
@@ -260,6 +266,39 @@ bool boot_info_parse(const struct db_boot_info *info,
       parsed->has_initrd = true;
     } break;
 
+    case DB_TAG_MODULES: {
+
+      const struct db_tag_modules *mods = (const struct db_tag_modules *)tag;
+
+      if (tag->size < sizeof(struct db_tag_modules)) {
+        continue;
+      }
+
+      /* 64-bit: module_count * 24 cannot overflow */
+      u64 array_end = sizeof(struct db_tag_modules) +
+                      (u64)mods->module_count * sizeof(struct db_module);
+      if (array_end > tag->size) {
+        continue; /* Module array runs past the tag */
+      }
+
+      bool valid = true;
+      for (u32 i = 0; i < mods->module_count && valid; i++) {
+        const struct db_module *mod = &mods->modules[i];
+        valid = mod->start != 0 && mod->end > mod->start &&
+                mod->name_offset >= array_end &&
+                mod->cmdline_offset >= array_end &&
+                boot_info_module_string(mods, mod->name_offset) != NULL &&
+                boot_info_module_string(mods, mod->cmdline_offset) != NULL;
+      }
+
+      if (!valid) {
+        continue; /* One bad entry and the whole table is suspect */
+      }
+
+      parsed->modules = mods;
+      parsed->has_modules = mods->module_count > 0;
+    } break;
+
     case DB_TAG_BOOTLOADER: {
 
       const struct db_tag_bootloader *bl =
@@ -308,3 +347,89 @@ bool boot_info_parse(const struct db_boot_info *info,
 
   return true;
 }
+
+/*
+ * The string at offset from the start of a modules tag, or NULL if it is
+ * outside the tag or not NUL-terminated inside it.
+ */
+const char *boot_info_module_string(const struct db_tag_modules *modules,
+                                    u32 offset) {
+  u32 size = modules->header.size;
+  if (offset >= size) {
+    return NULL;
+  }
+
+  const char *string = (const char *)modules + offset;
+  for (u32 i = 0; i < size - offset; i++) {
+    if (string[i] == '\0') {
+      return string;
+    }
+  }
+  return NULL;
+}
+
+#define RELOCATED_TAG_ALIGN 64 /* A cache line: tags do not share one */
+
+/* Space a tag takes in the relocated block; 0 if it was not kept */
+static u64 relocated_span(const void *tag) {
+  if (tag == NULL) {
+    return 0;
+  }
+  return ALIGN_UP((u64)((const struct db_tag *)tag)->size,
+                  (u64)RELOCATED_TAG_ALIGN);
+}
+
+/* Copy a tag to block + *offset and return the copy; NULL stays NULL */
+static const void *relocate_tag(const void *tag, u8 *block, u64 *offset) {
+  if (tag == NULL) {
+    return NULL;
+  }
+
+  const u8 *src = tag;
+  u8 *dst = block + *offset;
+  u32 size = ((const struct db_tag *)tag)->size;
+  for (u32 i = 0; i < size; i++) {
+    dst[i] = src[i];
+  }
+  *offset += relocated_span(tag);
+  return dst;
+}
+
+/*
+ * Copy the tags boot_info_parse() kept into one page-aligned block of
+ * kernel memory, each on its own cache line, and point parsed at the
+ * copies. Nothing then refers to the bootloader's boot information, so
+ * DB_MEM_BOOTLOADER can be reclaimed. After pmm_init(), before anything
+ * else keeps a pointer into a tag.
+ */
+bool boot_info_relocate(struct parsed_boot_info *parsed) {
+  if (parsed->relocated) {
+    return true;
+  }
+
+  u64 size = relocated_span(parsed->memory_map) +
+             relocated_span(parsed->framebuffer) +
+             relocated_span(parsed->cmdline) +
+             relocated_span(parsed->acpi_rsdp) + relocated_span(parsed->smp) +
+             relocated_span(parsed->initrd) + relocated_span(parsed->modules) +
+             relocated_span(parsed->bootloader);
+  u64 pages = ALIGN_UP(size, PAGE_SIZE) / PAGE_SIZE;
+  u64 phys = pmm_alloc_pages(MAX(pages, 1UL));
+  if (phys == 0) {
+    return false;
+  }
+
+  u8 *block = phys_to_virt(phys);
+  u64 offset = 0;
+  parsed->memory_map = relocate_tag(parsed->memory_map, block, &offset);
+  parsed->framebuffer = relocate_tag(parsed->framebuffer, block, &offset);
+  parsed->cmdline = relocate_tag(parsed->cmdline, block, &offset);
+  parsed->acpi_rsdp = relocate_tag(parsed->acpi_rsdp, block, &offset);
+  parsed->smp = relocate_tag(parsed->smp, block, &offset);
+  parsed->initrd = relocate_tag(parsed->initrd, block, &offset);
+  parsed->modules = relocate_tag(parsed->modules, block, &offset);
+  parsed->bootloader = relocate_tag(parsed->bootloader, block, &offset);
+
+  parsed->relocated = true;
+  return true;
+}
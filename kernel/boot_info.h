@@ -9,6 +9,83 @@
 
 #define DB_PROTOCOL_VERSION 0x0001
 
+#define DB_REQUEST_SCAN_LIMIT (32 * 1024) /* Header lives in the first 32 KiB */
+#define DB_REQUEST_ENTRY_DEFAULT 0xFFFFFFFF /* Use the ELF entry point */
+
+/* Request header flags: what the kernel wants from the bootloader */
+#define DB_REQ_FRAMEBUFFER (1U << 0)
+#define DB_REQ_MEMORY_MAP (1U << 1)
+#define DB_REQ_MODULES (1U << 2)
+#define DB_REQ_ACPI (1U << 3)
+#define DB_REQ_CMDLINE (1U << 4)
+#define DB_REQ_SMP (1U << 5)
+#define DB_REQ_INITRD (1U << 6)
+#define DB_REQ_HAS_TAGS (1U << 7)
+
+struct db_request_header {
+
+  u32 magic;
+
+  u32 checksum; /* CRC32 of header + tags, computed with this field as 0 */
+
+  u16 version;
+
+  u16 header_size; /* Header plus all request tags */
+
+  u32 flags;
+
+  u32 entry_point; /* Offset into the image, or DB_REQUEST_ENTRY_DEFAULT */
+} PACKED;
+
+enum db_rtag_type {
+
+  DB_RTAG_END = 0x0000,              /* End of request tag list */
+  DB_RTAG_FRAMEBUFFER_PREF = 0x0001, /* Preferred framebuffer settings */
+  DB_RTAG_MIN_MEMORY = 0x0002,       /* Minimum memory requirement */
+  DB_RTAG_LOAD_ADDRESS = 0x0003,     /* Preferred/required load address */
+  DB_RTAG_STACK_SIZE = 0x0004,       /* Requested initial stack size */
+  DB_RTAG_ARCH_FEATURES = 0x0005,    /* Architecture-specific requests */
+};
+
+#define DB_RTAG_FLAG_REQUIRED (1 << 0) /* Fail the boot if unavailable */
+
+struct db_request_tag {
+
+  u16 type;
+
+  u16 flags;
+
+  u32 size;
+} PACKED;
+
+struct db_rtag_framebuffer_pref {
+
+  struct db_request_tag header;
+
+  u32 min_width; /* 0 = any, here and below */
+  u32 min_height;
+  u32 preferred_width;
+  u32 preferred_height;
+  u8 min_bpp;
+  u8 preferred_bpp;
+
+  u8 padding[2];
+} PACKED;
+
+struct db_rtag_min_memory {
+
+  struct db_request_tag header;
+
+  u64 min_bytes;
+} PACKED;
+
+struct db_rtag_stack_size {
+
+  struct db_request_tag header;
+
+  u64 stack_size; /* 0 = bootloader default */
+} PACKED;
+
 struct db_boot_info {
 
   u32 magic;
@@ -101,6 +178,25 @@ struct db_tag_framebuffer {
   u8 padding[3];
 } PACKED;
 
+struct db_module {
+
+  u64 start; /* Physical */
+  u64 end;   /* Exclusive */
+
+  u32 name_offset;    /* NUL-terminated string, from the tag start */
+  u32 cmdline_offset; /* Likewise */
+} PACKED;
+
+struct db_tag_modules {
+
+  struct db_tag header;
+
+  u32 module_count;
+  u32 reserved;
+
+  struct db_module modules[];
+} PACKED;
+
 struct db_tag_cmdline {
 
   struct db_tag header;
@@ -163,6 +259,7 @@ struct parsed_boot_info {
   bool has_acpi;
   bool has_smp;
   bool has_initrd;
+  bool has_modules;
 
   const struct db_tag_memory_map *memory_map;
   const struct db_tag_framebuffer *framebuffer;
@@ -170,16 +267,25 @@ struct parsed_boot_info {
   const struct db_tag_acpi_rsdp *acpi_rsdp;
   const struct db_tag_smp *smp;
   const struct db_tag_initrd *initrd;
+  const struct db_tag_modules *modules;
   const struct db_tag_bootloader *bootloader;
 
+  bool relocated; /* The tags above are kernel copies (boot_info_relocate) */
   u32 total_usable_memory_mb;
   u32 cpu_count;
 };
 
 bool boot_info_validate(const struct db_boot_info *info);
+const char *boot_info_module_string(const struct db_tag_modules *modules,
+                                    u32 offset);
 bool boot_info_parse(const struct db_boot_info *info,
                      struct parsed_boot_info *parsed);
+bool boot_info_relocate(struct parsed_boot_info *parsed);
 const struct db_tag *boot_info_get_next_tag(const struct db_boot_info *info,
                                             const struct db_tag *tag);
 
+/* db_request.c: the request header embedded in this image */
+const struct db_request_header *db_request_get(void);
+bool db_request_verify(void);
+
 #endif /* DELTA_KERNEL_BOOT_INFO_H */
@@ -1,4 +1,11 @@
 #include "console.h"
+#include "fbkern.h"
+#include "kthread.h"
+#include "log.h"
+#include "param.h"
+#include "spinlock.h"
+
+#include "../arch/amd64/uart.h"
 
 static const u8 console_font[95][16] = {
 
@@ -310,6 +317,23 @@ static console_color_t current_fg = CONSOLE_WHITE;
 static console_color_t current_bg = CONSOLE_BLACK;
 
 static bool console_initialized = false;
+static bool fb_active = false;     /* Drawing on the framebuffer */
+static bool serial_active = false; /* Mirroring to the UART */
+static bool panic_mode = false;    /* Polled serial only, see console_panic */
+
+/* Cursor, scrolling and the screen itself, shared by every CPU that prints */
+static struct spinlock fb_lock = SPINLOCK_INIT;
+
+/* console=fb|serial|none, indexed by enum console_mode */
+static const char *const mode_names[] = {"fb", "serial", "none", NULL};
+static u32 console_mode = CONSOLE_MODE_FB;
+KERNEL_PARAM_CHOICE("console", console_mode, mode_names);
+
+static u32 console_baud = UART_BAUD_DEFAULT;
+KERNEL_PARAM_U32("console.baud", console_baud);
+
+/* Vector kernels for 32 bpp, once console_enable_simd() picked them */
+static const struct fb_kernels *simd_kernels = NULL;
 
 static u32 color_to_pixel(console_color_t color) {
 
@@ -348,8 +372,53 @@ static void put_pixel(u32 x, u32 y, u32 color) {
   }
 }
 
-static void draw_char(char c, u32 col, u32 row, console_color_t fg,
-                      console_color_t bg) {
+/*
+ * Kernels for a run of drawing: the SIMD ones if they may be used here,
+ * in which case the FPU is ours until kernels_end(). Scalar otherwise.
+ */
+static const struct fb_kernels *kernels_begin(void) {
+  if (simd_kernels != NULL && kernel_fpu_usable()) {
+    kernel_fpu_begin();
+    return simd_kernels;
+  }
+  return fb_kernels_get(FB_KERNEL_SCALAR);
+}
+
+static void kernels_end(const struct fb_kernels *k) {
+  if (k == simd_kernels) {
+    kernel_fpu_end();
+  }
+}
+
+static void fill_rows(const struct fb_kernels *k, u32 y, u32 rows,
+                      u32 pixel) {
+  if (fb_bpp != 32) {
+    for (u32 row = y; row < y + rows; row++) {
+      for (u32 x = 0; x < fb_width; x++) {
+        put_pixel(x, row, pixel);
+      }
+    }
+    return;
+  }
+
+  u8 *start = fb_address + (u64)y * fb_pitch;
+  if (fb_pitch == fb_width * sizeof(u32)) {
+    /* No padding: one long run */
+    k->fill32((u32 *)start, pixel, (u64)fb_width * rows);
+    return;
+  }
+  for (u32 row = 0; row < rows; row++) {
+    k->fill32((u32 *)(start + (u64)row * fb_pitch), pixel, fb_width);
+  }
+}
+
+static void draw_char(const struct fb_kernels *k, char c, u32 col, u32 row,
+                      console_color_t fg, console_color_t bg) {
+
+  /* SECURITY: the glyph kernels write whole cells unchecked */
+  if (col >= console_cols || row >= console_rows) {
+    return;
+  }
 
   u32 px = col * CONSOLE_FONT_WIDTH;
   u32 py = row * CONSOLE_FONT_HEIGHT;
@@ -364,6 +433,14 @@ static void draw_char(char c, u32 col, u32 row, console_color_t fg,
     glyph = console_font[0];
   }
 
+  if (fb_bpp == 32) {
+    /* Cells are whole: console_cols/rows round the screen size down */
+    u8 *cell = fb_address + (u64)py * fb_pitch + px * sizeof(u32);
+    k->glyph32(cell, fb_pitch, glyph, CONSOLE_FONT_HEIGHT, fg_pixel,
+               bg_pixel);
+    return;
+  }
+
   for (u32 font_row = 0; font_row < CONSOLE_FONT_HEIGHT; font_row++) {
     u8 row_data = glyph[font_row];
 
@@ -374,7 +451,7 @@ static void draw_char(char c, u32 col, u32 row, console_color_t fg,
   }
 }
 
-static void scroll_screen(void) {
+static void scroll_screen(const struct fb_kernels *k) {
   u32 row_size = fb_pitch;
   u32 scroll_amount = CONSOLE_FONT_HEIGHT * row_size;
   u32 copy_size = (console_rows - 1) * CONSOLE_FONT_HEIGHT * row_size;
@@ -386,17 +463,12 @@ static void scroll_screen(void) {
     dest[i] = src[i];
   }
 
-  u32 bg_pixel = color_to_pixel(current_bg);
   u32 last_row_start = (console_rows - 1) * CONSOLE_FONT_HEIGHT;
-
-  for (u32 y = 0; y < CONSOLE_FONT_HEIGHT; y++) {
-    for (u32 x = 0; x < fb_width; x++) {
-      put_pixel(x, last_row_start + y, bg_pixel);
-    }
-  }
+  fill_rows(k, last_row_start, CONSOLE_FONT_HEIGHT,
+            color_to_pixel(current_bg));
 }
 
-bool console_init(const struct db_tag_framebuffer *fb) {
+static bool fb_setup(const struct db_tag_framebuffer *fb) {
 
   if (fb == NULL) {
     return false;
@@ -431,27 +503,34 @@ bool console_init(const struct db_tag_framebuffer *fb) {
   current_fg = CONSOLE_WHITE;
   current_bg = CONSOLE_BLACK;
 
-  console_initialized = true;
+  fb_active = true;
   console_clear();
 
   return true;
 }
 
 void console_clear(void) {
-  if (!console_initialized) {
+  if (!fb_active) {
     return;
   }
 
-  u32 bg_pixel = color_to_pixel(current_bg);
-
-  for (u32 y = 0; y < fb_height; y++) {
-    for (u32 x = 0; x < fb_width; x++) {
-      put_pixel(x, y, bg_pixel);
-    }
-  }
-
+  const struct fb_kernels *k = kernels_begin();
+  u64 flags = spin_lock_irqsave(&fb_lock);
+  fill_rows(k, 0, fb_height, color_to_pixel(current_bg));
   cursor_x = 0;
   cursor_y = 0;
+  spin_unlock_irqrestore(&fb_lock, flags);
+  kernels_end(k);
+}
+
+/*
+ * Switch drawing to the best vector kernels the CPU runs, once kernel SIMD
+ * is available. Returns the name of the kernels in use.
+ */
+const char *console_enable_simd(void) {
+  enum fb_kernel_isa best = fb_kernels_best();
+  simd_kernels = best != FB_KERNEL_SCALAR ? fb_kernels_get(best) : NULL;
+  return fb_kernels_get(best)->name;
 }
 
 void console_set_color(console_color_t fg, console_color_t bg) {
@@ -459,11 +538,7 @@ void console_set_color(console_color_t fg, console_color_t bg) {
   current_bg = bg;
 }
 
-void console_putc(char c) {
-  if (!console_initialized) {
-    return;
-  }
-
+static void putc_with(const struct fb_kernels *k, char c) {
   switch (c) {
   case '\n':
     cursor_x = 0;
@@ -489,7 +564,7 @@ void console_putc(char c) {
     break;
 
   default:
-    draw_char(c, cursor_x, cursor_y, current_fg, current_bg);
+    draw_char(k, c, cursor_x, cursor_y, current_fg, current_bg);
     cursor_x++;
 
     if (cursor_x >= console_cols) {
@@ -500,43 +575,149 @@ void console_putc(char c) {
   }
 
   if (cursor_y >= console_rows) {
-    scroll_screen();
+    scroll_screen(k);
     cursor_y = console_rows - 1;
   }
 }
 
-void console_puts(const char *str) {
-  if (!console_initialized || str == NULL) {
+/* To the sinks, not the log. One SIMD region for the whole run. */
+static void emit(const char *text, u64 length) {
+  if (panic_mode) {
+    if (serial_active) {
+      uart_write_polled(text, length);
+    }
     return;
   }
-  while (*str) {
-    console_putc(*str);
-    str++;
+  if (fb_active) {
+    /* kernels_end() may reschedule, so the lock sits inside the region */
+    const struct fb_kernels *k = kernels_begin();
+    u64 flags = spin_lock_irqsave(&fb_lock);
+    for (u64 i = 0; i < length; i++) {
+      putc_with(k, text[i]);
+    }
+    spin_unlock_irqrestore(&fb_lock, flags);
+    kernels_end(k);
+  }
+  if (serial_active) {
+    uart_write(text, length);
   }
 }
 
-void console_newline(void) { console_putc('\n'); }
+/*
+ * Pick the sinks for the console= mode, falling back from the framebuffer
+ * to serial to the log alone when one is missing, and replay everything
+ * logged so far to them. The framebuffer is touched only in CONSOLE_MODE_FB.
+ * Call after the command line has been parsed.
+ */
+enum console_mode console_init(const struct db_tag_framebuffer *fb) {
+  if (console_mode > CONSOLE_MODE_NONE) {
+    console_mode = CONSOLE_MODE_FB;
+  }
+  if (console_mode == CONSOLE_MODE_FB && !fb_setup(fb)) {
+    console_mode = CONSOLE_MODE_SERIAL;
+  }
+  if (console_mode == CONSOLE_MODE_SERIAL) {
+    if (!uart_baud_supported(console_baud)) {
+      LOG_WARN("console.baud not reachable, using 115200\n");
+      console_baud = UART_BAUD_DEFAULT;
+    }
+    serial_active = uart_init(UART_COM1, console_baud);
+    if (!serial_active) {
+      console_mode = CONSOLE_MODE_NONE;
+    }
+  }
 
-void console_put_hex(u64 value) {
-  if (!console_initialized) {
+  console_initialized = true;
+  log_replay(0, emit);
+  return (enum console_mode)console_mode;
+}
+
+/*
+ * Panic: from here on output goes to the log and, polled, to COM1, which
+ * is brought up for the dump if the console was not using it. The screen
+ * waits for console_panic_paint(). Nothing here takes a lock.
+ */
+void console_panic(void) {
+  panic_mode = true;
+  if (!serial_active) {
+    serial_active = uart_present() || uart_init(UART_COM1, UART_BAUD_DEFAULT);
+  }
+}
+
+/* Sends logged text to the sinks again */
+void console_replay(u64 from) { log_replay(from, emit); }
+
+/* Clears each row just before drawing its first character */
+static void paint(const char *text, u64 length) {
+  /* Scalar: the FPU may hold the state of whatever was interrupted */
+  const struct fb_kernels *k = fb_kernels_get(FB_KERNEL_SCALAR);
+  for (u64 i = 0; i < length; i++) {
+    if (cursor_x == 0) {
+      fill_rows(k, cursor_y * CONSOLE_FONT_HEIGHT, CONSOLE_FONT_HEIGHT,
+                color_to_pixel(current_bg));
+    }
+    putc_with(k, text[i]);
+  }
+}
+
+/*
+ * Draw what was logged since from, white on red, from the top of the
+ * screen. Only the rows written are filled and only the tail that fits is
+ * drawn, so the cost is the report's, not the screen's.
+ */
+void console_panic_paint(u64 from) {
+  if (!fb_active) {
     return;
   }
 
-  static const char hex_chars[] = "0123456789ABCDEF";
+  u64 tail = log_record_start(console_rows - 1);
+  current_fg = CONSOLE_WHITE;
+  current_bg = CONSOLE_RED;
+  cursor_x = 0;
+  cursor_y = 0;
+  log_replay(tail > from ? tail : from, paint);
+}
 
-  console_puts("0x");
+enum console_mode console_get_mode(void) {
+  return (enum console_mode)console_mode;
+}
 
-  for (int i = 60; i >= 0; i -= 4) {
-    u8 nibble = (value >> i) & 0xF;
-    console_putc(hex_chars[nibble]);
-  }
+/* Output always reaches the log, even before console_init() */
+void console_putc(char c) {
+  log_write(&c, 1);
+  emit(&c, 1);
 }
 
-void console_put_dec(u64 value) {
-  if (!console_initialized) {
+void console_puts(const char *str) {
+  if (str == NULL) {
     return;
   }
 
+  u64 length = 0;
+  while (str[length] != '\0') {
+    length++;
+  }
+  log_write(str, length);
+  emit(str, length);
+}
+
+void console_newline(void) { console_putc('\n'); }
+
+void console_put_hex(u64 value) {
+  static const char hex_chars[] = "0123456789ABCDEF";
+
+  char buffer[19];
+  buffer[0] = '0';
+  buffer[1] = 'x';
+  for (int i = 0; i < 16; i++) {
+    buffer[2 + i] = hex_chars[(value >> (60 - 4 * i)) & 0xF];
+  }
+  buffer[18] = '\0';
+
+  console_puts(buffer);
+}
+
+void console_put_dec(u64 value) {
   if (value == 0) {
     console_putc('0');
     return;
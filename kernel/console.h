@@ -26,7 +26,16 @@ typedef u32 console_color_t;
 
 #define CONSOLE_FONT_HEIGHT 16
 
-bool console_init(const struct db_tag_framebuffer *fb);
+/* Where console output goes, besides the log ring (console=) */
+enum console_mode {
+  CONSOLE_MODE_FB = 0,     /* Framebuffer */
+  CONSOLE_MODE_SERIAL = 1, /* COM1 only: the framebuffer is never touched */
+  CONSOLE_MODE_NONE = 2,   /* The log ring alone */
+};
+
+enum console_mode console_init(const struct db_tag_framebuffer *fb);
+
+enum console_mode console_get_mode(void);
 
 void console_putc(char c);
 
@@ -40,6 +49,14 @@ void console_set_color(console_color_t fg, console_color_t bg);
 
 void console_clear(void);
 
+void console_panic(void);
+
+void console_replay(u64 from);
+
+void console_panic_paint(u64 from);
+
+const char *console_enable_simd(void);
+
 void console_newline(void);
 
 u32 console_get_width(void);
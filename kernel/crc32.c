@@ -0,0 +1,191 @@
+#include "crc32.h"
+#include "kthread.h"
+#include "param.h"
+#include "pmm.h"
+
+#include "../arch/amd64/cpu.h"
+#include "../arch/amd64/fpu.h"
+#include "../arch/amd64/tsc.h"
+
+#define CRC32_POLY 0xEDB88320U
+
+#define BENCH_ROUNDS 4096 /* Over one cache-resident page: 16 MiB */
+#define SELFTEST_SIZE 2048
+
+static u32 tables[8][256];
+static bool use_pclmul = false;
+
+/* crc32.pclmul=off: stay on the tables even where PCLMULQDQ exists */
+static bool allow_pclmul = true;
+KERNEL_PARAM_BOOL("crc32.pclmul", allow_pclmul);
+
+struct crc32_vector {
+  const char *data;
+  u32 crc;
+};
+
+/* Reference values from the CRC catalogue and zlib */
+static const struct crc32_vector vectors[] = {
+    {"", 0x00000000},
+    {"a", 0xE8B7BE43},
+    {"abc", 0x352441C2},
+    {"123456789", 0xCBF43926},
+    {"The quick brown fox jumps over the lazy dog", 0x414FA339},
+};
+
+static u64 str_length(const char *s) {
+  u64 n = 0;
+  while (s[n] != '\0') {
+    n++;
+  }
+  return n;
+}
+
+static void build_tables(void) {
+  for (u32 i = 0; i < 256; i++) {
+    u32 crc = i;
+    for (u32 bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (CRC32_POLY & (0U - (crc & 1)));
+    }
+    tables[0][i] = crc;
+  }
+
+  /* tables[k][i]: the CRC of byte i followed by k zero bytes */
+  for (u32 i = 0; i < 256; i++) {
+    for (u32 k = 1; k < 8; k++) {
+      u32 prev = tables[k - 1][i];
+      tables[k][i] = (prev >> 8) ^ tables[0][prev & 0xFF];
+    }
+  }
+}
+
+static inline u32 load32(const u8 *p) {
+  return (u32)p[0] | ((u32)p[1] << 8) | ((u32)p[2] << 16) | ((u32)p[3] << 24);
+}
+
+/* Raw (non-inverted) slicing-by-8 */
+static u32 crc32_raw(u32 crc, const u8 *p, u64 length) {
+  for (; length >= 8; length -= 8, p += 8) {
+    u32 lo = load32(p) ^ crc;
+    u32 hi = load32(p + 4);
+    crc = tables[7][lo & 0xFF] ^ tables[6][(lo >> 8) & 0xFF] ^
+          tables[5][(lo >> 16) & 0xFF] ^ tables[4][lo >> 24] ^
+          tables[3][hi & 0xFF] ^ tables[2][(hi >> 8) & 0xFF] ^
+          tables[1][(hi >> 16) & 0xFF] ^ tables[0][hi >> 24];
+  }
+  while (length-- > 0) {
+    crc = (crc >> 8) ^ tables[0][(crc ^ *p++) & 0xFF];
+  }
+  return crc;
+}
+
+u32 crc32_tables(u32 crc, const void *data, u64 length) {
+  return ~crc32_raw(~crc, data, length);
+}
+
+/* Folds whole 16-byte blocks a chunk at a time; the tail goes to the tables */
+static u32 crc32_simd(u32 crc, const u8 *p, u64 length) {
+  crc = ~crc;
+  while (length >= CRC32_SIMD_MIN) {
+    u64 chunk = MIN(length, (u64)CRC32_SIMD_CHUNK) & ~15UL;
+    kernel_fpu_begin();
+    crc = crc32_pclmul_fold(crc, p, chunk);
+    kernel_fpu_end();
+    p += chunk;
+    length -= chunk;
+  }
+  return ~crc32_raw(crc, p, length);
+}
+
+u32 crc32(u32 crc, const void *data, u64 length) {
+  if (use_pclmul && length >= CRC32_SIMD_MIN && kernel_fpu_usable()) {
+    return crc32_simd(crc, data, length);
+  }
+  return crc32_tables(crc, data, length);
+}
+
+/* Folding against the tables over every length class around the cut-offs */
+static bool selftest_pclmul(void) {
+  u64 page = pmm_alloc_page();
+  if (page == 0) {
+    return false;
+  }
+
+  u8 *buffer = phys_to_virt(page);
+  u32 seed = 0x12345678;
+  for (u32 i = 0; i < SELFTEST_SIZE; i++) {
+    seed = seed * 1103515245 + 12345;
+    buffer[i] = (u8)(seed >> 16);
+  }
+
+  bool ok = true;
+  for (u64 length = CRC32_SIMD_MIN - 16; ok && length <= SELFTEST_SIZE - 3;
+       length += 13) {
+    u32 offset = (u32)(length % 3);
+    ok = crc32_simd(length, buffer + offset, length) ==
+         crc32_tables(length, buffer + offset, length);
+  }
+
+  pmm_free_page(page);
+  return ok;
+}
+
+/* BSP, once the FPU and the PMM are up. false if a self-test failed */
+bool crc32_init(void) {
+  build_tables();
+
+  for (u32 i = 0; i < ARRAY_SIZE(vectors); i++) {
+    const char *s = vectors[i].data;
+    if (crc32_tables(0, s, str_length(s)) != vectors[i].crc) {
+      return false;
+    }
+  }
+
+  /* Chaining must match a single pass */
+  const char *s = vectors[ARRAY_SIZE(vectors) - 1].data;
+  u64 n = str_length(s);
+  if (crc32_tables(crc32_tables(0, s, 10), s + 10, n - 10) !=
+      vectors[ARRAY_SIZE(vectors) - 1].crc) {
+    return false;
+  }
+
+  if (allow_pclmul && cpu_has(CPU_FEATURE_PCLMUL) && kernel_fpu_usable()) {
+    if (!selftest_pclmul()) {
+      return false;
+    }
+    use_pclmul = true;
+  }
+  return true;
+}
+
+bool crc32_has_pclmul(void) { return use_pclmul; }
+
+/* Throughput in bytes per second, cache-resident; 0 if it cannot run */
+u64 crc32_measure(bool pclmul) {
+  if (pclmul && (!use_pclmul || !kernel_fpu_usable())) {
+    return 0;
+  }
+
+  u64 page = pmm_alloc_zeroed_page();
+  if (page == 0) {
+    return 0;
+  }
+  const u8 *buffer = phys_to_virt(page);
+
+  u32 crc = 0;
+  u64 start = rdtsc_ordered();
+  for (u32 i = 0; i < BENCH_ROUNDS; i++) {
+    crc = pclmul ? crc32_simd(crc, buffer, PAGE_SIZE)
+                 : crc32_tables(crc, buffer, PAGE_SIZE);
+  }
+  u64 cycles = rdtsc_ordered() - start;
+
+  pmm_free_page(page);
+
+  if (cycles == 0) {
+    return 0;
+  }
+  /* 16 MiB times a TSC rate in Hz stays well inside 64 bits */
+  u64 bytes = (u64)BENCH_ROUNDS * PAGE_SIZE;
+  return bytes * tsc_get_calibration()->hz / cycles;
+}
@@ -0,0 +1,35 @@
+#ifndef DELTA_KERNEL_CRC32_H
+#define DELTA_KERNEL_CRC32_H
+
+#include "types.h"
+
+/*
+ * CRC-32 (IEEE 802.3, reflected polynomial 0xEDB88320), as used by the DB
+ * request header, zlib and gzip. crc32() chains: pass 0 to start, then the
+ * previous result to continue over more data.
+ *
+ * Two implementations: slicing-by-8 tables (8 bytes per step, no SIMD) and
+ * PCLMULQDQ folding (64 bytes per step, SIMD unit crc32_simd.c), used for
+ * buffers large enough to pay for a kernel_fpu region. crc32_init() builds
+ * the tables and checks both against known vectors; call it before any
+ * other crc32 function.
+ */
+
+#define CRC32_SIMD_MIN 512           /* Smaller buffers stay on the tables */
+#define CRC32_SIMD_CHUNK (64 * 1024) /* Bytes per kernel_fpu region */
+
+bool crc32_init(void);
+
+u32 crc32(u32 crc, const void *data, u64 length);
+
+u32 crc32_tables(u32 crc, const void *data, u64 length);
+
+bool crc32_has_pclmul(void);
+
+u64 crc32_measure(bool pclmul);
+
+/* crc32_simd.c: raw (non-inverted) CRC of length bytes, length >= 64 and a
+ * multiple of 16. Inside kernel_fpu_begin/end only. */
+u32 crc32_pclmul_fold(u32 crc, const u8 *data, u64 length);
+
+#endif /* DELTA_KERNEL_CRC32_H */
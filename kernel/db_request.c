@@ -0,0 +1,85 @@
+#include "boot_info.h"
+#include "crc32.h"
+
+/*
+ * The DB request header: what this kernel asks the bootloader for. It goes
+ * in its own section, which linker.ld places first in .text, well inside
+ * the 32 KiB the bootloader scans. The checksum is left 0 here; the build
+ * fills it in after linking (tools/db_checksum.c).
+ *
+ * Only what the kernel uses is requested. Modules are indexed at boot and
+ * linked when first asked for (module.c).
+ */
+
+/* 32 bpp takes the vector fill and glyph kernels; 640x480 is 80x30 text */
+#define FB_MIN_WIDTH 640
+#define FB_MIN_HEIGHT 480
+#define FB_PREFERRED_WIDTH 1024
+#define FB_PREFERRED_HEIGHT 768
+#define FB_MIN_BPP 16
+#define FB_PREFERRED_BPP 32
+
+/* _start moves to its own stack at once: the bootloader's only calls it */
+#define BOOT_STACK_SIZE 4096
+
+struct kernel_request {
+  struct db_request_header header;
+  struct db_rtag_framebuffer_pref framebuffer;
+  struct db_rtag_stack_size stack;
+  struct db_request_tag end;
+} PACKED;
+
+_Static_assert(sizeof(struct db_request_header) % 4 == 0,
+               "request tags must start 4-byte aligned");
+_Static_assert(sizeof(struct kernel_request) <= U16_MAX,
+               "header_size is 16 bits");
+
+__attribute__((section(".db_request"), used, aligned(8)))
+static const struct kernel_request request = {
+    .header =
+        {
+            .magic = DB_REQUEST_MAGIC,
+            .checksum = 0,
+            .version = DB_PROTOCOL_VERSION,
+            .header_size = sizeof(struct kernel_request),
+            .flags = DB_REQ_FRAMEBUFFER | DB_REQ_MEMORY_MAP | DB_REQ_ACPI |
+                     DB_REQ_CMDLINE | DB_REQ_SMP | DB_REQ_INITRD |
+                     DB_REQ_MODULES | DB_REQ_HAS_TAGS,
+            .entry_point = DB_REQUEST_ENTRY_DEFAULT,
+        },
+    .framebuffer =
+        {
+            .header = {DB_RTAG_FRAMEBUFFER_PREF, 0,
+                       sizeof(struct db_rtag_framebuffer_pref)},
+            .min_width = FB_MIN_WIDTH,
+            .min_height = FB_MIN_HEIGHT,
+            .preferred_width = FB_PREFERRED_WIDTH,
+            .preferred_height = FB_PREFERRED_HEIGHT,
+            .min_bpp = FB_MIN_BPP,
+            .preferred_bpp = FB_PREFERRED_BPP,
+        },
+    .stack =
+        {
+            .header = {DB_RTAG_STACK_SIZE, 0,
+                       sizeof(struct db_rtag_stack_size)},
+            .stack_size = BOOT_STACK_SIZE,
+        },
+    .end = {DB_RTAG_END, 0, sizeof(struct db_request_tag)},
+};
+
+const struct db_request_header *db_request_get(void) { return &request.header; }
+
+/* Same check the bootloader makes. After crc32_init(). */
+bool db_request_verify(void) {
+  const struct db_request_header *header = &request.header;
+  u32 zero = 0;
+
+  u32 crc = crc32(0, header, OFFSET_OF(struct db_request_header, checksum));
+  crc = crc32(crc, &zero, sizeof(zero));
+  crc = crc32(crc, &header->version,
+              header->header_size -
+                  OFFSET_OF(struct db_request_header, version));
+
+  /* Patched after linking: the compiler must not fold in the 0 above */
+  return crc == *(const volatile u32 *)&header->checksum;
+}
@@ -0,0 +1,116 @@
+#ifndef DELTA_KERNEL_ELF_H
+#define DELTA_KERNEL_ELF_H
+
+#include "types.h"
+
+/*
+ * ELF64 structures (System V ABI, x86-64 supplement): the parts needed to
+ * link relocatable objects.
+ */
+
+#define ELF_MAGIC 0x464C457F /* "\x7FELF", little-endian */
+
+#define ELFCLASS64 2
+#define ELFDATA2LSB 1
+#define EV_CURRENT 1
+
+#define ET_REL 1
+#define EM_X86_64 62
+
+/* e_ident indices */
+#define EI_CLASS 4
+#define EI_DATA 5
+#define EI_VERSION 6
+#define EI_NIDENT 16
+
+/* Section types */
+#define SHT_NULL 0
+#define SHT_PROGBITS 1
+#define SHT_SYMTAB 2
+#define SHT_STRTAB 3
+#define SHT_RELA 4
+#define SHT_NOBITS 8
+#define SHT_REL 9
+
+/* Section flags */
+#define SHF_WRITE (1 << 0)
+#define SHF_ALLOC (1 << 1)
+#define SHF_EXECINSTR (1 << 2)
+
+/* Special section indices */
+#define SHN_UNDEF 0
+#define SHN_LORESERVE 0xFF00
+#define SHN_ABS 0xFFF1
+#define SHN_COMMON 0xFFF2
+
+#define ELF64_ST_BIND(info) ((info) >> 4)
+#define ELF64_ST_TYPE(info) ((info) & 0xF)
+
+#define STB_LOCAL 0
+#define STB_GLOBAL 1
+#define STB_WEAK 2
+
+#define STT_NOTYPE 0
+#define STT_OBJECT 1
+#define STT_FUNC 2
+#define STT_SECTION 3
+#define STT_FILE 4
+
+#define ELF64_R_SYM(info) ((u32)((info) >> 32))
+#define ELF64_R_TYPE(info) ((u32)(info))
+
+/* x86-64 relocation types (S: symbol, A: addend, P: place) */
+#define R_X86_64_NONE 0
+#define R_X86_64_64 1    /* S + A */
+#define R_X86_64_PC32 2  /* S + A - P, signed 32 */
+#define R_X86_64_PLT32 4 /* As PC32: no PLT, calls bind directly */
+#define R_X86_64_32 10   /* S + A, zero-extended 32 */
+#define R_X86_64_32S 11  /* S + A, sign-extended 32 */
+#define R_X86_64_PC64 24 /* S + A - P */
+
+struct elf64_ehdr {
+  u8 e_ident[EI_NIDENT];
+  u16 e_type;
+  u16 e_machine;
+  u32 e_version;
+  u64 e_entry;
+  u64 e_phoff;
+  u64 e_shoff;
+  u32 e_flags;
+  u16 e_ehsize;
+  u16 e_phentsize;
+  u16 e_phnum;
+  u16 e_shentsize;
+  u16 e_shnum;
+  u16 e_shstrndx;
+} PACKED;
+
+struct elf64_shdr {
+  u32 sh_name;
+  u32 sh_type;
+  u64 sh_flags;
+  u64 sh_addr;
+  u64 sh_offset;
+  u64 sh_size;
+  u32 sh_link;
+  u32 sh_info;
+  u64 sh_addralign;
+  u64 sh_entsize;
+} PACKED;
+
+struct elf64_sym {
+  u32 st_name;
+  u8 st_info;
+  u8 st_other;
+  u16 st_shndx;
+  u64 st_value;
+  u64 st_size;
+} PACKED;
+
+struct elf64_rela {
+  u64 r_offset;
+  u64 r_info;
+  i64 r_addend;
+} PACKED;
+
+#endif /* DELTA_KERNEL_ELF_H */
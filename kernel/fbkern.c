@@ -0,0 +1,113 @@
+#include "fbkern.h"
+#include "kthread.h"
+#include "pmm.h"
+
+#include "../arch/amd64/cpu.h"
+#include "../arch/amd64/fpu.h"
+
+#define BENCH_FILL_PIXELS (PAGE_SIZE / sizeof(u32))
+#define BENCH_FILL_ROUNDS 256
+#define BENCH_GLYPH_ROUNDS 1024
+#define BENCH_GLYPH_ROWS 16
+#define BENCH_GLYPH_PITCH (8 * sizeof(u32))
+
+static void fill32_scalar(u32 *dst, u32 pixel, u64 count) {
+  for (u64 i = 0; i < count; i++) {
+    dst[i] = pixel;
+  }
+}
+
+static void glyph32_scalar(u8 *dst, u32 pitch, const u8 *glyph, u32 rows,
+                           u32 fg, u32 bg) {
+  for (u32 row = 0; row < rows; row++, dst += pitch) {
+    u32 *line = (u32 *)dst;
+    u8 bits = glyph[row];
+    for (u32 col = 0; col < 8; col++) {
+      line[col] = (bits & (0x80 >> col)) ? fg : bg;
+    }
+  }
+}
+
+static const struct fb_kernels fb_kernels_scalar = {
+    .name = "scalar",
+    .fill32 = fill32_scalar,
+    .glyph32 = glyph32_scalar,
+};
+
+/* SSE2 is part of x86_64; AVX2 also needs the YMM state enabled in XCR0 */
+const struct fb_kernels *fb_kernels_get(enum fb_kernel_isa isa) {
+  switch (isa) {
+  case FB_KERNEL_SCALAR:
+    return &fb_kernels_scalar;
+  case FB_KERNEL_SSE2:
+    return fpu_ready() ? &fb_kernels_sse2 : NULL;
+  case FB_KERNEL_AVX2:
+    return fpu_ready() && fpu_has_avx() && cpu_has(CPU_FEATURE_AVX2)
+               ? &fb_kernels_avx2
+               : NULL;
+  default:
+    return NULL;
+  }
+}
+
+enum fb_kernel_isa fb_kernels_best(void) {
+  for (u32 isa = FB_KERNEL_COUNT; isa-- > 0;) {
+    if (fb_kernels_get(isa) != NULL) {
+      return isa;
+    }
+  }
+  return FB_KERNEL_SCALAR;
+}
+
+/*
+ * Time one flavour on a cache-resident page, so the figures compare the
+ * kernels themselves rather than the framebuffer's memory type. false if
+ * the flavour cannot run here or there is no page to run it on.
+ */
+bool fb_kernels_measure(enum fb_kernel_isa isa,
+                        struct fb_kernel_timing *timing) {
+  const struct fb_kernels *k = fb_kernels_get(isa);
+  bool simd = isa != FB_KERNEL_SCALAR;
+  if (k == NULL || (simd && !kernel_fpu_usable())) {
+    return false;
+  }
+
+  u64 page = pmm_alloc_page();
+  if (page == 0) {
+    return false;
+  }
+  u8 *buffer = phys_to_virt(page);
+
+  static const u8 pattern[BENCH_GLYPH_ROWS] = {
+      0x00, 0x18, 0x3C, 0x66, 0xC3, 0xFF, 0x81, 0x5A,
+      0xA5, 0x7E, 0x24, 0x42, 0x99, 0xE7, 0x0F, 0xF0,
+  };
+
+  if (simd) {
+    kernel_fpu_begin();
+  }
+
+  k->fill32((u32 *)buffer, 0, BENCH_FILL_PIXELS); /* Warm the page */
+
+  u64 start = rdtsc_ordered();
+  for (u32 i = 0; i < BENCH_FILL_ROUNDS; i++) {
+    k->fill32((u32 *)buffer, i, BENCH_FILL_PIXELS);
+  }
+  u64 fill = rdtsc_ordered() - start;
+
+  start = rdtsc_ordered();
+  for (u32 i = 0; i < BENCH_GLYPH_ROUNDS; i++) {
+    k->glyph32(buffer, BENCH_GLYPH_PITCH, pattern, BENCH_GLYPH_ROWS, i, ~i);
+  }
+  u64 glyph = rdtsc_ordered() - start;
+
+  if (simd) {
+    kernel_fpu_end();
+  }
+
+  pmm_free_page(page);
+
+  timing->fill_cycles = fill / BENCH_FILL_ROUNDS;
+  timing->glyph_cycles = glyph / BENCH_GLYPH_ROUNDS;
+  return true;
+}
@@ -0,0 +1,51 @@
+#ifndef DELTA_KERNEL_FBKERN_H
+#define DELTA_KERNEL_FBKERN_H
+
+#include "types.h"
+
+/*
+ * Framebuffer kernels for 32 bpp: solid fills and 8-pixel-wide glyph
+ * expansion, in scalar, SSE2 and AVX2 flavours. The SIMD ones live in a
+ * SIMD unit (fbkern_simd.c) and must run between kernel_fpu_begin() and
+ * kernel_fpu_end(); fb_kernels_get() returns NULL for a flavour the CPU
+ * cannot run.
+ *
+ * Large fills use non-temporal stores: a full clear of a big framebuffer
+ * is far larger than the caches, and would otherwise evict everything in
+ * them on its way to memory.
+ */
+
+#define FB_FILL_STREAM_MIN (256 * 1024) /* Bytes: stream fills this large */
+
+enum fb_kernel_isa {
+  FB_KERNEL_SCALAR = 0,
+  FB_KERNEL_SSE2 = 1,
+  FB_KERNEL_AVX2 = 2,
+  FB_KERNEL_COUNT,
+};
+
+struct fb_kernels {
+  const char *name;
+  void (*fill32)(u32 *dst, u32 pixel, u64 count);
+  /* One glyph row per byte, MSB leftmost; rows are pitch bytes apart */
+  void (*glyph32)(u8 *dst, u32 pitch, const u8 *glyph, u32 rows, u32 fg,
+                  u32 bg);
+};
+
+struct fb_kernel_timing {
+  u64 fill_cycles;  /* Per 4 KiB fill, cache-resident */
+  u64 glyph_cycles; /* Per 8x16 glyph */
+};
+
+const struct fb_kernels *fb_kernels_get(enum fb_kernel_isa isa);
+
+enum fb_kernel_isa fb_kernels_best(void);
+
+bool fb_kernels_measure(enum fb_kernel_isa isa,
+                        struct fb_kernel_timing *timing);
+
+/* fbkern_simd.c */
+extern const struct fb_kernels fb_kernels_sse2;
+extern const struct fb_kernels fb_kernels_avx2;
+
+#endif /* DELTA_KERNEL_FBKERN_H */
@@ -0,0 +1,133 @@
+#include "fbkern.h"
+
+/*
+ * Built with CFLAGS_SIMD: SSE2 is allowed throughout, AVX2 only in the
+ * functions that ask for it. GCC vector extensions rather than intrinsics,
+ * since <immintrin.h> drags in hosted headers.
+ */
+
+typedef u32 v4u32 __attribute__((vector_size(16)));
+typedef u32 v8u32 __attribute__((vector_size(32)));
+
+/* Same vectors at 4-byte alignment, for stores into arbitrary rows */
+typedef u32 v4u32_u __attribute__((vector_size(16), aligned(4)));
+typedef u32 v8u32_u __attribute__((vector_size(32), aligned(4)));
+
+#define AVX2 __attribute__((target("avx2")))
+
+static inline void store_fence(void) { __asm__ volatile("sfence" ::: "memory"); }
+
+static void fill32_sse2(u32 *dst, u32 pixel, u64 count) {
+  bool stream = count * sizeof(u32) >= FB_FILL_STREAM_MIN;
+
+  while (count > 0 && ((u64)dst & 15) != 0) {
+    *dst++ = pixel;
+    count--;
+  }
+
+  v4u32 v = (v4u32){0} + pixel;
+  if (stream) {
+    for (; count >= 16; count -= 16, dst += 16) {
+      __asm__ volatile("movntdq %4, %0\n\t"
+                       "movntdq %4, %1\n\t"
+                       "movntdq %4, %2\n\t"
+                       "movntdq %4, %3"
+                       : "=m"(*(v4u32 *)dst), "=m"(*(v4u32 *)(dst + 4)),
+                         "=m"(*(v4u32 *)(dst + 8)), "=m"(*(v4u32 *)(dst + 12))
+                       : "x"(v));
+    }
+    store_fence();
+  } else {
+    for (; count >= 16; count -= 16, dst += 16) {
+      *(v4u32 *)dst = v;
+      *(v4u32 *)(dst + 4) = v;
+      *(v4u32 *)(dst + 8) = v;
+      *(v4u32 *)(dst + 12) = v;
+    }
+  }
+
+  for (; count >= 4; count -= 4, dst += 4) {
+    *(v4u32 *)dst = v;
+  }
+  while (count-- > 0) {
+    *dst++ = pixel;
+  }
+}
+
+static void glyph32_sse2(u8 *dst, u32 pitch, const u8 *glyph, u32 rows,
+                         u32 fg, u32 bg) {
+  const v4u32 bits_lo = {0x80, 0x40, 0x20, 0x10};
+  const v4u32 bits_hi = {0x08, 0x04, 0x02, 0x01};
+  v4u32 fg_v = (v4u32){0} + fg;
+  v4u32 bg_v = (v4u32){0} + bg;
+
+  for (u32 row = 0; row < rows; row++, dst += pitch) {
+    v4u32 line = (v4u32){0} + glyph[row];
+    v4u32 lo = (v4u32)((line & bits_lo) != 0);
+    v4u32 hi = (v4u32)((line & bits_hi) != 0);
+    *(v4u32_u *)dst = (fg_v & lo) | (bg_v & ~lo);
+    *(v4u32_u *)(dst + 16) = (fg_v & hi) | (bg_v & ~hi);
+  }
+}
+
+AVX2 static void fill32_avx2(u32 *dst, u32 pixel, u64 count) {
+  bool stream = count * sizeof(u32) >= FB_FILL_STREAM_MIN;
+
+  while (count > 0 && ((u64)dst & 31) != 0) {
+    *dst++ = pixel;
+    count--;
+  }
+
+  v8u32 v = (v8u32){0} + pixel;
+  if (stream) {
+    for (; count >= 32; count -= 32, dst += 32) {
+      __asm__ volatile("vmovntdq %4, %0\n\t"
+                       "vmovntdq %4, %1\n\t"
+                       "vmovntdq %4, %2\n\t"
+                       "vmovntdq %4, %3"
+                       : "=m"(*(v8u32 *)dst), "=m"(*(v8u32 *)(dst + 8)),
+                         "=m"(*(v8u32 *)(dst + 16)), "=m"(*(v8u32 *)(dst + 24))
+                       : "x"(v));
+    }
+    store_fence();
+  } else {
+    for (; count >= 32; count -= 32, dst += 32) {
+      *(v8u32 *)dst = v;
+      *(v8u32 *)(dst + 8) = v;
+      *(v8u32 *)(dst + 16) = v;
+      *(v8u32 *)(dst + 24) = v;
+    }
+  }
+
+  for (; count >= 8; count -= 8, dst += 8) {
+    *(v8u32 *)dst = v;
+  }
+  while (count-- > 0) {
+    *dst++ = pixel;
+  }
+}
+
+/* A glyph row is 8 pixels: exactly one YMM store */
+AVX2 static void glyph32_avx2(u8 *dst, u32 pitch, const u8 *glyph, u32 rows,
+                              u32 fg, u32 bg) {
+  const v8u32 bits = {0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01};
+  v8u32 fg_v = (v8u32){0} + fg;
+  v8u32 bg_v = (v8u32){0} + bg;
+
+  for (u32 row = 0; row < rows; row++, dst += pitch) {
+    v8u32 mask = (v8u32)((((v8u32){0} + glyph[row]) & bits) != 0);
+    *(v8u32_u *)dst = (fg_v & mask) | (bg_v & ~mask);
+  }
+}
+
+const struct fb_kernels fb_kernels_sse2 = {
+    .name = "SSE2",
+    .fill32 = fill32_sse2,
+    .glyph32 = glyph32_sse2,
+};
+
+const struct fb_kernels fb_kernels_avx2 = {
+    .name = "AVX2",
+    .fill32 = fill32_avx2,
+    .glyph32 = glyph32_avx2,
+};
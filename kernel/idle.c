@@ -0,0 +1,245 @@
+#include "idle.h"
+#include "kthread.h"
+#include "timer.h"
+
+#include "../arch/amd64/apic.h"
+#include "../arch/amd64/cpu.h"
+#include "../arch/amd64/idt.h"
+#include "../arch/amd64/percpu.h"
+#include "../arch/amd64/tsc.h"
+
+#define CPUID_LEAF_MWAIT 0x05
+#define CPUID_5_ECX_EXTENSIONS (1U << 0)
+
+#define MWAIT_MAX_CSTATE 7
+
+/* Correction factor: EWMA of actual/predicted idle time, fixed point */
+#define CORRECTION_ONE 1024
+#define CORRECTION_WEIGHT_SHIFT 3 /* New sample weighs 1/8 */
+
+enum idle_cpu_state {
+  IDLE_RUNNING = 0,
+  IDLE_MWAIT = 1,  /* A store to the wake word is enough */
+  IDLE_HALTED = 2, /* Needs an interrupt */
+};
+
+/*
+ * The words a waker touches, alone on their cache line: MONITOR arms on the
+ * whole line, so unrelated stores here would cause spurious wakeups.
+ */
+struct idle_wake_line {
+  u32 wake;
+  u32 state;
+} ALIGNED(64);
+
+struct idle_cpu {
+  struct idle_wake_line line;
+  u64 correction;
+  struct idle_stats stats;
+};
+
+/*
+ * ACPI _CST would give exact figures; until there is an ACPI parser, use
+ * conservative break-even times for each MWAIT C-state.
+ */
+static const char *const cstate_names[MWAIT_MAX_CSTATE + 1] = {
+    "C0", "C1", "C2", "C3", "C4", "C5", "C6", "C7",
+};
+static const u64 cstate_residency_ns[MWAIT_MAX_CSTATE + 1] = {
+    0, 2000, 20000, 100000, 400000, 800000, 1500000, 3000000,
+};
+
+static struct idle_state states[IDLE_MAX_STATES];
+static u32 state_count = 0;
+static bool use_mwait = false;
+
+static struct idle_cpu idle_cpus[MAX_CPUS];
+
+static inline void cpu_monitor(const volatile void *address) {
+  __asm__ volatile("monitor" : : "a"(address), "c"(0), "d"(0));
+}
+
+/* STI's one-instruction shadow guarantees no wakeup is lost in between */
+static inline void cpu_sti_mwait(u32 hint) {
+  __asm__ volatile("sti; mwait" : : "a"(hint), "c"(0) : "memory");
+}
+
+static inline void cpu_sti_hlt(void) {
+  __asm__ volatile("sti; hlt" ::: "memory");
+}
+
+static void idle_wakeup_interrupt(u8 vector) {
+  UNUSED(vector); /* Taking the interrupt is the whole point */
+}
+
+static void idle_detect_states(void) {
+  state_count = 0;
+
+  if (cpu_has(CPU_FEATURE_MONITOR) && cpu_max_leaf() >= CPUID_LEAF_MWAIT) {
+    u32 eax, ebx, ecx, edx;
+    cpuid(CPUID_LEAF_MWAIT, 0, &eax, &ebx, &ecx, &edx);
+
+    if (ecx & CPUID_5_ECX_EXTENSIONS) {
+      /* EDX[4n+3:4n] = number of sub-states of Cn; hint is (n - 1) << 4 */
+      for (u32 cstate = 1; cstate <= MWAIT_MAX_CSTATE; cstate++) {
+        u32 substates = (edx >> (cstate * 4)) & 0xF;
+        if (substates == 0 || state_count >= IDLE_MAX_STATES) {
+          continue;
+        }
+
+        states[state_count].name = cstate_names[cstate];
+        states[state_count].mwait_hint = (cstate - 1) << 4;
+        states[state_count].target_residency_ns = cstate_residency_ns[cstate];
+        state_count++;
+      }
+    }
+  }
+
+  use_mwait = state_count > 0;
+  if (!use_mwait) {
+    states[0].name = "HLT";
+    states[0].mwait_hint = 0;
+    states[0].target_residency_ns = 0;
+    state_count = 1;
+  }
+}
+
+void idle_init(void) {
+  idle_detect_states();
+  irq_register(APIC_WAKEUP_VECTOR, idle_wakeup_interrupt);
+  idle_init_cpu();
+}
+
+void idle_init_cpu(void) {
+  struct idle_cpu *idle = &idle_cpus[this_cpu_id()];
+  idle->line.wake = 0;
+  idle->line.state = IDLE_RUNNING;
+  idle->correction = CORRECTION_ONE;
+}
+
+/* Deepest state whose break-even time fits the predicted idle period */
+static u32 idle_select(u64 predicted_ns) {
+  u32 chosen = 0;
+  for (u32 i = 1; i < state_count; i++) {
+    if (states[i].target_residency_ns <= predicted_ns) {
+      chosen = i;
+    }
+  }
+  return chosen;
+}
+
+static void idle_enter(struct idle_cpu *idle) {
+  cli();
+
+  if (__atomic_exchange_n(&idle->line.wake, 0, __ATOMIC_ACQ_REL)) {
+    idle->stats.monitor_wakeups++;
+    sti();
+    return;
+  }
+
+  /* Nothing periodic runs: the next event is the next timer, if any. */
+  u64 now = clock_monotonic_ns();
+  u64 next = timer_next_expiry();
+  u64 until = TIMER_NONE;
+  if (next != TIMER_NONE) {
+    until = next > now ? next - now : 0;
+  }
+
+  /* Devices wake us before the timer does; scale the prediction by how
+   * much of it we have actually been getting. */
+  u64 predicted = until;
+  if (until != TIMER_NONE) {
+    predicted = (u64)(((unsigned __int128)until * idle->correction) /
+                      CORRECTION_ONE);
+  }
+
+  u32 index = idle_select(predicted);
+
+  if (use_mwait) {
+    __atomic_store_n(&idle->line.state, IDLE_MWAIT, __ATOMIC_SEQ_CST);
+    cpu_monitor(&idle->line.wake);
+    if (__atomic_load_n(&idle->line.wake, __ATOMIC_SEQ_CST) == 0) {
+      cpu_sti_mwait(states[index].mwait_hint);
+    } else {
+      sti();
+    }
+  } else {
+    __atomic_store_n(&idle->line.state, IDLE_HALTED, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&idle->line.wake, __ATOMIC_SEQ_CST) == 0) {
+      cpu_sti_hlt();
+    } else {
+      sti();
+    }
+  }
+
+  __atomic_store_n(&idle->line.state, IDLE_RUNNING, __ATOMIC_RELEASE);
+
+  u64 actual = clock_monotonic_ns() - now;
+  idle->stats.entries[index]++;
+  idle->stats.residency_ns[index] += actual;
+
+  if (until != TIMER_NONE && until != 0) {
+    u64 ratio = MIN(actual, until) * CORRECTION_ONE / until;
+    i64 error = (i64)ratio - (i64)idle->correction;
+    idle->correction += error >> CORRECTION_WEIGHT_SHIFT;
+  }
+
+  if (__atomic_exchange_n(&idle->line.wake, 0, __ATOMIC_ACQ_REL)) {
+    idle->stats.monitor_wakeups++;
+  }
+}
+
+/*
+ * Body of each CPU's idle thread: run whatever is queued, and sleep when
+ * nothing is. A wakeup queued after schedule() came back empty also sets
+ * the wake word, so idle_enter() returns straight away.
+ */
+NORETURN void idle_loop(void) {
+  struct idle_cpu *idle = &idle_cpus[this_cpu_id()];
+
+  for (;;) {
+    schedule();
+    idle_enter(idle);
+  }
+}
+
+/*
+ * Wake an idle CPU. A CPU in MWAIT is woken by the store to its monitored
+ * line alone; only a CPU sitting in HLT needs an IPI.
+ */
+void idle_wake_cpu(u32 cpu) {
+  if (cpu >= MAX_CPUS) {
+    return;
+  }
+
+  struct idle_cpu *idle = &idle_cpus[cpu];
+  __atomic_store_n(&idle->line.wake, 1, __ATOMIC_SEQ_CST);
+
+  if (cpu == this_cpu_id()) {
+    return;
+  }
+
+  if (__atomic_load_n(&idle->line.state, __ATOMIC_SEQ_CST) == IDLE_HALTED) {
+    struct percpu *target = percpu_get(cpu);
+    apic_send_ipi(target->apic_id, APIC_WAKEUP_VECTOR);
+    __atomic_fetch_add(&idle->stats.ipi_wakeups, 1, __ATOMIC_RELAXED);
+  }
+}
+
+bool idle_uses_mwait(void) { return use_mwait; }
+
+u32 idle_state_count(void) { return state_count; }
+
+const struct idle_state *idle_get_state(u32 index) {
+  if (index >= state_count) {
+    return NULL;
+  }
+  return &states[index];
+}
+
+void idle_get_stats(u32 cpu, struct idle_stats *stats) {
+  if (cpu >= MAX_CPUS || stats == NULL) {
+    return;
+  }
+  *stats = idle_cpus[cpu].stats;
+}
@@ -0,0 +1,37 @@
+#ifndef DELTA_KERNEL_IDLE_H
+#define DELTA_KERNEL_IDLE_H
+
+#include "types.h"
+
+#define IDLE_MAX_STATES 8
+
+struct idle_state {
+  const char *name;
+  u32 mwait_hint;          /* EAX for MWAIT */
+  u64 target_residency_ns; /* Minimum idle time that makes it worthwhile */
+};
+
+struct idle_stats {
+  u64 entries[IDLE_MAX_STATES];
+  u64 residency_ns[IDLE_MAX_STATES];
+  u64 ipi_wakeups;     /* Wakeups that needed an IPI (no MWAIT) */
+  u64 monitor_wakeups; /* Wakeups by a store to the monitored line */
+};
+
+void idle_init(void);
+
+void idle_init_cpu(void);
+
+NORETURN void idle_loop(void);
+
+void idle_wake_cpu(u32 cpu);
+
+bool idle_uses_mwait(void);
+
+u32 idle_state_count(void);
+
+const struct idle_state *idle_get_state(u32 index);
+
+void idle_get_stats(u32 cpu, struct idle_stats *stats);
+
+#endif /* DELTA_KERNEL_IDLE_H */
@@ -0,0 +1,209 @@
+#include "initrd.h"
+#include "lz4.h"
+#include "pmm.h"
+#include "ramfs.h"
+#include "workqueue.h"
+
+#include "../arch/amd64/arch_types.h"
+#include "../arch/amd64/percpu.h"
+#include "../arch/amd64/smp.h"
+#include "../arch/amd64/tsc.h"
+
+struct unpack_frame {
+  struct lz4_frame lz4;
+  u64 offset; /* Into the output */
+};
+
+/*
+ * One unpack at a time (boot). CPUs claim frames by index until none are
+ * left, so a large frame on one CPU does not hold the others up.
+ */
+static struct {
+  struct unpack_frame *frames;
+  u32 count;
+  u8 *out;
+  u32 next;
+  u32 active; /* Workers still running */
+  u32 failed;
+} job;
+
+static struct work unpack_work[MAX_CPUS];
+static struct initrd_stats stats;
+static bool in_place = false;
+
+static void unpack_frames(void) {
+  for (;;) {
+    u32 index = __atomic_fetch_add(&job.next, 1, __ATOMIC_RELAXED);
+    if (index >= job.count) {
+      return;
+    }
+
+    const struct unpack_frame *frame = &job.frames[index];
+    if (!lz4_frame_decompress(&frame->lz4, job.out + frame->offset)) {
+      __atomic_store_n(&job.failed, 1, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+static void unpack_worker(struct work *work) {
+  UNUSED(work);
+  unpack_frames();
+  __atomic_fetch_sub(&job.active, 1, __ATOMIC_RELEASE);
+}
+
+static void free_pages(u64 base, u64 count) {
+  for (u64 i = 0; i < count; i++) {
+    pmm_free_page(base + i * PAGE_SIZE);
+  }
+}
+
+/* Walk the frames: how many, and how much they unpack to. false if bad. */
+static bool count_frames(const u8 *image, u64 length, u32 *frames,
+                         u64 *bytes) {
+  *frames = 0;
+  *bytes = 0;
+
+  for (u64 offset = 0; offset < length;) {
+    struct lz4_frame frame;
+    u64 used = lz4_frame_parse(image + offset, length - offset, &frame);
+    if (used == 0 || frame.content_size > U64_MAX - *bytes) {
+      return false;
+    }
+    if (frame.blocks != NULL) {
+      (*frames)++;
+      *bytes += frame.content_size;
+    }
+    offset += used;
+  }
+  return true;
+}
+
+/*
+ * Decompress every frame into one contiguous run of pages, so the ramfs
+ * can index the result in place. The calling CPU takes frames too, and
+ * waits for the others to finish theirs. After workqueue_init().
+ */
+static bool unpack(const u8 *image, u64 length, u8 **out, u64 *out_length) {
+  u64 start = clock_monotonic_ns();
+
+  u32 count;
+  u64 bytes;
+  if (!count_frames(image, length, &count, &bytes) || count == 0 ||
+      bytes == 0) {
+    return false;
+  }
+
+  u64 frame_bytes = (u64)count * sizeof(struct unpack_frame);
+  u64 frame_pages = ALIGN_UP(frame_bytes, PAGE_SIZE) / PAGE_SIZE;
+  u64 out_pages = ALIGN_UP(bytes, PAGE_SIZE) / PAGE_SIZE;
+  u64 frames_base = pmm_alloc_pages(frame_pages);
+  if (frames_base == 0) {
+    return false;
+  }
+  u64 out_base = pmm_alloc_pages(out_pages);
+  if (out_base == 0) {
+    free_pages(frames_base, frame_pages);
+    return false;
+  }
+
+  struct unpack_frame *frames = phys_to_virt(frames_base);
+  u64 offset = 0;
+  u32 index = 0;
+  for (u64 at = 0; at < length;) {
+    struct lz4_frame frame;
+    at += lz4_frame_parse(image + at, length - at, &frame);
+    if (frame.blocks != NULL) {
+      frames[index].lz4 = frame;
+      frames[index].offset = offset;
+      offset += frame.content_size;
+      index++;
+    }
+  }
+
+  job.frames = frames;
+  job.count = count;
+  job.out = phys_to_virt(out_base);
+  job.next = 0;
+  job.failed = 0;
+  job.active = 0;
+
+  /* Counted before queueing: a worker may finish before we look again */
+  u32 cpus = 1;
+  u32 self = this_cpu_id();
+  for (u32 cpu = 0; cpu < smp_cpu_count() && cpus < count; cpu++) {
+    if (cpu == self) {
+      continue;
+    }
+    work_init(&unpack_work[cpu], unpack_worker);
+    __atomic_fetch_add(&job.active, 1, __ATOMIC_RELAXED);
+    if (queue_work_on(cpu, &unpack_work[cpu])) {
+      cpus++;
+    } else {
+      __atomic_fetch_sub(&job.active, 1, __ATOMIC_RELAXED);
+    }
+  }
+
+  unpack_frames();
+  while (__atomic_load_n(&job.active, __ATOMIC_ACQUIRE) != 0) {
+    cpu_relax();
+  }
+
+  free_pages(frames_base, frame_pages);
+  if (job.failed) {
+    free_pages(out_base, out_pages);
+    return false;
+  }
+
+  stats.frames = count;
+  stats.cpus = cpus;
+  stats.compressed_bytes = length;
+  stats.bytes = bytes;
+  stats.unpack_ns = clock_monotonic_ns() - start;
+
+  *out = job.out;
+  *out_length = bytes;
+  return true;
+}
+
+/*
+ * Mount the initrd as the ramfs, unpacking it first if it is compressed.
+ * false if there is an initrd but it could not be used.
+ */
+bool initrd_load(const struct parsed_boot_info *info) {
+  if (!info->has_initrd) {
+    return true;
+  }
+
+  const u8 *image = phys_to_virt(info->initrd->start);
+  u64 length = info->initrd->length;
+
+  if (!lz4_frame_magic(image, length)) {
+    in_place = ramfs_init(image, length, RAMFS_BOOT_MEMORY);
+    return in_place;
+  }
+
+  stats.compressed = true;
+  u8 *unpacked;
+  u64 unpacked_length;
+  if (!unpack(image, length, &unpacked, &unpacked_length)) {
+    return false;
+  }
+  if (!ramfs_init(unpacked, unpacked_length, RAMFS_PAGE_ALLOCATOR)) {
+    free_pages(virt_to_phys(unpacked),
+               ALIGN_UP(unpacked_length, PAGE_SIZE) / PAGE_SIZE);
+    return false;
+  }
+  return true;
+}
+
+void initrd_get_stats(struct initrd_stats *out) {
+  if (out != NULL) {
+    *out = stats;
+  }
+}
+
+/*
+ * Whether the ramfs indexes the boot image itself. Its memory then stays
+ * with the ramfs, which gives it back file by file (ramfs_release()).
+ */
+bool initrd_in_place(void) { return in_place; }
@@ -0,0 +1,31 @@
+#ifndef DELTA_KERNEL_INITRD_H
+#define DELTA_KERNEL_INITRD_H
+
+#include "boot_info.h"
+#include "types.h"
+
+/*
+ * Initrd loading: the image from DB_TAG_INITRD is mounted as the ramfs,
+ * in place if it is a plain cpio archive. An image made of LZ4 frames
+ * (each compressed on its own, with its size in the header) is unpacked
+ * first into pages from the physical allocator. Frames are handed out to
+ * every online CPU through the work queues, so they decompress in
+ * parallel, and each frame's checksum is verified.
+ */
+
+struct initrd_stats {
+  bool compressed;
+  u32 frames;
+  u32 cpus; /* CPUs that took part in decompression */
+  u64 compressed_bytes;
+  u64 bytes; /* Uncompressed */
+  u64 unpack_ns;
+};
+
+bool initrd_load(const struct parsed_boot_info *info);
+
+void initrd_get_stats(struct initrd_stats *stats);
+
+bool initrd_in_place(void);
+
+#endif /* DELTA_KERNEL_INITRD_H */
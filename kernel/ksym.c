@@ -0,0 +1,64 @@
+#include "ksym.h"
+
+/* Generated by tools/ksym_gen (the Makefile's two-pass link) */
+extern const struct ksym_header ksym_table;
+
+static const u8 *names(void) {
+  return (const u8 *)&ksym_table.entries[ksym_table.count];
+}
+
+static bool table_valid(void) {
+  return ksym_table.magic == KSYM_MAGIC && ksym_table.count > 0;
+}
+
+u32 ksym_count(void) { return table_valid() ? ksym_table.count : 0; }
+
+u64 ksym_table_size(void) {
+  return sizeof(ksym_table) +
+         (u64)ksym_table.count * sizeof(struct ksym_entry) +
+         ksym_table.names_size;
+}
+
+/* Rebuild name index from the last whole name before it */
+static void decode_name(u32 index, char *out) {
+  const struct ksym_entry *entry = ksym_table.entries;
+  for (u32 i = index & ~(u32)(KSYM_RESTART - 1); i <= index; i++) {
+    const u8 *encoded = names() + entry[i].name;
+    u32 prefix = encoded[0];
+    u32 length = encoded[1];
+    for (u32 j = 0; j < length && prefix + j < KSYM_NAME_MAX - 1; j++) {
+      out[prefix + j] = (char)encoded[2 + j];
+    }
+    out[prefix + length < KSYM_NAME_MAX ? prefix + length
+                                        : KSYM_NAME_MAX - 1] = '\0';
+  }
+}
+
+/*
+ * Find the symbol containing address: the last one starting at or below
+ * it, if the address is inside .text at all.
+ */
+bool ksym_lookup(u64 address, struct ksym *sym) {
+  if (!table_valid() || address < ksym_table.base ||
+      address - ksym_table.base >= ksym_table.end) {
+    return false;
+  }
+
+  u32 offset = (u32)(address - ksym_table.base);
+  const struct ksym_entry *entry = ksym_table.entries;
+  u32 low = 0;
+  u32 high = ksym_table.count; /* entry[low].offset <= offset < [high] */
+  while (high - low > 1) {
+    u32 middle = low + (high - low) / 2;
+    if (entry[middle].offset <= offset) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+
+  sym->address = ksym_table.base + entry[low].offset;
+  sym->offset = offset - entry[low].offset;
+  decode_name(low, sym->name);
+  return true;
+}
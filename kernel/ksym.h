@@ -0,0 +1,52 @@
+#ifndef DELTA_KERNEL_KSYM_H
+#define DELTA_KERNEL_KSYM_H
+
+#include "types.h"
+
+/*
+ * The kernel's own symbol table, for turning code addresses into names in
+ * panics and profiles. tools/ksym_gen builds it from a first link of the
+ * kernel and the second link embeds it in .rodata (section .ksym):
+ *
+ *   struct ksym_header          with entries[count], sorted by offset
+ *   names                       front-coded, see below
+ *
+ * Each name is stored as the number of leading bytes it shares with the
+ * previous symbol's name, its remaining length, then those bytes. Every
+ * KSYM_RESTART-th name is stored whole, so decoding one costs at most
+ * KSYM_RESTART steps. A lookup is a binary search plus that decode, with
+ * no allocation and no lock, so it is safe in an NMI or a panic.
+ */
+
+#define KSYM_MAGIC 0x4D59534BU /* "KSYM" */
+#define KSYM_NAME_MAX 128      /* NUL included */
+#define KSYM_RESTART 16
+
+/* Layout shared with tools/ksym_gen; the names follow the entries */
+struct ksym_entry {
+  u32 offset; /* Address - base */
+  u32 name;   /* Offset of the encoded name in the names */
+};
+
+struct ksym_header {
+  u32 magic;
+  u32 count;
+  u64 base;       /* Address of the first symbol */
+  u32 end;        /* Offset of the end of .text */
+  u32 names_size; /* Bytes of names after the entries */
+  struct ksym_entry entries[];
+};
+
+struct ksym {
+  u64 address; /* Start of the symbol */
+  u64 offset;  /* From the start to the address looked up */
+  char name[KSYM_NAME_MAX];
+};
+
+bool ksym_lookup(u64 address, struct ksym *sym);
+
+u32 ksym_count(void);
+
+u64 ksym_table_size(void);
+
+#endif /* DELTA_KERNEL_KSYM_H */
@@ -0,0 +1,428 @@
+#include "kthread.h"
+#include "panic.h"
+#include "spinlock.h"
+
+#include "../arch/amd64/fpu.h"
+#include "../arch/amd64/idt.h"
+#include "../arch/amd64/syscall.h"
+#include "../arch/amd64/tsc.h"
+
+#define STACK_CANARY 0x5AFE57AC4B1D0E5AULL
+
+#define PING_PONG_ROUNDS 10000
+
+#define KTHREAD(t) CONTAINER_OF(t, struct kthread, task)
+
+/*
+ * One pool entry. The stack grows down towards its canary, which sits at
+ * the lowest address of the stack itself and is checked on every switch.
+ */
+struct kthread_slot {
+  u8 fpu_state[FPU_STATE_MAX] ALIGNED(FPU_STATE_ALIGN);
+  struct kthread thread;
+  struct kthread_slot *next_free;
+  u8 stack[KTHREAD_STACK_SIZE] ALIGNED(16);
+};
+
+struct kthread_cpu {
+  struct kthread idle; /* The CPU's boot context */
+  bool in_kernel_fpu;  /* Inside kernel_fpu_begin/end */
+  u8 idle_fpu_state[FPU_STATE_MAX] ALIGNED(FPU_STATE_ALIGN);
+} ALIGNED(64);
+
+/* The switch ping-pong run by kthread_measure_switch() */
+struct ping_pong {
+  struct kthread *ping;
+  struct kthread *pong;
+  u32 turn; /* Which of the two may run its round */
+  u64 start_tsc;
+  u64 end_tsc;
+  bool done;
+};
+
+enum { PING_TURN = 0, PONG_TURN = 1 };
+
+/* switch.asm */
+struct kthread *context_switch(u64 *prev_rsp, u64 next_rsp,
+                               struct kthread *prev);
+void kthread_entry_stub(void);
+
+NORETURN void kthread_entry(struct kthread *last);
+
+static struct kthread_slot slots[KTHREAD_MAX];
+static struct kthread_slot *free_slots = NULL;
+static struct spinlock pool_lock = SPINLOCK_INIT;
+
+static struct kthread_cpu kthread_cpus[MAX_CPUS];
+
+static struct ping_pong ping_pong;
+
+static inline u64 *slot_canary(struct kthread_slot *slot) {
+  return (u64 *)slot->stack;
+}
+
+static void slot_free(struct kthread_slot *slot) {
+  u64 flags = spin_lock_irqsave(&pool_lock);
+  slot->next_free = free_slots;
+  free_slots = slot;
+  spin_unlock_irqrestore(&pool_lock, flags);
+}
+
+/*
+ * Eager switch: the registers always hold the running thread's state. The
+ * save is cheap for the common thread that never touched the FPU, as
+ * XSAVEOPT/XSAVES write only components out of their init state, and skip
+ * those unmodified since this area was last restored.
+ */
+static inline void fpu_switch(struct kthread *prev, struct kthread *next) {
+  fpu_save(prev->fpu_state);
+  fpu_restore(next->fpu_state);
+}
+
+/* Completes a switch on the new thread's side: last's context is saved */
+static void finish_switch(struct kthread *last) {
+  __atomic_store_n(&last->task.on_cpu, false, __ATOMIC_RELEASE);
+
+  if (last->task.state == TASK_DEAD) {
+    slot_free(last->slot); /* We are off its stack now */
+  }
+}
+
+/*
+ * Give the CPU to the next task, if there is one. The running thread is
+ * requeued if it is still TASK_RUNNING, otherwise it stays off the run
+ * queue until woken.
+ */
+void schedule(void) {
+  u64 flags = irq_save();
+
+  u32 cpu = this_cpu_id();
+  struct kthread_cpu *kc = &kthread_cpus[cpu];
+  struct kthread *prev = this_cpu_current();
+
+  if (prev != &kc->idle) {
+    sched_put_prev(&prev->task);
+  }
+
+  struct task *task = sched_pick_next();
+  struct kthread *next = task != NULL ? KTHREAD(task) : &kc->idle;
+
+  if (next == prev) {
+    irq_restore(flags);
+    return;
+  }
+
+  /* Other CPUs never take a thread whose switch out is still under way
+   * (see task_migratable), so this wait is short and cannot deadlock. */
+  while (__atomic_load_n(&next->task.on_cpu, __ATOMIC_ACQUIRE)) {
+    cpu_relax();
+  }
+  next->task.on_cpu = true;
+  this_cpu_set_current(next);
+
+  fpu_switch(prev, next);
+
+  if (next->kernel_rsp != 0) {
+    syscall_set_kernel_stack(next->kernel_rsp);
+  }
+
+  if (prev->slot != NULL && *slot_canary(prev->slot) != STACK_CANARY) {
+    panic("Kernel thread stack overflow");
+  }
+
+  struct kthread *last = context_switch(&prev->rsp, next->rsp, prev);
+  finish_switch(last);
+
+  irq_restore(flags);
+}
+
+/* Switch right away if a wakeup asked for it and nothing forbids it */
+static void preempt_check(void) {
+  struct kthread *current = this_cpu_current();
+
+  if (current != &kthread_cpus[this_cpu_id()].idle &&
+      this_cpu_preempt_count() == 0 && (read_rflags() & RFLAGS_IF) &&
+      sched_need_resched()) {
+    schedule();
+  }
+}
+
+/* IRQ exit: interrupts were enabled in the interrupted code */
+static void kthread_irq_exit(void) {
+  struct kthread *current = this_cpu_current();
+
+  if (current != NULL && current != &kthread_cpus[this_cpu_id()].idle &&
+      this_cpu_preempt_count() == 0 && sched_need_resched()) {
+    schedule();
+  }
+}
+
+NORETURN void kthread_entry(struct kthread *last) {
+  finish_switch(last);
+  sti();
+
+  struct kthread *self = this_cpu_current();
+  self->fn(self->arg);
+
+  kthread_exit();
+}
+
+/* The calling context becomes this CPU's idle thread */
+static void idle_thread_init(void) {
+  u32 cpu = this_cpu_id();
+  struct kthread_cpu *kc = &kthread_cpus[cpu];
+  struct kthread *idle = &kc->idle;
+
+  sched_task_init(&idle->task, "idle");
+  sched_task_bind(&idle->task, cpu);
+  idle->task.state = TASK_RUNNING;
+  idle->task.on_cpu = true;
+  idle->slot = NULL;
+  idle->fn = NULL;
+  idle->arg = NULL;
+  idle->fpu_state = kc->idle_fpu_state;
+  idle->wake_pending = 0;
+  idle->kernel_rsp = 0;
+  kc->in_kernel_fpu = false;
+
+  this_cpu_set_current(idle);
+}
+
+/* BSP, after sched_init() */
+void kthread_init(void) {
+  fpu_init();
+
+  free_slots = NULL;
+  for (u32 i = KTHREAD_MAX; i-- > 0;) {
+    slots[i].next_free = free_slots;
+    free_slots = &slots[i];
+  }
+
+  irq_set_exit_handler(kthread_irq_exit);
+
+  idle_thread_init();
+}
+
+/* APs, after sched_init_cpu() */
+void kthread_init_cpu(void) {
+  fpu_init_cpu();
+  idle_thread_init();
+}
+
+/*
+ * Create a thread that will run fn(arg), then exit. It does not run until
+ * kthread_start(). Returns NULL if the pool is exhausted.
+ */
+struct kthread *kthread_create(kthread_fn_t fn, void *arg, const char *name) {
+  if (fn == NULL) {
+    return NULL;
+  }
+
+  u64 flags = spin_lock_irqsave(&pool_lock);
+  struct kthread_slot *slot = free_slots;
+  if (slot != NULL) {
+    free_slots = slot->next_free;
+  }
+  spin_unlock_irqrestore(&pool_lock, flags);
+
+  if (slot == NULL) {
+    return NULL;
+  }
+
+  struct kthread *thread = &slot->thread;
+  sched_task_init(&thread->task, name);
+  thread->slot = slot;
+  thread->fn = fn;
+  thread->arg = arg;
+  thread->fpu_state = slot->fpu_state;
+  fpu_copy_init(thread->fpu_state);
+  thread->wake_pending = 0;
+  thread->kernel_rsp = 0;
+
+  *slot_canary(slot) = STACK_CANARY;
+
+  /*
+   * What context_switch pops: six callee-saved registers, then
+   * kthread_entry_stub as the return address, placed so the stub's call
+   * sees the ABI's 16-byte alignment. The top slot is a null return address
+   * for backtraces.
+   */
+  u64 *top = (u64 *)&slot->stack[KTHREAD_STACK_SIZE];
+  top[-1] = 0;
+  top[-2] = 0;
+  top[-3] = (u64)kthread_entry_stub;
+  for (u32 i = 4; i <= 9; i++) {
+    top[-i] = 0;
+  }
+  thread->rsp = (u64)&top[-9];
+
+  return thread;
+}
+
+/* Before kthread_start() only */
+bool kthread_bind(struct kthread *thread, u32 cpu) {
+  return sched_task_bind(&thread->task, cpu);
+}
+
+void kthread_start(struct kthread *thread) {
+  sched_enqueue(&thread->task);
+  preempt_check();
+}
+
+NORETURN void kthread_exit(void) {
+  cli();
+  this_cpu_current()->task.state = TASK_DEAD;
+  schedule();
+  panic_unreachable();
+}
+
+/*
+ * Sleep until kthread_wake(). A wakeup that arrives first is not lost:
+ * this then returns at once. Wakeups may also be spurious, so callers
+ * re-check what they are waiting for.
+ */
+void kthread_block(void) {
+  struct kthread *self = this_cpu_current();
+
+  if (__atomic_exchange_n(&self->wake_pending, 0, __ATOMIC_ACQ_REL)) {
+    return;
+  }
+
+  __atomic_store_n(&self->task.state, TASK_BLOCKED, __ATOMIC_SEQ_CST);
+
+  if (__atomic_exchange_n(&self->wake_pending, 0, __ATOMIC_SEQ_CST)) {
+    /* Raced a waker. If it already moved us to RUNNABLE, its enqueue will
+     * find us still running and mark us RUNNING again. */
+    enum task_state expected = TASK_BLOCKED;
+    __atomic_compare_exchange_n(&self->task.state, &expected, TASK_RUNNING,
+                                false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    return;
+  }
+
+  schedule();
+}
+
+/* Safe from any CPU and from interrupt handlers */
+void kthread_wake(struct kthread *thread) {
+  struct task *task = &thread->task;
+
+  __atomic_store_n(&thread->wake_pending, 1, __ATOMIC_SEQ_CST);
+
+  enum task_state expected = TASK_BLOCKED;
+  if (!__atomic_compare_exchange_n(&task->state, &expected, TASK_RUNNABLE,
+                                   false, __ATOMIC_SEQ_CST,
+                                   __ATOMIC_RELAXED)) {
+    return; /* Running, or already being woken: the token is enough */
+  }
+
+  /* Delivered by the enqueue: the token must not end a later sleep too */
+  __atomic_store_n(&thread->wake_pending, 0, __ATOMIC_RELAXED);
+
+  /* Back where it last ran: only that CPU may pick it until it is fully
+   * switched out */
+  sched_enqueue_on(task->cpu, task);
+  preempt_check();
+}
+
+/*
+ * Kernel SIMD is allowed once the FPU is set up and this CPU runs threads,
+ * and not inside another kernel_fpu_begin/end (an interrupt handler that
+ * interrupted one, say): callers fall back to scalar code otherwise.
+ */
+bool kernel_fpu_usable(void) {
+  if (!fpu_ready() || this_cpu_current() == NULL) {
+    return false;
+  }
+  return !kthread_cpus[this_cpu_id()].in_kernel_fpu;
+}
+
+/*
+ * Lend the FPU/SIMD registers to kernel code: the running thread's state
+ * is saved and comes back in kernel_fpu_end(). No preemption in between,
+ * so the region must not sleep. Check kernel_fpu_usable() first.
+ */
+void kernel_fpu_begin(void) {
+  preempt_disable();
+
+  u64 flags = irq_save();
+  struct kthread *current = this_cpu_current();
+  kthread_cpus[this_cpu_id()].in_kernel_fpu = true;
+  fpu_save(current->fpu_state);
+  irq_restore(flags);
+}
+
+void kernel_fpu_end(void) {
+  u64 flags = irq_save();
+  struct kthread *current = this_cpu_current();
+  fpu_restore(current->fpu_state);
+  kthread_cpus[this_cpu_id()].in_kernel_fpu = false;
+  irq_restore(flags);
+
+  preempt_enable_no_resched();
+  preempt_check(); /* Not from interrupt handlers: IF is clear there */
+}
+
+static void ping_thread(void *arg) {
+  struct ping_pong *pp = arg;
+
+  pp->start_tsc = rdtsc_ordered();
+  for (u32 round = 0; round < PING_PONG_ROUNDS; round++) {
+    __atomic_store_n(&pp->turn, PONG_TURN, __ATOMIC_RELEASE);
+    kthread_wake(pp->pong);
+    while (__atomic_load_n(&pp->turn, __ATOMIC_ACQUIRE) != PING_TURN) {
+      kthread_block();
+    }
+  }
+  pp->end_tsc = rdtsc_ordered();
+
+  __atomic_store_n(&pp->done, true, __ATOMIC_RELEASE);
+}
+
+static void pong_thread(void *arg) {
+  struct ping_pong *pp = arg;
+
+  for (u32 round = 0; round < PING_PONG_ROUNDS; round++) {
+    while (__atomic_load_n(&pp->turn, __ATOMIC_ACQUIRE) != PONG_TURN) {
+      kthread_block();
+    }
+    __atomic_store_n(&pp->turn, PING_TURN, __ATOMIC_RELEASE);
+    kthread_wake(pp->ping);
+  }
+}
+
+/*
+ * Two threads bound to the calling CPU hand a token back and forth, each
+ * blocking until the other wakes it: every round is two full block/wake
+ * switches. Returns TSC cycles per switch, or 0 if the pool is exhausted.
+ * Must be called from the idle (boot) context, with nothing else queued.
+ */
+u64 kthread_measure_switch(void) {
+  struct ping_pong *pp = &ping_pong;
+  u32 cpu = this_cpu_id();
+
+  pp->turn = PING_TURN;
+  pp->done = false;
+  pp->ping = kthread_create(ping_thread, pp, "ping");
+  pp->pong = kthread_create(pong_thread, pp, "pong");
+
+  if (pp->ping == NULL || pp->pong == NULL) {
+    if (pp->ping != NULL) {
+      slot_free(pp->ping->slot);
+    }
+    if (pp->pong != NULL) {
+      slot_free(pp->pong->slot);
+    }
+    return 0;
+  }
+
+  kthread_bind(pp->ping, cpu);
+  kthread_bind(pp->pong, cpu);
+  kthread_start(pp->pong);
+  kthread_start(pp->ping);
+
+  while (!__atomic_load_n(&pp->done, __ATOMIC_ACQUIRE)) {
+    schedule();
+  }
+
+  return (pp->end_tsc - pp->start_tsc) / (2 * PING_PONG_ROUNDS);
+}
@@ -0,0 +1,79 @@
+#ifndef DELTA_KERNEL_KTHREAD_H
+#define DELTA_KERNEL_KTHREAD_H
+
+#include "sched.h"
+#include "types.h"
+
+#include "../arch/amd64/percpu.h"
+
+/*
+ * Kernel threads: the execution contexts the scheduler's tasks run in.
+ *
+ * Stacks come from a fixed pool of small slots. A switch saves only the
+ * callee-saved registers, plus the FPU/SIMD state, which is switched
+ * eagerly (see fpu.h for why that is cheap). Kernel code may use SIMD only
+ * between kernel_fpu_begin() and kernel_fpu_end().
+ *
+ * Each CPU's boot context becomes its idle thread, which runs whenever the
+ * run queue is empty. A running thread is preempted on interrupt exit only,
+ * so code holding an interrupt-disabling lock is never preempted;
+ * preempt_disable() covers sections that must not be, with interrupts on.
+ */
+
+#define KTHREAD_STACK_SIZE (8 * 1024)
+#define KTHREAD_MAX 128
+
+typedef void (*kthread_fn_t)(void *arg);
+
+struct kthread_slot;
+
+struct kthread {
+  struct task task; /* Must stay first */
+  u64 rsp;          /* Saved stack pointer while switched out */
+  struct kthread_slot *slot; /* NULL for idle threads */
+  kthread_fn_t fn;
+  void *arg;
+  u8 *fpu_state; /* Saved while switched out or lent to kernel SIMD */
+  u32 wake_pending; /* kthread_wake() arrived before kthread_block() */
+  u64 kernel_rsp;   /* Kernel stack top while running user code, else 0 */
+};
+
+void kthread_init(void);
+
+void kthread_init_cpu(void);
+
+struct kthread *kthread_create(kthread_fn_t fn, void *arg, const char *name);
+
+bool kthread_bind(struct kthread *thread, u32 cpu);
+
+void kthread_start(struct kthread *thread);
+
+NORETURN void kthread_exit(void);
+
+void kthread_block(void);
+
+void kthread_wake(struct kthread *thread);
+
+void schedule(void);
+
+u64 kthread_measure_switch(void);
+
+bool kernel_fpu_usable(void);
+
+void kernel_fpu_begin(void);
+
+void kernel_fpu_end(void);
+
+static inline struct kthread *kthread_current(void) {
+  return this_cpu_current();
+}
+
+/* Reschedule if a wakeup asked for it while preemption was disabled */
+static inline void preempt_enable(void) {
+  preempt_enable_no_resched();
+  if (this_cpu_preempt_count() == 0 && sched_need_resched()) {
+    schedule();
+  }
+}
+
+#endif /* DELTA_KERNEL_KTHREAD_H */
@@ -0,0 +1,74 @@
+#ifndef DELTA_KERNEL_LIST_H
+#define DELTA_KERNEL_LIST_H
+
+#include "types.h"
+
+/* Intrusive, circular, doubly linked list. An empty head points at itself. */
+struct list_node {
+  struct list_node *next;
+  struct list_node *prev;
+};
+
+#define LIST_ENTRY(node, type, member) CONTAINER_OF(node, type, member)
+
+static inline void list_init(struct list_node *head) {
+  head->next = head;
+  head->prev = head;
+}
+
+static inline bool list_empty(const struct list_node *head) {
+  return head->next == head;
+}
+
+static inline void list_insert_between(struct list_node *node,
+                                       struct list_node *prev,
+                                       struct list_node *next) {
+  node->prev = prev;
+  node->next = next;
+  prev->next = node;
+  next->prev = node;
+}
+
+static inline void list_add_head(struct list_node *head,
+                                 struct list_node *node) {
+  list_insert_between(node, head, head->next);
+}
+
+static inline void list_add_tail(struct list_node *head,
+                                 struct list_node *node) {
+  list_insert_between(node, head->prev, head);
+}
+
+static inline void list_remove(struct list_node *node) {
+  node->prev->next = node->next;
+  node->next->prev = node->prev;
+  list_init(node); /* Safe to remove twice */
+}
+
+static inline struct list_node *list_pop_head(struct list_node *head) {
+  if (list_empty(head)) {
+    return NULL;
+  }
+  struct list_node *node = head->next;
+  list_remove(node);
+  return node;
+}
+
+/* Move every node from src to the tail of dst, leaving src empty */
+static inline void list_splice_tail(struct list_node *dst,
+                                    struct list_node *src) {
+  if (list_empty(src)) {
+    return;
+  }
+  struct list_node *first = src->next;
+  struct list_node *last = src->prev;
+
+  first->prev = dst->prev;
+  dst->prev->next = first;
+  last->next = dst;
+  dst->prev = last;
+
+  list_init(src);
+}
+
+#endif /* DELTA_KERNEL_LIST_H */
@@ -0,0 +1,85 @@
+#include "log.h"
+
+#define LOG_RING_MASK (LOG_RING_SIZE - 1)
+
+_Static_assert((LOG_RING_SIZE & LOG_RING_MASK) == 0,
+               "LOG_RING_SIZE must be a power of two");
+
+static char ring[LOG_RING_SIZE];
+static u64 head = 0; /* Bytes ever reserved */
+
+void log_write(const char *text, u64 length) {
+  if (text == NULL || length == 0) {
+    return;
+  }
+
+  /* Only the tail of an oversized write would survive anyway */
+  if (length > LOG_RING_SIZE) {
+    text += length - LOG_RING_SIZE;
+    length = LOG_RING_SIZE;
+  }
+
+  u64 at = __atomic_fetch_add(&head, length, __ATOMIC_RELAXED);
+  for (u64 i = 0; i < length; i++) {
+    ring[(at + i) & LOG_RING_MASK] = text[i];
+  }
+}
+
+/*
+ * Where the next byte goes: everything before it has been reserved, but a
+ * writer still copying (another CPU, or one this CPU interrupted) may not
+ * have filled its part in yet.
+ */
+u64 log_position(void) { return __atomic_load_n(&head, __ATOMIC_RELAXED); }
+
+/* The oldest position the ring still holds */
+u64 log_oldest(void) {
+  u64 position = log_position();
+  return position > LOG_RING_SIZE ? position - LOG_RING_SIZE : 0;
+}
+
+/*
+ * Where the last `records` lines start, an unfinished last line counting
+ * as one. Stops at the oldest byte still held.
+ */
+u64 log_record_start(u32 records) {
+  u64 position = log_position();
+  u64 oldest = log_oldest();
+  if (records == 0) {
+    return position;
+  }
+
+  /* A trailing newline ends the last record rather than starting one */
+  u64 at = position;
+  if (at > oldest && ring[(at - 1) & LOG_RING_MASK] == '\n') {
+    at--;
+  }
+  for (; at > oldest; at--) {
+    if (ring[(at - 1) & LOG_RING_MASK] == '\n' && --records == 0) {
+      return at;
+    }
+  }
+  return oldest;
+}
+
+/*
+ * Hand everything from `from` to the present to sink, in at most two runs
+ * (the ring wraps once). Positions the ring no longer holds are skipped.
+ * Space reserved by a write still in progress goes out as whatever the
+ * ring held there before, so a replay racing a writer can show torn text.
+ */
+void log_replay(u64 from, log_sink_t sink) {
+  u64 to = log_position();
+  from = MAX(from, log_oldest());
+  if (from >= to) {
+    return;
+  }
+
+  u64 start = from & LOG_RING_MASK;
+  u64 length = to - from;
+  u64 first = MIN(length, LOG_RING_SIZE - start);
+  sink(&ring[start], first);
+  if (first < length) {
+    sink(&ring[0], length - first);
+  }
+}
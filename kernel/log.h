@@ -0,0 +1,36 @@
+#ifndef DELTA_KERNEL_LOG_H
+#define DELTA_KERNEL_LOG_H
+
+#include "types.h"
+
+/*
+ * The kernel log: every byte the console prints, in a ring in .bss. It
+ * works before anything else does, so nothing printed during early boot is
+ * lost, and the console replays it to its sinks once they exist. Records
+ * are lines.
+ *
+ * Writers reserve space with one atomic add and never wait, so the log
+ * can be written from any context, a panic or an NMI included. Positions
+ * count every byte ever reserved; the ring holds the last LOG_RING_SIZE.
+ *
+ * Nothing marks a reservation as filled in: waiting for that would let an
+ * NMI deadlock on the write it interrupted, or a panic on a CPU it froze.
+ * A reader racing a writer (a panic dump, most often) can therefore see
+ * stale bytes where the in-flight text goes.
+ */
+
+#define LOG_RING_SIZE (64 * 1024) /* Power of two */
+
+typedef void (*log_sink_t)(const char *text, u64 length);
+
+void log_write(const char *text, u64 length);
+
+u64 log_position(void);
+
+u64 log_oldest(void);
+
+u64 log_record_start(u32 records);
+
+void log_replay(u64 from, log_sink_t sink);
+
+#endif /* DELTA_KERNEL_LOG_H */
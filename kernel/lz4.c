@@ -0,0 +1,323 @@
+#include "lz4.h"
+
+/* Frame descriptor FLG byte */
+#define FLG_VERSION_MASK 0xC0
+#define FLG_VERSION 0x40
+#define FLG_BLOCK_CHECKSUM (1 << 4)
+#define FLG_CONTENT_SIZE (1 << 3)
+#define FLG_CONTENT_CHECKSUM (1 << 2)
+#define FLG_RESERVED (1 << 1)
+#define FLG_DICT_ID (1 << 0)
+
+/* Frame descriptor BD byte: bits 6-4 pick the block maximum size */
+#define BD_BLOCK_MAX_SHIFT 4
+#define BD_BLOCK_MAX_MASK 0x70
+#define BD_RESERVED 0x8F
+
+#define BLOCK_UNCOMPRESSED (1U << 31)
+#define BLOCK_SIZE_MASK 0x7FFFFFFF
+
+#define MIN_MATCH 4
+#define RUN_MASK 15
+
+#define XXH_PRIME1 2654435761U
+#define XXH_PRIME2 2246822519U
+#define XXH_PRIME3 3266489917U
+#define XXH_PRIME4 668265263U
+#define XXH_PRIME5 374761393U
+
+static inline u32 load32(const u8 *p) {
+  return (u32)p[0] | ((u32)p[1] << 8) | ((u32)p[2] << 16) | ((u32)p[3] << 24);
+}
+
+static inline u64 load64(const u8 *p) {
+  return load32(p) | ((u64)load32(p + 4) << 32);
+}
+
+static inline u32 rotl32(u32 value, u32 bits) {
+  return (value << bits) | (value >> (32 - bits));
+}
+
+static inline u32 xxh32_round(u32 acc, u32 input) {
+  return rotl32(acc + input * XXH_PRIME2, 13) * XXH_PRIME1;
+}
+
+u32 xxh32(const void *data, u64 length, u32 seed) {
+  const u8 *p = data;
+  const u8 *end = p + length;
+  u32 hash;
+
+  if (length >= 16) {
+    u32 v1 = seed + XXH_PRIME1 + XXH_PRIME2;
+    u32 v2 = seed + XXH_PRIME2;
+    u32 v3 = seed;
+    u32 v4 = seed - XXH_PRIME1;
+    for (; end - p >= 16; p += 16) {
+      v1 = xxh32_round(v1, load32(p));
+      v2 = xxh32_round(v2, load32(p + 4));
+      v3 = xxh32_round(v3, load32(p + 8));
+      v4 = xxh32_round(v4, load32(p + 12));
+    }
+    hash = rotl32(v1, 1) + rotl32(v2, 7) + rotl32(v3, 12) + rotl32(v4, 18);
+  } else {
+    hash = seed + XXH_PRIME5;
+  }
+
+  hash += (u32)length;
+  for (; end - p >= 4; p += 4) {
+    hash = rotl32(hash + load32(p) * XXH_PRIME3, 17) * XXH_PRIME4;
+  }
+  for (; p < end; p++) {
+    hash = rotl32(hash + *p * XXH_PRIME5, 11) * XXH_PRIME1;
+  }
+
+  hash ^= hash >> 15;
+  hash *= XXH_PRIME2;
+  hash ^= hash >> 13;
+  hash *= XXH_PRIME3;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+bool lz4_frame_magic(const void *data, u64 length) {
+  return length >= 4 && load32(data) == LZ4_FRAME_MAGIC;
+}
+
+/* Run-length extension: adds bytes while they are 255. false if truncated */
+static inline bool read_length(const u8 **ip, const u8 *end, u64 *length) {
+  u8 byte;
+  do {
+    if (*ip >= end) {
+      return false;
+    }
+    byte = *(*ip)++;
+    *length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+/* 8 bytes at a time; may write up to 7 bytes past dst + length */
+static inline void wild_copy(u8 *dst, const u8 *src, u64 length) {
+  u8 *end = dst + length;
+  do {
+    u64 word;
+    __builtin_memcpy(&word, src, sizeof(word));
+    __builtin_memcpy(dst, &word, sizeof(word));
+    dst += 8;
+    src += 8;
+  } while (dst < end);
+}
+
+static inline void byte_copy(u8 *dst, const u8 *src, u64 length) {
+  for (u64 i = 0; i < length; i++) {
+    dst[i] = src[i];
+  }
+}
+
+/*
+ * One compressed block into [*op, out_end). Matches may reach back to
+ * out_start, which covers linked blocks of the same frame. Advances *op.
+ */
+static bool decompress_block(const u8 *ip, u64 length, u8 *out_start, u8 **op,
+                             u8 *out_end) {
+  const u8 *in_end = ip + length;
+  u8 *out = *op;
+
+  while (ip < in_end) {
+    u8 token = *ip++;
+
+    u64 literals = token >> 4;
+    if (literals == RUN_MASK && !read_length(&ip, in_end, &literals)) {
+      return false;
+    }
+    if (literals > (u64)(in_end - ip) || literals > (u64)(out_end - out)) {
+      return false;
+    }
+    if ((u64)(in_end - ip) - literals >= 8 &&
+        (u64)(out_end - out) - literals >= 8) {
+      wild_copy(out, ip, literals);
+    } else {
+      byte_copy(out, ip, literals);
+    }
+    ip += literals;
+    out += literals;
+
+    if (ip == in_end) {
+      break; /* The last sequence is literals only */
+    }
+
+    if (in_end - ip < 2) {
+      return false;
+    }
+    u64 offset = (u64)ip[0] | ((u64)ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (u64)(out - out_start)) {
+      return false;
+    }
+
+    u64 match_length = token & RUN_MASK;
+    if (match_length == RUN_MASK && !read_length(&ip, in_end, &match_length)) {
+      return false;
+    }
+    match_length += MIN_MATCH;
+    if (match_length > (u64)(out_end - out)) {
+      return false;
+    }
+
+    const u8 *match = out - offset;
+    if (offset >= 8 && (u64)(out_end - out) - match_length >= 8) {
+      wild_copy(out, match, match_length);
+    } else {
+      byte_copy(out, match, match_length); /* Overlapping: repeats a pattern */
+    }
+    out += match_length;
+  }
+
+  *op = out;
+  return true;
+}
+
+/*
+ * Describe the frame at data: its descriptor is checked and its blocks
+ * walked (not decompressed) to find where it ends. Returns the bytes it
+ * takes up, 0 if it is malformed or unsupported. A skippable frame is
+ * accepted with frame->blocks NULL and nothing to decompress.
+ */
+u64 lz4_frame_parse(const void *data, u64 length, struct lz4_frame *frame) {
+  const u8 *start = data;
+  const u8 *end = start + length;
+
+  if (length < 8) {
+    return 0;
+  }
+
+  u32 magic = load32(start);
+  if ((magic & LZ4_SKIPPABLE_MASK) == LZ4_SKIPPABLE_MAGIC) {
+    u64 size = 8 + (u64)load32(start + 4);
+    if (size > length) {
+      return 0;
+    }
+    frame->blocks = NULL;
+    frame->frame_size = size;
+    frame->content_size = 0;
+    frame->block_checksum = false;
+    frame->content_checksum = false;
+    return size;
+  }
+  if (magic != LZ4_FRAME_MAGIC) {
+    return 0;
+  }
+
+  const u8 *descriptor = start + 4;
+  u8 flg = descriptor[0];
+  u8 bd = descriptor[1];
+  if ((flg & FLG_VERSION_MASK) != FLG_VERSION || (flg & FLG_RESERVED) != 0 ||
+      (bd & BD_RESERVED) != 0) {
+    return 0;
+  }
+
+  if ((flg & FLG_DICT_ID) != 0) {
+    return 0; /* The dictionary would have to come from somewhere */
+  }
+
+  u32 block_max_index = (bd & BD_BLOCK_MAX_MASK) >> BD_BLOCK_MAX_SHIFT;
+  if (block_max_index < 4) {
+    return 0;
+  }
+  u64 block_max = 1ULL << (8 + 2 * block_max_index); /* 64 KiB .. 4 MiB */
+
+  bool has_size = (flg & FLG_CONTENT_SIZE) != 0;
+  u64 descriptor_size = 2 + (has_size ? 8 : 0); /* FLG, BD, content size */
+  if ((u64)(end - descriptor) < descriptor_size + 1) {
+    return 0;
+  }
+  u8 header_checksum = descriptor[descriptor_size];
+  u32 descriptor_hash = xxh32(descriptor, descriptor_size, 0);
+  if (((descriptor_hash >> 8) & 0xFF) != header_checksum) {
+    return 0;
+  }
+
+  frame->content_size = has_size ? load64(descriptor + 2) : 0;
+  frame->block_checksum = (flg & FLG_BLOCK_CHECKSUM) != 0;
+  frame->content_checksum = (flg & FLG_CONTENT_CHECKSUM) != 0;
+  frame->blocks = descriptor + descriptor_size + 1;
+
+  u64 block_trailer = frame->block_checksum ? 4 : 0;
+  const u8 *p = frame->blocks;
+  for (;;) {
+    if (end - p < 4) {
+      return 0;
+    }
+    u32 header = load32(p);
+    p += 4;
+    if (header == 0) {
+      break; /* EndMark */
+    }
+
+    /* Parallel decompression needs the size up front (lz4 leaves it out
+     * of empty frames, which are fine) */
+    u64 size = header & BLOCK_SIZE_MASK;
+    if (!has_size || size > block_max ||
+        size + block_trailer > (u64)(end - p)) {
+      return 0;
+    }
+    p += size + block_trailer;
+  }
+
+  if (frame->content_checksum) {
+    if (end - p < 4) {
+      return 0;
+    }
+    p += 4;
+  }
+
+  frame->frame_size = (u64)(p - start);
+  return frame->frame_size;
+}
+
+/*
+ * Decompress a frame described by lz4_frame_parse() into out, which has
+ * room for exactly frame->content_size bytes. Checks block and content
+ * checksums when the frame carries them. false if anything is off.
+ */
+bool lz4_frame_decompress(const struct lz4_frame *frame, void *out) {
+  if (frame->blocks == NULL) {
+    return true;
+  }
+
+  u8 *out_start = out;
+  u8 *out_end = out_start + frame->content_size;
+  u8 *op = out_start;
+  const u8 *p = frame->blocks;
+
+  for (;;) {
+    u32 header = load32(p);
+    p += 4;
+    if (header == 0) {
+      break;
+    }
+
+    u64 size = header & BLOCK_SIZE_MASK;
+    if (frame->block_checksum && xxh32(p, size, 0) != load32(p + size)) {
+      return false;
+    }
+
+    if ((header & BLOCK_UNCOMPRESSED) != 0) {
+      if (size > (u64)(out_end - op)) {
+        return false;
+      }
+      byte_copy(op, p, size);
+      op += size;
+    } else if (!decompress_block(p, size, out_start, &op, out_end)) {
+      return false;
+    }
+
+    p += size + (frame->block_checksum ? 4 : 0);
+  }
+
+  if (op != out_end) {
+    return false;
+  }
+  return !frame->content_checksum ||
+         xxh32(out_start, frame->content_size, 0) == load32(p);
+}
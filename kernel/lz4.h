@@ -0,0 +1,38 @@
+#ifndef DELTA_KERNEL_LZ4_H
+#define DELTA_KERNEL_LZ4_H
+
+#include "types.h"
+
+/*
+ * LZ4 frame format decoder (lz4.org, frame format v1.6). Each frame is
+ * independent, so a stream of concatenated frames can be decompressed in
+ * parallel, one frame per CPU, once lz4_frame_parse() has found where
+ * each one starts and how much it produces. That needs the content size
+ * in the frame header (lz4 --content-size); frames without it, and frames
+ * that need a dictionary, are rejected.
+ *
+ * Everything is bounds-checked: a corrupt frame fails, it never reads or
+ * writes outside the buffers it was given.
+ */
+
+#define LZ4_FRAME_MAGIC 0x184D2204
+#define LZ4_SKIPPABLE_MAGIC 0x184D2A50 /* Low 4 bits are free */
+#define LZ4_SKIPPABLE_MASK 0xFFFFFFF0
+
+struct lz4_frame {
+  const u8 *blocks;  /* First block header, after the frame descriptor */
+  u64 frame_size;    /* Compressed bytes, header to checksum inclusive */
+  u64 content_size;  /* Decompressed bytes */
+  bool block_checksum;
+  bool content_checksum;
+};
+
+bool lz4_frame_magic(const void *data, u64 length);
+
+u64 lz4_frame_parse(const void *data, u64 length, struct lz4_frame *frame);
+
+bool lz4_frame_decompress(const struct lz4_frame *frame, void *out);
+
+u32 xxh32(const void *data, u64 length, u32 seed);
+
+#endif /* DELTA_KERNEL_LZ4_H */
@@ -1,11 +1,49 @@
 #include "boot_info.h"
 #include "console.h"
+#include "crc32.h"
+#include "fbkern.h"
+#include "idle.h"
+#include "initrd.h"
+#include "ksym.h"
+#include "kthread.h"
+#include "module.h"
 #include "types.h"
 
+#include "panic.h"
+#include "param.h"
+#include "pmm.h"
+#include "profile.h"
+#include "ramfs.h"
+#include "reclaim.h"
+#include "sched.h"
+#include "syscall.h"
+#include "vdso.h"
+#include "timer.h"
+#include "workqueue.h"
+
+#include "../arch/amd64/apic.h"
+#include "../arch/amd64/cpu.h"
+#include "../arch/amd64/fpu.h"
+#include "../arch/amd64/gdt.h"
+#include "../arch/amd64/idt.h"
+#include "../arch/amd64/percpu.h"
+#include "../arch/amd64/pmu.h"
+#include "../arch/amd64/smp.h"
+#include "../arch/amd64/tsc.h"
+#include "../arch/amd64/uart.h"
+
 static void print_banner(void);
 
 static void print_memory_map(const struct parsed_boot_info *info);
 static void print_system_info(const struct parsed_boot_info *info);
+static void print_timer_info(void);
+static void print_sched_info(void);
+static void print_fb_kernels(void);
+static void print_crc32(const struct parsed_boot_info *info);
+static void print_reclaim(void);
+
+static u32 params_applied = 0;
+static bool profiling = false;
 
 void kernel_main(struct db_boot_info *boot_info) {
 
@@ -29,23 +67,78 @@ void kernel_main(struct db_boot_info *boot_info) {
     }
   }
 
-  if (parsed.has_framebuffer) {
+  /* Options only set variables; warnings wait in the log for the console */
+  params_applied =
+      kernel_param_parse(parsed.has_cmdline ? parsed.cmdline->cmdline : NULL);
 
-    if (!console_init(parsed.framebuffer)) {
-      for (;;) {
-        __asm__ volatile("hlt");
-      }
-    }
-  } else {
-    for (;;) {
-      __asm__ volatile("hlt");
-    }
+  /* Headless (no framebuffer, or console=serial|none) boots on regardless */
+  console_init(parsed.has_framebuffer ? parsed.framebuffer : NULL);
+
+  gdt_init_cpu(0);
+  idt_init();
+  panic_init();
+
+  cpu_detect_features();
+  pmu_init();
+  if (!apic_init()) {
+    panic("No usable local APIC");
+  }
+  percpu_init_cpu(0, apic_get_id());
+
+  if (!pmm_init(&parsed)) {
+    panic("No usable physical memory");
+  }
+  if (!boot_info_relocate(&parsed)) {
+    panic("Boot information relocation failed");
+  }
+
+  if (!tsc_calibrate()) {
+    panic("TSC calibration failed");
+  }
+  if (!apic_timer_init()) {
+    panic("APIC timer initialization failed");
+  }
+  if (!timer_subsystem_init()) {
+    panic("Timer wheel self-test failed");
+  }
+  if (!vdso_init()) {
+    panic("Time page initialization failed");
   }
+  idle_init();
+  sched_init();
+  kthread_init();
+  console_enable_simd();
+  if (!crc32_init()) {
+    panic("CRC32 self-test failed");
+  }
+  syscall_init();
+  smp_init(&parsed);
+  if (!workqueue_init()) {
+    panic("Work queue initialization failed");
+  }
+  profiling = profile_start(); /* Samples the rest of boot, if asked to */
+  initrd_load(&parsed); /* Outcome reported with the system information */
+  module_init(&parsed);
 
-  print_banner();
+  /* The banner is for screens; headless it is only boot latency */
+  if (console_get_mode() == CONSOLE_MODE_FB) {
+    print_banner();
+  }
 
   print_system_info(&parsed);
 
+  /* After the last read of the initrd image (its CRC, above) */
+  reclaim_boot_memory(&parsed);
+  print_reclaim();
+
+  print_timer_info();
+
+  /* Serial output moves from polling to the transmit interrupt */
+  uart_enable_irq(UART_COM1_IRQ);
+  sti();
+
+  print_sched_info();
+
   print_memory_map(&parsed);
 
   console_newline();
@@ -54,11 +147,9 @@ void kernel_main(struct db_boot_info *boot_info) {
   console_newline();
   console_puts("DeltaOS kernel has finished early initialization.\n");
   console_puts("Further subsystems are not yet implemented.\n");
-  console_puts("System halted.\n");
+  console_puts("Entering idle.\n");
 
-  for (;;) {
-    __asm__ volatile("hlt");
-  }
+  idle_loop();
 }
 
 static void print_banner(void) {
@@ -110,13 +201,23 @@ static void print_system_info(const struct parsed_boot_info *info) {
   }
   console_puts("\n");
 
+  console_puts("  Request:       ");
+  console_put_dec(db_request_get()->header_size);
+  console_puts(" bytes, checksum ");
+  console_puts(db_request_verify() ? "valid" : "INVALID");
+  console_puts("\n");
+
   console_puts("  CPUs:          ");
   console_put_dec(info->cpu_count);
-  console_puts("\n");
+  console_puts(" (");
+  console_put_dec(smp_cpu_count());
+  console_puts(" online)\n");
 
   console_puts("  Usable RAM:    ");
   console_put_dec(info->total_usable_memory_mb);
-  console_puts(" MiB\n");
+  console_puts(" MiB (");
+  console_put_dec(pmm_free_pages() * PAGE_SIZE / (1024 * 1024));
+  console_puts(" MiB free pages)\n");
 
   if (info->has_framebuffer) {
     console_puts("  Display:       ");
@@ -132,12 +233,68 @@ static void print_system_info(const struct parsed_boot_info *info) {
     console_puts("\n");
   }
 
+  static const char *const console_modes[] = {
+      [CONSOLE_MODE_FB] = "framebuffer",
+      [CONSOLE_MODE_SERIAL] = "serial (COM1)",
+      [CONSOLE_MODE_NONE] = "log ring only",
+  };
+  console_puts("  Console:       ");
+  console_puts(console_modes[console_get_mode()]);
+  if (uart_present()) {
+    console_puts(", ");
+    console_put_dec(uart_baud());
+    console_puts(uart_fifo_size() > 1 ? " baud, FIFO" : " baud, no FIFO");
+  }
+  console_puts("\n");
+
+  /* Headless, the glyph and fill kernels have nothing to draw on */
+  if (console_get_mode() == CONSOLE_MODE_FB) {
+    print_fb_kernels();
+  }
+
   if (info->has_cmdline) {
     console_puts("  Command line:  ");
     console_puts(info->cmdline->cmdline);
     console_puts("\n");
   }
 
+  console_puts("  Parameters:    ");
+  console_put_dec(params_applied);
+  console_puts(" applied, ");
+  console_put_dec(kernel_param_count());
+  console_puts(kernel_param_indexed() ? " known (perfect hash)\n"
+                                      : " known (no index, linear scan)\n");
+
+  console_puts("  Symbols:       ");
+  if (ksym_count() > 0) {
+    console_put_dec(ksym_count());
+    console_puts(" (");
+    console_put_dec((ksym_table_size() + 1023) / 1024);
+    console_puts(" KiB table)\n");
+  } else {
+    console_puts("None (stack traces unsymbolized)\n");
+  }
+
+  console_puts("  PMU:           ");
+  if (pmu_available()) {
+    struct pmu_info pmu;
+    pmu_get_info(&pmu);
+    console_puts("v");
+    console_put_dec(pmu.version);
+    console_puts(", ");
+    console_put_dec(pmu.counters);
+    console_puts(" x ");
+    console_put_dec(pmu.width);
+    console_puts("-bit counters");
+    if (profiling) {
+      console_puts(", profiling ");
+      console_puts(pmu_event_name(pmu.event));
+    }
+    console_puts("\n");
+  } else {
+    console_puts("Not available\n");
+  }
+
   console_puts("  ACPI:          ");
   if (info->has_acpi) {
     console_puts("Available at ");
@@ -147,18 +304,243 @@ static void print_system_info(const struct parsed_boot_info *info) {
   }
   console_puts("\n");
 
+  print_crc32(info);
+
+  console_puts("---------------------------------------------------------------"
+               "-----------------\n");
+  console_puts("\n");
+}
+
+/* GB/s with one decimal place */
+static void put_rate(u64 bytes_per_second) {
+  u64 tenths = bytes_per_second / 100000000;
+  console_put_dec(tenths / 10);
+  console_puts(".");
+  console_put_dec(tenths % 10);
+  console_puts(" GB/s");
+}
+
+/* Checksum throughput, then the initrd's CRC and what it cost to compute */
+static void print_crc32(const struct parsed_boot_info *info) {
+  console_puts("  CRC32:         tables ");
+  put_rate(crc32_measure(false));
+  if (crc32_has_pclmul()) {
+    console_puts(", PCLMUL ");
+    put_rate(crc32_measure(true));
+  }
+  console_puts("\n");
+
   console_puts("  InitRD:        ");
   if (info->has_initrd) {
+    const void *data = phys_to_virt(info->initrd->start);
+    u64 start = rdtsc_ordered();
+    u32 crc = crc32(0, data, info->initrd->length);
+    u64 cycles = rdtsc_ordered() - start;
+
     console_puts("Loaded (");
     console_put_dec(info->initrd->length / 1024);
-    console_puts(" KiB)");
+    console_puts(" KiB, CRC32 ");
+    console_put_hex(crc);
+    console_puts(" in ");
+    console_put_dec(tsc_cycles_to_ns(tsc_get_calibration(), cycles) / 1000);
+    console_puts(" us)");
   } else {
     console_puts("Not loaded");
   }
   console_puts("\n");
 
-  console_puts("---------------------------------------------------------------"
-               "-----------------\n");
+  struct initrd_stats initrd;
+  initrd_get_stats(&initrd);
+  if (initrd.compressed) {
+    console_puts("  Unpack:        ");
+    if (initrd.frames > 0) {
+      console_puts("LZ4, ");
+      console_put_dec(initrd.frames);
+      console_puts(" frames, ");
+      console_put_dec(initrd.compressed_bytes / 1024);
+      console_puts(" -> ");
+      console_put_dec(initrd.bytes / 1024);
+      console_puts(" KiB in ");
+      console_put_dec(initrd.unpack_ns / 1000);
+      console_puts(" us on ");
+      console_put_dec(initrd.cpus);
+      console_puts(" CPUs (");
+      console_put_dec(initrd.bytes * 1000 / MAX(initrd.unpack_ns, 1ULL));
+      console_puts(" MB/s)");
+    } else {
+      console_puts("LZ4 frames corrupt or unsupported");
+    }
+    console_puts("\n");
+  }
+
+  if (info->has_initrd) {
+    console_puts("  Ramfs:         ");
+    if (ramfs_mounted()) {
+      struct ramfs_stats stats;
+      ramfs_get_stats(&stats);
+      console_put_dec(stats.files);
+      console_puts(" files, ");
+      console_put_dec(stats.directories);
+      console_puts(" directories, indexed in place in ");
+      console_put_dec(stats.index_ns / 1000);
+      console_puts(" us");
+    } else {
+      console_puts("InitRD is not a cpio (newc) archive");
+    }
+    console_puts("\n");
+  }
+
+  if (info->has_modules) {
+    console_puts("  Modules:       ");
+    console_put_dec(module_count());
+    console_puts(" indexed, linked on first use\n");
+  }
+}
+
+/* What went back to the page allocator from boot memory, by source */
+static void print_reclaim(void) {
+  static const char *const names[RECLAIM_SOURCE_COUNT] = {
+      [RECLAIM_BOOTLOADER] = "bootloader",
+      [RECLAIM_ACPI] = "ACPI",
+      [RECLAIM_INITRD] = "initrd",
+  };
+
+  struct reclaim_stats stats;
+  reclaim_get_stats(&stats);
+
+  u64 total = 0;
+  for (u32 i = 0; i < RECLAIM_SOURCE_COUNT; i++) {
+    total += stats.pages[i];
+  }
+
+  LOG_INFO("Reclaimed ");
+  console_put_dec(total * PAGE_SIZE / 1024);
+  console_puts(" KiB of boot memory (");
+  for (u32 i = 0; i < RECLAIM_SOURCE_COUNT; i++) {
+    console_puts(i > 0 ? ", " : "");
+    console_puts(names[i]);
+    console_puts(" ");
+    console_put_dec(stats.pages[i] * PAGE_SIZE / 1024);
+  }
+  console_puts(" KiB) in ");
+  console_put_dec(stats.reclaim_ns / 1000);
+  console_puts(" us\n\n");
+}
+
+/* Cycles per 4 KiB fill and per glyph, for every flavour this CPU runs */
+static void print_fb_kernels(void) {
+  struct fb_kernel_timing timing[FB_KERNEL_COUNT];
+  bool measured[FB_KERNEL_COUNT];
+
+  for (u32 isa = 0; isa < FB_KERNEL_COUNT; isa++) {
+    measured[isa] = fb_kernels_measure(isa, &timing[isa]);
+  }
+
+  console_puts("  Fill 4 KiB:    ");
+  for (u32 isa = 0, shown = 0; isa < FB_KERNEL_COUNT; isa++) {
+    if (measured[isa]) {
+      console_puts(shown++ > 0 ? ", " : "");
+      console_puts(fb_kernels_get(isa)->name);
+      console_puts(" ");
+      console_put_dec(timing[isa].fill_cycles);
+    }
+  }
+  console_puts(" cycles\n");
+
+  console_puts("  Glyph 8x16:    ");
+  for (u32 isa = 0, shown = 0; isa < FB_KERNEL_COUNT; isa++) {
+    if (measured[isa]) {
+      console_puts(shown++ > 0 ? ", " : "");
+      console_puts(fb_kernels_get(isa)->name);
+      console_puts(" ");
+      console_put_dec(timing[isa].glyph_cycles);
+    }
+  }
+  console_puts(" cycles (");
+  console_puts(fb_kernels_get(fb_kernels_best())->name);
+  console_puts(" in use)\n");
+}
+
+static void print_timer_info(void) {
+  const struct tsc_calibration *cal = tsc_get_calibration();
+
+  LOG_INFO("Timer:\n");
+  console_puts("  Local APIC:    ");
+  console_puts(apic_is_x2apic() ? "x2APIC (MSR)" : "xAPIC (MMIO)");
+  console_puts("\n");
+
+  console_puts("  TSC:           ");
+  console_put_dec(cal->hz / 1000000);
+  console_puts(" MHz");
+  if (cpu_has(CPU_FEATURE_INVARIANT_TSC)) {
+    console_puts(" (invariant)");
+  }
+  console_puts("\n");
+
+  console_puts("  One-shot mode: ");
+  console_puts(apic_timer_uses_tsc_deadline() ? "TSC-deadline"
+                                              : "APIC count-down");
+  console_puts("\n");
+
+  console_puts("  Reprogram:     ");
+  console_put_dec(apic_timer_measure_reprogram());
+  console_puts(" cycles\n");
+
+  console_puts("  Time page:     ");
+  console_put_hex(VDSO_TIME_VA);
+  console_puts(" (user read-only, seqlock)\n");
+
+  console_puts("  Wall clock:    ");
+  console_put_dec(vdso_clock_realtime_ns(vdso_time_page()) / 1000000000ULL);
+  console_puts(" s since 1970 (RTC)\n");
+
+  console_puts("  Idle states:   ");
+  console_puts(idle_uses_mwait() ? "MWAIT" : "HLT only");
+  for (u32 i = 0; idle_uses_mwait() && i < idle_state_count(); i++) {
+    console_puts(" ");
+    console_puts(idle_get_state(i)->name);
+  }
+  console_puts("\n");
+  console_puts("\n");
+}
+
+static void print_sched_info(void) {
+  const struct tsc_calibration *cal = tsc_get_calibration();
+
+  LOG_INFO("Scheduler:\n");
+  console_puts("  FPU state:     ");
+  console_puts(fpu_format_name());
+  console_puts(", ");
+  console_put_dec(fpu_state_size());
+  console_puts(" bytes, switched eagerly\n");
+
+  console_puts("  Kthread pool:  ");
+  console_put_dec(KTHREAD_MAX);
+  console_puts(" x ");
+  console_put_dec(KTHREAD_STACK_SIZE / 1024);
+  console_puts(" KiB stacks\n");
+
+  console_puts("  Work queues:   ");
+  console_put_dec(smp_cpu_count());
+  console_puts(" per-CPU + ");
+  console_put_dec(workqueue_unbound_workers());
+  console_puts(" unbound workers, batches of ");
+  console_put_dec(WORKQUEUE_BATCH_MAX);
+  console_puts("\n");
+
+  u64 cycles = kthread_measure_switch();
+  console_puts("  Switch:        ");
+  console_put_dec(cycles);
+  console_puts(" cycles (");
+  console_put_dec(tsc_cycles_to_ns(cal, cycles));
+  console_puts(" ns) kthread ping-pong\n");
+
+  cycles = syscall_measure_null();
+  console_puts("  Syscall:       ");
+  console_put_dec(cycles);
+  console_puts(" cycles (");
+  console_put_dec(tsc_cycles_to_ns(cal, cycles));
+  console_puts(" ns) null SYSCALL/SYSRET\n");
   console_puts("\n");
 }
 
@@ -0,0 +1,542 @@
+#include "module.h"
+#include "console.h"
+#include "crc32.h"
+#include "elf.h"
+#include "kthread.h"
+#include "panic.h"
+#include "pmm.h"
+#include "ramfs.h"
+#include "workqueue.h"
+
+#include "../arch/amd64/arch_types.h"
+#include "../arch/amd64/tsc.h"
+#include "../arch/amd64/vmm.h"
+
+#define INDEX_SLOTS (MODULE_MAX * 2) /* Power of two, at most half full */
+
+#define FNV_OFFSET_BASIS 0x811C9DC5U
+#define FNV_PRIME 0x01000193U
+
+/* Allocated sections are grouped by the protection they end up with */
+enum section_group {
+  GROUP_TEXT = 0,   /* Read, execute */
+  GROUP_RODATA = 1, /* Read */
+  GROUP_DATA = 2,   /* Read, write */
+  GROUP_COUNT = 3,
+};
+
+static const u64 group_flags[GROUP_COUNT] = {
+    [GROUP_TEXT] = 0,
+    [GROUP_RODATA] = PTE_NX,
+    [GROUP_DATA] = PTE_WRITABLE | PTE_NX,
+};
+
+struct kernel_export {
+  const char *name;
+  u64 address;
+};
+
+#define EXPORT(symbol) {#symbol, (u64)&symbol}
+
+/* What modules may link against. Keep it small: it is the module ABI. */
+static const struct kernel_export exports[] = {
+    EXPORT(clock_monotonic_ns),
+    EXPORT(console_put_dec),
+    EXPORT(console_put_hex),
+    EXPORT(console_putc),
+    EXPORT(console_puts),
+    EXPORT(crc32),
+    EXPORT(kthread_create),
+    EXPORT(kthread_start),
+    EXPORT(module_get),
+    EXPORT(panic),
+    EXPORT(pmm_alloc_page),
+    EXPORT(pmm_alloc_zeroed_page),
+    EXPORT(pmm_free_page),
+    EXPORT(queue_work),
+    EXPORT(queue_work_on),
+    EXPORT(ramfs_lookup),
+    EXPORT(ramfs_read),
+    EXPORT(work_init),
+};
+
+/* A module being linked */
+struct link {
+  const u8 *image;
+  u64 image_size;
+  const struct elf64_ehdr *ehdr;
+  const struct elf64_shdr *sections;
+  u64 *addresses; /* Per section: where it was loaded, 0 if it was not */
+  u64 group_start[GROUP_COUNT + 1]; /* Offsets into the module area block */
+};
+
+static struct module modules[MODULE_MAX];
+static u32 count = 0;
+static u8 slots[INDEX_SLOTS]; /* Slot -> modules[] index + 1, 0 = empty */
+static u64 area_next = MODULE_AREA_BASE;
+
+static bool names_equal(const char *a, const char *b) {
+  while (*a != '\0' && *a == *b) {
+    a++;
+    b++;
+  }
+  return *a == *b;
+}
+
+static u32 hash_name(const char *name) {
+  u32 hash = FNV_OFFSET_BASIS;
+  for (; *name != '\0'; name++) {
+    hash = (hash ^ (u8)*name) * FNV_PRIME;
+  }
+  return hash;
+}
+
+static void fill_zero(u8 *dst, u64 length) {
+  for (u64 i = 0; i < length; i++) {
+    dst[i] = 0;
+  }
+}
+
+static void copy_bytes(u8 *dst, const u8 *src, u64 length) {
+  for (u64 i = 0; i < length; i++) {
+    dst[i] = src[i];
+  }
+}
+
+static u64 lookup_export(const char *name) {
+  for (u32 i = 0; i < ARRAY_SIZE(exports); i++) {
+    if (names_equal(exports[i].name, name)) {
+      return exports[i].address;
+    }
+  }
+  return 0;
+}
+
+static bool range_valid(const struct link *link, u64 offset, u64 size) {
+  return offset <= link->image_size && size <= link->image_size - offset;
+}
+
+static enum section_group group_of(const struct elf64_shdr *section) {
+  if (section->sh_flags & SHF_EXECINSTR) {
+    return GROUP_TEXT;
+  }
+  return (section->sh_flags & SHF_WRITE) ? GROUP_DATA : GROUP_RODATA;
+}
+
+/* ELF64, x86-64, relocatable, with every section inside the image */
+static bool check_object(struct link *link) {
+  if (link->image_size < sizeof(struct elf64_ehdr)) {
+    return false;
+  }
+
+  const struct elf64_ehdr *ehdr = (const struct elf64_ehdr *)link->image;
+  if (*(const u32 *)ehdr->e_ident != ELF_MAGIC ||
+      ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+      ehdr->e_ident[EI_DATA] != ELFDATA2LSB ||
+      ehdr->e_ident[EI_VERSION] != EV_CURRENT || ehdr->e_type != ET_REL ||
+      ehdr->e_machine != EM_X86_64 ||
+      ehdr->e_shentsize != sizeof(struct elf64_shdr) || ehdr->e_shnum == 0 ||
+      ehdr->e_shnum >= SHN_LORESERVE) {
+    return false;
+  }
+
+  u64 table_size = (u64)ehdr->e_shnum * sizeof(struct elf64_shdr);
+  if (!range_valid(link, ehdr->e_shoff, table_size) ||
+      (ehdr->e_shoff & 7) != 0) {
+    return false;
+  }
+
+  link->ehdr = ehdr;
+  link->sections = (const struct elf64_shdr *)(link->image + ehdr->e_shoff);
+
+  for (u32 i = 0; i < ehdr->e_shnum; i++) {
+    const struct elf64_shdr *section = &link->sections[i];
+    if (section->sh_type != SHT_NOBITS &&
+        !range_valid(link, section->sh_offset, section->sh_size)) {
+      return false;
+    }
+    if (section->sh_link >= ehdr->e_shnum) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Offsets of every allocated section, grouped text, rodata, data, each
+ * group starting on a page so it can be protected on its own. Returns the
+ * bytes needed, 0 if an alignment is unusable.
+ */
+static u64 layout(struct link *link) {
+  u64 offset = 0;
+
+  for (u32 group = 0; group < GROUP_COUNT; group++) {
+    offset = ALIGN_UP(offset, PAGE_SIZE);
+    link->group_start[group] = offset;
+
+    for (u32 i = 0; i < link->ehdr->e_shnum; i++) {
+      const struct elf64_shdr *section = &link->sections[i];
+      if (!(section->sh_flags & SHF_ALLOC) || group_of(section) != group) {
+        continue;
+      }
+
+      u64 align = MAX(section->sh_addralign, 1UL);
+      if ((align & (align - 1)) != 0 || align > PAGE_SIZE) {
+        return 0;
+      }
+      offset = ALIGN_UP(offset, align);
+      link->addresses[i] = offset;
+      offset += section->sh_size;
+    }
+  }
+
+  offset = ALIGN_UP(offset, PAGE_SIZE);
+  link->group_start[GROUP_COUNT] = offset;
+  return offset;
+}
+
+static void unmap_area(u64 base, u64 pages) {
+  for (u64 i = 0; i < pages; i++) {
+    u64 phys = vmm_unmap_page(base + i * PAGE_SIZE);
+    if (phys != 0) {
+      pmm_free_page(phys);
+    }
+  }
+}
+
+/* Zeroed, writable pages at [base, base + size) */
+static bool map_area(u64 base, u64 size) {
+  u64 pages = size / PAGE_SIZE;
+  for (u64 i = 0; i < pages; i++) {
+    u64 phys = pmm_alloc_zeroed_page();
+    if (phys == 0 ||
+        !vmm_map_page(base + i * PAGE_SIZE, phys, PTE_WRITABLE | PTE_NX)) {
+      pmm_free_page(phys);
+      unmap_area(base, i);
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Final protection. No other CPU has touched these pages: no shootdown. */
+static void protect_area(const struct link *link, u64 base) {
+  for (u32 group = 0; group < GROUP_COUNT; group++) {
+    for (u64 offset = link->group_start[group];
+         offset < link->group_start[group + 1]; offset += PAGE_SIZE) {
+      u64 phys = vmm_unmap_page(base + offset);
+      vmm_map_page(base + offset, phys, group_flags[group]);
+    }
+  }
+}
+
+static void copy_sections(const struct link *link) {
+  for (u32 i = 0; i < link->ehdr->e_shnum; i++) {
+    const struct elf64_shdr *section = &link->sections[i];
+    if ((section->sh_flags & SHF_ALLOC) && section->sh_type != SHT_NOBITS) {
+      copy_bytes((u8 *)link->addresses[i], link->image + section->sh_offset,
+                 section->sh_size);
+    }
+    /* NOBITS (.bss) is already zero: the pages were */
+  }
+}
+
+/* Resolve a symbol to an address. false if undefined and not weak. */
+static bool symbol_value(const struct link *link,
+                         const struct elf64_shdr *symtab,
+                         const struct elf64_sym *sym, u64 *value) {
+  const struct elf64_shdr *strtab = &link->sections[symtab->sh_link];
+
+  switch (sym->st_shndx) {
+  case SHN_UNDEF: {
+    if (sym->st_name >= strtab->sh_size) {
+      return false;
+    }
+    const char *name =
+        (const char *)link->image + strtab->sh_offset + sym->st_name;
+    *value = lookup_export(name);
+    return *value != 0 || ELF64_ST_BIND(sym->st_info) == STB_WEAK;
+  }
+  case SHN_ABS:
+    *value = sym->st_value;
+    return true;
+  case SHN_COMMON:
+    return false; /* Build with -fno-common */
+  default:
+    if (sym->st_shndx >= link->ehdr->e_shnum ||
+        link->addresses[sym->st_shndx] == 0) {
+      return false; /* Not an allocated section */
+    }
+    *value = link->addresses[sym->st_shndx] + sym->st_value;
+    return true;
+  }
+}
+
+static bool apply_rela(const struct link *link, const struct elf64_shdr *rela,
+                       const struct elf64_shdr *symtab) {
+  const struct elf64_shdr *target = &link->sections[rela->sh_info];
+  const struct elf64_rela *entries =
+      (const struct elf64_rela *)(link->image + rela->sh_offset);
+  u64 entry_count = rela->sh_size / sizeof(struct elf64_rela);
+  u64 symbol_count = symtab->sh_size / sizeof(struct elf64_sym);
+  const struct elf64_sym *symbols =
+      (const struct elf64_sym *)(link->image + symtab->sh_offset);
+
+  for (u64 i = 0; i < entry_count; i++) {
+    const struct elf64_rela *r = &entries[i];
+    u32 type = ELF64_R_TYPE(r->r_info);
+    u32 symbol = ELF64_R_SYM(r->r_info);
+
+    u64 width = (type == R_X86_64_64 || type == R_X86_64_PC64) ? 8 : 4;
+    if (type == R_X86_64_NONE) {
+      continue;
+    }
+    if (symbol >= symbol_count || r->r_offset > target->sh_size ||
+        width > target->sh_size - r->r_offset) {
+      return false;
+    }
+
+    u64 s;
+    if (!symbol_value(link, symtab, &symbols[symbol], &s)) {
+      return false;
+    }
+    u64 place = link->addresses[rela->sh_info] + r->r_offset;
+    u64 value = s + (u64)r->r_addend;
+
+    switch (type) {
+    case R_X86_64_64:
+      *(u64 *)place = value;
+      break;
+    case R_X86_64_PC64:
+      *(u64 *)place = value - place;
+      break;
+    case R_X86_64_PC32:
+    case R_X86_64_PLT32: {
+      i64 relative = (i64)(value - place);
+      if (relative != (i32)relative) {
+        return false;
+      }
+      *(u32 *)place = (u32)relative;
+    } break;
+    case R_X86_64_32:
+      if (value != (u32)value) {
+        return false;
+      }
+      *(u32 *)place = (u32)value;
+      break;
+    case R_X86_64_32S:
+      if ((i64)value != (i32)value) {
+        return false;
+      }
+      *(u32 *)place = (u32)value;
+      break;
+    default:
+      return false; /* GOT-relative and TLS relocations are not supported */
+    }
+  }
+  return true;
+}
+
+static bool relocate(const struct link *link) {
+  for (u32 i = 0; i < link->ehdr->e_shnum; i++) {
+    const struct elf64_shdr *section = &link->sections[i];
+    if (section->sh_type == SHT_REL) {
+      return false; /* x86-64 objects always use RELA */
+    }
+    if (section->sh_type != SHT_RELA) {
+      continue;
+    }
+
+    if (section->sh_info >= link->ehdr->e_shnum ||
+        link->sections[section->sh_link].sh_type != SHT_SYMTAB) {
+      return false;
+    }
+    if (link->addresses[section->sh_info] == 0) {
+      continue; /* Relocations for debug sections we did not load */
+    }
+    if (!apply_rela(link, section, &link->sections[section->sh_link])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* module_main: global and in a loaded executable section */
+static module_main_t find_entry(const struct link *link) {
+  for (u32 i = 0; i < link->ehdr->e_shnum; i++) {
+    const struct elf64_shdr *symtab = &link->sections[i];
+    if (symtab->sh_type != SHT_SYMTAB) {
+      continue;
+    }
+
+    const struct elf64_shdr *strtab = &link->sections[symtab->sh_link];
+    const struct elf64_sym *symbols =
+        (const struct elf64_sym *)(link->image + symtab->sh_offset);
+    u64 symbol_count = symtab->sh_size / sizeof(struct elf64_sym);
+
+    for (u64 s = 0; s < symbol_count; s++) {
+      const struct elf64_sym *sym = &symbols[s];
+      if (ELF64_ST_BIND(sym->st_info) != STB_GLOBAL ||
+          sym->st_name >= strtab->sh_size || sym->st_shndx == SHN_UNDEF ||
+          sym->st_shndx >= link->ehdr->e_shnum ||
+          group_of(&link->sections[sym->st_shndx]) != GROUP_TEXT) {
+        continue;
+      }
+
+      const char *name =
+          (const char *)link->image + strtab->sh_offset + sym->st_name;
+      u64 address;
+      if (names_equal(name, MODULE_ENTRY) &&
+          symbol_value(link, symtab, sym, &address)) {
+        return (module_main_t)address;
+      }
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Link a module into the module area. Returns its entry point, or NULL
+ * with nothing left mapped. The area it used is not reused on failure.
+ */
+static module_main_t link_module(struct module *module) {
+  struct link link = {
+      .image = module->image,
+      .image_size = module->image_size,
+  };
+  if (!check_object(&link)) {
+    return NULL;
+  }
+
+  u64 table_pages =
+      ALIGN_UP((u64)link.ehdr->e_shnum * sizeof(u64), PAGE_SIZE) / PAGE_SIZE;
+  u64 table = pmm_alloc_pages(table_pages);
+  if (table == 0) {
+    return NULL;
+  }
+  link.addresses = phys_to_virt(table);
+  fill_zero((u8 *)link.addresses, table_pages * PAGE_SIZE);
+
+  module_main_t entry = NULL;
+  u64 size = layout(&link);
+  u64 base = size == 0 ? 0
+                       : __atomic_fetch_add(&area_next, size, __ATOMIC_RELAXED);
+
+  if (size != 0 && base + size <= MODULE_AREA_TOP && map_area(base, size)) {
+    for (u32 i = 0; i < link.ehdr->e_shnum; i++) {
+      if (link.sections[i].sh_flags & SHF_ALLOC) {
+        link.addresses[i] += base;
+      }
+    }
+
+    copy_sections(&link);
+    if (relocate(&link)) {
+      entry = find_entry(&link);
+    }
+
+    if (entry != NULL) {
+      protect_area(&link, base);
+      module->base = base;
+      module->size = size;
+    } else {
+      unmap_area(base, size / PAGE_SIZE);
+    }
+  }
+
+  for (u64 i = 0; i < table_pages; i++) {
+    pmm_free_page(table + i * PAGE_SIZE);
+  }
+  return entry;
+}
+
+static struct module *find(const char *name) {
+  u32 hash = hash_name(name);
+  for (u32 i = hash & (INDEX_SLOTS - 1);; i = (i + 1) & (INDEX_SLOTS - 1)) {
+    if (slots[i] == 0) {
+      return NULL;
+    }
+    struct module *module = &modules[slots[i] - 1];
+    if (module->hash == hash && names_equal(module->name, name)) {
+      return module;
+    }
+  }
+}
+
+/*
+ * Index the modules the bootloader loaded. Nothing is linked yet. Returns
+ * how many were indexed; a name seen twice keeps its first module.
+ */
+u32 module_init(const struct parsed_boot_info *info) {
+  if (!info->has_modules) {
+    return 0;
+  }
+
+  const struct db_tag_modules *tag = info->modules;
+  for (u32 i = 0; i < tag->module_count && count < MODULE_MAX; i++) {
+    const struct db_module *entry = &tag->modules[i];
+    const char *name = boot_info_module_string(tag, entry->name_offset);
+    if (name[0] == '\0' || find(name) != NULL) {
+      continue;
+    }
+
+    struct module *module = &modules[count];
+    module->name = name;
+    module->cmdline = boot_info_module_string(tag, entry->cmdline_offset);
+    module->image = phys_to_virt(entry->start);
+    module->image_size = entry->end - entry->start;
+    module->hash = hash_name(name);
+    module->state = MODULE_INDEXED;
+
+    u32 slot = module->hash & (INDEX_SLOTS - 1);
+    while (slots[slot] != 0) {
+      slot = (slot + 1) & (INDEX_SLOTS - 1);
+    }
+    slots[slot] = (u8)(count + 1);
+    count++;
+  }
+  return count;
+}
+
+/* Index lookup only: never links */
+const struct module *module_find(const char *name) { return find(name); }
+
+/*
+ * The named module, linked and initialized. The first caller links it and
+ * runs its module_main; concurrent callers wait for that to finish. NULL if
+ * there is no such module or it failed to load.
+ */
+const struct module *module_get(const char *name) {
+  struct module *module = find(name);
+  if (module == NULL) {
+    return NULL;
+  }
+
+  u32 state = MODULE_INDEXED;
+  if (__atomic_compare_exchange_n(&module->state, &state, MODULE_LOADING,
+                                  false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+    u64 start = clock_monotonic_ns();
+    module_main_t entry = link_module(module);
+    module->link_ns = clock_monotonic_ns() - start;
+
+    bool ok = entry != NULL && entry(module->cmdline);
+    state = ok ? MODULE_READY : MODULE_FAILED;
+    __atomic_store_n(&module->state, state, __ATOMIC_RELEASE);
+  }
+
+  while (state == MODULE_LOADING) {
+    cpu_relax();
+    state = __atomic_load_n(&module->state, __ATOMIC_ACQUIRE);
+  }
+  return state == MODULE_READY ? module : NULL;
+}
+
+u32 module_count(void) { return count; }
+
+u32 module_ready_count(void) {
+  u32 ready = 0;
+  for (u32 i = 0; i < count; i++) {
+    ready += __atomic_load_n(&modules[i].state, __ATOMIC_ACQUIRE) ==
+             MODULE_READY;
+  }
+  return ready;
+}
@@ -0,0 +1,61 @@
+#ifndef DELTA_KERNEL_MODULE_H
+#define DELTA_KERNEL_MODULE_H
+
+#include "boot_info.h"
+#include "types.h"
+
+/*
+ * Boot modules (DB_TAG_MODULES) are relocatable ELF objects, built with
+ * gcc -c -mcmodel=kernel -fno-pic -mno-red-zone -mno-sse -fno-common.
+ *
+ * At boot they are only indexed by name. A module is linked the first time
+ * module_get() asks for it: its sections are laid out in the module area,
+ * within 2 GiB of the kernel image so 32-bit relocations reach both ways;
+ * its relocations are applied against the kernel's exported symbols; its
+ * pages are write-protected (code) or made non-executable (data); and then
+ * its module_main(cmdline) runs. A driver for hardware that is not there
+ * is never asked for, so it costs nothing beyond the index entry.
+ *
+ * Modules are never unloaded.
+ */
+
+#define MODULE_MAX 64
+
+/* KERNEL_VMA + 512 MiB: above the image, which must end below it */
+#define MODULE_AREA_BASE 0xFFFFFFFFA0000000UL
+#define MODULE_AREA_TOP 0xFFFFFFFFC0000000UL /* Exclusive */
+
+#define MODULE_ENTRY "module_main"
+
+enum module_state {
+  MODULE_INDEXED = 0, /* Not linked yet */
+  MODULE_LOADING = 1,
+  MODULE_READY = 2,
+  MODULE_FAILED = 3, /* Bad object, missing symbol or module_main said no */
+};
+
+typedef bool (*module_main_t)(const char *cmdline);
+
+struct module {
+  const char *name;
+  const char *cmdline;
+  const u8 *image; /* The object file, where the bootloader put it */
+  u64 image_size;
+  u32 hash;
+  u32 state;
+  u64 base; /* Linked image in the module area, once ready */
+  u64 size;
+  u64 link_ns;
+};
+
+u32 module_init(const struct parsed_boot_info *info);
+
+const struct module *module_find(const char *name);
+
+const struct module *module_get(const char *name);
+
+u32 module_count(void);
+
+u32 module_ready_count(void);
+
+#endif /* DELTA_KERNEL_MODULE_H */
@@ -1,24 +1,212 @@
 
 #include "panic.h"
 #include "console.h"
+#include "ksym.h"
+#include "log.h"
 
+#include "../arch/amd64/apic.h"
 #include "../arch/amd64/arch_types.h"
+#include "../arch/amd64/idt.h"
+#include "../arch/amd64/percpu.h"
+#include "../arch/amd64/pmu.h"
+#include "../arch/amd64/stacktrace.h"
 
-NORETURN void panic(const char *message) {
+#define PANIC_LOG_RECORDS 32 /* Log lines dumped ahead of the report */
+#define PANIC_TRACE_DEPTH 32
+#define PANIC_FREEZE_SPINS 10000000UL /* Bound on waiting for the NMIs */
+
+#define NO_CPU U32_MAX
+
+/* The CPU running the panic; the first to claim it wins */
+static u32 panic_cpu = NO_CPU;
+static bool nested_reported = false;
+
+/* Other CPUs stopped by the panic NMI, and where each was */
+static u32 frozen_count = 0;
+static u64 frozen_rip[MAX_CPUS];
+
+/* Before percpu_init_cpu(0) there is no GS base to read the CPU from */
+static u32 current_cpu(void) {
+  return percpu_online_count() > 0 ? this_cpu_id() : 0;
+}
+
+static bool panic_nmi(struct interrupt_frame *frame) {
+  u32 owner = __atomic_load_n(&panic_cpu, __ATOMIC_ACQUIRE);
+  if (owner == NO_CPU || owner == current_cpu()) {
+    return false; /* Someone else's NMI, or the reporter's own */
+  }
+
+  frozen_rip[current_cpu()] = frame->rip;
+  __atomic_fetch_add(&frozen_count, 1, __ATOMIC_RELEASE);
+  halt_forever(); /* NMIs stay blocked: there is no IRET */
+}
+
+/* Lets a panic stop the other CPUs; call once the IDT is loaded */
+void panic_init(void) { nmi_register(panic_nmi); }
+
+static void freeze_other_cpus(void) {
+  u32 online = percpu_online_count();
+  if (online <= 1) {
+    return;
+  }
+
+  apic_send_nmi_others();
+  for (u64 spins = 0;
+       spins < PANIC_FREEZE_SPINS &&
+       __atomic_load_n(&frozen_count, __ATOMIC_ACQUIRE) < online - 1;
+       spins++) {
+    cpu_relax();
+  }
+}
+
+static void put_reg(const char *name, u64 value, bool last) {
+  console_puts(name);
+  console_put_hex(value);
+  console_puts(last ? "\n" : "  ");
+}
+
+static void dump_registers(u64 rip, u64 rsp, u64 rbp, u64 rflags,
+                           const struct interrupt_frame *frame) {
+  console_puts("\nRegisters:\n");
+  put_reg("  RIP ", rip, false);
+  put_reg("RSP ", rsp, false);
+  put_reg("RBP ", rbp, true);
+  if (frame != NULL) {
+    put_reg("  RAX ", frame->rax, false);
+    put_reg("RBX ", frame->rbx, false);
+    put_reg("RCX ", frame->rcx, true);
+    put_reg("  RDX ", frame->rdx, false);
+    put_reg("RSI ", frame->rsi, false);
+    put_reg("RDI ", frame->rdi, true);
+    put_reg("  R8  ", frame->r8, false);
+    put_reg("R9  ", frame->r9, false);
+    put_reg("R10 ", frame->r10, true);
+    put_reg("  R11 ", frame->r11, false);
+    put_reg("R12 ", frame->r12, false);
+    put_reg("R13 ", frame->r13, true);
+    put_reg("  R14 ", frame->r14, false);
+    put_reg("R15 ", frame->r15, false);
+    put_reg("CS  ", frame->cs, true);
+  }
+  put_reg("  RFL ", rflags, false);
+  put_reg("CR0 ", read_cr0(), false);
+  put_reg("CR2 ", read_cr2(), true);
+  put_reg("  CR3 ", read_cr3(), false);
+  put_reg("CR4 ", read_cr4(), true);
+}
 
+/* "name+0x1f", the offset without the leading zeros of console_put_hex */
+static void put_symbol(u64 address) {
+  static const char hex_chars[] = "0123456789abcdef";
+  struct ksym sym;
+  if (!ksym_lookup(address, &sym)) {
+    return;
+  }
+
+  char offset[17];
+  u32 start = sizeof(offset) - 1;
+  offset[start] = '\0';
+  do {
+    offset[--start] = hex_chars[sym.offset & 0xF];
+    sym.offset >>= 4;
+  } while (sym.offset != 0);
+
+  console_puts(" ");
+  console_puts(sym.name);
+  console_puts("+0x");
+  console_puts(&offset[start]);
+}
+
+static void put_frame(u32 depth, u64 address) {
+  console_puts("  #");
+  console_put_dec(depth);
+  console_puts(depth < 10 ? "  " : " ");
+  console_put_hex(address);
+  put_symbol(address);
+  console_puts("\n");
+}
+
+static void dump_trace(u64 rip, u64 rsp, u64 rbp) {
+  u64 returns[PANIC_TRACE_DEPTH - 1];
+  u32 count = stack_walk(rsp, rbp, returns, ARRAY_SIZE(returns));
+
+  console_puts("\nStack trace:\n");
+  put_frame(0, rip);
+  for (u32 i = 0; i < count; i++) {
+    put_frame(i + 1, returns[i]);
+  }
+}
+
+static void dump_other_cpus(u32 self) {
+  u32 online = percpu_online_count();
+  if (online <= 1) {
+    return;
+  }
+
+  console_puts("\nOther CPUs (");
+  console_put_dec(__atomic_load_n(&frozen_count, __ATOMIC_ACQUIRE));
+  console_puts(" of ");
+  console_put_dec(online - 1);
+  console_puts(" stopped):\n");
+  for (u32 cpu = 0; cpu < online && cpu < MAX_CPUS; cpu++) {
+    if (cpu == self) {
+      continue;
+    }
+    console_puts("  CPU ");
+    console_put_dec(cpu);
+    if (frozen_rip[cpu] != 0) {
+      console_puts(" at ");
+      console_put_hex(frozen_rip[cpu]);
+      put_symbol(frozen_rip[cpu]);
+      console_puts("\n");
+    } else {
+      console_puts(" did not stop\n");
+    }
+  }
+}
+
+/*
+ * Stop the machine and report: the last log lines, the message, registers,
+ * a stack trace and where the other CPUs were. Everything goes out over
+ * serial (polled) before the screen is touched, and nothing is allocated
+ * or locked, so the report gets out whatever state the kernel is in.
+ */
+static NORETURN void panic_report(const char *message, u64 rip, u64 rsp,
+                                  u64 rbp, u64 rflags,
+                                  const struct interrupt_frame *frame) {
   cli();
 
-  console_set_color(CONSOLE_WHITE, CONSOLE_RED);
-  console_clear();
+  u32 self = current_cpu();
+  u32 owner = NO_CPU;
+  if (!__atomic_compare_exchange_n(&panic_cpu, &owner, self, false,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    if (owner == self && !nested_reported) {
+      /* The report itself failed: say so, once, and give up */
+      nested_reported = true;
+      console_puts("\nPanic while panicking: ");
+      console_puts(message != NULL ? message : "(no message provided)");
+      console_puts("\n");
+    }
+    halt_forever(); /* Another CPU is reporting; its NMI may be on the way */
+  }
+
+  /* A profiler counter left armed here would interrupt the report */
+  pmu_stop();
+
+  freeze_other_cpus();
+  console_panic();
+
+  console_puts("\n--- Last log lines ---\n");
+  console_replay(log_record_start(PANIC_LOG_RECORDS));
 
-  console_puts("\n\n");
+  u64 report = log_position();
+  console_puts("\n");
   console_puts("==============================================================="
                "=================\n");
   console_puts("                              KERNEL PANIC                     "
                "                 \n");
   console_puts("==============================================================="
                "=================\n");
-  console_puts("\n");
 
   console_puts("FATAL ERROR: ");
   if (message != NULL) {
@@ -26,17 +214,35 @@ NORETURN void panic(const char *message) {
   } else {
     console_puts("(no message provided)");
   }
-  console_puts("\n\n");
-
-  console_puts("The system has been halted to prevent damage.\n");
-  console_puts("Please restart your computer.\n");
-  console_puts("\n");
-  console_puts(
-      "If this error persists, please report it to the DeltaOS team\n");
-  console_puts("with the error message above.\n");
+  console_puts("\nCPU ");
+  console_put_dec(self);
   console_puts("\n");
+
+  dump_registers(rip, rsp, rbp, rflags, frame);
+  if (frame != NULL && (frame->cs & 3) != 0) {
+    console_puts("\nStack trace: (user mode)\n");
+  } else {
+    dump_trace(rip, rsp, rbp);
+  }
+  dump_other_cpus(self);
+
+  console_puts("\nThe system has been halted to prevent damage.\n");
   console_puts("==============================================================="
                "=================\n");
 
+  console_panic_paint(report);
   halt_forever();
 }
+
+/* Registers as the caller had them at the call, read from this frame */
+NORETURN void panic(const char *message) {
+  const u64 *frame = __builtin_frame_address(0);
+  panic_report(message, frame[1], (u64)(frame + 2), frame[0], read_rflags(),
+               NULL);
+}
+
+NORETURN void panic_with_frame(const char *message,
+                               const struct interrupt_frame *frame) {
+  panic_report(message, frame->rip, frame->rsp, frame->rbp, frame->rflags,
+               frame);
+}
@@ -3,8 +3,16 @@
 
 #include "types.h"
 
+struct interrupt_frame;
+
+void panic_init(void);
+
 NORETURN void panic(const char *message);
 
+/* For exceptions: the report includes the interrupted context */
+NORETURN void panic_with_frame(const char *message,
+                               const struct interrupt_frame *frame);
+
 #define panic_assert(condition, message)                                       \
   do {                                                                         \
     if (UNLIKELY(!(condition))) {                                              \
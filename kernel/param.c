@@ -0,0 +1,223 @@
+#include "param.h"
+#include "console.h"
+
+/* linker.ld: the entries, straight after the index */
+extern const struct kernel_param __kernel_params_start[];
+extern const struct kernel_param __kernel_params_end[];
+
+/*
+ * Filled in by tools/param_index after linking. Not static and written
+ * nowhere in the kernel: the compiler must read it, not fold it.
+ */
+__attribute__((section(".kernel_param_index"), used, aligned(8)))
+struct kernel_param_index kernel_param_index = {
+    .magic = KERNEL_PARAM_INDEX_MAGIC,
+};
+
+/* A run of the command line, not NUL-terminated */
+struct token {
+  const char *text;
+  u64 length;
+};
+
+static bool token_is(struct token token, const char *word) {
+  u64 i = 0;
+  for (; i < token.length; i++) {
+    if (word[i] != token.text[i]) {
+      return false;
+    }
+  }
+  return word[i] == '\0';
+}
+
+static void put_token(struct token token) {
+  for (u64 i = 0; i < token.length; i++) {
+    console_putc(token.text[i]);
+  }
+}
+
+u32 kernel_param_count(void) {
+  return (u32)(__kernel_params_end - __kernel_params_start);
+}
+
+/* The table matches the options linked in */
+bool kernel_param_indexed(void) {
+  return kernel_param_index.seed != 0 &&
+         kernel_param_index.count == kernel_param_count() &&
+         kernel_param_index.mask < KERNEL_PARAM_SLOTS;
+}
+
+static const struct kernel_param *find(struct token name) {
+  if (name.length >= KERNEL_PARAM_NAME_MAX) {
+    return NULL;
+  }
+
+  if (kernel_param_indexed()) {
+    u32 hash = kernel_param_hash(name.text, name.length,
+                                 kernel_param_index.seed);
+    u32 slot = kernel_param_index.slots[hash & kernel_param_index.mask];
+    if (slot == 0) {
+      return NULL;
+    }
+    const struct kernel_param *param = &__kernel_params_start[slot - 1];
+    return token_is(name, param->name) ? param : NULL;
+  }
+
+  for (const struct kernel_param *param = __kernel_params_start;
+       param < __kernel_params_end; param++) {
+    if (token_is(name, param->name)) {
+      return param;
+    }
+  }
+  return NULL;
+}
+
+static bool parse_bool(struct token value, bool *out) {
+  static const char *const yes[] = {"1", "on", "yes", "true"};
+  static const char *const no[] = {"0", "off", "no", "false"};
+
+  for (u32 i = 0; i < ARRAY_SIZE(yes); i++) {
+    if (token_is(value, yes[i])) {
+      *out = true;
+      return true;
+    }
+    if (token_is(value, no[i])) {
+      *out = false;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Decimal or 0x hex, no larger than max */
+static bool parse_number(struct token value, u64 max, u64 *out) {
+  u64 base = 10;
+  u64 i = 0;
+  if (value.length > 2 && value.text[0] == '0' &&
+      (value.text[1] == 'x' || value.text[1] == 'X')) {
+    base = 16;
+    i = 2;
+  }
+  if (i == value.length) {
+    return false;
+  }
+
+  u64 number = 0;
+  for (; i < value.length; i++) {
+    char c = value.text[i];
+    u64 digit;
+    if (c >= '0' && c <= '9') {
+      digit = (u64)(c - '0');
+    } else if (base == 16 && c >= 'a' && c <= 'f') {
+      digit = (u64)(c - 'a' + 10);
+    } else if (base == 16 && c >= 'A' && c <= 'F') {
+      digit = (u64)(c - 'A' + 10);
+    } else {
+      return false;
+    }
+    if (number > (max - digit) / base) {
+      return false;
+    }
+    number = number * base + digit;
+  }
+  *out = number;
+  return true;
+}
+
+/* has_value is false for a bare "name", which only a bool accepts */
+static bool set(const struct kernel_param *param, struct token value,
+                bool has_value) {
+  u64 number;
+  switch (param->type) {
+  case KERNEL_PARAM_TYPE_BOOL: {
+    bool flag = true;
+    if (has_value && !parse_bool(value, &flag)) {
+      return false;
+    }
+    *(bool *)param->value = flag;
+    return true;
+  }
+  case KERNEL_PARAM_TYPE_U32:
+    if (!has_value || !parse_number(value, U32_MAX, &number)) {
+      return false;
+    }
+    *(u32 *)param->value = (u32)number;
+    return true;
+  case KERNEL_PARAM_TYPE_U64:
+    if (!has_value || !parse_number(value, U64_MAX, &number)) {
+      return false;
+    }
+    *(u64 *)param->value = number;
+    return true;
+  case KERNEL_PARAM_TYPE_CHOICE:
+    for (u32 i = 0; has_value && param->choices[i] != NULL; i++) {
+      if (token_is(value, param->choices[i])) {
+        *(u32 *)param->value = i;
+        return true;
+      }
+    }
+    return false;
+  default:
+    return false;
+  }
+}
+
+static void warn(const char *what, struct token name) {
+  LOG_WARN(what);
+  put_token(name);
+  console_puts("\n");
+}
+
+static bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/*
+ * Apply the command line in one pass. Returns how many options were set;
+ * anything unknown or malformed is warned about and skipped.
+ */
+u32 kernel_param_parse(const char *cmdline) {
+  u32 applied = 0;
+  if (cmdline == NULL) {
+    return 0;
+  }
+
+  const char *p = cmdline;
+  for (;;) {
+    while (is_space(*p)) {
+      p++;
+    }
+    if (*p == '\0') {
+      return applied;
+    }
+
+    struct token name = {p, 0};
+    while (*p != '\0' && *p != '=' && !is_space(*p)) {
+      p++;
+    }
+    name.length = (u64)(p - name.text);
+
+    struct token value = {p, 0};
+    bool has_value = *p == '=';
+    if (has_value) {
+      p++;
+      bool quoted = *p == '"';
+      p += quoted;
+      value.text = p;
+      while (*p != '\0' && (quoted ? *p != '"' : !is_space(*p))) {
+        p++;
+      }
+      value.length = (u64)(p - value.text);
+      p += quoted && *p == '"';
+    }
+
+    const struct kernel_param *param = find(name);
+    if (param == NULL) {
+      warn("Unknown kernel parameter: ", name);
+    } else if (!set(param, value, has_value)) {
+      warn("Bad value for kernel parameter: ", name);
+    } else {
+      applied++;
+    }
+  }
+}
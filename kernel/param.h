@@ -0,0 +1,106 @@
+#ifndef DELTA_KERNEL_PARAM_H
+#define DELTA_KERNEL_PARAM_H
+
+#include "types.h"
+
+/*
+ * Kernel command-line options. A subsystem registers an option next to the
+ * variable it sets:
+ *
+ *   static u32 max_cpus = 0;
+ *   KERNEL_PARAM_U32("maxcpus", max_cpus);
+ *
+ * Each registration is one fixed-size entry in the .kernel_params section.
+ * After linking, tools/param_index finds a seed for which the options'
+ * FNV-1a hashes land in distinct slots of kernel_param_index and writes
+ * the table into the image, so a lookup is one hash, one probe and one
+ * compare. Without the table (the tool did not run) lookups fall back to
+ * scanning the section.
+ *
+ * The command line is "name" (a bool set to true) or "name=value", split
+ * on spaces; values may be double-quoted. Numbers are decimal or 0x hex;
+ * bools are 1/0, on/off, yes/no or true/false; a choice is one of a fixed
+ * list of words, stored as its index. Unknown options and bad values are
+ * warned about and skipped.
+ */
+
+#define KERNEL_PARAM_MAGIC 0x4D524150U       /* "PARM" */
+#define KERNEL_PARAM_INDEX_MAGIC 0x58444E49U /* "INDX" */
+
+#define KERNEL_PARAM_NAME_MAX 32 /* NUL included */
+#define KERNEL_PARAM_MAX 64
+#define KERNEL_PARAM_SLOTS 256 /* Power of two; the table may use fewer */
+
+enum kernel_param_type {
+  KERNEL_PARAM_TYPE_BOOL = 0,
+  KERNEL_PARAM_TYPE_U32 = 1,
+  KERNEL_PARAM_TYPE_U64 = 2,
+  KERNEL_PARAM_TYPE_CHOICE = 3, /* u32 index into a NULL-terminated list */
+};
+
+/* Layout shared with tools/param_index */
+struct kernel_param {
+  u32 magic;
+  u32 type;
+  void *value;
+  const char *const *choices; /* KERNEL_PARAM_TYPE_CHOICE only */
+  char name[KERNEL_PARAM_NAME_MAX];
+};
+
+struct kernel_param_index {
+  u32 magic;
+  u32 seed;  /* 0 until tools/param_index has filled in the table */
+  u32 count; /* Options the table was built for */
+  u32 mask;  /* Slots used - 1 */
+  u8 slots[KERNEL_PARAM_SLOTS]; /* Option index + 1, 0 = empty */
+};
+
+_Static_assert(sizeof(struct kernel_param) % 8 == 0,
+               "entries must pack into an array");
+_Static_assert(KERNEL_PARAM_MAX < 256, "slots hold an index + 1 in a byte");
+
+#define KERNEL_PARAM_DEFINE(param_name, param_type, var, param_choices)       \
+  _Static_assert(sizeof(param_name) <= KERNEL_PARAM_NAME_MAX,                  \
+                 "option name too long: " param_name);                         \
+  __attribute__((section(".kernel_params"), used, aligned(8)))                 \
+  static const struct kernel_param kernel_param_##var = {                      \
+      .magic = KERNEL_PARAM_MAGIC,                                             \
+      .type = param_type,                                                      \
+      .value = &var,                                                           \
+      .choices = param_choices,                                                \
+      .name = param_name,                                                      \
+  }
+
+#define KERNEL_PARAM_BOOL(name, var)                                           \
+  _Static_assert(sizeof(var) == sizeof(bool), #var " is not a bool");          \
+  KERNEL_PARAM_DEFINE(name, KERNEL_PARAM_TYPE_BOOL, var, NULL)
+
+#define KERNEL_PARAM_U32(name, var)                                            \
+  _Static_assert(sizeof(var) == sizeof(u32), #var " is not a u32");            \
+  KERNEL_PARAM_DEFINE(name, KERNEL_PARAM_TYPE_U32, var, NULL)
+
+#define KERNEL_PARAM_U64(name, var)                                            \
+  _Static_assert(sizeof(var) == sizeof(u64), #var " is not a u64");            \
+  KERNEL_PARAM_DEFINE(name, KERNEL_PARAM_TYPE_U64, var, NULL)
+
+/* choices: a NULL-terminated array of words; var gets the index */
+#define KERNEL_PARAM_CHOICE(name, var, choices)                                \
+  _Static_assert(sizeof(var) == sizeof(u32), #var " is not a u32");            \
+  KERNEL_PARAM_DEFINE(name, KERNEL_PARAM_TYPE_CHOICE, var, choices)
+
+/* Seeded FNV-1a; tools/param_index computes the same */
+static inline u32 kernel_param_hash(const char *name, u64 length, u32 seed) {
+  u32 hash = seed;
+  for (u64 i = 0; i < length; i++) {
+    hash = (hash ^ (u8)name[i]) * 0x01000193U;
+  }
+  return hash ^ (hash >> 16);
+}
+
+u32 kernel_param_parse(const char *cmdline);
+
+u32 kernel_param_count(void);
+
+bool kernel_param_indexed(void);
+
+#endif /* DELTA_KERNEL_PARAM_H */
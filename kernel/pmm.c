@@ -0,0 +1,177 @@
+#include "pmm.h"
+#include "spinlock.h"
+
+#include "../arch/amd64/arch_types.h"
+
+#define PMM_MIN_ADDRESS 0x100000UL /* 1 MiB */
+
+struct pmm_region {
+  u64 next; /* Next never-allocated page */
+  u64 end;
+};
+
+/* Link stored in the first word of each free page */
+struct free_page {
+  u64 next;
+};
+
+static struct pmm_region regions[PMM_MAX_REGIONS];
+static u32 region_count = 0;
+static u32 current_region = 0;
+
+static u64 free_list = 0; /* Physical address, 0 = empty */
+static u64 total_pages = 0;
+static u64 free_pages = 0;
+
+static struct spinlock pmm_lock = SPINLOCK_INIT;
+
+/*
+ * Collect the usable regions. The kernel, the boot information, the
+ * bootloader's page tables and the framebuffer all have their own memory
+ * map types, so none of them are handed out.
+ */
+bool pmm_init(const struct parsed_boot_info *info) {
+  if (!info->has_memory_map) {
+    return false;
+  }
+
+  const struct db_tag_memory_map *mmap = info->memory_map;
+  for (u32 i = 0; i < mmap->entry_count && region_count < PMM_MAX_REGIONS;
+       i++) {
+    const u8 *entry_ptr = (const u8 *)mmap->entries + (i * mmap->entry_size);
+    const struct db_mmap_entry *entry = (const struct db_mmap_entry *)entry_ptr;
+
+    if (entry->type != DB_MEM_USABLE) {
+      continue;
+    }
+
+    u64 start = ALIGN_UP(MAX(entry->base, PMM_MIN_ADDRESS), PAGE_SIZE);
+    u64 end = ALIGN_DOWN(entry->base + entry->length, PAGE_SIZE);
+    if (start >= end) {
+      continue;
+    }
+
+    regions[region_count].next = start;
+    regions[region_count].end = end;
+    region_count++;
+    total_pages += (end - start) / PAGE_SIZE;
+  }
+
+  free_pages = total_pages;
+  return region_count > 0;
+}
+
+/* Physical address of a free page, or 0 if memory is exhausted */
+u64 pmm_alloc_page(void) {
+  u64 flags = spin_lock_irqsave(&pmm_lock);
+
+  u64 page = 0;
+  if (free_list != 0) {
+    page = free_list;
+    free_list = ((struct free_page *)phys_to_virt(page))->next;
+  } else {
+    while (current_region < region_count) {
+      struct pmm_region *region = &regions[current_region];
+      if (region->next < region->end) {
+        page = region->next;
+        region->next += PAGE_SIZE;
+        break;
+      }
+      current_region++;
+    }
+  }
+
+  if (page != 0) {
+    free_pages--;
+  }
+
+  spin_unlock_irqrestore(&pmm_lock, flags);
+  return page;
+}
+
+u64 pmm_alloc_zeroed_page(void) {
+  u64 page = pmm_alloc_page();
+  if (page != 0) {
+    u64 *words = phys_to_virt(page);
+    for (u32 i = 0; i < PAGE_SIZE / sizeof(u64); i++) {
+      words[i] = 0;
+    }
+  }
+  return page;
+}
+
+/*
+ * count physically contiguous pages, or 0. Only never-allocated memory is
+ * contiguous, so this takes from the regions and leaves the free list alone;
+ * give the pages back one at a time with pmm_free_page().
+ */
+u64 pmm_alloc_pages(u64 count) {
+  if (count == 0) {
+    return 0;
+  }
+
+  u64 flags = spin_lock_irqsave(&pmm_lock);
+
+  u64 base = 0;
+  for (u32 i = current_region; i < region_count; i++) {
+    struct pmm_region *region = &regions[i];
+    if ((region->end - region->next) / PAGE_SIZE >= count) {
+      base = region->next;
+      region->next += count * PAGE_SIZE;
+      free_pages -= count;
+      break;
+    }
+  }
+
+  spin_unlock_irqrestore(&pmm_lock, flags);
+  return base;
+}
+
+void pmm_free_page(u64 phys) {
+  if (phys == 0 || (phys & PAGE_MASK) != 0) {
+    return;
+  }
+
+  u64 flags = spin_lock_irqsave(&pmm_lock);
+  ((struct free_page *)phys_to_virt(phys))->next = free_list;
+  free_list = phys;
+  free_pages++;
+  spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+/*
+ * Hand over memory the allocator never owned (reclaimed boot memory). Only
+ * whole pages inside [start, end) are taken. The range becomes a region of
+ * its own while there is room, so its pages are not touched until they are
+ * handed out; after that they go on the free list. Returns how many.
+ */
+u64 pmm_add_range(u64 start, u64 end) {
+  start = ALIGN_UP(MAX(start, PMM_MIN_ADDRESS), PAGE_SIZE);
+  end = ALIGN_DOWN(end, PAGE_SIZE);
+  if (start >= end) {
+    return 0;
+  }
+
+  u64 count = (end - start) / PAGE_SIZE;
+  u64 flags = spin_lock_irqsave(&pmm_lock);
+  if (region_count < PMM_MAX_REGIONS) {
+    regions[region_count].next = start;
+    regions[region_count].end = end;
+    region_count++;
+  } else {
+    for (u64 page = start; page < end; page += PAGE_SIZE) {
+      ((struct free_page *)phys_to_virt(page))->next = free_list;
+      free_list = page;
+    }
+  }
+  total_pages += count;
+  free_pages += count;
+  spin_unlock_irqrestore(&pmm_lock, flags);
+  return count;
+}
+
+u64 pmm_total_pages(void) {
+  return __atomic_load_n(&total_pages, __ATOMIC_RELAXED);
+}
+
+u64 pmm_free_pages(void) { return __atomic_load_n(&free_pages, __ATOMIC_RELAXED); }
@@ -0,0 +1,33 @@
+#ifndef DELTA_KERNEL_PMM_H
+#define DELTA_KERNEL_PMM_H
+
+#include "boot_info.h"
+#include "types.h"
+
+/*
+ * Physical page allocator. Usable memory map regions are handed out front
+ * to back, so start-up costs nothing however much RAM there is; freed
+ * pages go on a free list threaded through the pages themselves and are
+ * reused first. Memory below 1 MiB is left alone (real-mode structures and
+ * the AP trampoline).
+ */
+
+#define PMM_MAX_REGIONS 64
+
+bool pmm_init(const struct parsed_boot_info *info);
+
+u64 pmm_alloc_page(void);
+
+u64 pmm_alloc_zeroed_page(void);
+
+u64 pmm_alloc_pages(u64 count);
+
+void pmm_free_page(u64 phys);
+
+u64 pmm_add_range(u64 start, u64 end);
+
+u64 pmm_total_pages(void);
+
+u64 pmm_free_pages(void);
+
+#endif /* DELTA_KERNEL_PMM_H */
@@ -0,0 +1,364 @@
+#include "profile.h"
+#include "console.h"
+#include "ksym.h"
+#include "param.h"
+#include "pmm.h"
+#include "workqueue.h"
+
+#include "../arch/amd64/idt.h"
+#include "../arch/amd64/percpu.h"
+#include "../arch/amd64/pmu.h"
+#include "../arch/amd64/stacktrace.h"
+#include "../arch/amd64/uart.h"
+
+#define NS_PER_MS 1000000UL
+
+/* Longest folded line: every frame a full-length name, then the count */
+#define PROFILE_LINE_MAX (PROFILE_DEPTH * KSYM_NAME_MAX + 32)
+
+#define FNV64_OFFSET 0xCBF29CE484222325UL
+#define FNV64_PRIME 0x00000100000001B3UL
+
+struct profile_sample {
+  u32 depth; /* Entries in ips; 0 for a sample taken in user mode */
+  u32 reserved;
+  u64 ips[PROFILE_DEPTH]; /* Innermost first */
+};
+
+#define PROFILE_BUFFER_PAGES                                                   \
+  ((PROFILE_SAMPLES_PER_CPU * sizeof(struct profile_sample) + PAGE_SIZE - 1) / \
+   PAGE_SIZE)
+
+struct profile_cpu {
+  struct profile_sample *samples;
+  u32 count;
+  u32 dropped;
+  bool sampling; /* Counter armed: its NMIs are ours */
+  bool bound;    /* Has its own worker, so it takes part */
+  struct work start;
+  struct work stop;
+};
+
+/* One distinct call chain and how many samples hit it */
+struct profile_stack {
+  const struct profile_sample *sample;
+  u64 count;
+};
+
+static u32 profile_ms = 0;
+static u32 profile_period = PROFILE_PERIOD_DEFAULT;
+KERNEL_PARAM_U32("profile", profile_ms);
+KERNEL_PARAM_U32("profile.period", profile_period);
+
+static struct profile_cpu cpus[MAX_CPUS];
+static u32 cpu_count = 0;
+static u32 running = 0; /* CPUs yet to stop */
+static bool stopping = false;
+static u32 sample_period = 0; /* profile.period as the PMU took it */
+static struct delayed_work stop_all;
+
+static char line[PROFILE_LINE_MAX];
+
+static bool profile_nmi(struct interrupt_frame *frame) {
+  struct profile_cpu *cpu = &cpus[this_cpu_id()];
+  if (!__atomic_load_n(&cpu->sampling, __ATOMIC_ACQUIRE) ||
+      !pmu_overflowed()) {
+    return false;
+  }
+
+  if (cpu->count < PROFILE_SAMPLES_PER_CPU) {
+    struct profile_sample *sample = &cpu->samples[cpu->count++];
+    if ((frame->cs & 3) != 0) {
+      sample->depth = 0;
+    } else {
+      sample->ips[0] = frame->rip;
+      sample->depth = 1 + stack_walk(frame->rsp, frame->rbp, &sample->ips[1],
+                                     PROFILE_DEPTH - 1);
+    }
+  } else {
+    cpu->dropped++;
+  }
+  pmu_rearm();
+  return true;
+}
+
+static void sample_this_cpu(void) {
+  if (__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+    return; /* The window closed before this CPU got to start */
+  }
+  __atomic_store_n(&cpus[this_cpu_id()].sampling, true, __ATOMIC_RELEASE);
+  __atomic_store_n(&sample_period, pmu_start(profile_period),
+                   __ATOMIC_RELAXED);
+}
+
+static void start_work(struct work *work) {
+  (void)work;
+  sample_this_cpu();
+}
+
+/*
+ * Fold each address to the start of its symbol, so call sites merge. A
+ * return address is looked up one byte back: a call to a function that
+ * does not return can be the last instruction of its caller.
+ */
+static void canonicalize(struct profile_sample *sample) {
+  struct ksym sym;
+  for (u32 i = 0; i < sample->depth; i++) {
+    if (ksym_lookup(sample->ips[i] - (i > 0 ? 1 : 0), &sym)) {
+      sample->ips[i] = sym.address;
+    }
+  }
+}
+
+static u64 sample_hash(const struct profile_sample *sample) {
+  u64 hash = FNV64_OFFSET ^ sample->depth;
+  for (u32 i = 0; i < sample->depth; i++) {
+    hash = (hash ^ sample->ips[i]) * FNV64_PRIME;
+  }
+  return hash;
+}
+
+static bool same_stack(const struct profile_sample *a,
+                       const struct profile_sample *b) {
+  if (a->depth != b->depth) {
+    return false;
+  }
+  for (u32 i = 0; i < a->depth; i++) {
+    if (a->ips[i] != b->ips[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Open addressing, linear probing; the table is at least twice the load */
+static u32 merge_stacks(struct profile_stack *table, u64 mask) {
+  u32 stacks = 0;
+  for (u32 cpu = 0; cpu < cpu_count; cpu++) {
+    for (u32 i = 0; i < cpus[cpu].count; i++) {
+      const struct profile_sample *sample = &cpus[cpu].samples[i];
+      u64 slot = sample_hash(sample) & mask;
+      while (table[slot].sample != NULL &&
+             !same_stack(table[slot].sample, sample)) {
+        slot = (slot + 1) & mask;
+      }
+      if (table[slot].sample == NULL) {
+        table[slot].sample = sample;
+        stacks++;
+      }
+      table[slot].count++;
+    }
+  }
+  return stacks;
+}
+
+static u32 append(u32 length, const char *text) {
+  while (*text != '\0' && length < PROFILE_LINE_MAX - 1) {
+    line[length++] = *text++;
+  }
+  return length;
+}
+
+static u32 append_number(u32 length, u64 value, u32 base) {
+  static const char digits[] = "0123456789abcdef";
+  char text[21];
+  u32 start = sizeof(text) - 1;
+  text[start] = '\0';
+  do {
+    text[--start] = digits[value % base];
+    value /= base;
+  } while (value != 0);
+  return append(length, &text[start]);
+}
+
+static u32 append_frame(u32 length, u64 address) {
+  struct ksym sym;
+  if (ksym_lookup(address, &sym)) {
+    return append(length, sym.name);
+  }
+  return append_number(append(length, "0x"), address, 16);
+}
+
+/* One folded line, written whole so console output cannot split it */
+static void export_stack(const struct profile_stack *stack) {
+  const struct profile_sample *sample = stack->sample;
+  u32 length = 0;
+  if (sample->depth == 0) {
+    length = append(length, "[user]");
+  }
+  for (u32 i = sample->depth; i-- > 0;) {
+    length = append_frame(length, sample->ips[i]);
+    if (i > 0) {
+      length = append(length, ";");
+    }
+  }
+  length = append(length, " ");
+  length = append_number(length, stack->count, 10);
+  length = append(length, "\n");
+  uart_write(line, length);
+}
+
+static void free_pages(u64 base, u64 pages) {
+  for (u64 i = 0; i < pages; i++) {
+    pmm_free_page(base + i * PAGE_SIZE);
+  }
+}
+
+/*
+ * Merge and send everything, once every CPU has stopped. Runs in the last
+ * CPU's worker, so it may take the time the serial line needs.
+ */
+static void profile_export(void) {
+  u64 samples = 0;
+  u64 dropped = 0;
+  for (u32 cpu = 0; cpu < cpu_count; cpu++) {
+    for (u32 i = 0; i < cpus[cpu].count; i++) {
+      canonicalize(&cpus[cpu].samples[i]);
+    }
+    samples += cpus[cpu].count;
+    dropped += cpus[cpu].dropped;
+  }
+
+  u64 slots = 2;
+  while (slots < samples * 2) {
+    slots <<= 1;
+  }
+  u64 table_pages =
+      (slots * sizeof(struct profile_stack) + PAGE_SIZE - 1) / PAGE_SIZE;
+  u64 table_base = pmm_alloc_pages(table_pages);
+  bool serial = uart_present() || uart_init(UART_COM1, UART_BAUD_DEFAULT);
+  if (table_base == 0 || !serial) {
+    LOG_WARN(table_base == 0 ? "Profile: no memory to merge the samples\n"
+                             : "Profile: no serial port to send it to\n");
+  } else {
+    struct profile_stack *table = phys_to_virt(table_base);
+    for (u64 i = 0; i < slots; i++) {
+      table[i].sample = NULL;
+      table[i].count = 0;
+    }
+    u32 stacks = merge_stacks(table, slots - 1);
+
+    u32 length = append(0, "# profile: ");
+    struct pmu_info pmu;
+    pmu_get_info(&pmu);
+    length = append(length, pmu_event_name(pmu.event));
+    length = append(length, " every ");
+    length = append_number(length, sample_period, 10);
+    length = append(length, ", ");
+    length = append_number(length, cpu_count, 10);
+    length = append(length, " CPUs, ");
+    length = append_number(length, samples, 10);
+    length = append(length, " samples, ");
+    length = append_number(length, dropped, 10);
+    length = append(length, " dropped\n");
+    uart_write(line, length);
+    for (u64 i = 0; i < slots; i++) {
+      if (table[i].sample != NULL) {
+        export_stack(&table[i]);
+      }
+    }
+    uart_write("# profile end\n", 14);
+
+    LOG_INFO("Profile: ");
+    console_put_dec(samples);
+    console_puts(" samples in ");
+    console_put_dec(stacks);
+    console_puts(" call chains (");
+    console_put_dec(dropped);
+    console_puts(" dropped), folded stacks sent to COM1\n");
+  }
+
+  if (table_base != 0) {
+    free_pages(table_base, table_pages);
+  }
+  for (u32 cpu = 0; cpu < cpu_count; cpu++) {
+    free_pages(virt_to_phys(cpus[cpu].samples), PROFILE_BUFFER_PAGES);
+    cpus[cpu].samples = NULL;
+  }
+}
+
+static void cpu_stopped(void) {
+  if (__atomic_sub_fetch(&running, 1, __ATOMIC_ACQ_REL) == 0) {
+    profile_export();
+  }
+}
+
+static void stop_work(struct work *work) {
+  (void)work;
+  pmu_stop();
+  __atomic_store_n(&cpus[this_cpu_id()].sampling, false, __ATOMIC_RELEASE);
+  cpu_stopped();
+}
+
+static void stop_all_work(struct work *work) {
+  (void)work;
+  __atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+  for (u32 cpu = 0; cpu < cpu_count; cpu++) {
+    if (cpus[cpu].bound) {
+      queue_work_on(cpu, &cpus[cpu].stop);
+    }
+  }
+}
+
+/*
+ * Start sampling if profile= asks for it: this CPU now, the others from
+ * their workers, and arm the timer that ends the window. Call once the
+ * work queues are up. A CPU without its own worker is left out: work
+ * queued for it would run on whichever CPU the unbound pool picks.
+ */
+bool profile_start(void) {
+  if (profile_ms == 0) {
+    return false;
+  }
+  if (!pmu_available()) {
+    LOG_WARN("profile= needs an architectural PMU (CPUID leaf 0xA)\n");
+    return false;
+  }
+
+  if (!nmi_register(profile_nmi)) {
+    LOG_WARN("profile= found no free NMI handler slot\n");
+    return false;
+  }
+
+  u32 online = MIN(percpu_online_count(), (u32)MAX_CPUS);
+  for (u32 cpu = 0; cpu < online; cpu++) {
+    u64 buffer = pmm_alloc_pages(PROFILE_BUFFER_PAGES);
+    if (buffer == 0) {
+      for (u32 i = 0; i < cpu; i++) {
+        free_pages(virt_to_phys(cpus[i].samples), PROFILE_BUFFER_PAGES);
+      }
+      LOG_WARN("profile= could not allocate its sample buffers\n");
+      return false;
+    }
+    cpus[cpu].samples = phys_to_virt(buffer);
+    work_init(&cpus[cpu].start, start_work);
+    work_init(&cpus[cpu].stop, stop_work);
+  }
+  u32 bound = 0;
+  for (u32 cpu = 0; cpu < online; cpu++) {
+    cpus[cpu].bound = workqueue_has_worker(cpu);
+    bound += cpus[cpu].bound ? 1 : 0;
+  }
+  u32 self = this_cpu_id();
+  if (!cpus[self].bound) {
+    for (u32 cpu = 0; cpu < online; cpu++) {
+      free_pages(virt_to_phys(cpus[cpu].samples), PROFILE_BUFFER_PAGES);
+    }
+    LOG_WARN("profile= needs a worker on the starting CPU\n");
+    return false;
+  }
+  cpu_count = online;
+  running = bound;
+  delayed_work_init(&stop_all, stop_all_work);
+
+  sample_this_cpu();
+  for (u32 cpu = 0; cpu < online; cpu++) {
+    if (cpu != self && cpus[cpu].bound) {
+      queue_work_on(cpu, &cpus[cpu].start);
+    }
+  }
+  if (!queue_delayed_work(&stop_all, (u64)profile_ms * NS_PER_MS)) {
+    stop_all_work(&stop_all.work);
+  }
+  return true;
+}
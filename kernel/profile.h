@@ -0,0 +1,33 @@
+#ifndef DELTA_KERNEL_PROFILE_H
+#define DELTA_KERNEL_PROFILE_H
+
+#include "types.h"
+
+/*
+ * Sampling profiler. With profile=<ms>, every CPU samples the kernel from
+ * work queue start-up for at least that many milliseconds (the stop timer
+ * fires once the boot CPU enables interrupts), every profile.period events
+ * of the PMU (arch/amd64/pmu.h). Each sample is the interrupted RIP and up
+ * to PROFILE_DEPTH - 1 return addresses from the frame-pointer chain,
+ * taken in the counter's NMI into that CPU's buffer; a full buffer counts
+ * drops instead.
+ *
+ * When the window closes, identical call chains are merged and sent over
+ * COM1 as folded stacks, outermost frame first, with their sample count:
+ *
+ *   # profile: cycles every 1000000, 4 CPUs, 5210 samples, 0 dropped
+ *   kernel_main;initrd_load;lz4_decode_block 812
+ *   [user] 3
+ *   # profile end
+ *
+ * flamegraph.pl and compatible tools read the lines between the markers
+ * as is. Frames are symbols from ksym.h; unknown addresses stay in hex.
+ */
+
+#define PROFILE_DEPTH 15              /* RIP and return addresses */
+#define PROFILE_SAMPLES_PER_CPU 2048  /* 256 KiB of buffer per CPU */
+#define PROFILE_PERIOD_DEFAULT 1000000
+
+bool profile_start(void);
+
+#endif /* DELTA_KERNEL_PROFILE_H */
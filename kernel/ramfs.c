@@ -0,0 +1,329 @@
+#include "ramfs.h"
+#include "pmm.h"
+
+#include "../arch/amd64/arch_types.h"
+#include "../arch/amd64/tsc.h"
+
+/* cpio "newc": ASCII header, then the name, then the data, each 4-aligned */
+#define CPIO_HEADER_SIZE 110
+#define CPIO_MAGIC_SIZE 6
+#define CPIO_FIELD_SIZE 8
+#define CPIO_ALIGN 4
+
+enum cpio_field {
+  CPIO_INO = 0,
+  CPIO_MODE = 1,
+  CPIO_UID = 2,
+  CPIO_GID = 3,
+  CPIO_NLINK = 4,
+  CPIO_MTIME = 5,
+  CPIO_FILESIZE = 6,
+  CPIO_DEVMAJOR = 7,
+  CPIO_DEVMINOR = 8,
+  CPIO_RDEVMAJOR = 9,
+  CPIO_RDEVMINOR = 10,
+  CPIO_NAMESIZE = 11,
+  CPIO_CHECK = 12,
+};
+
+enum cpio_result {
+  CPIO_ENTRY = 0,
+  CPIO_END = 1, /* Trailer reached */
+  CPIO_BAD = 2,
+};
+
+struct cpio_entry {
+  const char *name; /* Leading "./" and "/" removed */
+  const u8 *data;
+  u64 size;
+  u32 mode;
+};
+
+#define RAMFS_MIN_SLOTS 16
+
+#define FNV_OFFSET_BASIS 0x811C9DC5U
+#define FNV_PRIME 0x01000193U
+
+/*
+ * Open addressing with linear probing, at most half full. Slots are never
+ * emptied (a released file stays as a marker), so probing stays simple.
+ */
+static struct ramfs_file *table = NULL;
+static u32 table_mask = 0;
+static enum ramfs_backing image_backing = RAMFS_BOOT_MEMORY;
+static struct ramfs_stats stats;
+
+static bool bytes_equal(const u8 *a, const char *b, u32 length) {
+  for (u32 i = 0; i < length; i++) {
+    if (a[i] != (u8)b[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool names_equal(const char *a, const char *b) {
+  while (*a != '\0' && *a == *b) {
+    a++;
+    b++;
+  }
+  return *a == *b;
+}
+
+static const char *strip_prefix(const char *path) {
+  for (;;) {
+    if (path[0] == '/') {
+      path++;
+    } else if (path[0] == '.' && path[1] == '/') {
+      path += 2;
+    } else {
+      return path;
+    }
+  }
+}
+
+static u32 hash_name(const char *name) {
+  u32 hash = FNV_OFFSET_BASIS;
+  for (; *name != '\0'; name++) {
+    hash = (hash ^ (u8)*name) * FNV_PRIME;
+  }
+  return hash;
+}
+
+static bool parse_field(const u8 *header, enum cpio_field field, u32 *value) {
+  const u8 *p = header + CPIO_MAGIC_SIZE + field * CPIO_FIELD_SIZE;
+  u32 result = 0;
+
+  for (u32 i = 0; i < CPIO_FIELD_SIZE; i++) {
+    u8 c = p[i];
+    u32 digit;
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      digit = c - 'A' + 10;
+    } else {
+      return false;
+    }
+    result = (result << 4) | digit;
+  }
+
+  *value = result;
+  return true;
+}
+
+/* Decode the header at *offset and advance past the entry's data */
+static enum cpio_result cpio_next(const u8 *image, u64 length, u64 *offset,
+                                  struct cpio_entry *entry) {
+  u64 at = *offset;
+  if (at > length || length - at < CPIO_HEADER_SIZE) {
+    return CPIO_BAD;
+  }
+
+  const u8 *header = image + at;
+  /* 070701 is plain newc, 070702 adds a checksum we do not use */
+  if (!bytes_equal(header, "07070", 5) ||
+      (header[5] != '1' && header[5] != '2')) {
+    return CPIO_BAD;
+  }
+
+  u32 mode, file_size, name_size;
+  if (!parse_field(header, CPIO_MODE, &mode) ||
+      !parse_field(header, CPIO_FILESIZE, &file_size) ||
+      !parse_field(header, CPIO_NAMESIZE, &name_size) || name_size == 0) {
+    return CPIO_BAD;
+  }
+
+  u64 name_at = at + CPIO_HEADER_SIZE;
+  if (length - name_at < name_size || image[name_at + name_size - 1] != '\0') {
+    return CPIO_BAD;
+  }
+
+  const char *name = (const char *)image + name_at;
+  if (names_equal(name, "TRAILER!!!")) {
+    return CPIO_END;
+  }
+
+  u64 data_at = ALIGN_UP(name_at + name_size, CPIO_ALIGN);
+  if (data_at > length || length - data_at < file_size) {
+    return CPIO_BAD;
+  }
+
+  entry->name = strip_prefix(name);
+  entry->data = image + data_at;
+  entry->size = file_size;
+  entry->mode = mode;
+  *offset = ALIGN_UP(data_at + file_size, CPIO_ALIGN);
+  return CPIO_ENTRY;
+}
+
+/* The archive root: "." or an empty name after stripping */
+static bool is_root(const char *name) {
+  return name[0] == '\0' || (name[0] == '.' && name[1] == '\0');
+}
+
+static struct ramfs_file *find_slot(const char *name, u32 hash) {
+  for (u32 i = hash & table_mask;; i = (i + 1) & table_mask) {
+    struct ramfs_file *slot = &table[i];
+    if (slot->name == NULL ||
+        (slot->hash == hash && names_equal(slot->name, name))) {
+      return slot;
+    }
+  }
+}
+
+static void insert(const struct cpio_entry *entry) {
+  u32 hash = hash_name(entry->name);
+  struct ramfs_file *slot = find_slot(entry->name, hash);
+  bool replacing = slot->name != NULL;
+
+  if (replacing) {
+    if ((slot->mode & RAMFS_MODE_TYPE) == RAMFS_MODE_DIR) {
+      stats.directories--;
+    } else {
+      stats.files--;
+      stats.file_bytes -= slot->size;
+    }
+  }
+
+  slot->name = entry->name;
+  slot->data = entry->data;
+  slot->size = entry->size;
+  slot->mode = entry->mode;
+  slot->hash = hash;
+  slot->released = false;
+
+  if ((entry->mode & RAMFS_MODE_TYPE) == RAMFS_MODE_DIR) {
+    stats.directories++;
+  } else {
+    stats.files++;
+    stats.file_bytes += entry->size;
+  }
+}
+
+/*
+ * Index a cpio archive in place. The image must stay mapped, and must not
+ * be written, for as long as the ramfs is used. Returns false if it is not
+ * a well-formed archive, or the index could not be allocated. Call once.
+ */
+bool ramfs_init(const void *image, u64 length, enum ramfs_backing backing) {
+  u64 start = clock_monotonic_ns();
+  struct cpio_entry entry;
+
+  /* First pass: validate and count, to size the table */
+  u32 entries = 0;
+  u64 offset = 0;
+  enum cpio_result result;
+  while ((result = cpio_next(image, length, &offset, &entry)) == CPIO_ENTRY) {
+    entries += is_root(entry.name) ? 0 : 1;
+  }
+  if (result != CPIO_END) {
+    return false;
+  }
+
+  u64 slots = RAMFS_MIN_SLOTS;
+  while (slots < (u64)entries * 2) {
+    slots <<= 1;
+  }
+  u64 bytes = ALIGN_UP(slots * sizeof(struct ramfs_file), PAGE_SIZE);
+  u64 base = pmm_alloc_pages(bytes / PAGE_SIZE);
+  if (base == 0) {
+    return false;
+  }
+
+  table = phys_to_virt(base);
+  for (u64 i = 0; i < slots; i++) {
+    table[i].name = NULL;
+  }
+  table_mask = (u32)(slots - 1);
+  image_backing = backing;
+
+  offset = 0;
+  while (cpio_next(image, length, &offset, &entry) == CPIO_ENTRY) {
+    if (!is_root(entry.name)) {
+      insert(&entry);
+    }
+  }
+
+  stats.image_bytes = length;
+  stats.index_bytes = bytes;
+  stats.index_ns = clock_monotonic_ns() - start;
+  return true;
+}
+
+bool ramfs_mounted(void) { return table != NULL; }
+
+/* NULL if there is no such path, or it was released */
+const struct ramfs_file *ramfs_lookup(const char *path) {
+  if (table == NULL) {
+    return NULL;
+  }
+
+  path = strip_prefix(path);
+  const struct ramfs_file *file = find_slot(path, hash_name(path));
+  if (file->name == NULL ||
+      __atomic_load_n(&file->released, __ATOMIC_ACQUIRE)) {
+    return NULL;
+  }
+  return file;
+}
+
+/* A regular file's contents, in place. NULL for anything else. */
+const void *ramfs_read(const char *path, u64 *size) {
+  const struct ramfs_file *file = ramfs_lookup(path);
+  if (file == NULL || (file->mode & RAMFS_MODE_TYPE) != RAMFS_MODE_FILE) {
+    return NULL;
+  }
+
+  if (size != NULL) {
+    *size = file->size;
+  }
+  return file->data;
+}
+
+/*
+ * Drop a file and give the pages holding nothing but its data to the page
+ * allocator. Pages shared with neighbouring headers or files stay until
+ * the whole image is reclaimed. The caller must be done with the data, and
+ * every pointer into it. Returns the bytes given back.
+ */
+u64 ramfs_release(const char *path) {
+  const struct ramfs_file *found = ramfs_lookup(path);
+  if (found == NULL) {
+    return 0;
+  }
+
+  struct ramfs_file *file = (struct ramfs_file *)found;
+  bool expected = false;
+  if (!__atomic_compare_exchange_n(&file->released, &expected, true, false,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+    return 0; /* Another CPU got there first */
+  }
+
+  u64 start = virt_to_phys(file->data);
+  u64 end = start + file->size;
+  u64 pages = 0;
+  if (image_backing == RAMFS_BOOT_MEMORY) {
+    pages = pmm_add_range(start, end);
+  } else {
+    for (u64 page = ALIGN_UP(start, PAGE_SIZE); page + PAGE_SIZE <= end;
+         page += PAGE_SIZE) {
+      pmm_free_page(page);
+      pages++;
+    }
+  }
+  __atomic_fetch_add(&stats.released_bytes, pages * PAGE_SIZE,
+                     __ATOMIC_RELAXED);
+  return pages * PAGE_SIZE;
+}
+
+void ramfs_get_stats(struct ramfs_stats *out) {
+  if (out == NULL) {
+    return;
+  }
+
+  *out = stats;
+  out->released_bytes =
+      __atomic_load_n(&stats.released_bytes, __ATOMIC_RELAXED);
+}
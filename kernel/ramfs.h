@@ -0,0 +1,63 @@
+#ifndef DELTA_KERNEL_RAMFS_H
+#define DELTA_KERNEL_RAMFS_H
+
+#include "types.h"
+
+/*
+ * Read-only file system over a cpio (newc) archive, usually the initrd.
+ * The archive is indexed once, in place: a hash table maps each path to
+ * its data inside the image, and lookups hand out pointers straight into
+ * it. Nothing is copied.
+ *
+ * Paths are stored as in the archive with any leading "./" or "/" removed,
+ * and looked up the same way. A later entry with the same path replaces an
+ * earlier one, as it would when unpacking.
+ *
+ * Once a file's contents are no longer needed, ramfs_release() gives the
+ * pages that only hold its data back to the physical allocator: boot
+ * memory (the initrd as loaded) is added to it, pages it handed out (an
+ * unpacked initrd) are freed.
+ */
+
+#define RAMFS_MODE_TYPE 0170000
+#define RAMFS_MODE_DIR 0040000
+#define RAMFS_MODE_FILE 0100000
+#define RAMFS_MODE_SYMLINK 0120000
+
+enum ramfs_backing {
+  RAMFS_BOOT_MEMORY = 0,    /* Never owned by the page allocator */
+  RAMFS_PAGE_ALLOCATOR = 1, /* From pmm_alloc_pages() */
+};
+
+struct ramfs_file {
+  const char *name; /* In the image, NUL-terminated */
+  const u8 *data;   /* In the image: valid until ramfs_release() */
+  u64 size;
+  u32 mode;
+  u32 hash;
+  bool released;
+};
+
+struct ramfs_stats {
+  u32 files; /* Regular files and symlinks */
+  u32 directories;
+  u64 file_bytes;
+  u64 image_bytes;
+  u64 index_bytes;    /* Hash table */
+  u64 released_bytes; /* Returned to the page allocator */
+  u64 index_ns;       /* Time to parse and index the archive */
+};
+
+bool ramfs_init(const void *image, u64 length, enum ramfs_backing backing);
+
+bool ramfs_mounted(void);
+
+const struct ramfs_file *ramfs_lookup(const char *path);
+
+const void *ramfs_read(const char *path, u64 *size);
+
+u64 ramfs_release(const char *path);
+
+void ramfs_get_stats(struct ramfs_stats *stats);
+
+#endif /* DELTA_KERNEL_RAMFS_H */
@@ -0,0 +1,287 @@
+#include "rbtree.h"
+
+static inline bool is_red(const struct rb_node *node) {
+  return node != NULL && node->color == RB_RED;
+}
+
+static void replace_child(struct rb_root *root, struct rb_node *parent,
+                          struct rb_node *old, struct rb_node *new) {
+  if (parent == NULL) {
+    root->node = new;
+  } else if (parent->left == old) {
+    parent->left = new;
+  } else {
+    parent->right = new;
+  }
+}
+
+/*
+ * A rotation moves no node in or out of the subtree it is applied to, so
+ * only the two rotated nodes need their augmented value recomputed, lower
+ * one first.
+ */
+static void rotate_left(struct rb_root *root, struct rb_node *node,
+                        rb_augment_t augment) {
+  struct rb_node *pivot = node->right;
+
+  node->right = pivot->left;
+  if (pivot->left != NULL) {
+    pivot->left->parent = node;
+  }
+  pivot->parent = node->parent;
+  replace_child(root, node->parent, node, pivot);
+  pivot->left = node;
+  node->parent = pivot;
+
+  if (augment != NULL) {
+    augment(node);
+    augment(pivot);
+  }
+}
+
+static void rotate_right(struct rb_root *root, struct rb_node *node,
+                         rb_augment_t augment) {
+  struct rb_node *pivot = node->left;
+
+  node->left = pivot->right;
+  if (pivot->right != NULL) {
+    pivot->right->parent = node;
+  }
+  pivot->parent = node->parent;
+  replace_child(root, node->parent, node, pivot);
+  pivot->right = node;
+  node->parent = pivot;
+
+  if (augment != NULL) {
+    augment(node);
+    augment(pivot);
+  }
+}
+
+static void propagate(struct rb_node *node, rb_augment_t augment) {
+  if (augment == NULL) {
+    return;
+  }
+  for (; node != NULL; node = node->parent) {
+    augment(node);
+  }
+}
+
+void rb_insert(struct rb_root *root, struct rb_node *node,
+               rb_augment_t augment) {
+  propagate(node, augment);
+
+  struct rb_node *parent;
+  while ((parent = node->parent) != NULL && parent->color == RB_RED) {
+    struct rb_node *grandparent = parent->parent; /* The root is black */
+
+    if (parent == grandparent->left) {
+      struct rb_node *uncle = grandparent->right;
+      if (is_red(uncle)) {
+        parent->color = RB_BLACK;
+        uncle->color = RB_BLACK;
+        grandparent->color = RB_RED;
+        node = grandparent;
+        continue;
+      }
+      if (node == parent->right) {
+        rotate_left(root, parent, augment);
+        node = parent;
+        parent = node->parent;
+      }
+      parent->color = RB_BLACK;
+      grandparent->color = RB_RED;
+      rotate_right(root, grandparent, augment);
+    } else {
+      struct rb_node *uncle = grandparent->left;
+      if (is_red(uncle)) {
+        parent->color = RB_BLACK;
+        uncle->color = RB_BLACK;
+        grandparent->color = RB_RED;
+        node = grandparent;
+        continue;
+      }
+      if (node == parent->left) {
+        rotate_right(root, parent, augment);
+        node = parent;
+        parent = node->parent;
+      }
+      parent->color = RB_BLACK;
+      grandparent->color = RB_RED;
+      rotate_left(root, grandparent, augment);
+    }
+  }
+
+  root->node->color = RB_BLACK;
+}
+
+static void erase_fixup(struct rb_root *root, struct rb_node *node,
+                        struct rb_node *parent, rb_augment_t augment) {
+  /* node carries an extra black; it may be NULL, hence the explicit parent */
+  while (node != root->node && !is_red(node)) {
+    if (node == parent->left) {
+      struct rb_node *sibling = parent->right;
+      if (is_red(sibling)) {
+        sibling->color = RB_BLACK;
+        parent->color = RB_RED;
+        rotate_left(root, parent, augment);
+        sibling = parent->right;
+      }
+      if (!is_red(sibling->left) && !is_red(sibling->right)) {
+        sibling->color = RB_RED;
+        node = parent;
+        parent = node->parent;
+        continue;
+      }
+      if (!is_red(sibling->right)) {
+        sibling->left->color = RB_BLACK;
+        sibling->color = RB_RED;
+        rotate_right(root, sibling, augment);
+        sibling = parent->right;
+      }
+      sibling->color = parent->color;
+      parent->color = RB_BLACK;
+      sibling->right->color = RB_BLACK;
+      rotate_left(root, parent, augment);
+    } else {
+      struct rb_node *sibling = parent->left;
+      if (is_red(sibling)) {
+        sibling->color = RB_BLACK;
+        parent->color = RB_RED;
+        rotate_right(root, parent, augment);
+        sibling = parent->left;
+      }
+      if (!is_red(sibling->left) && !is_red(sibling->right)) {
+        sibling->color = RB_RED;
+        node = parent;
+        parent = node->parent;
+        continue;
+      }
+      if (!is_red(sibling->left)) {
+        sibling->right->color = RB_BLACK;
+        sibling->color = RB_RED;
+        rotate_left(root, sibling, augment);
+        sibling = parent->left;
+      }
+      sibling->color = parent->color;
+      parent->color = RB_BLACK;
+      sibling->left->color = RB_BLACK;
+      rotate_right(root, parent, augment);
+    }
+    node = root->node;
+    break;
+  }
+
+  if (node != NULL) {
+    node->color = RB_BLACK;
+  }
+}
+
+static void transplant(struct rb_root *root, struct rb_node *old,
+                       struct rb_node *new) {
+  replace_child(root, old->parent, old, new);
+  if (new != NULL) {
+    new->parent = old->parent;
+  }
+}
+
+void rb_erase(struct rb_root *root, struct rb_node *node,
+              rb_augment_t augment) {
+  struct rb_node *child;
+  struct rb_node *parent; /* Lowest node whose subtree lost a member */
+  u8 removed_color = node->color;
+
+  if (node->left == NULL) {
+    child = node->right;
+    parent = node->parent;
+    transplant(root, node, child);
+  } else if (node->right == NULL) {
+    child = node->left;
+    parent = node->parent;
+    transplant(root, node, child);
+  } else {
+    /* Two children: the successor takes the node's place */
+    struct rb_node *successor = node->right;
+    while (successor->left != NULL) {
+      successor = successor->left;
+    }
+
+    removed_color = successor->color;
+    child = successor->right;
+
+    if (successor->parent == node) {
+      parent = successor;
+    } else {
+      parent = successor->parent;
+      transplant(root, successor, child);
+      successor->right = node->right;
+      successor->right->parent = successor;
+    }
+
+    transplant(root, node, successor);
+    successor->left = node->left;
+    successor->left->parent = successor;
+    successor->color = node->color;
+  }
+
+  /* Covers the successor too: it is an ancestor of parent now */
+  propagate(parent, augment);
+
+  if (removed_color == RB_BLACK) {
+    erase_fixup(root, child, parent, augment);
+  }
+}
+
+struct rb_node *rb_first(const struct rb_root *root) {
+  struct rb_node *node = root->node;
+  if (node == NULL) {
+    return NULL;
+  }
+  while (node->left != NULL) {
+    node = node->left;
+  }
+  return node;
+}
+
+struct rb_node *rb_last(const struct rb_root *root) {
+  struct rb_node *node = root->node;
+  if (node == NULL) {
+    return NULL;
+  }
+  while (node->right != NULL) {
+    node = node->right;
+  }
+  return node;
+}
+
+struct rb_node *rb_next(const struct rb_node *node) {
+  if (node->right != NULL) {
+    node = node->right;
+    while (node->left != NULL) {
+      node = node->left;
+    }
+    return (struct rb_node *)node;
+  }
+
+  const struct rb_node *parent;
+  while ((parent = node->parent) != NULL && node == parent->right) {
+    node = parent;
+  }
+  return (struct rb_node *)parent;
+}
+
+struct rb_node *rb_prev(const struct rb_node *node) {
+  if (node->left != NULL) {
+    node = node->left;
+    while (node->right != NULL) {
+      node = node->right;
+    }
+    return (struct rb_node *)node;
+  }
+
+  const struct rb_node *parent;
+  while ((parent = node->parent) != NULL && node == parent->left) {
+    node = parent;
+  }
+  return (struct rb_node *)parent;
+}
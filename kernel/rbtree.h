@@ -0,0 +1,62 @@
+#ifndef DELTA_KERNEL_RBTREE_H
+#define DELTA_KERNEL_RBTREE_H
+
+#include "types.h"
+
+/*
+ * Intrusive red-black tree with optional augmentation. The caller does the
+ * search and links the new node at the leaf it found (rb_link), then calls
+ * rb_insert to rebalance. An augmented tree passes a callback that
+ * recomputes a node's summary from its own key and its children; the tree
+ * calls it on every node whose subtree changes.
+ */
+
+#define RB_RED 0
+#define RB_BLACK 1
+
+struct rb_node {
+  struct rb_node *parent;
+  struct rb_node *left;
+  struct rb_node *right;
+  u8 color;
+};
+
+struct rb_root {
+  struct rb_node *node;
+};
+
+#define RB_ROOT_INIT {NULL}
+#define RB_ENTRY(node, type, member) CONTAINER_OF(node, type, member)
+
+typedef void (*rb_augment_t)(struct rb_node *node);
+
+static inline void rb_root_init(struct rb_root *root) { root->node = NULL; }
+
+static inline bool rb_empty(const struct rb_root *root) {
+  return root->node == NULL;
+}
+
+static inline void rb_link(struct rb_node *node, struct rb_node *parent,
+                           struct rb_node **link) {
+  node->parent = parent;
+  node->left = NULL;
+  node->right = NULL;
+  node->color = RB_RED;
+  *link = node;
+}
+
+void rb_insert(struct rb_root *root, struct rb_node *node,
+               rb_augment_t augment);
+
+void rb_erase(struct rb_root *root, struct rb_node *node,
+              rb_augment_t augment);
+
+struct rb_node *rb_first(const struct rb_root *root);
+
+struct rb_node *rb_last(const struct rb_root *root);
+
+struct rb_node *rb_next(const struct rb_node *node);
+
+struct rb_node *rb_prev(const struct rb_node *node);
+
+#endif /* DELTA_KERNEL_RBTREE_H */
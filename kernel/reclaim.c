@@ -0,0 +1,129 @@
+#include "reclaim.h"
+#include "initrd.h"
+#include "param.h"
+#include "pmm.h"
+
+#include "../arch/amd64/arch_types.h"
+#include "../arch/amd64/tsc.h"
+#include "../arch/amd64/vmm.h"
+
+/* Memory inside a reclaimable region that is still in use */
+struct kept_range {
+  u64 start;
+  u64 end;
+};
+
+static struct reclaim_stats stats;
+static bool reclaimed = false;
+
+/* reclaim=off: keep boot memory as the bootloader left it, for debugging */
+static bool reclaim_enabled = true;
+KERNEL_PARAM_BOOL("reclaim", reclaim_enabled);
+
+/* Page tables are mostly allocated in order, so this is close to linear */
+static void sort_ranges(struct kept_range *ranges, u64 count) {
+  for (u64 i = 1; i < count; i++) {
+    struct kept_range range = ranges[i];
+    u64 j = i;
+    for (; j > 0 && ranges[j - 1].start > range.start; j--) {
+      ranges[j] = ranges[j - 1];
+    }
+    ranges[j] = range;
+  }
+}
+
+/* Add [start, end) minus the kept ranges, which are sorted. Pages added. */
+static u64 add_around(u64 start, u64 end, const struct kept_range *kept,
+                      u64 kept_count) {
+  u64 pages = 0;
+  for (u64 i = 0; i < kept_count && start < end; i++) {
+    if (kept[i].end <= start || kept[i].start >= end) {
+      continue;
+    }
+    if (kept[i].start > start) {
+      pages += pmm_add_range(start, kept[i].start);
+    }
+    start = MAX(start, kept[i].end);
+  }
+  if (start < end) {
+    pages += pmm_add_range(start, end);
+  }
+  return pages;
+}
+
+static bool source_of(const struct parsed_boot_info *info, u32 type,
+                      enum reclaim_source *source) {
+  switch (type) {
+  case DB_MEM_BOOTLOADER:
+    *source = RECLAIM_BOOTLOADER;
+    return info->relocated; /* Otherwise the tags are still in use */
+  case DB_MEM_ACPI_RECLAIMABLE:
+    *source = RECLAIM_ACPI;
+    return true;
+  case DB_MEM_INITRD:
+    *source = RECLAIM_INITRD;
+    return !initrd_in_place();
+  default:
+    return false;
+  }
+}
+
+/*
+ * Give the reclaimable boot memory to the physical allocator. Returns the
+ * pages added. Only the first call does anything.
+ */
+u64 reclaim_boot_memory(const struct parsed_boot_info *info) {
+  if (reclaimed || !reclaim_enabled || !info->has_memory_map) {
+    return 0;
+  }
+  reclaimed = true;
+  u64 start_ns = clock_monotonic_ns();
+
+  /* The bootloader's page tables are still the ones in use */
+  u64 tables = vmm_table_pages(NULL, 0);
+  u64 bytes = tables * (sizeof(struct kept_range) + sizeof(u64));
+  u64 kept_pages = ALIGN_UP(bytes, PAGE_SIZE) / PAGE_SIZE;
+  u64 kept_base = pmm_alloc_pages(kept_pages);
+  if (kept_base == 0) {
+    return 0;
+  }
+
+  struct kept_range *kept = phys_to_virt(kept_base);
+  u64 *table_pages = (u64 *)&kept[tables];
+  /* Any table added since came from the allocator, not the bootloader */
+  tables = MIN(vmm_table_pages(table_pages, tables), tables);
+  for (u64 i = 0; i < tables; i++) {
+    kept[i].start = table_pages[i];
+    kept[i].end = table_pages[i] + PAGE_SIZE;
+  }
+  sort_ranges(kept, tables);
+
+  const struct db_tag_memory_map *mmap = info->memory_map;
+  for (u32 i = 0; i < mmap->entry_count; i++) {
+    const struct db_mmap_entry *entry =
+        (const struct db_mmap_entry *)((const u8 *)mmap->entries +
+                                       i * mmap->entry_size);
+    enum reclaim_source source;
+    if (source_of(info, entry->type, &source)) {
+      stats.pages[source] +=
+          add_around(entry->base, entry->base + entry->length, kept, tables);
+    }
+  }
+
+  for (u64 i = 0; i < kept_pages; i++) {
+    pmm_free_page(kept_base + i * PAGE_SIZE);
+  }
+  stats.reclaim_ns = clock_monotonic_ns() - start_ns;
+
+  u64 total = 0;
+  for (u32 i = 0; i < RECLAIM_SOURCE_COUNT; i++) {
+    total += stats.pages[i];
+  }
+  return total;
+}
+
+void reclaim_get_stats(struct reclaim_stats *out) {
+  if (out != NULL) {
+    *out = stats;
+  }
+}
@@ -0,0 +1,39 @@
+#ifndef DELTA_KERNEL_RECLAIM_H
+#define DELTA_KERNEL_RECLAIM_H
+
+#include "boot_info.h"
+#include "types.h"
+
+/*
+ * Boot memory reclaim: once early initialization is over, the memory map
+ * regions the protocol marks reclaimable go to the physical allocator.
+ *
+ * - DB_MEM_BOOTLOADER, once boot_info_relocate() has copied the tags
+ *   out, except the page tables still in CR3, which the bootloader also
+ *   allocates there
+ * - DB_MEM_ACPI_RECLAIMABLE: nothing reads the tables past the RSDP, so
+ *   they are dead once the boot information has been parsed
+ * - DB_MEM_INITRD, unless the ramfs indexes it in place, in which case the
+ *   ramfs releases it file by file; an unpacked image is no longer needed
+ *
+ * Module images (DB_MEM_MODULES) are kept: modules link on first use.
+ * Runs once, after the last reader of the initrd image.
+ */
+
+enum reclaim_source {
+  RECLAIM_BOOTLOADER = 0,
+  RECLAIM_ACPI = 1,
+  RECLAIM_INITRD = 2,
+  RECLAIM_SOURCE_COUNT = 3,
+};
+
+struct reclaim_stats {
+  u64 pages[RECLAIM_SOURCE_COUNT];
+  u64 reclaim_ns;
+};
+
+u64 reclaim_boot_memory(const struct parsed_boot_info *info);
+
+void reclaim_get_stats(struct reclaim_stats *stats);
+
+#endif /* DELTA_KERNEL_RECLAIM_H */
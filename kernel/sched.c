@@ -0,0 +1,814 @@
+#include "sched.h"
+#include "idle.h"
+#include "spinlock.h"
+#include "timer.h"
+#include "wsdeque.h"
+
+#include "../arch/amd64/apic.h"
+#include "../arch/amd64/cpu.h"
+#include "../arch/amd64/percpu.h"
+#include "../arch/amd64/tsc.h"
+
+#define STEAL_RETRIES 4 /* Per topology level, on a lost race */
+#define NO_CPU U32_MAX
+
+#define NICE_0_WEIGHT 1024
+
+/*
+ * Weight per nice level: each step is ~1.25x, so one nice level apart is a
+ * ~10% difference in CPU share between two busy tasks.
+ */
+static const u32 nice_to_weight[SCHED_NICE_MAX - SCHED_NICE_MIN + 1] = {
+    88761, 71755, 56483, 46273, 36291, /* -20 .. -16 */
+    29154, 23254, 18705, 14949, 11916, /* -15 .. -11 */
+    9548,  7620,  6100,  4904,  3906,  /* -10 ..  -6 */
+    3121,  2501,  1991,  1586,  1277,  /*  -5 ..  -1 */
+    1024,  820,   655,   526,   423,   /*   0 ..   4 */
+    335,   272,   215,   172,   137,   /*   5 ..   9 */
+    110,   87,    70,    56,    45,    /*  10 ..  14 */
+    36,    29,    23,    18,    15,    /*  15 ..  19 */
+};
+
+/*
+ * EEVDF state. vruntime advances by real time scaled by NICE_0_WEIGHT /
+ * weight; a task is eligible when its vruntime is at or below the
+ * weight-averaged vruntime V of the queue, i.e. it has received no more
+ * than its share. Sums are kept relative to min_vruntime so they stay small.
+ */
+struct fair_rq {
+  struct rb_root tree; /* Queued tasks; the running one is off-tree */
+  struct task *curr;
+  u64 min_vruntime;
+  i64 sum_w_vruntime; /* Sum of (vruntime - min_vruntime) * weight */
+  u64 sum_weight;
+  u32 nr_queued;
+  struct timer slice_timer;
+};
+
+/*
+ * The lock covers the fair class and curr. Worker tasks only need it to
+ * check curr: the deque and inbox are lock-free.
+ */
+struct run_queue {
+  struct wsdeque deque;
+  struct task *inbox ALIGNED(64); /* LIFO stack of remotely queued tasks */
+  struct spinlock lock ALIGNED(64);
+  struct task *curr; /* Running task of either class, NULL when idle */
+  u32 nr_queued;
+  bool online;
+  bool need_resched;
+  struct fair_rq fair;
+  u64 latency[SCHED_LATENCY_BUCKETS];
+  struct sched_stats stats;
+};
+
+static struct run_queue run_queues[MAX_CPUS];
+
+static u32 next_task_id = 0;
+
+#define FAIR_ENTRY(rb) RB_ENTRY(rb, struct task, fair.node)
+
+/*
+ * A task preempted on another CPU is queued again before its registers are
+ * saved; only its own CPU may pick it until the switch completes.
+ */
+static inline bool task_migratable(const struct task *task) {
+  return !task->pinned && !__atomic_load_n(&task->on_cpu, __ATOMIC_ACQUIRE);
+}
+
+static inline u64 calc_delta_fair(u64 delta, u32 weight) {
+  return weight == NICE_0_WEIGHT ? delta : delta * NICE_0_WEIGHT / weight;
+}
+
+static inline i64 fair_key(const struct fair_rq *fair, const struct task *t) {
+  return (i64)(t->fair.vruntime - fair->min_vruntime);
+}
+
+static void fair_augment(struct rb_node *node) {
+  struct task *task = FAIR_ENTRY(node);
+  u64 min = task->fair.vruntime;
+
+  if (node->left != NULL) {
+    u64 left = FAIR_ENTRY(node->left)->fair.min_vruntime;
+    if ((i64)(left - min) < 0) {
+      min = left;
+    }
+  }
+  if (node->right != NULL) {
+    u64 right = FAIR_ENTRY(node->right)->fair.min_vruntime;
+    if ((i64)(right - min) < 0) {
+      min = right;
+    }
+  }
+
+  task->fair.min_vruntime = min;
+}
+
+/* Weighted vruntime sum and load, the running task included */
+static void fair_load(const struct fair_rq *fair, i64 *sum, i64 *load) {
+  *sum = fair->sum_w_vruntime;
+  *load = (i64)fair->sum_weight;
+
+  if (fair->curr != NULL) {
+    *sum += fair_key(fair, fair->curr) * fair->curr->fair.weight;
+    *load += fair->curr->fair.weight;
+  }
+}
+
+static u64 fair_avg_vruntime(const struct fair_rq *fair) {
+  i64 sum, load;
+  fair_load(fair, &sum, &load);
+
+  if (load != 0) {
+    if (sum < 0) {
+      sum -= load - 1; /* Round towards minus infinity */
+    }
+    sum /= load;
+  }
+  return fair->min_vruntime + (u64)sum;
+}
+
+/* vruntime <= V, without the division: (v - min) * load <= sum */
+static bool fair_eligible(const struct fair_rq *fair, u64 vruntime) {
+  i64 sum, load;
+  fair_load(fair, &sum, &load);
+  return sum >= (i64)(vruntime - fair->min_vruntime) * load;
+}
+
+static void fair_update_min_vruntime(struct fair_rq *fair) {
+  bool found = false;
+  u64 candidate = 0;
+
+  if (fair->curr != NULL) {
+    candidate = fair->curr->fair.vruntime;
+    found = true;
+  }
+  if (fair->tree.node != NULL) {
+    u64 tree_min = FAIR_ENTRY(fair->tree.node)->fair.min_vruntime;
+    if (!found || (i64)(tree_min - candidate) < 0) {
+      candidate = tree_min;
+    }
+    found = true;
+  }
+
+  /* Only ever moves forward; every key shifts down by the same amount */
+  if (found && (i64)(candidate - fair->min_vruntime) > 0) {
+    u64 delta = candidate - fair->min_vruntime;
+    fair->sum_w_vruntime -= (i64)delta * (i64)fair->sum_weight;
+    fair->min_vruntime = candidate;
+  }
+}
+
+static void fair_insert(struct fair_rq *fair, struct task *task) {
+  struct rb_node **link = &fair->tree.node;
+  struct rb_node *parent = NULL;
+
+  while (*link != NULL) {
+    parent = *link;
+    if ((i64)(task->fair.deadline - FAIR_ENTRY(parent)->fair.deadline) < 0) {
+      link = &parent->left;
+    } else {
+      link = &parent->right; /* Equal deadlines: first come, first served */
+    }
+  }
+
+  rb_link(&task->fair.node, parent, link);
+  rb_insert(&fair->tree, &task->fair.node, fair_augment);
+
+  fair->sum_w_vruntime += fair_key(fair, task) * task->fair.weight;
+  fair->sum_weight += task->fair.weight;
+  fair->nr_queued++;
+}
+
+static void fair_remove(struct fair_rq *fair, struct task *task) {
+  rb_erase(&fair->tree, &task->fair.node, fair_augment);
+
+  fair->sum_w_vruntime -= fair_key(fair, task) * task->fair.weight;
+  fair->sum_weight -= task->fair.weight;
+  fair->nr_queued--;
+}
+
+/* Charge the running task for the time since it was last accounted */
+static void fair_update_curr(struct run_queue *rq, u64 now) {
+  struct fair_rq *fair = &rq->fair;
+  struct task *curr = fair->curr;
+  if (curr == NULL) {
+    return;
+  }
+
+  i64 delta = (i64)(now - curr->fair.exec_start);
+  if (delta <= 0) {
+    return;
+  }
+
+  curr->fair.exec_start = now;
+  curr->fair.sum_exec_ns += (u64)delta;
+  curr->fair.vruntime += calc_delta_fair((u64)delta, curr->fair.weight);
+  fair_update_min_vruntime(fair);
+
+  if ((i64)(curr->fair.vruntime - curr->fair.deadline) >= 0) {
+    /* Slice used up: request another one and let the others compete */
+    curr->fair.deadline =
+        curr->fair.vruntime +
+        calc_delta_fair(curr->fair.slice_ns, curr->fair.weight);
+    rq->need_resched = true;
+    rq->stats.slice_expiries++;
+  }
+}
+
+/*
+ * Position a waking task at V minus its saved lag, so sleeping neither
+ * earns nor forfeits service. The lag is inflated by the task's own weight
+ * because adding the task moves V towards it.
+ */
+static void fair_place(struct fair_rq *fair, struct task *task) {
+  u64 avg = fair_avg_vruntime(fair);
+  i64 lag = task->fair.vlag;
+
+  i64 sum, load;
+  fair_load(fair, &sum, &load);
+  if (load != 0) {
+    lag = lag * (load + task->fair.weight) / load;
+  }
+
+  task->fair.vruntime = avg - (u64)lag;
+  task->fair.deadline =
+      task->fair.vruntime + calc_delta_fair(task->fair.slice_ns, task->fair.weight);
+}
+
+static void fair_save_lag(struct fair_rq *fair, struct task *task) {
+  i64 limit = (i64)calc_delta_fair(2 * task->fair.slice_ns, task->fair.weight);
+  i64 lag = (i64)(fair_avg_vruntime(fair) - task->fair.vruntime);
+
+  task->fair.vlag = MAX(-limit, MIN(lag, limit));
+}
+
+/*
+ * Eligible task with the earliest deadline. The tree is ordered by
+ * deadline, and each node knows the smallest vruntime below it, so a left
+ * subtree holding any eligible task always wins: O(log n).
+ */
+static struct task *fair_pick_eevdf(struct fair_rq *fair) {
+  struct rb_node *node = fair->tree.node;
+
+  while (node != NULL) {
+    struct rb_node *left = node->left;
+    if (left != NULL &&
+        fair_eligible(fair, FAIR_ENTRY(left)->fair.min_vruntime)) {
+      node = left;
+      continue;
+    }
+    if (fair_eligible(fair, FAIR_ENTRY(node)->fair.vruntime)) {
+      return FAIR_ENTRY(node);
+    }
+    node = node->right;
+  }
+
+  /* Rounding can leave nobody eligible; fall back to the earliest deadline */
+  struct rb_node *first = rb_first(&fair->tree);
+  return first != NULL ? FAIR_ENTRY(first) : NULL;
+}
+
+/* Real time (ns) until the running task reaches its virtual deadline */
+static u64 fair_slice_remaining(const struct task *task) {
+  i64 virtual = (i64)(task->fair.deadline - task->fair.vruntime);
+  if (virtual <= 0) {
+    return 0;
+  }
+  /* Round up, so the deadline has been reached when the timer fires */
+  return ((u64)virtual * task->fair.weight + NICE_0_WEIGHT - 1) /
+         NICE_0_WEIGHT;
+}
+
+/* Runs on the run queue's own CPU, in interrupt context */
+static void fair_slice_expired(struct timer *timer) {
+  struct run_queue *rq = timer->data;
+  struct fair_rq *fair = &rq->fair;
+  u64 now = clock_monotonic_ns();
+
+  spin_lock(&rq->lock);
+  if (fair->curr != NULL) {
+    u64 deadline = fair->curr->fair.deadline;
+    fair_update_curr(rq, now);
+    if (fair->curr->fair.deadline == deadline) {
+      /* Clock skew between the wheel and the TSC: not quite there yet */
+      timer_add(&fair->slice_timer,
+                now + MAX(fair_slice_remaining(fair->curr), TIMER_TICK_NS), 0);
+    }
+  }
+  spin_unlock(&rq->lock);
+}
+
+/* rq->lock held */
+static struct task *fair_pick(struct run_queue *rq, u64 now) {
+  struct fair_rq *fair = &rq->fair;
+
+  struct task *task = fair_pick_eevdf(fair);
+  if (task != NULL) {
+    fair_remove(fair, task);
+    fair->curr = task;
+    task->fair.exec_start = now;
+    timer_add(&fair->slice_timer, now + fair_slice_remaining(task), 0);
+  }
+
+  return task;
+}
+
+/* Queue a waking fair task; rq->lock held */
+static void fair_enqueue(struct run_queue *rq, struct task *task, u64 now) {
+  struct fair_rq *fair = &rq->fair;
+
+  fair_update_curr(rq, now);
+  fair_place(fair, task);
+  fair_insert(fair, task);
+
+  /* Wakeup preemption: the newcomer is owed time and is more urgent */
+  struct task *curr = fair->curr;
+  if (curr == NULL || (fair_eligible(fair, task->fair.vruntime) &&
+                       (i64)(task->fair.deadline - curr->fair.deadline) < 0)) {
+    if (curr != NULL) {
+      rq->stats.wakeup_preempts++;
+    }
+    rq->need_resched = true;
+  }
+}
+
+void sched_init(void) { sched_init_cpu(); }
+
+void sched_init_cpu(void) {
+  struct run_queue *rq = &run_queues[this_cpu_id()];
+
+  wsdeque_init(&rq->deque);
+  rq->inbox = NULL;
+  spin_init(&rq->lock);
+  rq->curr = NULL;
+  rq->nr_queued = 0;
+  rq->need_resched = false;
+
+  rb_root_init(&rq->fair.tree);
+  rq->fair.curr = NULL;
+  rq->fair.min_vruntime = 0;
+  rq->fair.sum_w_vruntime = 0;
+  rq->fair.sum_weight = 0;
+  rq->fair.nr_queued = 0;
+  timer_init(&rq->fair.slice_timer, fair_slice_expired, rq);
+
+  /* Publish last: thieves scan only online run queues */
+  __atomic_store_n(&rq->online, true, __ATOMIC_RELEASE);
+}
+
+void sched_task_init(struct task *task, const char *name) {
+  task->inbox_next = NULL;
+  task->id = __atomic_fetch_add(&next_task_id, 1, __ATOMIC_RELAXED);
+  task->cpu = this_cpu_id();
+  task->state = TASK_BLOCKED;
+  task->sched_class = SCHED_CLASS_FAIR;
+  task->pinned = false;
+  task->on_cpu = false;
+  task->name = name;
+  task->runnable_since = 0;
+
+  task->fair.vruntime = 0;
+  task->fair.deadline = 0;
+  task->fair.min_vruntime = 0;
+  task->fair.vlag = 0;
+  task->fair.slice_ns = SCHED_SLICE_DEFAULT_NS;
+  task->fair.exec_start = 0;
+  task->fair.sum_exec_ns = 0;
+  task->fair.weight = NICE_0_WEIGHT;
+  task->fair.nice = 0;
+}
+
+/* Pin a task that has not been queued yet to one CPU: it is never stolen */
+bool sched_task_bind(struct task *task, u32 cpu) {
+  if (cpu >= MAX_CPUS || task->state != TASK_BLOCKED) {
+    return false;
+  }
+
+  task->cpu = cpu;
+  task->pinned = true;
+  return true;
+}
+
+/* Weight and slice are fixed while a task sits in a tree: change them only
+ * while it is running or blocked. */
+bool sched_set_nice(struct task *task, i32 nice) {
+  if (nice < SCHED_NICE_MIN || nice > SCHED_NICE_MAX ||
+      task->state == TASK_RUNNABLE) {
+    return false;
+  }
+
+  task->fair.nice = nice;
+  task->fair.weight = nice_to_weight[nice - SCHED_NICE_MIN];
+  return true;
+}
+
+bool sched_set_slice(struct task *task, u64 slice_ns) {
+  if (slice_ns < SCHED_SLICE_MIN_NS || slice_ns > SCHED_SLICE_MAX_NS ||
+      task->state == TASK_RUNNABLE) {
+    return false;
+  }
+
+  task->fair.slice_ns = slice_ns;
+  return true;
+}
+
+static void inbox_push(struct run_queue *rq, struct task *task) {
+  struct task *head = __atomic_load_n(&rq->inbox, __ATOMIC_RELAXED);
+  do {
+    task->inbox_next = head;
+  } while (!__atomic_compare_exchange_n(&rq->inbox, &head, task, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * Owner only. Take the whole inbox, return its oldest task and move the rest
+ * onto the deque, where other CPUs can steal them.
+ */
+static struct task *inbox_drain(struct run_queue *rq) {
+  if (__atomic_load_n(&rq->inbox, __ATOMIC_RELAXED) == NULL) {
+    return NULL;
+  }
+
+  struct task *head = __atomic_exchange_n(&rq->inbox, NULL, __ATOMIC_ACQUIRE);
+
+  /* The stack is newest-first: reverse it to queue in arrival order */
+  struct task *oldest = NULL;
+  while (head != NULL) {
+    struct task *next = head->inbox_next;
+    head->inbox_next = oldest;
+    oldest = head;
+    head = next;
+  }
+
+  if (oldest == NULL) {
+    return NULL;
+  }
+
+  struct task *task = oldest->inbox_next;
+  oldest->inbox_next = NULL;
+  while (task != NULL) {
+    struct task *next = task->inbox_next;
+    task->inbox_next = NULL;
+    if (!wsdeque_push(&rq->deque, task)) {
+      inbox_push(rq, task); /* Deque full: leave it for the next drain */
+    }
+    task = next;
+  }
+
+  return oldest;
+}
+
+/* Push a worker task on the local deque; interrupts disabled */
+static void worker_queue_local(struct run_queue *rq, struct task *task) {
+  if (!wsdeque_push(&rq->deque, task)) {
+    inbox_push(rq, task);
+  }
+}
+
+/*
+ * Queue a waking task on rq, with interrupts disabled. Returns false if the
+ * task had not finished switching out there yet: it was only marked running
+ * again, and sched_put_prev() will requeue it.
+ */
+static bool rq_enqueue(struct run_queue *rq, struct task *task, bool local,
+                       u64 now) {
+  bool queued = true;
+
+  spin_lock(&rq->lock);
+
+  if (rq->curr == task) {
+    task->state = TASK_RUNNING;
+    queued = false;
+  } else {
+    task->state = TASK_RUNNABLE;
+    task->runnable_since = now;
+
+    if (task->sched_class == SCHED_CLASS_WORKER) {
+      if (local) {
+        worker_queue_local(rq, task);
+      } else {
+        inbox_push(rq, task);
+      }
+    } else {
+      fair_enqueue(rq, task, now);
+    }
+
+    __atomic_fetch_add(&rq->nr_queued, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&rq->stats.enqueued, 1, __ATOMIC_RELAXED);
+  }
+
+  spin_unlock(&rq->lock);
+  return queued;
+}
+
+/*
+ * Queue a waking task on the calling CPU (or its own, if pinned). A full
+ * deque overflows into the inbox, so this never fails.
+ */
+void sched_enqueue(struct task *task) {
+  u32 cpu = this_cpu_id();
+  if (task->pinned && task->cpu != cpu) {
+    sched_enqueue_on(task->cpu, task);
+    return;
+  }
+
+  struct run_queue *rq = &run_queues[cpu];
+  u64 now = clock_monotonic_ns();
+
+  u64 flags = irq_save();
+  if (rq_enqueue(rq, task, true, now) && rq->curr == NULL) {
+    idle_wake_cpu(cpu); /* Don't let the idle loop go back to sleep */
+  }
+  irq_restore(flags);
+}
+
+/* Queue a waking task on any CPU, waking or preempting it as needed. */
+void sched_enqueue_on(u32 cpu, struct task *task) {
+  if (task->pinned) {
+    cpu = task->cpu;
+  }
+  if (cpu >= MAX_CPUS ||
+      !__atomic_load_n(&run_queues[cpu].online, __ATOMIC_ACQUIRE)) {
+    cpu = this_cpu_id();
+  }
+
+  if (cpu == this_cpu_id()) {
+    sched_enqueue(task);
+    return;
+  }
+
+  struct run_queue *rq = &run_queues[cpu];
+  u64 now = clock_monotonic_ns();
+
+  u64 flags = irq_save();
+  bool queued = rq_enqueue(rq, task, false, now);
+  bool preempt = __atomic_load_n(&rq->need_resched, __ATOMIC_RELAXED) &&
+                 __atomic_load_n(&rq->curr, __ATOMIC_RELAXED) != NULL;
+  irq_restore(flags);
+
+  if (!queued) {
+    return;
+  }
+
+  idle_wake_cpu(cpu);
+  if (preempt) {
+    /* Running something else: the IPI's exit path reschedules */
+    apic_send_ipi(percpu_get(cpu)->apic_id, APIC_WAKEUP_VECTOR);
+  }
+}
+
+/*
+ * Hand back the task that was running on this CPU. If it is still
+ * TASK_RUNNING it was preempted and is requeued with its vruntime intact;
+ * otherwise it blocked or exited and keeps its lag for the next wakeup.
+ */
+void sched_put_prev(struct task *prev) {
+  struct run_queue *rq = &run_queues[this_cpu_id()];
+  struct fair_rq *fair = &rq->fair;
+  u64 now = clock_monotonic_ns();
+
+  u64 flags = irq_save();
+  spin_lock(&rq->lock);
+
+  bool requeue = prev->state == TASK_RUNNING;
+  if (requeue) {
+    prev->state = TASK_RUNNABLE;
+    prev->runnable_since = now;
+    __atomic_fetch_add(&rq->nr_queued, 1, __ATOMIC_RELAXED);
+  }
+
+  if (prev->sched_class == SCHED_CLASS_WORKER) {
+    if (requeue) {
+      worker_queue_local(rq, prev);
+    }
+  } else {
+    if (fair->curr == prev) {
+      fair_update_curr(rq, now);
+      timer_cancel(&fair->slice_timer);
+      if (!requeue) {
+        fair_save_lag(fair, prev);
+      }
+      fair->curr = NULL;
+    }
+    if (requeue) {
+      fair_insert(fair, prev);
+    }
+  }
+
+  rq->curr = NULL;
+
+  spin_unlock(&rq->lock);
+  irq_restore(flags);
+}
+
+/* Online CPU at the given distance with the most queued tasks */
+static u32 find_busiest(u32 self, u32 self_apic,
+                        enum cpu_topology_distance distance) {
+  u32 busiest = NO_CPU;
+  u32 busiest_size = 0;
+
+  for (u32 cpu = 0; cpu < MAX_CPUS; cpu++) {
+    struct run_queue *rq = &run_queues[cpu];
+    if (cpu == self || !__atomic_load_n(&rq->online, __ATOMIC_ACQUIRE)) {
+      continue;
+    }
+    if (cpu_topology_distance(self_apic, percpu_get(cpu)->apic_id) !=
+        distance) {
+      continue;
+    }
+
+    u32 size = __atomic_load_n(&rq->nr_queued, __ATOMIC_RELAXED);
+    if (size > busiest_size) {
+      busiest = cpu;
+      busiest_size = size;
+    }
+  }
+
+  return busiest;
+}
+
+/*
+ * Move the least urgent migratable fair task of another CPU here, keeping
+ * its lag so it is neither favoured nor penalised by the move. The two
+ * locks are never held together; each queue's nr_queued changes under the
+ * lock that moves the task, so another thief pulling it on from here
+ * decrements a count that includes it.
+ */
+static bool fair_pull(struct run_queue *rq, struct run_queue *victim_rq) {
+  struct fair_rq *victim = &victim_rq->fair;
+
+  spin_lock(&victim_rq->lock);
+  struct rb_node *node = rb_last(&victim->tree);
+  while (node != NULL && !task_migratable(FAIR_ENTRY(node))) {
+    node = rb_prev(node);
+  }
+  if (node == NULL) {
+    spin_unlock(&victim_rq->lock);
+    return false;
+  }
+  struct task *task = FAIR_ENTRY(node);
+  fair_save_lag(victim, task);
+  fair_remove(victim, task);
+  __atomic_fetch_sub(&victim_rq->nr_queued, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&victim_rq->stats.stolen, 1, __ATOMIC_RELAXED);
+  spin_unlock(&victim_rq->lock);
+
+  spin_lock(&rq->lock);
+  fair_place(&rq->fair, task);
+  fair_insert(&rq->fair, task);
+  __atomic_fetch_add(&rq->nr_queued, 1, __ATOMIC_RELAXED);
+  spin_unlock(&rq->lock);
+
+  return true;
+}
+
+/*
+ * Steal one task, trying SMT siblings first, then cores sharing the
+ * package, then remote packages: the closer the victim, the warmer the
+ * caches the task leaves behind.
+ */
+static struct task *sched_steal(u32 self, struct run_queue *rq, u64 now) {
+  u32 self_apic = this_cpu()->apic_id;
+
+  rq->stats.steal_attempts++;
+
+  for (u32 distance = 0; distance < CPU_DISTANCE_COUNT; distance++) {
+    for (u32 attempt = 0; attempt < STEAL_RETRIES; attempt++) {
+      u32 victim = find_busiest(self, self_apic, distance);
+      if (victim == NO_CPU) {
+        break;
+      }
+
+      struct run_queue *victim_rq = &run_queues[victim];
+      struct task *task = wsdeque_steal(&victim_rq->deque);
+      if (task == WSDEQUE_ABORT) {
+        continue; /* Raced another thief: look again */
+      }
+      if (task != WSDEQUE_EMPTY && !task_migratable(task)) {
+        inbox_push(victim_rq, task); /* Not ours to take: hand it back */
+        continue;
+      }
+      if (task == WSDEQUE_EMPTY) {
+        if (!fair_pull(rq, victim_rq)) {
+          continue; /* Drained in the meantime */
+        }
+        /* The pulled task is queued here now: pick it like any other */
+        spin_lock(&rq->lock);
+        task = fair_pick(rq, now);
+        if (task != NULL) {
+          __atomic_fetch_sub(&rq->nr_queued, 1, __ATOMIC_RELAXED);
+        }
+        spin_unlock(&rq->lock);
+        if (task == NULL) {
+          continue; /* Pulled away again by another thief */
+        }
+      } else {
+        __atomic_fetch_sub(&victim_rq->nr_queued, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&victim_rq->stats.stolen, 1, __ATOMIC_RELAXED);
+      }
+
+      rq->stats.steals++;
+      return task;
+    }
+  }
+
+  return NULL;
+}
+
+static void record_latency(struct run_queue *rq, u64 latency_ns) {
+  u32 bucket = latency_ns != 0 ? 63 - __builtin_clzll(latency_ns) : 0;
+  rq->latency[MIN(bucket, SCHED_LATENCY_BUCKETS - 1)]++;
+}
+
+/*
+ * Next task for the calling CPU, after sched_put_prev() on the previous
+ * one: local worker tasks (newest first, their data is the most likely to
+ * still be cached), then remotely queued workers, then the fair class, then
+ * work stolen from a neighbour. Returns NULL if there is nothing to run.
+ */
+struct task *sched_pick_next(void) {
+  u32 cpu = this_cpu_id();
+  struct run_queue *rq = &run_queues[cpu];
+  u64 now = clock_monotonic_ns();
+
+  u64 flags = irq_save();
+  spin_lock(&rq->lock);
+
+  rq->need_resched = false;
+
+  struct task *task = wsdeque_pop(&rq->deque);
+  if (task == WSDEQUE_EMPTY) {
+    task = inbox_drain(rq);
+  }
+  if (task == NULL) {
+    task = fair_pick(rq, now);
+  }
+
+  if (task != NULL) {
+    __atomic_fetch_sub(&rq->nr_queued, 1, __ATOMIC_RELAXED);
+  } else {
+    spin_unlock(&rq->lock);
+    task = sched_steal(cpu, rq, now);
+    spin_lock(&rq->lock);
+  }
+
+  if (task != NULL) {
+    if (task->cpu != cpu) {
+      rq->stats.migrations++;
+      task->cpu = cpu;
+    }
+    task->state = TASK_RUNNING;
+    record_latency(rq, now - task->runnable_since);
+  }
+  rq->curr = task;
+
+  spin_unlock(&rq->lock);
+  irq_restore(flags);
+  return task;
+}
+
+/* Set by slice expiry and wakeup preemption; cleared by sched_pick_next() */
+bool sched_need_resched(void) {
+  return __atomic_load_n(&run_queues[this_cpu_id()].need_resched,
+                         __ATOMIC_RELAXED);
+}
+
+u32 sched_runqueue_length(u32 cpu) {
+  if (cpu >= MAX_CPUS) {
+    return 0;
+  }
+  return __atomic_load_n(&run_queues[cpu].nr_queued, __ATOMIC_RELAXED);
+}
+
+/* Online and running nothing: a hint, it may change at any moment */
+bool sched_cpu_idle(u32 cpu) {
+  if (cpu >= MAX_CPUS) {
+    return false;
+  }
+
+  struct run_queue *rq = &run_queues[cpu];
+  return __atomic_load_n(&rq->online, __ATOMIC_ACQUIRE) &&
+         __atomic_load_n(&rq->curr, __ATOMIC_RELAXED) == NULL;
+}
+
+/* Counters are updated locklessly: this is a snapshot, not a transaction */
+void sched_get_stats(u32 cpu, struct sched_stats *stats) {
+  if (cpu >= MAX_CPUS || stats == NULL) {
+    return;
+  }
+
+  struct run_queue *rq = &run_queues[cpu];
+  *stats = rq->stats;
+  stats->nr_queued = __atomic_load_n(&rq->nr_queued, __ATOMIC_RELAXED);
+}
+
+void sched_get_latency_histogram(u32 cpu, u64 buckets[SCHED_LATENCY_BUCKETS]) {
+  if (cpu >= MAX_CPUS || buckets == NULL) {
+    return;
+  }
+
+  for (u32 i = 0; i < SCHED_LATENCY_BUCKETS; i++) {
+    buckets[i] = run_queues[cpu].latency[i];
+  }
+}
@@ -0,0 +1,114 @@
+#ifndef DELTA_KERNEL_SCHED_H
+#define DELTA_KERNEL_SCHED_H
+
+#include "rbtree.h"
+#include "types.h"
+
+/*
+ * Per-CPU run queues with two scheduling classes:
+ *
+ * - Fair (the default): EEVDF. Each task receives CPU time in proportion to
+ *   its weight (from its nice value); among the tasks that are owed time,
+ *   the one with the earliest virtual deadline runs. A task's slice request
+ *   sets how far out that deadline is, so a short slice is a latency target:
+ *   the task runs sooner and more often, in smaller pieces.
+ *
+ * - Worker: short run-to-completion tasks (deferred work). They run ahead of
+ *   fair tasks from a lock-free work-stealing deque: the owning CPU pushes
+ *   and pops at one end, while idle CPUs steal from the other. Tasks queued
+ *   from another CPU go through a lock-free inbox instead, since only the
+ *   owner may push onto a deque.
+ *
+ * An idle CPU steals from the busiest CPU closest to it in the topology,
+ * worker tasks first, then fair ones.
+ */
+
+#define SCHED_NICE_MIN (-20)
+#define SCHED_NICE_MAX 19
+
+#define SCHED_SLICE_DEFAULT_NS 3000000ULL /* 3 ms */
+#define SCHED_SLICE_MIN_NS 100000ULL      /* 100 us */
+#define SCHED_SLICE_MAX_NS 100000000ULL   /* 100 ms */
+
+#define SCHED_LATENCY_BUCKETS 32 /* Bucket n: [2^n, 2^(n+1)) ns */
+
+enum task_state {
+  TASK_RUNNABLE = 0,
+  TASK_RUNNING = 1,
+  TASK_BLOCKED = 2,
+  TASK_DEAD = 3,
+};
+
+enum sched_class {
+  SCHED_CLASS_FAIR = 0,
+  SCHED_CLASS_WORKER = 1,
+};
+
+struct sched_fair_entity {
+  struct rb_node node; /* Keyed by deadline */
+  u64 vruntime;        /* Virtual time received */
+  u64 deadline;        /* Virtual deadline: vruntime + slice / weight */
+  u64 min_vruntime;    /* Smallest vruntime in this subtree */
+  i64 vlag;            /* Service owed (> 0) or overdrawn, while off-queue */
+  u64 slice_ns;        /* Requested slice */
+  u64 exec_start;      /* When the current run started (ns) */
+  u64 sum_exec_ns;     /* Total CPU time received */
+  u32 weight;
+  i32 nice;
+};
+
+struct task {
+  struct task *inbox_next; /* Remote-enqueue link (worker class) */
+  u32 id;
+  u32 cpu; /* CPU the task last ran on */
+  enum task_state state;
+  enum sched_class sched_class;
+  bool pinned; /* Runs only on cpu: never stolen */
+  bool on_cpu; /* Context still live: set and cleared by the switch code */
+  const char *name;
+  u64 runnable_since; /* For the scheduling-latency histogram */
+  struct sched_fair_entity fair;
+};
+
+struct sched_stats {
+  u32 nr_queued;       /* Run-queue length: tasks waiting on this CPU */
+  u64 enqueued;        /* Tasks queued to this CPU, locally or remotely */
+  u64 steal_attempts;  /* Times this CPU went looking for work */
+  u64 steals;          /* Tasks this CPU stole from others */
+  u64 stolen;          /* Tasks other CPUs stole from this one */
+  u64 migrations;      /* Tasks picked here that last ran elsewhere */
+  u64 slice_expiries;  /* Fair tasks that used up their slice */
+  u64 wakeup_preempts; /* Wakeups that asked to preempt the current task */
+};
+
+void sched_init(void);
+
+void sched_init_cpu(void);
+
+void sched_task_init(struct task *task, const char *name);
+
+bool sched_task_bind(struct task *task, u32 cpu);
+
+bool sched_set_nice(struct task *task, i32 nice);
+
+bool sched_set_slice(struct task *task, u64 slice_ns);
+
+void sched_enqueue(struct task *task);
+
+void sched_enqueue_on(u32 cpu, struct task *task);
+
+void sched_put_prev(struct task *prev);
+
+struct task *sched_pick_next(void);
+
+bool sched_need_resched(void);
+
+u32 sched_runqueue_length(u32 cpu);
+
+bool sched_cpu_idle(u32 cpu);
+
+void sched_get_stats(u32 cpu, struct sched_stats *stats);
+
+void sched_get_latency_histogram(u32 cpu, u64 buckets[SCHED_LATENCY_BUCKETS]);
+
+#endif /* DELTA_KERNEL_SCHED_H */
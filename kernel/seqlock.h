@@ -0,0 +1,46 @@
+#ifndef DELTA_KERNEL_SEQLOCK_H
+#define DELTA_KERNEL_SEQLOCK_H
+
+#include "types.h"
+
+#include "../arch/amd64/arch_types.h"
+
+/*
+ * Sequence counter: readers never write shared memory, they retry if a
+ * writer ran while they were reading. The count is odd while a write is in
+ * progress. Writers must be serialized by the caller.
+ *
+ *   do {
+ *     seq = seq_read_begin(&s);
+ *     ... copy the data ...
+ *   } while (seq_read_retry(&s, seq));
+ */
+struct seqcount {
+  u32 sequence;
+};
+
+#define SEQCOUNT_INIT {0}
+
+static inline u32 seq_read_begin(const struct seqcount *s) {
+  u32 seq;
+  while ((seq = __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE)) & 1) {
+    cpu_relax();
+  }
+  return seq;
+}
+
+static inline bool seq_read_retry(const struct seqcount *s, u32 start) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&s->sequence, __ATOMIC_RELAXED) != start;
+}
+
+static inline void seq_write_begin(struct seqcount *s) {
+  __atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seq_write_end(struct seqcount *s) {
+  __atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* DELTA_KERNEL_SEQLOCK_H */
@@ -0,0 +1,50 @@
+#ifndef DELTA_KERNEL_SPINLOCK_H
+#define DELTA_KERNEL_SPINLOCK_H
+
+#include "types.h"
+
+#include "../arch/amd64/arch_types.h"
+
+/* FIFO ticket lock: waiters are served in arrival order. */
+struct spinlock {
+  u32 next;  /* Next ticket to hand out */
+  u32 owner; /* Ticket currently holding the lock */
+};
+
+#define SPINLOCK_INIT {0, 0}
+
+static inline void spin_init(struct spinlock *lock) {
+  lock->next = 0;
+  lock->owner = 0;
+}
+
+static inline void spin_lock(struct spinlock *lock) {
+  u32 ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+  while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+    cpu_relax();
+  }
+}
+
+static inline bool spin_trylock(struct spinlock *lock) {
+  u32 owner = __atomic_load_n(&lock->owner, __ATOMIC_RELAXED);
+  u32 expected = owner;
+  return __atomic_compare_exchange_n(&lock->next, &expected, owner + 1, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void spin_unlock(struct spinlock *lock) {
+  __atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
+}
+
+static inline u64 spin_lock_irqsave(struct spinlock *lock) {
+  u64 flags = irq_save();
+  spin_lock(lock);
+  return flags;
+}
+
+static inline void spin_unlock_irqrestore(struct spinlock *lock, u64 flags) {
+  spin_unlock(lock);
+  irq_restore(flags);
+}
+
+#endif /* DELTA_KERNEL_SPINLOCK_H */
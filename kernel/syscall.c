@@ -0,0 +1,75 @@
+#include "syscall.h"
+#include "kthread.h"
+#include "pmm.h"
+
+#include "../arch/amd64/syscall.h"
+#include "../arch/amd64/vmm.h"
+
+#define NULL_SYSCALL_ROUNDS 100000
+
+#define BENCH_CODE_VA USER_BASE
+#define BENCH_STACK_VA (USER_BASE + 2 * PAGE_SIZE) /* Unmapped page between */
+
+/* syscall_entry.asm */
+extern const u8 user_null_loop_start[];
+extern const u8 user_null_loop_end[];
+
+static i64 sys_null(u64 a0, u64 a1, u64 a2, u64 a3, u64 a4, u64 a5) {
+  (void)a0, (void)a1, (void)a2, (void)a3, (void)a4, (void)a5;
+  return 0;
+}
+
+static i64 sys_exit(u64 code, u64 a1, u64 a2, u64 a3, u64 a4, u64 a5) {
+  (void)a1, (void)a2, (void)a3, (void)a4, (void)a5;
+  user_return((i64)code);
+}
+
+const syscall_fn_t syscall_table[SYSCALL_COUNT] = {
+    [SYS_NULL] = sys_null,
+    [SYS_EXIT] = sys_exit,
+};
+
+void syscall_init(void) { syscall_init_cpu(); }
+
+/*
+ * Run user code on the current thread until it exits, returning its exit
+ * code. While it runs, the thread's kernel stack top is recorded so the
+ * scheduler can reinstall it when the thread is switched back in.
+ */
+i64 syscall_run_user(u64 rip, u64 rsp, u64 arg) {
+  struct kthread *self = kthread_current();
+  i64 code = user_enter(rip, rsp, arg, &self->kernel_rsp);
+  self->kernel_rsp = 0;
+  return code;
+}
+
+/*
+ * Cycles per SYS_NULL round trip, measured in ring 3 around a tight loop
+ * so the figure is the full SYSCALL -> dispatch -> SYSRET cost. 0 if the
+ * user pages could not be set up.
+ */
+u64 syscall_measure_null(void) {
+  u64 code_page = pmm_alloc_zeroed_page();
+  u64 stack_page = pmm_alloc_zeroed_page();
+  i64 cycles = -1;
+
+  if (code_page != 0 && stack_page != 0 &&
+      vmm_map_page(BENCH_CODE_VA, code_page, PTE_USER)) {
+    u8 *code = phys_to_virt(code_page);
+    for (const u8 *p = user_null_loop_start; p < user_null_loop_end; p++) {
+      *code++ = *p;
+    }
+
+    if (vmm_map_page(BENCH_STACK_VA, stack_page,
+                     PTE_USER | PTE_WRITABLE | PTE_NX)) {
+      cycles = syscall_run_user(BENCH_CODE_VA, BENCH_STACK_VA + PAGE_SIZE,
+                                NULL_SYSCALL_ROUNDS);
+      vmm_unmap_page(BENCH_STACK_VA);
+    }
+    vmm_unmap_page(BENCH_CODE_VA);
+  }
+
+  pmm_free_page(code_page);
+  pmm_free_page(stack_page);
+  return cycles > 0 ? (u64)cycles / NULL_SYSCALL_ROUNDS : 0;
+}
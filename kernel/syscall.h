@@ -0,0 +1,31 @@
+#ifndef DELTA_KERNEL_SYSCALL_H
+#define DELTA_KERNEL_SYSCALL_H
+
+#include "types.h"
+
+/*
+ * System call numbers index syscall_table directly; the entry path
+ * (arch/amd64/syscall_entry.asm) bounds-checks them against SYSCALL_COUNT,
+ * which it keeps its own copy of.
+ */
+enum syscall_number {
+  SYS_NULL = 0, /* Does nothing: measures the entry/exit path */
+  SYS_EXIT = 1, /* Leaves user mode: exit(code) */
+  SYSCALL_COUNT
+};
+
+/* Negative return values are errors */
+#define SYSCALL_EFAULT (-14)
+#define SYSCALL_ENOSYS (-38)
+
+typedef i64 (*syscall_fn_t)(u64 a0, u64 a1, u64 a2, u64 a3, u64 a4, u64 a5);
+
+extern const syscall_fn_t syscall_table[SYSCALL_COUNT];
+
+void syscall_init(void);
+
+i64 syscall_run_user(u64 rip, u64 rsp, u64 arg);
+
+u64 syscall_measure_null(void);
+
+#endif /* DELTA_KERNEL_SYSCALL_H */
@@ -0,0 +1,447 @@
+#include "timer.h"
+#include "spinlock.h"
+
+#include "../arch/amd64/apic.h"
+#include "../arch/amd64/percpu.h"
+#include "../arch/amd64/tsc.h"
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define LEVEL_SHIFT(level) ((level) * TIMER_WHEEL_BITS)
+#define WHEEL_MAX_DELTA                                                        \
+  ((1ULL << LEVEL_SHIFT(TIMER_WHEEL_LEVELS)) - 1) /* In ticks */
+
+/*
+ * Level L holds timers 64^L..64^(L+1) ticks out, one slot per 64^L ticks.
+ * When the low L*6 bits of the clock wrap to zero, the level-L slot for the
+ * new period is cascaded: its timers are re-inserted at a finer level.
+ */
+struct timer_wheel {
+  struct spinlock lock;
+  u64 clock;           /* Next tick to process */
+  u64 programmed_tick; /* Tick the APIC is armed for, TIMER_NONE if none */
+  u64 occupied[TIMER_WHEEL_LEVELS]; /* Bit per non-empty slot */
+  struct list_node slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+  struct timer *running;
+  struct timer_stats stats;
+};
+
+static struct timer_wheel wheels[MAX_CPUS];
+
+/* Round up: a timer may fire late by up to one tick, never early. */
+static inline u64 ns_to_tick(u64 ns) {
+  return (ns >> TIMER_TICK_SHIFT) + ((ns & (TIMER_TICK_NS - 1)) != 0);
+}
+
+static inline u64 tick_to_tsc(u64 tick) {
+  const struct tsc_calibration *cal = tsc_get_calibration();
+  return cal->boot_tsc + tsc_ns_to_cycles(cal, tick << TIMER_TICK_SHIFT);
+}
+
+/*
+ * Pick the expiry inside [expires, expires + slack] with the most trailing
+ * zero bits. Timers with similar slack then land on the same tick and are
+ * served by a single interrupt.
+ */
+static u64 apply_slack(u64 expires, u64 slack) {
+  if (slack == 0 || expires > U64_MAX - slack) {
+    return expires;
+  }
+
+  u64 limit = expires + slack;
+  u64 differing = limit ^ expires;
+  if (differing == 0) {
+    return expires;
+  }
+
+  u32 bit = 63 - __builtin_clzll(differing);
+  return limit & ~((1ULL << bit) - 1);
+}
+
+static void wheel_enqueue(struct timer_wheel *wheel, struct timer *timer) {
+  if (timer->tick < wheel->clock) {
+    timer->tick = wheel->clock; /* Already due: fire on the next tick */
+  }
+
+  u64 delta = timer->tick - wheel->clock;
+  if (delta > WHEEL_MAX_DELTA) {
+    timer->tick = wheel->clock + WHEEL_MAX_DELTA;
+    delta = WHEEL_MAX_DELTA;
+  }
+
+  u32 level = 0;
+  while (level < TIMER_WHEEL_LEVELS - 1 &&
+         delta >= (1ULL << LEVEL_SHIFT(level + 1))) {
+    level++;
+  }
+
+  u32 slot = (timer->tick >> LEVEL_SHIFT(level)) & SLOT_MASK;
+  list_add_tail(&wheel->slots[level][slot], &timer->node);
+  wheel->occupied[level] |= 1ULL << slot;
+
+  timer->level = (u8)level;
+  timer->slot = (u8)slot;
+}
+
+static void wheel_dequeue(struct timer_wheel *wheel, struct timer *timer) {
+  list_remove(&timer->node);
+  if (list_empty(&wheel->slots[timer->level][timer->slot])) {
+    wheel->occupied[timer->level] &= ~(1ULL << timer->slot);
+  }
+}
+
+static void wheel_cascade(struct timer_wheel *wheel, u32 level, u32 slot) {
+  if (!(wheel->occupied[level] & (1ULL << slot))) {
+    return;
+  }
+
+  struct list_node moving;
+  list_init(&moving);
+  list_splice_tail(&moving, &wheel->slots[level][slot]);
+  wheel->occupied[level] &= ~(1ULL << slot);
+
+  struct list_node *node;
+  while ((node = list_pop_head(&moving)) != NULL) {
+    wheel_enqueue(wheel, LIST_ENTRY(node, struct timer, node));
+    wheel->stats.cascaded++;
+  }
+}
+
+/* Earliest tick at which the wheel has work (an expiry or a cascade). */
+static u64 wheel_next_tick(const struct timer_wheel *wheel) {
+  u64 best = TIMER_NONE;
+
+  for (u32 level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    u64 bits = wheel->occupied[level];
+    if (bits == 0) {
+      continue;
+    }
+
+    u32 shift = LEVEL_SHIFT(level);
+    u32 current = (wheel->clock >> shift) & SLOT_MASK;
+    u64 rotated = current ? (bits >> current) | (bits << (64 - current)) : bits;
+
+    u64 tick;
+    if (level == 0) {
+      tick = wheel->clock + __builtin_ctzll(rotated);
+    } else {
+      /*
+       * The current slot of an upper level is a full rotation away once it
+       * has been cascaded, i.e. once the clock is past the slot's first
+       * tick. wheel_advance() can stop on that first tick with the cascade
+       * still to do, and then it is due now.
+       */
+      if ((wheel->clock & ((1ULL << shift) - 1)) != 0) {
+        rotated &= ~1ULL;
+      }
+      u32 offset = rotated ? (u32)__builtin_ctzll(rotated) : TIMER_WHEEL_SLOTS;
+      tick = ((wheel->clock >> shift) + offset) << shift;
+    }
+
+    best = MIN(best, tick);
+  }
+
+  return best;
+}
+
+/* Must run on the wheel's own CPU: only the local APIC can be programmed. */
+static void wheel_program(struct timer_wheel *wheel) {
+  u64 next = wheel_next_tick(wheel);
+
+  if (next == wheel->programmed_tick) {
+    return;
+  }
+
+  if (next == TIMER_NONE) {
+    apic_timer_cancel(); /* Nothing pending: no timer interrupts at all */
+  } else {
+    apic_timer_arm(tick_to_tsc(next));
+    wheel->stats.reprograms++;
+  }
+  wheel->programmed_tick = next;
+}
+
+static void wheel_advance(struct timer_wheel *wheel, u64 now_tick) {
+  while (wheel->clock <= now_tick) {
+    if (wheel->stats.pending == 0) {
+      wheel->clock = now_tick + 1;
+      break;
+    }
+
+    u64 clock = wheel->clock;
+    u32 index = clock & SLOT_MASK;
+
+    if (index == 0) {
+      for (u32 level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        u32 slot = (clock >> LEVEL_SHIFT(level)) & SLOT_MASK;
+        wheel_cascade(wheel, level, slot);
+        if (slot != 0) {
+          break;
+        }
+      }
+    }
+
+    /* Detach the slot and move the clock first, so a callback that re-adds
+     * its timer lands in a later slot instead of this one. */
+    struct list_node expired;
+    list_init(&expired);
+    list_splice_tail(&expired, &wheel->slots[0][index]);
+    wheel->occupied[0] &= ~(1ULL << index);
+    wheel->clock = clock + 1;
+
+    struct list_node *node;
+    while ((node = list_pop_head(&expired)) != NULL) {
+      struct timer *timer = LIST_ENTRY(node, struct timer, node);
+      timer->pending = false;
+      wheel->running = timer;
+      wheel->stats.pending--;
+      wheel->stats.fired++;
+
+      spin_unlock(&wheel->lock);
+      timer->callback(timer);
+      spin_lock(&wheel->lock);
+
+      wheel->running = NULL;
+    }
+
+    /* Skip empty level-0 slots up to the next cascade boundary */
+    if ((wheel->clock & SLOT_MASK) != 0) {
+      u64 ahead = wheel->occupied[0] >> (wheel->clock & SLOT_MASK);
+      u64 next = ahead ? wheel->clock + __builtin_ctzll(ahead)
+                       : (wheel->clock | SLOT_MASK) + 1;
+      wheel->clock = MIN(next, now_tick + 1);
+    }
+  }
+}
+
+static void timer_interrupt(void) {
+  struct timer_wheel *wheel = &wheels[this_cpu_id()];
+  u64 now_tick = clock_monotonic_ns() >> TIMER_TICK_SHIFT;
+
+  spin_lock(&wheel->lock);
+  wheel->programmed_tick = TIMER_NONE; /* The one-shot has been consumed */
+  wheel_advance(wheel, now_tick);
+  wheel_program(wheel);
+  spin_unlock(&wheel->lock);
+}
+
+static void wheel_init(struct timer_wheel *wheel, u64 clock) {
+  spin_init(&wheel->lock);
+  for (u32 level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    for (u32 slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+      list_init(&wheel->slots[level][slot]);
+    }
+    wheel->occupied[level] = 0;
+  }
+
+  wheel->clock = clock;
+  wheel->programmed_tick = TIMER_NONE;
+  wheel->running = NULL;
+}
+
+/* Self-test wheel, off to the side: never programmed, never interrupted */
+static struct timer_wheel selftest_wheel;
+static u64 selftest_fired[2];
+
+static void selftest_callback(struct timer *timer) {
+  selftest_fired[(u64)timer->data] = selftest_wheel.clock - 1;
+}
+
+static void selftest_add(struct timer *timer, u64 index, u64 tick) {
+  timer_init(timer, selftest_callback, (void *)index);
+  timer->tick = tick;
+  timer->pending = true;
+  wheel_enqueue(&selftest_wheel, timer);
+  selftest_wheel.stats.pending++;
+}
+
+/*
+ * A level-0 timer ending exactly before a cascade boundary leaves the
+ * clock on that boundary with the level-1 slot not yet cascaded: the next
+ * event must be the boundary itself, not a full rotation later.
+ */
+static bool wheel_selftest(void) {
+  struct timer early;
+  struct timer late;
+  selftest_fired[0] = selftest_fired[1] = TIMER_NONE;
+  wheel_init(&selftest_wheel, 10);
+
+  spin_lock(&selftest_wheel.lock);
+  selftest_add(&early, 0, TIMER_WHEEL_SLOTS - 1);
+  selftest_add(&late, 1, TIMER_WHEEL_SLOTS + 36);
+
+  wheel_advance(&selftest_wheel, TIMER_WHEEL_SLOTS - 1);
+  bool passed = selftest_fired[0] == TIMER_WHEEL_SLOTS - 1 &&
+                wheel_next_tick(&selftest_wheel) == TIMER_WHEEL_SLOTS;
+
+  wheel_advance(&selftest_wheel, TIMER_WHEEL_SLOTS + 35);
+  passed = passed && selftest_fired[1] == TIMER_NONE &&
+           wheel_next_tick(&selftest_wheel) == TIMER_WHEEL_SLOTS + 36;
+
+  wheel_advance(&selftest_wheel, TIMER_WHEEL_SLOTS + 36);
+  passed = passed && selftest_fired[1] == TIMER_WHEEL_SLOTS + 36;
+  spin_unlock(&selftest_wheel.lock);
+  return passed;
+}
+
+/* BSP, once the TSC is calibrated. false if the wheel self-test failed */
+bool timer_subsystem_init(void) {
+  if (!wheel_selftest()) {
+    return false;
+  }
+  timer_init_cpu();
+  apic_timer_set_handler(timer_interrupt);
+  return true;
+}
+
+void timer_init_cpu(void) {
+  wheel_init(&wheels[this_cpu_id()],
+             clock_monotonic_ns() >> TIMER_TICK_SHIFT);
+}
+
+void timer_init(struct timer *timer, timer_callback_t callback, void *data) {
+  list_init(&timer->node);
+  timer->expires = 0;
+  timer->tick = 0;
+  timer->callback = callback;
+  timer->data = data;
+  timer->cpu = 0;
+  timer->level = 0;
+  timer->slot = 0;
+  timer->pending = false;
+}
+
+/*
+ * Queue (or re-queue) a timer on the calling CPU. It fires at or after
+ * expires_ns, and may be delayed by up to slack_ns to share an interrupt
+ * with its neighbours.
+ */
+bool timer_add(struct timer *timer, u64 expires_ns, u64 slack_ns) {
+  if (timer == NULL || timer->callback == NULL) {
+    return false;
+  }
+
+  if (timer->pending) {
+    timer_cancel(timer);
+  }
+
+  u32 cpu = this_cpu_id();
+  struct timer_wheel *wheel = &wheels[cpu];
+
+  u64 flags = spin_lock_irqsave(&wheel->lock);
+
+  timer->expires = expires_ns;
+  timer->tick = ns_to_tick(apply_slack(expires_ns, slack_ns));
+  timer->cpu = cpu;
+  timer->pending = true;
+
+  wheel_enqueue(wheel, timer);
+  wheel->stats.pending++;
+
+  /* Only a new earliest expiry needs the hardware touched */
+  if (timer->tick < wheel->programmed_tick) {
+    wheel_program(wheel);
+  }
+
+  spin_unlock_irqrestore(&wheel->lock, flags);
+  return true;
+}
+
+/*
+ * Returns true if the timer was pending and is now cancelled, false if it
+ * had already fired (or is firing). The hardware is not reprogrammed: an
+ * early interrupt just finds nothing to do and re-arms for the next timer.
+ */
+bool timer_cancel(struct timer *timer) {
+  for (;;) {
+    u32 cpu = __atomic_load_n(&timer->cpu, __ATOMIC_ACQUIRE);
+    struct timer_wheel *wheel = &wheels[cpu];
+
+    u64 flags = spin_lock_irqsave(&wheel->lock);
+
+    if (timer->cpu != cpu) {
+      /* Migrated while we were acquiring the lock */
+      spin_unlock_irqrestore(&wheel->lock, flags);
+      continue;
+    }
+
+    bool was_pending = timer->pending;
+    if (was_pending) {
+      wheel_dequeue(wheel, timer);
+      timer->pending = false;
+      wheel->stats.pending--;
+    }
+
+    spin_unlock_irqrestore(&wheel->lock, flags);
+    return was_pending;
+  }
+}
+
+/*
+ * Move every timer of a CPU going offline onto the calling CPU's wheel.
+ * Returns the number of timers moved.
+ */
+u32 timer_migrate_from(u32 offline_cpu) {
+  u32 target_cpu = this_cpu_id();
+  if (offline_cpu >= MAX_CPUS || offline_cpu == target_cpu) {
+    return 0;
+  }
+
+  struct timer_wheel *source = &wheels[offline_cpu];
+  struct timer_wheel *target = &wheels[target_cpu];
+
+  /* Fixed lock order (by CPU index) so concurrent migrations can't deadlock */
+  u64 flags = irq_save();
+  if (offline_cpu < target_cpu) {
+    spin_lock(&source->lock);
+    spin_lock(&target->lock);
+  } else {
+    spin_lock(&target->lock);
+    spin_lock(&source->lock);
+  }
+
+  u32 moved = 0;
+  for (u32 level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    for (u32 slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+      struct list_node *node;
+      while ((node = list_pop_head(&source->slots[level][slot])) != NULL) {
+        struct timer *timer = LIST_ENTRY(node, struct timer, node);
+        __atomic_store_n(&timer->cpu, target_cpu, __ATOMIC_RELEASE);
+        wheel_enqueue(target, timer);
+        moved++;
+      }
+    }
+    source->occupied[level] = 0;
+  }
+
+  source->stats.pending = 0;
+  target->stats.pending += moved;
+  wheel_program(target);
+
+  spin_unlock(&source->lock);
+  spin_unlock(&target->lock);
+  irq_restore(flags);
+
+  return moved;
+}
+
+/* Absolute time (ns) of the calling CPU's next timer event, or TIMER_NONE */
+u64 timer_next_expiry(void) {
+  struct timer_wheel *wheel = &wheels[this_cpu_id()];
+
+  u64 flags = spin_lock_irqsave(&wheel->lock);
+  u64 next = wheel_next_tick(wheel);
+  spin_unlock_irqrestore(&wheel->lock, flags);
+
+  return next == TIMER_NONE ? TIMER_NONE : next << TIMER_TICK_SHIFT;
+}
+
+void timer_get_stats(u32 cpu, struct timer_stats *stats) {
+  if (cpu >= MAX_CPUS || stats == NULL) {
+    return;
+  }
+
+  struct timer_wheel *wheel = &wheels[cpu];
+  u64 flags = spin_lock_irqsave(&wheel->lock);
+  *stats = wheel->stats;
+  spin_unlock_irqrestore(&wheel->lock, flags);
+}
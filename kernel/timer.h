@@ -0,0 +1,62 @@
+#ifndef DELTA_KERNEL_TIMER_H
+#define DELTA_KERNEL_TIMER_H
+
+#include "list.h"
+#include "types.h"
+
+/*
+ * Per-CPU hierarchical timer wheel. Times are absolute nanoseconds on
+ * clock_monotonic_ns(). Insert and cancel are O(1); the wheel drives the
+ * local APIC one-shot timer, so a CPU with no pending timers takes no timer
+ * interrupts at all.
+ */
+
+#define TIMER_TICK_SHIFT 16 /* Wheel resolution: 2^16 ns (~65 us) */
+#define TIMER_TICK_NS (1ULL << TIMER_TICK_SHIFT)
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1U << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 7 /* 2^(16 + 42) ns: ~9 years of range */
+
+#define TIMER_NONE U64_MAX
+
+struct timer;
+
+typedef void (*timer_callback_t)(struct timer *timer);
+
+struct timer {
+  struct list_node node;
+  u64 expires; /* Requested expiry (ns) */
+  u64 tick;    /* Wheel tick after slack was applied */
+  timer_callback_t callback;
+  void *data;
+  u32 cpu;
+  u8 level;
+  u8 slot;
+  bool pending;
+};
+
+struct timer_stats {
+  u32 pending;
+  u64 fired;
+  u64 cascaded;
+  u64 reprograms;
+};
+
+bool timer_subsystem_init(void);
+
+void timer_init_cpu(void);
+
+void timer_init(struct timer *timer, timer_callback_t callback, void *data);
+
+bool timer_add(struct timer *timer, u64 expires_ns, u64 slack_ns);
+
+bool timer_cancel(struct timer *timer);
+
+u32 timer_migrate_from(u32 offline_cpu);
+
+u64 timer_next_expiry(void);
+
+void timer_get_stats(u32 cpu, struct timer_stats *stats);
+
+#endif /* DELTA_KERNEL_TIMER_H */
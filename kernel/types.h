@@ -63,6 +63,11 @@ typedef u64 uptr;
 
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
+#define OFFSET_OF(type, member) __builtin_offsetof(type, member)
+
+#define CONTAINER_OF(ptr, type, member)                                        \
+  ((type *)((u8 *)(ptr) - OFFSET_OF(type, member)))
+
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
@@ -0,0 +1,58 @@
+#include "vdso.h"
+#include "pmm.h"
+#include "spinlock.h"
+
+#include "../arch/amd64/rtc.h"
+#include "../arch/amd64/tsc.h"
+
+#define NS_PER_SEC 1000000000ULL
+
+static struct vdso_time_page *time_page = NULL; /* Kernel view */
+static struct spinlock write_lock = SPINLOCK_INIT;
+
+/*
+ * Fill the page from the boot calibration and the RTC and map it into the
+ * user half. User mappings are shared by every address space for now, so
+ * one mapping covers them all. Needs tsc_calibrate() and pmm_init().
+ */
+bool vdso_init(void) {
+  u64 page = pmm_alloc_zeroed_page();
+  if (page == 0) {
+    return false;
+  }
+
+  const struct tsc_calibration *cal = tsc_get_calibration();
+  time_page = phys_to_virt(page);
+  time_page->version = VDSO_TIME_VERSION;
+  time_page->boot_tsc = cal->boot_tsc;
+  time_page->ns_mult = cal->ns_mult;
+  time_page->shift = TSC_SHIFT;
+
+  /* Anchor wall time: the RTC reading is "now", not the monotonic origin */
+  u64 unix_ns = rtc_read_unix_seconds() * NS_PER_SEC;
+  vdso_set_wall_time(unix_ns);
+
+  if (!vmm_map_page(VDSO_TIME_VA, page, PTE_USER | PTE_NX)) {
+    pmm_free_page(page);
+    time_page = NULL;
+    return false;
+  }
+  return true;
+}
+
+/* Set the current Unix time; the monotonic clock is left untouched */
+void vdso_set_wall_time(u64 unix_ns) {
+  if (time_page == NULL) {
+    return;
+  }
+
+  u64 flags = spin_lock_irqsave(&write_lock);
+  u64 monotonic = clock_monotonic_ns();
+  seq_write_begin(&time_page->seq);
+  __atomic_store_n(&time_page->wall_offset_ns, unix_ns - monotonic,
+                   __ATOMIC_RELAXED);
+  seq_write_end(&time_page->seq);
+  spin_unlock_irqrestore(&write_lock, flags);
+}
+
+const struct vdso_time_page *vdso_time_page(void) { return time_page; }
@@ -0,0 +1,73 @@
+#ifndef DELTA_KERNEL_VDSO_H
+#define DELTA_KERNEL_VDSO_H
+
+#include "seqlock.h"
+#include "types.h"
+
+#include "../arch/amd64/vmm.h"
+
+/*
+ * Time page shared with user mode. It holds the boot TSC calibration and
+ * the wall-clock offset under a sequence counter, so user code computes
+ * the time with rdtsc and no system call:
+ *
+ *   monotonic = ((tsc - boot_tsc) * ns_mult) >> shift
+ *   realtime  = monotonic + wall_offset_ns
+ *
+ * The readers below are the reference implementation and are safe to call
+ * from either side. The page is mapped user-readable at VDSO_TIME_VA,
+ * leaving the last user page unmapped.
+ */
+
+#define VDSO_TIME_VA (USER_TOP - 2 * PAGE_SIZE)
+
+#define VDSO_TIME_VERSION 1
+
+struct vdso_time_page {
+  struct seqcount seq;
+  u32 version;        /* VDSO_TIME_VERSION */
+  u64 boot_tsc;       /* TSC at the monotonic clock's origin */
+  u64 ns_mult;        /* cycles -> ns multiplier */
+  u32 shift;          /* ... and shift */
+  u32 reserved;
+  u64 wall_offset_ns; /* Unix time at the monotonic origin */
+};
+
+bool vdso_init(void);
+
+void vdso_set_wall_time(u64 unix_ns);
+
+const struct vdso_time_page *vdso_time_page(void);
+
+static inline u64 vdso_cycles_to_ns(u64 cycles, u64 mult, u32 shift) {
+  return (u64)(((unsigned __int128)cycles * mult) >> shift);
+}
+
+static inline u64 vdso_clock_monotonic_ns(const struct vdso_time_page *page) {
+  u32 seq;
+  u64 ns;
+  do {
+    seq = seq_read_begin(&page->seq);
+    u64 boot_tsc = __atomic_load_n(&page->boot_tsc, __ATOMIC_RELAXED);
+    u64 mult = __atomic_load_n(&page->ns_mult, __ATOMIC_RELAXED);
+    u32 shift = __atomic_load_n(&page->shift, __ATOMIC_RELAXED);
+    ns = vdso_cycles_to_ns(rdtsc_ordered() - boot_tsc, mult, shift);
+  } while (seq_read_retry(&page->seq, seq));
+  return ns;
+}
+
+static inline u64 vdso_clock_realtime_ns(const struct vdso_time_page *page) {
+  u32 seq;
+  u64 ns;
+  do {
+    seq = seq_read_begin(&page->seq);
+    u64 boot_tsc = __atomic_load_n(&page->boot_tsc, __ATOMIC_RELAXED);
+    u64 mult = __atomic_load_n(&page->ns_mult, __ATOMIC_RELAXED);
+    u32 shift = __atomic_load_n(&page->shift, __ATOMIC_RELAXED);
+    u64 offset = __atomic_load_n(&page->wall_offset_ns, __ATOMIC_RELAXED);
+    ns = vdso_cycles_to_ns(rdtsc_ordered() - boot_tsc, mult, shift) + offset;
+  } while (seq_read_retry(&page->seq, seq));
+  return ns;
+}
+
+#endif /* DELTA_KERNEL_VDSO_H */
@@ -0,0 +1,396 @@
+#include "workqueue.h"
+#include "kthread.h"
+#include "sched.h"
+#include "spinlock.h"
+
+#include "../arch/amd64/percpu.h"
+#include "../arch/amd64/smp.h"
+#include "../arch/amd64/tsc.h"
+
+/* A short slice is an early EEVDF deadline: work runs soon after queueing */
+#define WORKER_SLICE_NS 500000ULL /* 500 us */
+
+/* Delayed work may run up to 1/16 of its delay late, to share interrupts */
+#define DELAYED_SLACK_SHIFT 4
+
+/*
+ * Producers push onto a lock-free stack; the worker takes the whole stack
+ * at once and reverses it, so items run in the order they were queued.
+ */
+struct cpu_pool {
+  struct work *pending ALIGNED(64);
+  struct kthread *worker;
+  u32 idle; /* Worker is blocked, or about to: wake it */
+  struct workqueue_stats stats;
+} ALIGNED(64);
+
+/* Shared FIFO: any of the workers may take the next item */
+struct unbound_pool {
+  struct spinlock lock;
+  struct work *head;
+  struct work *tail;
+  u32 idle_mask; /* Bit per blocked worker */
+  u32 nr_workers;
+  struct kthread *workers[WORKQUEUE_UNBOUND_MAX];
+  struct workqueue_stats stats;
+};
+
+static struct cpu_pool cpu_pools[MAX_CPUS];
+
+static struct unbound_pool unbound = {
+    .lock = SPINLOCK_INIT,
+};
+
+static void stat_max(u64 *max, u64 value) {
+  u64 current = __atomic_load_n(max, __ATOMIC_RELAXED);
+  while (value > current &&
+         !__atomic_compare_exchange_n(max, &current, value, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+static void stats_queued(struct workqueue_stats *stats) {
+  __atomic_fetch_add(&stats->queued, 1, __ATOMIC_RELAXED);
+
+  u32 depth = __atomic_add_fetch(&stats->depth, 1, __ATOMIC_RELAXED);
+  u32 max = __atomic_load_n(&stats->max_depth, __ATOMIC_RELAXED);
+  while (depth > max &&
+         !__atomic_compare_exchange_n(&stats->max_depth, &max, depth, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+static void run_work(struct workqueue_stats *stats, struct work *work) {
+  u64 start = clock_monotonic_ns();
+  u64 queued = work->queued_ns;
+  work_fn_t fn = work->fn;
+
+  __atomic_fetch_sub(&stats->depth, 1, __ATOMIC_RELAXED);
+
+  /* Cleared first, so the function may queue its item again (or free it) */
+  __atomic_store_n(&work->pending, 0, __ATOMIC_RELEASE);
+  fn(work);
+
+  u64 end = clock_monotonic_ns();
+  u64 wait = start - queued;
+  u64 service = end - start;
+
+  __atomic_fetch_add(&stats->executed, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats->wait_ns_total, wait, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats->service_ns_total, service, __ATOMIC_RELAXED);
+  stat_max(&stats->wait_ns_max, wait);
+  stat_max(&stats->service_ns_max, service);
+}
+
+static void cpu_pool_push(struct cpu_pool *pool, struct work *work) {
+  work->queued_ns = clock_monotonic_ns();
+  stats_queued(&pool->stats);
+
+  struct work *head = __atomic_load_n(&pool->pending, __ATOMIC_RELAXED);
+  do {
+    work->next = head;
+  } while (!__atomic_compare_exchange_n(&pool->pending, &head, work, true,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+  /* Pairs with the worker publishing idle before its last look */
+  if (__atomic_load_n(&pool->idle, __ATOMIC_SEQ_CST)) {
+    kthread_wake(pool->worker);
+  }
+}
+
+/* Worker only: everything queued so far, oldest first */
+static struct work *cpu_pool_take(struct cpu_pool *pool) {
+  if (__atomic_load_n(&pool->pending, __ATOMIC_RELAXED) == NULL) {
+    return NULL;
+  }
+
+  struct work *head = __atomic_exchange_n(&pool->pending, NULL,
+                                          __ATOMIC_ACQUIRE);
+  struct work *oldest = NULL;
+  while (head != NULL) {
+    struct work *next = head->next;
+    head->next = oldest;
+    oldest = head;
+    head = next;
+  }
+  return oldest;
+}
+
+static void cpu_worker(void *arg) {
+  struct cpu_pool *pool = arg;
+  struct work *backlog = NULL; /* Taken but not run yet: ours alone */
+
+  for (;;) {
+    if (backlog == NULL) {
+      backlog = cpu_pool_take(pool);
+    }
+
+    if (backlog == NULL) {
+      __atomic_store_n(&pool->idle, 1, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == NULL) {
+        kthread_block();
+      }
+      __atomic_store_n(&pool->idle, 0, __ATOMIC_RELAXED);
+      continue;
+    }
+
+    u32 done = 0;
+    while (backlog != NULL && done < WORKQUEUE_BATCH_MAX) {
+      struct work *work = backlog;
+      backlog = work->next;
+      run_work(&pool->stats, work);
+      done++;
+    }
+    pool->stats.passes++;
+
+    if (done == WORKQUEUE_BATCH_MAX &&
+        (backlog != NULL ||
+         __atomic_load_n(&pool->pending, __ATOMIC_RELAXED) != NULL)) {
+      pool->stats.capped_passes++;
+      schedule(); /* Still TASK_RUNNING: just requeued */
+    }
+  }
+}
+
+/*
+ * Wake one blocked worker, preferring one that last ran on a CPU with
+ * nothing else to do. unbound.lock held.
+ */
+static struct kthread *unbound_pick_idle(void) {
+  u32 mask = unbound.idle_mask;
+  if (mask == 0) {
+    return NULL;
+  }
+
+  u32 chosen = __builtin_ctz(mask);
+  for (u32 bits = mask; bits != 0; bits &= bits - 1) {
+    u32 index = __builtin_ctz(bits);
+    if (sched_cpu_idle(unbound.workers[index]->task.cpu)) {
+      chosen = index;
+      break;
+    }
+  }
+
+  unbound.idle_mask &= ~(1U << chosen);
+  return unbound.workers[chosen];
+}
+
+static void unbound_push(struct work *work) {
+  work->queued_ns = clock_monotonic_ns();
+  work->next = NULL;
+  stats_queued(&unbound.stats);
+
+  u64 flags = spin_lock_irqsave(&unbound.lock);
+  if (unbound.tail != NULL) {
+    unbound.tail->next = work;
+  } else {
+    unbound.head = work;
+  }
+  unbound.tail = work;
+  struct kthread *worker = unbound_pick_idle();
+  spin_unlock_irqrestore(&unbound.lock, flags);
+
+  if (worker != NULL) {
+    kthread_wake(worker);
+  }
+}
+
+/* One item at a time, so a burst is shared out between the workers */
+static struct work *unbound_take(void) {
+  u64 flags = spin_lock_irqsave(&unbound.lock);
+  struct work *work = unbound.head;
+  if (work != NULL) {
+    unbound.head = work->next;
+    if (unbound.head == NULL) {
+      unbound.tail = NULL;
+    }
+  }
+  spin_unlock_irqrestore(&unbound.lock, flags);
+  return work;
+}
+
+static void unbound_worker(void *arg) {
+  u32 bit = 1U << (u32)(u64)arg;
+
+  for (;;) {
+    u32 done = 0;
+    struct work *work;
+    while (done < WORKQUEUE_BATCH_MAX && (work = unbound_take()) != NULL) {
+      run_work(&unbound.stats, work);
+      done++;
+    }
+
+    if (done > 0) {
+      __atomic_fetch_add(&unbound.stats.passes, 1, __ATOMIC_RELAXED);
+    }
+    if (done == WORKQUEUE_BATCH_MAX) {
+      __atomic_fetch_add(&unbound.stats.capped_passes, 1, __ATOMIC_RELAXED);
+      schedule();
+      continue;
+    }
+
+    u64 flags = spin_lock_irqsave(&unbound.lock);
+    bool empty = unbound.head == NULL;
+    if (empty) {
+      unbound.idle_mask |= bit;
+    }
+    spin_unlock_irqrestore(&unbound.lock, flags);
+
+    if (empty) {
+      kthread_block(); /* The waker clears our bit */
+    }
+  }
+}
+
+static bool has_worker(u32 cpu) {
+  return cpu < MAX_CPUS && cpu_pools[cpu].worker != NULL;
+}
+
+/* Route an item already marked pending */
+static void work_dispatch(u32 cpu, struct work *work) {
+  if (has_worker(cpu)) {
+    cpu_pool_push(&cpu_pools[cpu], work);
+  } else {
+    unbound_push(work);
+  }
+}
+
+static void delayed_work_timer(struct timer *timer) {
+  struct delayed_work *dwork = timer->data;
+  work_dispatch(dwork->cpu, &dwork->work);
+}
+
+/*
+ * Start a worker for every online CPU plus the unbound pool. Call once,
+ * after smp_init(). Returns false if the thread pool ran out.
+ */
+bool workqueue_init(void) {
+  u32 cpus = smp_cpu_count();
+
+  for (u32 cpu = 0; cpu < cpus; cpu++) {
+    struct cpu_pool *pool = &cpu_pools[cpu];
+    struct kthread *thread = kthread_create(cpu_worker, pool, "kworker");
+    if (thread == NULL) {
+      return false;
+    }
+
+    kthread_bind(thread, cpu);
+    sched_set_slice(&thread->task, WORKER_SLICE_NS);
+    pool->worker = thread;
+    kthread_start(thread);
+  }
+
+  u32 count = MIN(cpus, WORKQUEUE_UNBOUND_MAX);
+  for (u32 i = 0; i < count; i++) {
+    struct kthread *thread =
+        kthread_create(unbound_worker, (void *)(u64)i, "kworker/unbound");
+    if (thread == NULL) {
+      return false;
+    }
+
+    sched_set_slice(&thread->task, WORKER_SLICE_NS);
+    unbound.workers[i] = thread;
+    __atomic_store_n(&unbound.nr_workers, i + 1, __ATOMIC_RELEASE);
+    kthread_start(thread);
+  }
+
+  return true;
+}
+
+void work_init(struct work *work, work_fn_t fn) {
+  work->next = NULL;
+  work->fn = fn;
+  work->pending = 0;
+  work->queued_ns = 0;
+}
+
+void delayed_work_init(struct delayed_work *dwork, work_fn_t fn) {
+  work_init(&dwork->work, fn);
+  timer_init(&dwork->timer, delayed_work_timer, dwork);
+  dwork->cpu = 0;
+}
+
+static bool work_claim(struct work *work) {
+  return __atomic_exchange_n(&work->pending, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+/*
+ * Run work->fn on the calling CPU's worker. Returns false if the item was
+ * already pending, or there is no worker to run it yet.
+ */
+bool queue_work(struct work *work) { return queue_work_on(this_cpu_id(), work); }
+
+/* Falls back to the unbound pool for a CPU without a worker */
+bool queue_work_on(u32 cpu, struct work *work) {
+  if (!has_worker(cpu) &&
+      __atomic_load_n(&unbound.nr_workers, __ATOMIC_ACQUIRE) == 0) {
+    return false;
+  }
+  if (!work_claim(work)) {
+    return false;
+  }
+
+  work_dispatch(cpu, work);
+  return true;
+}
+
+bool queue_work_unbound(struct work *work) {
+  if (__atomic_load_n(&unbound.nr_workers, __ATOMIC_ACQUIRE) == 0 ||
+      !work_claim(work)) {
+    return false;
+  }
+
+  unbound_push(work);
+  return true;
+}
+
+/* Queue on the calling CPU once delay_ns has passed (timer wheel slack) */
+bool queue_delayed_work(struct delayed_work *dwork, u64 delay_ns) {
+  if (delay_ns == 0) {
+    return queue_work(&dwork->work);
+  }
+
+  u32 cpu = this_cpu_id();
+  if (!has_worker(cpu) &&
+      __atomic_load_n(&unbound.nr_workers, __ATOMIC_ACQUIRE) == 0) {
+    return false;
+  }
+  if (!work_claim(&dwork->work)) {
+    return false;
+  }
+
+  dwork->cpu = cpu;
+  timer_add(&dwork->timer, clock_monotonic_ns() + delay_ns,
+            delay_ns >> DELAYED_SLACK_SHIFT);
+  return true;
+}
+
+/* Returns true if the timer was stopped before the work was queued */
+bool cancel_delayed_work(struct delayed_work *dwork) {
+  if (!timer_cancel(&dwork->timer)) {
+    return false;
+  }
+
+  __atomic_store_n(&dwork->work.pending, 0, __ATOMIC_RELEASE);
+  return true;
+}
+
+u32 workqueue_unbound_workers(void) {
+  return __atomic_load_n(&unbound.nr_workers, __ATOMIC_ACQUIRE);
+}
+
+/* True if queue_work_on(cpu, ...) runs the item on that CPU itself */
+bool workqueue_has_worker(u32 cpu) { return has_worker(cpu); }
+
+/* A CPU index, or WORKQUEUE_UNBOUND. Counters are a snapshot. */
+void workqueue_get_stats(u32 pool, struct workqueue_stats *stats) {
+  if (stats == NULL) {
+    return;
+  }
+
+  if (pool == WORKQUEUE_UNBOUND) {
+    *stats = unbound.stats;
+  } else if (pool < MAX_CPUS) {
+    *stats = cpu_pools[pool].stats;
+  }
+}
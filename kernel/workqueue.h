@@ -0,0 +1,76 @@
+#ifndef DELTA_KERNEL_WORKQUEUE_H
+#define DELTA_KERNEL_WORKQUEUE_H
+
+#include "timer.h"
+#include "types.h"
+
+/*
+ * Deferred work. Each CPU has a worker thread draining its own queue, so
+ * work queued from an interrupt handler runs on the CPU that took the
+ * interrupt, with its data still in cache. Queueing is lock-free and safe
+ * from interrupt context.
+ *
+ * A worker runs at most WORKQUEUE_BATCH_MAX items per pass, then yields if
+ * more are waiting, so a burst of work delays other threads by one batch
+ * at most. Unbound work goes to a shared pool whose workers are not tied
+ * to a CPU: the scheduler spreads them over whichever CPUs are idle.
+ */
+
+#define WORKQUEUE_BATCH_MAX 32
+#define WORKQUEUE_UNBOUND_MAX 8 /* Unbound pool workers */
+
+#define WORKQUEUE_UNBOUND U32_MAX /* Pool index for workqueue_get_stats() */
+
+struct work;
+
+typedef void (*work_fn_t)(struct work *work);
+
+struct work {
+  struct work *next;
+  work_fn_t fn;
+  u32 pending; /* Queued and not started yet: queueing again is a no-op */
+  u64 queued_ns;
+};
+
+struct delayed_work {
+  struct work work;
+  struct timer timer;
+  u32 cpu; /* Queue the work lands on when the timer fires */
+};
+
+struct workqueue_stats {
+  u64 queued;
+  u64 executed;
+  u32 depth;            /* Queued, not started yet */
+  u32 max_depth;
+  u64 passes;           /* Worker drain passes */
+  u64 capped_passes;    /* Passes cut short by WORKQUEUE_BATCH_MAX */
+  u64 wait_ns_total;    /* Queued to started */
+  u64 wait_ns_max;
+  u64 service_ns_total; /* Time spent in work functions */
+  u64 service_ns_max;
+};
+
+bool workqueue_init(void);
+
+void work_init(struct work *work, work_fn_t fn);
+
+void delayed_work_init(struct delayed_work *dwork, work_fn_t fn);
+
+bool queue_work(struct work *work);
+
+bool queue_work_on(u32 cpu, struct work *work);
+
+bool queue_work_unbound(struct work *work);
+
+bool queue_delayed_work(struct delayed_work *dwork, u64 delay_ns);
+
+bool cancel_delayed_work(struct delayed_work *dwork);
+
+u32 workqueue_unbound_workers(void);
+
+bool workqueue_has_worker(u32 cpu);
+
+void workqueue_get_stats(u32 pool, struct workqueue_stats *stats);
+
+#endif /* DELTA_KERNEL_WORKQUEUE_H */
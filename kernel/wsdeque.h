@@ -0,0 +1,97 @@
+#ifndef DELTA_KERNEL_WSDEQUE_H
+#define DELTA_KERNEL_WSDEQUE_H
+
+#include "types.h"
+
+/*
+ * Chase-Lev work-stealing deque (fixed capacity), after Le et al., "Correct
+ * and Efficient Work-Stealing for Weak Memory Models". The owning CPU pushes
+ * and pops at the bottom without locks or atomic RMW in the common case;
+ * other CPUs steal from the top with a single CAS.
+ */
+
+#define WSDEQUE_CAPACITY 256 /* Power of two */
+#define WSDEQUE_MASK (WSDEQUE_CAPACITY - 1)
+
+#define WSDEQUE_EMPTY ((void *)0)
+#define WSDEQUE_ABORT ((void *)1) /* Lost a race; the caller may retry */
+
+struct wsdeque {
+  i64 top ALIGNED(64); /* Thieves' end, on its own cache line */
+  i64 bottom ALIGNED(64);
+  void *slots[WSDEQUE_CAPACITY];
+};
+
+static inline void wsdeque_init(struct wsdeque *deque) {
+  deque->top = 0;
+  deque->bottom = 0;
+}
+
+/* Owner only. Fails when full. */
+static inline bool wsdeque_push(struct wsdeque *deque, void *item) {
+  i64 bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+  i64 top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+
+  if (bottom - top >= WSDEQUE_CAPACITY) {
+    return false;
+  }
+
+  __atomic_store_n(&deque->slots[bottom & WSDEQUE_MASK], item,
+                   __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+  return true;
+}
+
+/* Owner only. LIFO: returns the most recently pushed item. */
+static inline void *wsdeque_pop(struct wsdeque *deque) {
+  i64 bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+  __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  i64 top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+  if (top > bottom) {
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return WSDEQUE_EMPTY;
+  }
+
+  void *item = __atomic_load_n(&deque->slots[bottom & WSDEQUE_MASK],
+                               __ATOMIC_RELAXED);
+  if (top == bottom) {
+    /* Last item: race the thieves for it */
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+      item = WSDEQUE_EMPTY;
+    }
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+  }
+  return item;
+}
+
+/* Any CPU. FIFO: takes the oldest item. */
+static inline void *wsdeque_steal(struct wsdeque *deque) {
+  i64 top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  i64 bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+
+  if (top >= bottom) {
+    return WSDEQUE_EMPTY;
+  }
+
+  void *item =
+      __atomic_load_n(&deque->slots[top & WSDEQUE_MASK], __ATOMIC_RELAXED);
+  if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false,
+                                   __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+    return WSDEQUE_ABORT;
+  }
+  return item;
+}
+
+/* Racy snapshot, good enough for load-balancing decisions */
+static inline u32 wsdeque_size(const struct wsdeque *deque) {
+  i64 bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+  i64 top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+  return bottom > top ? (u32)(bottom - top) : 0;
+}
+
+#endif /* DELTA_KERNEL_WSDEQUE_H */
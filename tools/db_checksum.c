@@ -0,0 +1,133 @@
+/*
+ * db_checksum - fill in the DB request header checksum of a linked kernel.
+ *
+ * Runs on the build host after linking. Finds the request header the way a
+ * bootloader does (magic at an 8-byte aligned offset in the first 32 KiB of
+ * the file), checks the request tags, then stores the CRC32 of header and
+ * tags, computed with the checksum field as 0, back into the file.
+ *
+ * Usage: db_checksum <kernel.elf>
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define DB_REQUEST_MAGIC 0x44420001U
+#define DB_REQUEST_SCAN_LIMIT (32 * 1024)
+#define DB_REQUEST_HEADER_SIZE 20
+#define DB_REQUEST_TAG_SIZE 8
+#define DB_RTAG_END 0x0000
+#define CHECKSUM_OFFSET 4
+
+/* The header_size field is 16 bits, so this covers any header */
+#define READ_LIMIT (DB_REQUEST_SCAN_LIMIT + 0x10000)
+
+static uint8_t image[READ_LIMIT];
+
+static uint16_t load16(const uint8_t *p) { return (uint16_t)(p[0] | p[1] << 8); }
+
+static uint32_t load32(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+static void store32(uint8_t *p, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = (uint8_t)(value >> (8 * i));
+  }
+}
+
+/* Bitwise: a few hundred bytes once per build */
+static uint32_t crc32(const uint8_t *data, size_t length) {
+  uint32_t crc = 0xFFFFFFFFU;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+static long find_header(size_t length) {
+  for (size_t offset = 0;
+       offset < DB_REQUEST_SCAN_LIMIT && offset + DB_REQUEST_HEADER_SIZE <= length;
+       offset += 8) {
+    if (load32(image + offset) == DB_REQUEST_MAGIC) {
+      return (long)offset;
+    }
+  }
+  return -1;
+}
+
+/* Tags 4-byte aligned, inside header_size, ending with DB_RTAG_END */
+static const char *check_tags(const uint8_t *header, uint32_t header_size) {
+  uint32_t offset = DB_REQUEST_HEADER_SIZE;
+
+  while (offset + DB_REQUEST_TAG_SIZE <= header_size) {
+    uint16_t type = load16(header + offset);
+    uint32_t size = load32(header + offset + 4);
+
+    if (size < DB_REQUEST_TAG_SIZE || size > header_size - offset) {
+      return "request tag overruns header_size";
+    }
+    if (type == DB_RTAG_END) {
+      return NULL;
+    }
+    offset += (size + 3) & ~3U;
+  }
+  return "request tags have no end tag";
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <kernel.elf>\n", argv[0]);
+    return 2;
+  }
+
+  const char *path = argv[1];
+  FILE *file = fopen(path, "r+b");
+  if (file == NULL) {
+    perror(path);
+    return 1;
+  }
+
+  size_t length = fread(image, 1, sizeof(image), file);
+  long offset = find_header(length);
+  if (offset < 0) {
+    fprintf(stderr, "%s: no DB request header in the first %d KiB\n", path,
+            DB_REQUEST_SCAN_LIMIT / 1024);
+    fclose(file);
+    return 1;
+  }
+
+  uint8_t *header = image + offset;
+  uint32_t header_size = load16(header + 10);
+  const char *error = NULL;
+  if (header_size < DB_REQUEST_HEADER_SIZE ||
+      (size_t)offset + header_size > length) {
+    error = "bad header_size";
+  } else {
+    error = check_tags(header, header_size);
+  }
+  if (error != NULL) {
+    fprintf(stderr, "%s: %s\n", path, error);
+    fclose(file);
+    return 1;
+  }
+
+  store32(header + CHECKSUM_OFFSET, 0);
+  uint32_t checksum = crc32(header, header_size);
+  store32(header + CHECKSUM_OFFSET, checksum);
+
+  if (fseek(file, offset + CHECKSUM_OFFSET, SEEK_SET) != 0 ||
+      fwrite(header + CHECKSUM_OFFSET, 1, 4, file) != 4 || fclose(file) != 0) {
+    perror(path);
+    return 1;
+  }
+
+  printf("[DB] Request header at file offset 0x%lx: %u bytes, CRC32 0x%08x\n",
+         offset, header_size, checksum);
+  return 0;
+}
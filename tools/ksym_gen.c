@@ -0,0 +1,301 @@
+/*
+ * ksym_gen - generate the kernel symbol table.
+ *
+ * Runs on the build host between the two links of the kernel. Reads the
+ * function symbols in .text of the first link and writes them out as a
+ * NASM source defining ksym_table in section .ksym, which linker.ld puts
+ * after the rest of .rodata. The second link then embeds the table without
+ * moving any code, so the addresses in it hold.
+ *
+ * Symbols are sorted by address; each entry is the offset from the first
+ * symbol and the offset of the name. Names are front-coded: each one
+ * stores how many bytes it shares with the previous name, then the rest,
+ * restarting from a full name every KSYM_RESTART symbols. Layout must
+ * match kernel/ksym.h.
+ *
+ * Usage: ksym_gen <kernel.elf> <out.asm>
+ *        ksym_gen --empty <out.asm>    (an empty table, for the first link)
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KSYM_MAGIC 0x4D59534BU /* "KSYM" */
+#define KSYM_NAME_MAX 128      /* NUL included */
+#define KSYM_RESTART 16
+
+#define SHT_SYMTAB 2
+#define STT_NOTYPE 0
+#define STT_FUNC 2
+#define STB_GLOBAL 1
+
+struct symbol {
+  uint64_t address;
+  const char *name;
+  int rank; /* Lower wins when two symbols share an address */
+};
+
+static uint16_t load16(const uint8_t *p) {
+  return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t load32(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+static uint64_t load64(const uint8_t *p) {
+  return (uint64_t)load32(p) | (uint64_t)load32(p + 4) << 32;
+}
+
+static int by_address(const void *a, const void *b) {
+  const struct symbol *x = a;
+  const struct symbol *y = b;
+  if (x->address != y->address) {
+    return x->address < y->address ? -1 : 1;
+  }
+  if (x->rank != y->rank) {
+    return x->rank - y->rank;
+  }
+  return strcmp(x->name, y->name);
+}
+
+static uint8_t *read_file(const char *path, size_t *length) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL || fseek(file, 0, SEEK_END) != 0) {
+    perror(path);
+    return NULL;
+  }
+  long file_length = ftell(file);
+  uint8_t *image = malloc(file_length > 0 ? (size_t)file_length : 1);
+  rewind(file);
+  if (file_length < 0 || image == NULL ||
+      fread(image, 1, (size_t)file_length, file) != (size_t)file_length) {
+    perror(path);
+    return NULL;
+  }
+  fclose(file);
+  *length = (size_t)file_length;
+  return image;
+}
+
+/* Section headers of an ELF64 little-endian file, bounds-checked */
+struct elf {
+  const uint8_t *image;
+  size_t length;
+  uint64_t shoff;
+  uint16_t shentsize;
+  uint16_t shnum;
+};
+
+static const uint8_t *section(const struct elf *elf, uint32_t index) {
+  uint64_t offset = elf->shoff + (uint64_t)index * elf->shentsize;
+  if (index >= elf->shnum || offset + 64 > elf->length) {
+    return NULL;
+  }
+  return elf->image + offset;
+}
+
+static const uint8_t *section_data(const struct elf *elf, const uint8_t *sh,
+                                   uint64_t *size) {
+  uint64_t offset = load64(sh + 24);
+  *size = load64(sh + 32);
+  if (offset > elf->length || *size > elf->length - offset) {
+    return NULL;
+  }
+  return elf->image + offset;
+}
+
+/* Collect the .text symbols; returns the count, or -1 on a bad file */
+static long collect(const struct elf *elf, struct symbol **out,
+                    uint64_t *text_end) {
+  const uint8_t *shstr_header = section(elf, load16(elf->image + 62));
+  uint64_t shstr_size;
+  const char *shstr =
+      shstr_header ? (const char *)section_data(elf, shstr_header, &shstr_size)
+                   : NULL;
+  if (shstr == NULL) {
+    return -1;
+  }
+
+  uint32_t text_index = 0;
+  const uint8_t *symtab = NULL;
+  for (uint32_t i = 1; i < elf->shnum; i++) {
+    const uint8_t *sh = section(elf, i);
+    if (sh == NULL) {
+      return -1;
+    }
+    uint32_t name = load32(sh);
+    if (name < shstr_size && strcmp(shstr + name, ".text") == 0) {
+      text_index = i;
+      *text_end = load64(sh + 16) + load64(sh + 32);
+    }
+    if (load32(sh + 4) == SHT_SYMTAB) {
+      symtab = sh;
+    }
+  }
+  if (text_index == 0 || symtab == NULL) {
+    return -1;
+  }
+
+  uint64_t symtab_size;
+  uint64_t strtab_size;
+  const uint8_t *symbols = section_data(elf, symtab, &symtab_size);
+  const uint8_t *strtab_header = section(elf, load32(symtab + 40));
+  const char *strtab =
+      strtab_header
+          ? (const char *)section_data(elf, strtab_header, &strtab_size)
+          : NULL;
+  if (symbols == NULL || strtab == NULL) {
+    return -1;
+  }
+
+  uint64_t total = symtab_size / 24;
+  struct symbol *list = calloc(total > 0 ? total : 1, sizeof(*list));
+  long count = 0;
+  for (uint64_t i = 0; list != NULL && i < total; i++) {
+    const uint8_t *sym = symbols + i * 24;
+    uint32_t name = load32(sym);
+    uint8_t type = sym[4] & 0xF;
+    uint8_t bind = sym[4] >> 4;
+    if (load16(sym + 6) != text_index || name == 0 || name >= strtab_size ||
+        (type != STT_FUNC && type != STT_NOTYPE)) {
+      continue;
+    }
+    const char *text = strtab + name;
+    /* Assembler-local labels: ".loop", NASM's "..@12.skip" */
+    if (text[0] == '.' || memchr(text, '\0', strtab_size - name) == NULL) {
+      continue;
+    }
+    list[count].address = load64(sym + 8);
+    list[count].name = text;
+    list[count].rank =
+        (type == STT_FUNC ? 0 : 2) + (bind == STB_GLOBAL ? 0 : 1);
+    count++;
+  }
+  if (list == NULL) {
+    return -1;
+  }
+
+  /* One name per address: the best ranked */
+  qsort(list, (size_t)count, sizeof(*list), by_address);
+  long unique = 0;
+  for (long i = 0; i < count; i++) {
+    if (unique == 0 || list[unique - 1].address != list[i].address) {
+      list[unique++] = list[i];
+    }
+  }
+  *out = list;
+  return unique;
+}
+
+static size_t shared_prefix(const char *a, const char *b, size_t limit) {
+  size_t n = 0;
+  while (n < limit && a[n] != '\0' && a[n] == b[n]) {
+    n++;
+  }
+  return n;
+}
+
+static void write_table(FILE *out, const struct symbol *symbols, long count,
+                        uint64_t text_end) {
+  uint64_t base = count > 0 ? symbols[0].address : 0;
+  uint32_t end = count > 0 ? (uint32_t)(text_end - base) : 0;
+
+  /* Front-code the names first: entries need their offsets */
+  size_t capacity = (size_t)count * (KSYM_NAME_MAX + 2) + 1;
+  uint8_t *names = malloc(capacity);
+  uint32_t *name_offsets = malloc(((size_t)count + 1) * sizeof(uint32_t));
+  if (names == NULL || name_offsets == NULL) {
+    fprintf(stderr, "ksym_gen: out of memory\n");
+    exit(1);
+  }
+  size_t names_size = 0;
+  for (long i = 0; i < count; i++) {
+    size_t length = strlen(symbols[i].name);
+    if (length > KSYM_NAME_MAX - 1) {
+      length = KSYM_NAME_MAX - 1;
+    }
+    size_t prefix = i % KSYM_RESTART == 0
+                        ? 0
+                        : shared_prefix(symbols[i - 1].name, symbols[i].name,
+                                        length);
+    name_offsets[i] = (uint32_t)names_size;
+    names[names_size++] = (uint8_t)prefix;
+    names[names_size++] = (uint8_t)(length - prefix);
+    memcpy(names + names_size, symbols[i].name + prefix, length - prefix);
+    names_size += length - prefix;
+  }
+
+  fprintf(out, "; Generated by tools/ksym_gen: the kernel symbol table, laid "
+               "out as in kernel/ksym.h\n\n");
+  fprintf(out, "bits 64\n\nsection .ksym progbits alloc noexec nowrite "
+               "align=8\n\nglobal ksym_table\n\nksym_table:\n");
+  fprintf(out, "    dd 0x%08X, %ld\n", KSYM_MAGIC, count);
+  fprintf(out, "    dq 0x%016llX\n", (unsigned long long)base);
+  fprintf(out, "    dd 0x%X, %zu\n", end, names_size);
+  for (long i = 0; i < count; i++) {
+    fprintf(out, "    dd 0x%X, 0x%X\n",
+            (uint32_t)(symbols[i].address - base), name_offsets[i]);
+  }
+  for (size_t i = 0; i < names_size; i++) {
+    fprintf(out, i % 16 == 0 ? "    db 0x%02X" : ", 0x%02X", names[i]);
+    if (i % 16 == 15 || i + 1 == names_size) {
+      fprintf(out, "\n");
+    }
+  }
+  free(names);
+  free(name_offsets);
+}
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s <kernel.elf>|--empty <out.asm>\n", argv[0]);
+    return 2;
+  }
+
+  struct symbol *symbols = NULL;
+  long count = 0;
+  uint64_t text_end = 0;
+  if (strcmp(argv[1], "--empty") != 0) {
+    struct elf elf = {0};
+    elf.image = read_file(argv[1], &elf.length);
+    if (elf.image == NULL) {
+      return 1;
+    }
+    if (elf.length < 64 || memcmp(elf.image, "\x7F" "ELF\x02\x01", 6) != 0) {
+      fprintf(stderr, "%s: not a little-endian ELF64 file\n", argv[1]);
+      return 1;
+    }
+    elf.shoff = load64(elf.image + 40);
+    elf.shentsize = load16(elf.image + 58);
+    elf.shnum = load16(elf.image + 60);
+
+    count = elf.shentsize == 64 ? collect(&elf, &symbols, &text_end) : -1;
+    if (count < 0) {
+      fprintf(stderr, "%s: no .text symbols\n", argv[1]);
+      return 1;
+    }
+    if (count > 0 && text_end - symbols[0].address > UINT32_MAX) {
+      fprintf(stderr, "%s: .text too large for 32-bit offsets\n", argv[1]);
+      return 1;
+    }
+  }
+
+  FILE *out = fopen(argv[2], "w");
+  if (out == NULL) {
+    perror(argv[2]);
+    return 1;
+  }
+  write_table(out, symbols, count, text_end);
+  if (fclose(out) != 0) {
+    perror(argv[2]);
+    return 1;
+  }
+
+  printf("[KSYM] %ld symbols\n", count);
+  free(symbols);
+  return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * param_index - build the kernel command-line option table of a linked
+ * kernel.
+ *
+ * Runs on the build host after linking. Finds kernel_param_index (its magic
+ * at an 8-byte aligned file offset, followed directly by the .kernel_params
+ * entries, as linker.ld lays them out), then searches for a seed under
+ * which every option name hashes to its own slot, and writes seed, count,
+ * mask and slots back into the file. The kernel then finds an option with
+ * one probe. Layout and hash must match kernel/param.h.
+ *
+ * Usage: param_index <kernel.elf>
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KERNEL_PARAM_MAGIC 0x4D524150U
+#define KERNEL_PARAM_INDEX_MAGIC 0x58444E49U
+#define KERNEL_PARAM_NAME_MAX 32
+#define KERNEL_PARAM_MAX 64
+#define KERNEL_PARAM_SLOTS 256
+
+#define PARAM_SIZE (4 + 4 + 8 + 8 + KERNEL_PARAM_NAME_MAX)
+#define PARAM_NAME_OFFSET 24
+#define INDEX_HEADER_SIZE 16 /* magic, seed, count, mask */
+#define INDEX_SIZE (INDEX_HEADER_SIZE + KERNEL_PARAM_SLOTS)
+
+#define SEED_TRIES (1U << 20) /* Per table size */
+
+static uint32_t load32(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+static void store32(uint8_t *p, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = (uint8_t)(value >> (8 * i));
+  }
+}
+
+static uint32_t hash(const char *name, uint32_t seed) {
+  uint32_t h = seed;
+  for (; *name != '\0'; name++) {
+    h = (h ^ (uint8_t)*name) * 0x01000193U;
+  }
+  return h ^ (h >> 16);
+}
+
+/* The index followed by at least one entry, or else the only index */
+static long find_index(const uint8_t *image, size_t length) {
+  long found = -1;
+  for (size_t offset = 0; offset + INDEX_SIZE <= length; offset += 8) {
+    if (load32(image + offset) != KERNEL_PARAM_INDEX_MAGIC) {
+      continue;
+    }
+    size_t entry = offset + INDEX_SIZE;
+    if (entry + 4 <= length && load32(image + entry) == KERNEL_PARAM_MAGIC) {
+      return (long)offset;
+    }
+    found = (long)offset;
+  }
+  return found;
+}
+
+/* Seed 0 marks an empty table, so seeds start at 1 */
+static int build(const char **names, uint32_t count, uint8_t *slots,
+                 uint32_t *seed_out, uint32_t *mask_out) {
+  uint32_t size = 1;
+  while (size < 2 * count) {
+    size *= 2;
+  }
+
+  for (; size <= KERNEL_PARAM_SLOTS; size *= 2) {
+    for (uint32_t seed = 1; seed <= SEED_TRIES; seed++) {
+      memset(slots, 0, KERNEL_PARAM_SLOTS);
+      uint32_t i = 0;
+      for (; i < count; i++) {
+        uint32_t slot = hash(names[i], seed) & (size - 1);
+        if (slots[slot] != 0) {
+          break;
+        }
+        slots[slot] = (uint8_t)(i + 1);
+      }
+      if (i == count) {
+        *seed_out = seed;
+        *mask_out = size - 1;
+        return 0;
+      }
+    }
+  }
+  return -1;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <kernel.elf>\n", argv[0]);
+    return 2;
+  }
+
+  const char *path = argv[1];
+  FILE *file = fopen(path, "r+b");
+  if (file == NULL || fseek(file, 0, SEEK_END) != 0) {
+    perror(path);
+    return 1;
+  }
+  long file_length = ftell(file);
+  uint8_t *image = malloc(file_length > 0 ? (size_t)file_length : 1);
+  rewind(file);
+  if (file_length < 0 || image == NULL ||
+      fread(image, 1, (size_t)file_length, file) != (size_t)file_length) {
+    perror(path);
+    return 1;
+  }
+  size_t length = (size_t)file_length;
+
+  long offset = find_index(image, length);
+  if (offset < 0) {
+    fprintf(stderr, "%s: no kernel_param_index\n", path);
+    return 1;
+  }
+
+  const char *names[KERNEL_PARAM_MAX];
+  uint32_t count = 0;
+  for (size_t entry = (size_t)offset + INDEX_SIZE;
+       entry + PARAM_SIZE <= length &&
+       load32(image + entry) == KERNEL_PARAM_MAGIC;
+       entry += PARAM_SIZE) {
+    const char *name = (const char *)image + entry + PARAM_NAME_OFFSET;
+    if (memchr(name, '\0', KERNEL_PARAM_NAME_MAX) == NULL || name[0] == '\0') {
+      fprintf(stderr, "%s: option %u has a bad name\n", path, count);
+      return 1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+      if (strcmp(names[i], name) == 0) {
+        fprintf(stderr, "%s: option \"%s\" registered twice\n", path, name);
+        return 1;
+      }
+    }
+    if (count == KERNEL_PARAM_MAX) {
+      fprintf(stderr, "%s: more than %d options\n", path, KERNEL_PARAM_MAX);
+      return 1;
+    }
+    names[count++] = name;
+  }
+
+  uint8_t *index = image + offset;
+  uint8_t *slots = index + INDEX_HEADER_SIZE;
+  uint32_t seed = 0;
+  uint32_t mask = 0;
+  if (count > 0 && build(names, count, slots, &seed, &mask) != 0) {
+    fprintf(stderr, "%s: no perfect hash for %u options\n", path, count);
+    return 1;
+  }
+  store32(index + 4, seed);
+  store32(index + 8, count);
+  store32(index + 12, mask);
+
+  if (fseek(file, offset, SEEK_SET) != 0 ||
+      fwrite(index, 1, INDEX_SIZE, file) != INDEX_SIZE || fclose(file) != 0) {
+    perror(path);
+    return 1;
+  }
+
+  printf("[PARAM] %u options in %u slots, seed 0x%x\n", count, mask + 1, seed);
+  free(image);
+  return 0;
+}